@@ -0,0 +1,366 @@
+/*
+ * Copyright 2022 Timescale Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "admission.h"
+
+#include <postgres.h>
+
+#include <nodes/pg_list.h>
+#include <utils/guc.h>
+#include <utils/hsearch.h>
+#include <utils/memutils.h>
+#include <utils/timestamp.h>
+#include <utils/varlena.h>
+
+#include <netinet/in.h>
+#include <string.h>
+
+#include "stats.h"
+
+/* Maximum number of buckets in each table. When a table is full, it
+ * is cleared, which resets all limits of that kind. */
+#define ADMISSION_MAX_BUCKETS 65536
+
+/** Lines per second from each source address, or zero for no limit. */
+int InfluxSourceRateLimit = 0;
+
+/** Lines per second for each measurement, or zero for no limit. */
+int InfluxMeasurementRateLimit = 0;
+
+/** What to do with lines above the limits. */
+int InfluxRateLimitPolicy = ADMISSION_DROP;
+
+/** Admit one in this many lines above the limits when sampling. */
+int InfluxRateLimitSample = 10;
+
+/** Comma-separated list of measurements that are never limited. */
+char *InfluxRateLimitExempt = NULL;
+
+const struct config_enum_entry InfluxRateLimitPolicyOptions[] = {
+    {"drop", ADMISSION_DROP, false},
+    {"sample", ADMISSION_SAMPLE, false},
+    {"spool", ADMISSION_SPOOL, false},
+    {NULL, 0, false},
+};
+
+/**
+ * Key for the bucket of a source address.
+ *
+ * The port is not part of the key since clients usually send from
+ * an ephemeral port.
+ */
+typedef struct SourceKey {
+  sa_family_t family;
+  uint8 addr[16];
+} SourceKey;
+
+/**
+ * Token bucket for a source address or a measurement.
+ */
+typedef struct TokenBucket {
+  /** Hash key, which has to be first */
+  union {
+    SourceKey source;
+    char measurement[NAMEDATALEN];
+  } key;
+
+  /** Number of lines that can be admitted right now */
+  double tokens;
+
+  /** Time when the tokens were last refilled */
+  TimestampTz updated;
+
+  /** Number of lines above the limit, used for sampling */
+  uint64 excess;
+} TokenBucket;
+
+static HTAB *SourceBuckets = NULL;
+static HTAB *MeasurementBuckets = NULL;
+
+/* Setting the list of exempt measurements was parsed from, and the
+ * parsed list. The names point into `ExemptString`. */
+static char *ExemptSetting = NULL;
+static char *ExemptString = NULL;
+static List *ExemptNames = NIL;
+
+/**
+ * Check that the list of exempt measurements can be parsed.
+ */
+bool CheckRateLimitExempt(char **newval, void **extra, GucSource source) {
+  char *rawstring;
+  List *names;
+  bool ok;
+
+  if (*newval == NULL)
+    return true;
+
+  rawstring = pstrdup(*newval);
+  ok = SplitGUCList(rawstring, ',', &names);
+  list_free(names);
+  pfree(rawstring);
+  if (!ok)
+    GUC_check_errdetail("List syntax is invalid.");
+  return ok;
+}
+
+/**
+ * Parse the list of exempt measurements if the setting changed.
+ */
+static void LoadExemptNames(void) {
+  const char *setting = InfluxRateLimitExempt ? InfluxRateLimitExempt : "";
+  MemoryContext oldcontext;
+
+  if (ExemptSetting && strcmp(ExemptSetting, setting) == 0)
+    return;
+
+  if (ExemptSetting) {
+    pfree(ExemptSetting);
+    pfree(ExemptString);
+    list_free(ExemptNames);
+    ExemptNames = NIL;
+  }
+
+  /* The setting was checked when it was set, so it can be parsed. */
+  oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+  ExemptSetting = pstrdup(setting);
+  ExemptString = pstrdup(setting);
+  if (!SplitGUCList(ExemptString, ',', &ExemptNames))
+    ExemptNames = NIL;
+  MemoryContextSwitchTo(oldcontext);
+}
+
+static bool IsExempt(const char *measurement) {
+  ListCell *cell;
+  foreach (cell, ExemptNames) {
+    if (strcmp(measurement, (const char *)lfirst(cell)) == 0)
+      return true;
+  }
+  return false;
+}
+
+/**
+ * Find the bucket for a key, creating the table and the bucket if
+ * necessary.
+ *
+ * New buckets start full.
+ */
+static TokenBucket *LookupBucket(HTAB **table, const char *name,
+                                 const void *key, Size keysize, int rate,
+                                 TimestampTz now) {
+  TokenBucket *bucket;
+  bool found;
+
+  if (*table && hash_get_num_entries(*table) >= ADMISSION_MAX_BUCKETS) {
+    hash_destroy(*table);
+    *table = NULL;
+  }
+
+  if (!*table) {
+    HASHCTL hash_ctl;
+    memset(&hash_ctl, 0, sizeof(hash_ctl));
+    hash_ctl.keysize = keysize;
+    hash_ctl.entrysize = sizeof(TokenBucket);
+    *table = hash_create(name, 128, &hash_ctl, HASH_ELEM | HASH_BLOBS);
+  }
+
+  bucket = hash_search(*table, key, HASH_ENTER, &found);
+  if (!found) {
+    bucket->tokens = rate;
+    bucket->updated = now;
+    bucket->excess = 0;
+  }
+  return bucket;
+}
+
+/**
+ * Find the bucket for a source address.
+ *
+ * @returns The bucket, or NULL if the address is not an IP address.
+ */
+static TokenBucket *LookupSourceBucket(const struct sockaddr *source,
+                                       TimestampTz now) {
+  SourceKey key;
+
+  memset(&key, 0, sizeof(key));
+  key.family = source->sa_family;
+  switch (source->sa_family) {
+    case AF_INET:
+      memcpy(key.addr, &((const struct sockaddr_in *)source)->sin_addr,
+             sizeof(struct in_addr));
+      break;
+    case AF_INET6:
+      memcpy(key.addr, &((const struct sockaddr_in6 *)source)->sin6_addr,
+             sizeof(struct in6_addr));
+      break;
+    default:
+      return NULL;
+  }
+
+  return LookupBucket(&SourceBuckets, "Influx Source Buckets", &key,
+                      sizeof(key), InfluxSourceRateLimit, now);
+}
+
+/**
+ * Add the tokens accumulated since the bucket was last refilled.
+ *
+ * The bucket holds at most one second worth of tokens, which is the
+ * largest burst that is admitted.
+ */
+static void RefillBucket(TokenBucket *bucket, int rate, TimestampTz now) {
+  if (now > bucket->updated) {
+    bucket->tokens += (double)(now - bucket->updated) * rate / USECS_PER_SEC;
+    bucket->updated = now;
+  }
+  if (bucket->tokens > rate)
+    bucket->tokens = rate;
+}
+
+/**
+ * Extract the measurement name from the start of a line.
+ *
+ * Escapes are removed from the name, which is truncated to fit in
+ * `NAMEDATALEN`.
+ */
+static void GetMeasurement(const char *line, const char *end,
+                           char name[NAMEDATALEN]) {
+  int len = 0;
+
+  memset(name, 0, NAMEDATALEN);
+  while (line < end && *line != ',' && *line != ' ' && *line != '\n') {
+    if (*line == '\\' && line + 1 < end)
+      ++line;
+    if (len < NAMEDATALEN - 1)
+      name[len++] = *line;
+    ++line;
+  }
+}
+
+/**
+ * Decide if a line above the limit of a bucket is admitted anyway.
+ */
+static bool SampleExcess(TokenBucket *bucket) {
+  return InfluxRateLimitPolicy == ADMISSION_SAMPLE &&
+         ++bucket->excess % InfluxRateLimitSample == 0;
+}
+
+/**
+ * Decide if a line is admitted, and take the tokens for it.
+ *
+ * Tokens are only taken if the line is admitted by all limits, so a
+ * source that is over its limit does not use up the limit of the
+ * measurements it writes to.
+ */
+static bool AdmitLine(const char *line, const char *end,
+                      TokenBucket *source_bucket, TimestampTz now) {
+  TokenBucket *measurement_bucket = NULL;
+
+  /* Empty lines and comments are left to the parser. */
+  if (line == end || *line == '\n' || *line == '#')
+    return true;
+
+  if (ExemptNames != NIL || InfluxMeasurementRateLimit > 0) {
+    char name[NAMEDATALEN];
+
+    GetMeasurement(line, end, name);
+    if (IsExempt(name))
+      return true;
+    if (InfluxMeasurementRateLimit > 0)
+      measurement_bucket =
+          LookupBucket(&MeasurementBuckets, "Influx Measurement Buckets",
+                       name, NAMEDATALEN, InfluxMeasurementRateLimit, now);
+  }
+
+  if (source_bucket && source_bucket->tokens < 1.0)
+    return SampleExcess(source_bucket);
+
+  if (measurement_bucket) {
+    RefillBucket(measurement_bucket, InfluxMeasurementRateLimit, now);
+    if (measurement_bucket->tokens < 1.0)
+      return SampleExcess(measurement_bucket);
+    measurement_bucket->tokens -= 1.0;
+  }
+
+  if (source_bucket)
+    source_bucket->tokens -= 1.0;
+  return true;
+}
+
+/**
+ * Remove lines above the rate limits from a packet.
+ *
+ * The admitted lines are moved to the start of the packet, which is
+ * null-terminated after them. Lines that are not admitted are
+ * deferred to the spool for deferred lines if that is the policy and
+ * the spool has room, otherwise they are dropped. The deferred lines
+ * keep the source address of the packet, so they can be admitted
+ * again when they are replayed.
+ *
+ * If the source address of the packet is not known, only the
+ * measurement limit applies.
+ *
+ * @param packet Packet with lines, which is modified in place.
+ * @param spool Spool for deferred lines, or NULL to drop them.
+ * @param shed[out] Number of lines that were not admitted, or NULL.
+ * @returns Number of bytes of admitted lines, which is also the new
+ * size of the packet.
+ */
+size_t AdmitLines(Packet *packet, Spool *spool, uint64 *shed) {
+  const TimestampTz now = GetCurrentTimestamp();
+  TokenBucket *source_bucket = NULL;
+  char *const end = packet->data + packet->bytes;
+  char *line = packet->data, *out = packet->data;
+  uint64 dropped = 0, deferred = 0;
+
+  LoadExemptNames();
+  if (InfluxSourceRateLimit > 0 && packet->source) {
+    source_bucket = LookupSourceBucket(packet->source, now);
+    if (source_bucket)
+      RefillBucket(source_bucket, InfluxSourceRateLimit, now);
+  }
+
+  while (line < end) {
+    char *next = memchr(line, '\n', end - line);
+    size_t length;
+
+    next = next ? next + 1 : end;
+    length = next - line;
+
+    if (AdmitLine(line, next, source_bucket, now)) {
+      if (out != line)
+        memmove(out, line, length);
+      out += length;
+    } else if (InfluxRateLimitPolicy == ADMISSION_SPOOL && spool) {
+      Packet deferred_line = *packet;
+      deferred_line.data = line;
+      deferred_line.bytes = length;
+      if (SpoolPut(spool, &deferred_line))
+        deferred++;
+      else
+        dropped++;
+    } else {
+      dropped++;
+    }
+    line = next;
+  }
+
+  *out = '\0';
+  StatsAdd(STAT_SHED_LINES, dropped);
+  StatsAdd(STAT_SPOOLED, deferred);
+  if (shed)
+    *shed = dropped + deferred;
+  packet->bytes = out - packet->data;
+  return packet->bytes;
+}
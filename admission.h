@@ -0,0 +1,74 @@
+/*
+ * Copyright 2022 Timescale Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Module for admission control of lines.
+ *
+ * Each worker keeps a token bucket for each source address and for
+ * each measurement name, which are refilled at the configured rate
+ * and can hold one second worth of lines. A line is admitted if both
+ * buckets have a token, otherwise it is shed according to the policy:
+ * dropped, sampled so that one in N excess lines is admitted anyway,
+ * or deferred to a spool of their own and admitted again later.
+ *
+ * Lines are filtered in the buffer they were received into, before
+ * they are parsed, spooled, or handed over to the inserters, so shed
+ * lines cost little more than finding the measurement name.
+ *
+ * The buckets are local to each worker, so the limits apply to each
+ * worker separately.
+ */
+
+#ifndef ADMISSION_H_
+#define ADMISSION_H_
+
+#include <postgres.h>
+
+#include <utils/guc.h>
+
+#include <sys/socket.h>
+
+#include "receive.h"
+#include "spool.h"
+
+/**
+ * What to do with lines above the limits.
+ */
+typedef enum AdmissionPolicy {
+  ADMISSION_DROP,
+  ADMISSION_SAMPLE,
+  ADMISSION_SPOOL,
+} AdmissionPolicy;
+
+extern int InfluxSourceRateLimit;
+extern int InfluxMeasurementRateLimit;
+extern int InfluxRateLimitPolicy;
+extern int InfluxRateLimitSample;
+extern char *InfluxRateLimitExempt;
+extern const struct config_enum_entry InfluxRateLimitPolicyOptions[];
+
+extern bool CheckRateLimitExempt(char **newval, void **extra,
+                                 GucSource source);
+extern size_t AdmitLines(Packet *packet, Spool *spool, uint64 *shed);
+
+/**
+ * Check if any rate limit is configured.
+ */
+static inline bool AdmissionEnabled(void) {
+  return InfluxSourceRateLimit > 0 || InfluxMeasurementRateLimit > 0;
+}
+
+#endif /* ADMISSION_H_ */
@@ -0,0 +1,159 @@
+/*
+ * Copyright 2022 Timescale Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Microbenchmark of the number parsing kernel.
+ *
+ * Parses typical field values and timestamps with the kernel and with
+ * the C library functions that the input functions of the server use,
+ * checks that the results are the same, and prints the time per value.
+ *
+ * Build and run with "make bench".
+ */
+
+#include <postgres.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "number.h"
+
+#define VALUES 1000000
+#define ROUNDS 10
+
+typedef struct Sample {
+  char text[32];
+  size_t len;
+} Sample;
+
+static Sample *Floats;
+static Sample *Integers;
+
+static uint64 RandomState = UINT64CONST(88172645463325252);
+
+static uint64 Random(void) {
+  RandomState ^= RandomState << 13;
+  RandomState ^= RandomState >> 7;
+  RandomState ^= RandomState << 17;
+  return RandomState;
+}
+
+static double Now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Values like the ones Telegraf sends: percentages with all digits,
+ * short decimals, and nanosecond timestamps. */
+static void MakeSamples(void) {
+  int i;
+
+  Floats = malloc(VALUES * sizeof(Sample));
+  Integers = malloc(VALUES * sizeof(Sample));
+  for (i = 0; i < VALUES; ++i) {
+    switch (i % 3) {
+      case 0:
+        snprintf(Floats[i].text, sizeof(Floats[i].text), "%.17g",
+                 (double)(Random() % 10000000) / 100000.0);
+        break;
+      case 1:
+        snprintf(Floats[i].text, sizeof(Floats[i].text), "%.2f",
+                 (double)(Random() % 100000) / 100.0);
+        break;
+      case 2:
+        snprintf(Floats[i].text, sizeof(Floats[i].text), "%llu",
+                 (unsigned long long)(Random() % 1000000000));
+        break;
+    }
+    Floats[i].len = strlen(Floats[i].text);
+
+    snprintf(Integers[i].text, sizeof(Integers[i].text), "%llu",
+             (unsigned long long)(UINT64CONST(1574753954000000000) +
+                                  Random() % 1000000000000));
+    Integers[i].len = strlen(Integers[i].text);
+  }
+}
+
+static void Report(const char *name, double seconds) {
+  printf("%-22s %8.2f ns/value\n", name,
+         seconds * 1e9 / ((double)VALUES * ROUNDS));
+}
+
+int main(void) {
+  volatile double fsum = 0;
+  volatile int64 isum = 0;
+  double start;
+  int i, r, fallbacks = 0, mismatches = 0;
+
+  MakeSamples();
+
+  for (i = 0; i < VALUES; ++i) {
+    double kernel, libc = strtod(Floats[i].text, NULL);
+    int64 ikernel;
+    if (!NumberParseFloat8(Floats[i].text, Floats[i].len, &kernel))
+      fallbacks++;
+    else if (memcmp(&kernel, &libc, sizeof(kernel)) != 0)
+      mismatches++;
+    if (!NumberParseInt64(Integers[i].text, Integers[i].len, &ikernel) ||
+        ikernel != strtoll(Integers[i].text, NULL, 10))
+      mismatches++;
+  }
+  printf("%d values, %d float fallbacks, %d mismatches\n", VALUES, fallbacks,
+         mismatches);
+
+  start = Now();
+  for (r = 0; r < ROUNDS; ++r)
+    for (i = 0; i < VALUES; ++i) {
+      char *end;
+      errno = 0;
+      fsum += strtod(Floats[i].text, &end);
+    }
+  Report("strtod", Now() - start);
+
+  start = Now();
+  for (r = 0; r < ROUNDS; ++r)
+    for (i = 0; i < VALUES; ++i) {
+      double value;
+      if (!NumberParseFloat8(Floats[i].text, Floats[i].len, &value))
+        value = strtod(Floats[i].text, NULL);
+      fsum += value;
+    }
+  Report("NumberParseFloat8", Now() - start);
+
+  start = Now();
+  for (r = 0; r < ROUNDS; ++r)
+    for (i = 0; i < VALUES; ++i) {
+      char *end;
+      errno = 0;
+      isum += strtoll(Integers[i].text, &end, 10);
+    }
+  Report("strtoll", Now() - start);
+
+  start = Now();
+  for (r = 0; r < ROUNDS; ++r)
+    for (i = 0; i < VALUES; ++i) {
+      int64 value;
+      if (NumberParseInt64(Integers[i].text, Integers[i].len, &value))
+        isum += value;
+    }
+  Report("NumberParseInt64", Now() - start);
+
+  return mismatches == 0 ? 0 : 1;
+}
@@ -2,74 +2,376 @@
 
 #include <postgres.h>
 
+#include <access/table.h>
+#include <catalog/pg_type.h>
+#include <nodes/makefuncs.h>
+#include <parser/parse_func.h>
+#include <storage/lmgr.h>
+#include <storage/proc.h>
+#include <utils/builtins.h>
 #include <utils/inval.h>
 #include <utils/lsyscache.h>
+#include <utils/memutils.h>
 #include <utils/rel.h>
+#include <utils/syscache.h>
+#include <utils/timestamp.h>
+
+/* Maximum number of measurements that are remembered as rejected.
+ * When there are more, all of them are forgotten. */
+#define METRIC_TABLE_MAX_REJECTED 10000
+
+/* PostgreSQL 13 hashes string keys unless told otherwise. */
+#if PG_VERSION_NUM < 140000
+#define HASH_STRINGS 0
+#endif
+
+/**
+ * Column number for a column name.
+ */
+typedef struct ColumnEntry {
+  /** Hash key, which has to be first */
+  NameData name;
+  AttrNumber attnum;
+} ColumnEntry;
 
 /**
- * Hash table with prepared inserts for relations.
+ * Hash table with descriptions of metric tables.
  *
- * There is one entry for each relation that has been inserted into.
+ * There is one entry for each measurement that has been inserted.
  */
-static HTAB *InsertCache = NULL;
+static HTAB *MetricTableCache = NULL;
+
+/** Milliseconds before trying again to create a table for a
+ * measurement, or zero to try for every line. */
+int InfluxCreateRetryInterval = 10000;
+
+/* Number of entries for rejected measurements. */
+static int RejectedCount = 0;
+
+/* Number of tables described, used as the version of descriptions. */
+static uint64 DescriptionCount = 0;
+
+/* The `_create` function of the namespace it was last looked up
+ * for. The function can be missing, so there is a separate flag for
+ * when it has to be looked up again. */
+static Oid CreateFuncNamespace = InvalidOid;
+static Oid CreateFuncOid = InvalidOid;
+static bool CreateFuncValid = false;
 
 /**
  * Initialize the cache.
  */
-void InitInsertCache(void) {
+static void InitMetricTableCache(void) {
   HASHCTL hash_ctl;
 
   memset(&hash_ctl, 0, sizeof(hash_ctl));
 
-  hash_ctl.keysize = sizeof(Oid);
-  hash_ctl.entrysize = sizeof(PreparedInsertData);
+  hash_ctl.keysize = sizeof(MetricTableKey);
+  hash_ctl.entrysize = sizeof(MetricTableData);
 
   /* The initial size was arbitrarily picked. Most other usage of
    * hash_create in the PostgreSQL code uses 128, so we do the same
    * here. */
-  InsertCache =
-      hash_create("Prepared Inserts", 128, &hash_ctl, HASH_ELEM | HASH_BLOBS);
+  MetricTableCache = hash_create("Influx Metric Tables", 128, &hash_ctl,
+                                 HASH_ELEM | HASH_BLOBS);
+}
+
+static void MakeKey(MetricTableKey *key, Oid nspid, const char *name) {
+  memset(key, 0, sizeof(*key));
+  key->nspid = nspid;
+  namestrcpy(&key->name, name);
+}
+
+/* Free the description of an entry, but keep the entry. */
+static void ReleaseEntry(MetricTable table) {
+  table->valid = false;
+  if (table->rejected != 0) {
+    table->rejected = 0;
+    RejectedCount--;
+  }
+  if (table->pplan) {
+    SPI_freeplan(table->pplan);
+    table->pplan = NULL;
+  }
+  if (table->mcxt) {
+    MemoryContextDelete(table->mcxt);
+    table->mcxt = NULL;
+  }
 }
 
 /**
- * Find an existing entry for the given relation, or insert a new one.
+ * Fill in the description of a table from its tuple descriptor.
+ *
+ * Everything is allocated in the current memory context, and the
+ * tuple descriptor has to live as long as the description.
  *
- * @param rel[in] Relation for the entry.
- * @param precord[out] Pointer to variable for record.
- * @retval true Existing entry was found.
- * @retval false Inserted a new entry.
+ * This is used both for cached tables and for the result of
+ * `parse_influx`, which does not have a table.
  */
-bool FindOrAllocEntry(Relation rel, PreparedInsert *precord) {
-  const Oid relid = RelationGetRelid(rel);
+void MetricTableDescribe(MetricTable table, TupleDesc tupdesc) {
+  HASHCTL hash_ctl;
+  int i;
+
+  memset(&hash_ctl, 0, sizeof(hash_ctl));
+  hash_ctl.keysize = NAMEDATALEN;
+  hash_ctl.entrysize = sizeof(ColumnEntry);
+  hash_ctl.hcxt = CurrentMemoryContext;
+
+  table->attinmeta = TupleDescGetAttInMetadata(tupdesc);
+  table->argtypes = palloc(tupdesc->natts * sizeof(Oid));
+  table->conversions = palloc(tupdesc->natts * sizeof(Conversion));
+  table->columns =
+      hash_create("Influx Metric Columns", Max(tupdesc->natts, 16), &hash_ctl,
+                  HASH_ELEM | HASH_STRINGS | HASH_CONTEXT);
+
+  for (i = 0; i < tupdesc->natts; ++i) {
+    Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+    ColumnEntry *entry;
+
+    table->argtypes[i] = attr->atttypid;
+    table->conversions[i] = ConversionForColumn(attr);
+    if (attr->attisdropped)
+      continue;
+    entry = hash_search(table->columns, NameStr(attr->attname), HASH_ENTER,
+                        NULL);
+    entry->attnum = attr->attnum;
+  }
+
+  table->version = ++DescriptionCount;
+  table->time_attnum = MetricTableColumn(table, "_time");
+  table->tags_attnum = MetricTableColumn(table, "_tags");
+  table->fields_attnum = MetricTableColumn(table, "_fields");
+  table->metric_attnum = MetricTableColumn(table, "_metric");
+}
+
+/**
+ * Get the column number of a column.
+ *
+ * Names are compared the same way as for `SPI_fnumber`, that is,
+ * only the first `NAMEDATALEN - 1` characters are significant.
+ *
+ * @returns The column number, or `InvalidAttrNumber` if the table has
+ * no such column.
+ */
+AttrNumber MetricTableColumn(MetricTable table, const char *name) {
+  ColumnEntry *entry = hash_search(table->columns, name, HASH_FIND, NULL);
+  return entry ? entry->attnum : InvalidAttrNumber;
+}
+
+/* Describe the table for an entry and mark it as valid. The table is
+ * locked until the end of the transaction, so that the definition
+ * cannot change before the rows are inserted. */
+static MetricTable BuildEntry(const MetricTableKey *key, Oid relid) {
+  MetricTable table;
+  MemoryContext oldcontext;
+  Relation rel;
   bool found;
 
-  if (!InsertCache)
-    InitInsertCache();
+  table = hash_search(MetricTableCache, key, HASH_ENTER, &found);
+  if (found)
+    ReleaseEntry(table);
+  else {
+    table->mcxt = NULL;
+    table->pplan = NULL;
+    table->rejected = 0;
+  }
+  table->valid = false;
+  table->relid = relid;
+
+  /* Opening the table processes pending invalidations, so the tuple
+   * descriptor is current once it is open. */
+  rel = table_open(relid, AccessShareLock);
+
+  table->mcxt = AllocSetContextCreate(CacheMemoryContext,
+                                      "Influx Metric Table",
+                                      ALLOCSET_SMALL_SIZES);
+  MemoryContextCopyAndSetIdentifier(table->mcxt, NameStr(key->name));
+  oldcontext = MemoryContextSwitchTo(table->mcxt);
+  MetricTableDescribe(table, CreateTupleDescCopy(RelationGetDescr(rel)));
+  MemoryContextSwitchTo(oldcontext);
+
+  table_close(rel, NoLock);
+
+  table->lxid = MyProc->lxid;
+  table->valid = true;
+  return table;
+}
 
-  *precord = hash_search(InsertCache, &relid, HASH_ENTER, &found);
-  return found;
+/* Remove an entry from the cache. */
+static void RemoveEntry(MetricTable table) {
+  ReleaseEntry(table);
+  hash_search(MetricTableCache, &table->key, HASH_REMOVE, NULL);
 }
 
 /**
- * Invalidate an insert cache entry.
+ * Find the table for a measurement.
+ *
+ * The table is locked the first time it is used in each transaction.
+ * Locking the table processes pending invalidations, so if the table
+ * was changed or dropped since it was last used, the entry is rebuilt
+ * from the catalog.
  *
- * The cache entry is invalidated by just removing it. It will be
- * re-created when it is again requested since it will not be found in
- * the cache.
+ * Measurements for which a table could not be created recently are
+ * not looked up in the catalog at all.
+ *
+ * @param nspid Namespace of the metric tables.
+ * @param name Measurement name.
+ * @param rejected[out] Set to true if the measurement was rejected
+ * recently, in which case creating the table should not be tried.
+ * @returns The table, or NULL if there is no table for the
+ * measurement.
+ */
+MetricTable MetricTableLookup(Oid nspid, const char *name, bool *rejected) {
+  MetricTableKey key;
+  MetricTable table;
+  Oid relid;
+
+  if (!MetricTableCache)
+    InitMetricTableCache();
+
+  *rejected = false;
+  MakeKey(&key, nspid, name);
+  table = hash_search(MetricTableCache, &key, HASH_FIND, NULL);
+  if (table && table->rejected != 0) {
+    if (!TimestampDifferenceExceeds(table->rejected, GetCurrentTimestamp(),
+                                    InfluxCreateRetryInterval)) {
+      *rejected = true;
+      return NULL;
+    }
+    RemoveEntry(table);
+    table = NULL;
+  }
+
+  if (table && table->valid && table->lxid != MyProc->lxid) {
+    LockRelationOid(table->relid, AccessShareLock);
+    table->lxid = MyProc->lxid;
+  }
+  if (table && table->valid)
+    return table;
+
+  relid = get_relname_relid(NameStr(key.name), nspid);
+  if (!OidIsValid(relid)) {
+    if (table)
+      RemoveEntry(table);
+    return NULL;
+  }
+  return BuildEntry(&key, relid);
+}
+
+/* Forget all rejected measurements. */
+static void ForgetRejected(void) {
+  HASH_SEQ_STATUS status;
+  MetricTable table;
+
+  /* Removing the entry just returned is allowed while scanning. */
+  hash_seq_init(&status, MetricTableCache);
+  while ((table = hash_seq_search(&status)) != NULL) {
+    if (table->rejected != 0)
+      RemoveEntry(table);
+  }
+}
+
+/**
+ * Remember that a table could not be created for a measurement.
+ *
+ * Lines for the measurement are skipped without looking for the table
+ * until `influx.create_retry_interval` has passed.
+ */
+void MetricTableReject(Oid nspid, const char *name) {
+  MetricTableKey key;
+  MetricTable table;
+  bool found;
+
+  if (InfluxCreateRetryInterval <= 0)
+    return;
+
+  if (!MetricTableCache)
+    InitMetricTableCache();
+  if (RejectedCount >= METRIC_TABLE_MAX_REJECTED)
+    ForgetRejected();
+
+  MakeKey(&key, nspid, name);
+  table = hash_search(MetricTableCache, &key, HASH_ENTER, &found);
+  if (found)
+    ReleaseEntry(table);
+  else {
+    table->mcxt = NULL;
+    table->pplan = NULL;
+  }
+  table->relid = InvalidOid;
+  table->rejected = GetCurrentTimestamp();
+  RejectedCount++;
+}
+
+/**
+ * Add the table for a measurement.
+ *
+ * This is used when the table was just created, and can have a
+ * different name than the measurement.
+ */
+MetricTable MetricTableAdd(Oid nspid, const char *name, Oid relid) {
+  MetricTableKey key;
+
+  if (!MetricTableCache)
+    InitMetricTableCache();
+
+  MakeKey(&key, nspid, name);
+  return BuildEntry(&key, relid);
+}
+
+/**
+ * Invalidate metric table cache entries.
+ *
+ * The entries for the relation are only marked as invalid here, since
+ * invalidations can be processed while an entry is in use. They are
+ * rebuilt the next time they are looked up.
  *
  * @param arg[in] Not used
- * @param relid[in] Relation id for relation that was invalidated
+ * @param relid[in] Relation id for relation that was invalidated, or
+ * `InvalidOid` if all relations were invalidated.
  */
 void InsertCacheInvalCallback(Datum arg, Oid relid) {
-  if (InsertCache) {
-    bool found;
-    PreparedInsert record =
-        hash_search(InsertCache, &relid, HASH_REMOVE, &found);
-    if (found)
-      SPI_freeplan(record->pplan);
+  HASH_SEQ_STATUS status;
+  MetricTable table;
+
+  if (!MetricTableCache)
+    return;
+
+  hash_seq_init(&status, MetricTableCache);
+  while ((table = hash_seq_search(&status)) != NULL) {
+    if (!OidIsValid(relid) || table->relid == relid)
+      table->valid = false;
+  }
+}
+
+/**
+ * Find the function that creates tables for new measurements.
+ *
+ * The function is named `_create` and is in the same schema as the
+ * metric tables. The result is cached, also if there is no such
+ * function, until a function is created, changed, or dropped.
+ *
+ * @returns The OID of the function, or `InvalidOid` if there is none.
+ */
+Oid MetricCreateFunction(Oid nspid) {
+  if (!CreateFuncValid || CreateFuncNamespace != nspid) {
+    Oid args[] = {NAMEOID, NAMEARRAYOID, NAMEARRAYOID};
+    List *funcname = list_make2(makeString(get_namespace_name(nspid)),
+                                makeString("_create"));
+    CreateFuncOid = LookupFuncName(funcname, lengthof(args), args, true);
+    CreateFuncNamespace = nspid;
+    CreateFuncValid = true;
   }
+  return CreateFuncOid;
+}
+
+/* Forget the create function when any function changes. */
+static void CreateFuncInvalCallback(Datum arg, int cacheid,
+                                    uint32 hashvalue) {
+  CreateFuncValid = false;
 }
 
 void CacheInit(void) {
   CacheRegisterRelcacheCallback(InsertCacheInvalCallback, 0);
+  CacheRegisterSyscacheCallback(PROCOID, CreateFuncInvalCallback, 0);
 }
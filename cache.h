@@ -17,21 +17,88 @@
 
 #include <postgres.h>
 
+#include <access/attnum.h>
+#include <datatype/timestamp.h>
 #include <executor/spi.h>
+#include <funcapi.h>
+#include <utils/hsearch.h>
+
+#include "convert.h"
 
 /**
- * Structure for prepared inserts.
+ * Key of a metric table in the cache.
+ */
+typedef struct MetricTableKey {
+  Oid nspid;
+  NameData name;
+} MetricTableKey;
+
+/**
+ * Cached description of a metric table.
+ *
+ * Entries are keyed by the namespace and the measurement name, and
+ * hold what is needed to turn a line into a row of the table, so that
+ * this does not have to be looked up again for each line.
  */
-typedef struct PreparedInsertData {
+typedef struct MetricTableData {
+  /** Hash key, which has to be first */
+  MetricTableKey key;
+
+  /** False if the relation was invalidated and has to be looked up
+   * again */
+  bool valid;
+
+  /** Table that lines for the measurement are inserted into */
   Oid relid;
+
+  /** Transaction in which the table was last locked */
+  LocalTransactionId lxid;
+
+  /** Memory context for the description */
+  MemoryContext mcxt;
+
+  /** Input functions for the columns, and the tuple descriptor */
+  AttInMetadata *attinmeta;
+
+  /** Column numbers by column name */
+  HTAB *columns;
+
+  /** Type of each column */
+  Oid *argtypes;
+
+  /** How values are converted for each column */
+  Conversion *conversions;
+
+  /** Number that is different for each description, so that data
+   * derived from it can tell if the table was described again */
+  uint64 version;
+
+  /** Column numbers of the special columns, or zero if missing */
+  AttrNumber time_attnum;
+  AttrNumber tags_attnum;
+  AttrNumber fields_attnum;
+  AttrNumber metric_attnum;
+
+  /** Prepared insert statement, or NULL if not prepared yet */
   SPIPlanPtr pplan;
-} PreparedInsertData;
 
-typedef PreparedInsertData *PreparedInsert;
+  /** Time when creating a table for the measurement failed, or zero if
+   * the entry has a table */
+  TimestampTz rejected;
+} MetricTableData;
+
+typedef MetricTableData *MetricTable;
+
+extern int InfluxCreateRetryInterval;
 
 extern void CacheInit(void);
-extern bool FindOrAllocEntry(Relation rel, PreparedInsert *precord);
-extern void InitInsertCache(void);
+extern MetricTable MetricTableLookup(Oid nspid, const char *name,
+                                     bool *rejected);
+extern void MetricTableReject(Oid nspid, const char *name);
+extern MetricTable MetricTableAdd(Oid nspid, const char *name, Oid relid);
+extern void MetricTableDescribe(MetricTable table, TupleDesc tupdesc);
+extern AttrNumber MetricTableColumn(MetricTable table, const char *name);
+extern Oid MetricCreateFunction(Oid nspid);
 extern void InsertCacheInvalCallback(Datum arg, Oid relid);
 
 #endif /* CACHE_H_ */
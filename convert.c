@@ -0,0 +1,285 @@
+/*
+ * Copyright 2022 Timescale Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "convert.h"
+
+#include <postgres.h>
+#include <fmgr.h>
+
+#include <catalog/pg_type.h>
+#include <datatype/timestamp.h>
+#include <utils/builtins.h>
+#include <utils/datetime.h>
+#include <utils/timestamp.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "number.h"
+
+/**
+ * Pick the conversion for a column.
+ *
+ * Columns with a type modifier, such as `numeric(10,2)` or
+ * `varchar(20)`, need the input function to apply the modifier, and
+ * so do domains, so they are converted with the input function.
+ */
+Conversion ConversionForColumn(Form_pg_attribute attr) {
+  if (attr->atttypmod >= 0)
+    return CONVERT_INPUT;
+
+  switch (attr->atttypid) {
+    case INT2OID:
+      return CONVERT_INT2;
+    case INT4OID:
+      return CONVERT_INT4;
+    case INT8OID:
+      return CONVERT_INT8;
+    case FLOAT4OID:
+      return CONVERT_FLOAT4;
+    case FLOAT8OID:
+      return CONVERT_FLOAT8;
+    case NUMERICOID:
+      return CONVERT_NUMERIC;
+    case BOOLOID:
+      return CONVERT_BOOL;
+    case TEXTOID:
+    case VARCHAROID:
+      return CONVERT_TEXT;
+    case TIMESTAMPTZOID:
+      return CONVERT_TIMESTAMPTZ;
+    default:
+      return CONVERT_INPUT;
+  }
+}
+
+/* Parse a decimal integer with an optional minus sign and nothing
+ * else. Values that do not fit in an int64 are not parsed. */
+static bool ParseInteger(const char *str, int64 *result) {
+  return NumberParseInt64(str, strlen(str), result);
+}
+
+/* Parse a floating-point number the same way as the input functions
+ * for float4 and float8, which also use strtof and strtod. Overflow
+ * and underflow are left to the input functions, which report them.
+ *
+ * Doubles are first tried with the number parsing kernel, which
+ * gives the same result as strtod. Rounding the double to a float
+ * could round twice, so floats always use strtof. */
+static bool ParseFloat8(const char *str, float8 *result) {
+  char *end;
+
+  if (NumberParseFloat8(str, strlen(str), result))
+    return true;
+
+  errno = 0;
+  *result = strtod(str, &end);
+  return end != str && *end == '\0' && errno == 0;
+}
+
+static bool ParseFloat4(const char *str, float4 *result) {
+  char *end;
+
+  errno = 0;
+  *result = strtof(str, &end);
+  return end != str && *end == '\0' && errno == 0;
+}
+
+/* Parse the boolean literals of the line protocol. */
+static bool ParseBool(const char *str, bool *result) {
+  if (strcmp(str, "t") == 0 || strcmp(str, "T") == 0 ||
+      strcmp(str, "true") == 0 || strcmp(str, "True") == 0 ||
+      strcmp(str, "TRUE") == 0)
+    *result = true;
+  else if (strcmp(str, "f") == 0 || strcmp(str, "F") == 0 ||
+           strcmp(str, "false") == 0 || strcmp(str, "False") == 0 ||
+           strcmp(str, "FALSE") == 0)
+    *result = false;
+  else
+    return false;
+  return true;
+}
+
+/* Parse a fixed number of digits. */
+static bool ParseDigits(const char **pptr, int count, int *result) {
+  const char *ptr = *pptr;
+  int value = 0;
+
+  while (count-- > 0) {
+    if (!isdigit((unsigned char)*ptr))
+      return false;
+    value = value * 10 + (*ptr++ - '0');
+  }
+  *pptr = ptr;
+  *result = value;
+  return true;
+}
+
+/*
+ * Parse an RFC 3339 timestamp with a time zone, for example
+ * "2019-11-26T07:39:14.5Z" or "2019-11-26T08:39:14+01:00".
+ *
+ * Other formats, more than microsecond precision, and values that
+ * would need checks beyond the ranges of the fields are left to the
+ * input function.
+ */
+static bool ParseTimestampTz(const char *str, TimestampTz *result) {
+  const char *ptr = str;
+  struct pg_tm tm;
+  fsec_t fsec = 0;
+  int tz = 0;
+
+  memset(&tm, 0, sizeof(tm));
+  if (!ParseDigits(&ptr, 4, &tm.tm_year) || *ptr++ != '-' ||
+      !ParseDigits(&ptr, 2, &tm.tm_mon) || *ptr++ != '-' ||
+      !ParseDigits(&ptr, 2, &tm.tm_mday) || *ptr++ != 'T' ||
+      !ParseDigits(&ptr, 2, &tm.tm_hour) || *ptr++ != ':' ||
+      !ParseDigits(&ptr, 2, &tm.tm_min) || *ptr++ != ':' ||
+      !ParseDigits(&ptr, 2, &tm.tm_sec))
+    return false;
+
+  if (*ptr == '.') {
+    int scale = 1000000;
+    ++ptr;
+    if (!isdigit((unsigned char)*ptr))
+      return false;
+    while (isdigit((unsigned char)*ptr)) {
+      if (scale == 1)
+        return false;
+      scale /= 10;
+      fsec += (*ptr++ - '0') * scale;
+    }
+  }
+
+  if (*ptr == 'Z') {
+    ++ptr;
+  } else if (*ptr == '+' || *ptr == '-') {
+    const int sign = *ptr++ == '+' ? 1 : -1;
+    int hours, minutes;
+    if (!ParseDigits(&ptr, 2, &hours) || *ptr++ != ':' ||
+        !ParseDigits(&ptr, 2, &minutes) || hours > MAX_TZDISP_HOUR ||
+        minutes >= MINS_PER_HOUR)
+      return false;
+    /* PostgreSQL counts time zone offsets west of Greenwich. */
+    tz = -sign * (hours * SECS_PER_HOUR + minutes * SECS_PER_MINUTE);
+  } else {
+    return false;
+  }
+  if (*ptr != '\0')
+    return false;
+
+  if (tm.tm_year < 1 || tm.tm_mon < 1 || tm.tm_mon > MONTHS_PER_YEAR ||
+      tm.tm_mday < 1 ||
+      tm.tm_mday > day_tab[isleap(tm.tm_year)][tm.tm_mon - 1] ||
+      tm.tm_hour >= HOURS_PER_DAY || tm.tm_min >= MINS_PER_HOUR ||
+      tm.tm_sec >= SECS_PER_MINUTE)
+    return false;
+
+  return tm2timestamp(&tm, fsec, &tz, result) == 0 &&
+         IS_VALID_TIMESTAMP(*result);
+}
+
+/**
+ * Convert a value for a column without the input function.
+ *
+ * Values that the parser classified as strings or booleans are only
+ * converted for text, boolean, and timestamp columns. Integers and floats are
+ * converted for all the supported columns.
+ *
+ * @param conversion Conversion for the column.
+ * @param value Value as a C string.
+ * @param type Type of the value.
+ * @param result[out] Datum for the value.
+ * @returns false if the value has to be converted using the input
+ * function of the column type.
+ */
+bool ConvertValue(Conversion conversion, const char *value, Type type,
+                  Datum *result) {
+  const bool number = (type == TYPE_INTEGER || type == TYPE_FLOAT);
+  int64 ival;
+
+  switch (conversion) {
+    case CONVERT_INPUT:
+      return false;
+
+    case CONVERT_INT2:
+      if (!number || !ParseInteger(value, &ival) || ival < PG_INT16_MIN ||
+          ival > PG_INT16_MAX)
+        return false;
+      *result = Int16GetDatum((int16)ival);
+      return true;
+
+    case CONVERT_INT4:
+      if (!number || !ParseInteger(value, &ival) || ival < PG_INT32_MIN ||
+          ival > PG_INT32_MAX)
+        return false;
+      *result = Int32GetDatum((int32)ival);
+      return true;
+
+    case CONVERT_INT8:
+      if (!number || !ParseInteger(value, &ival))
+        return false;
+      *result = Int64GetDatum(ival);
+      return true;
+
+    case CONVERT_FLOAT4: {
+      float4 fval;
+      if (!number || !ParseFloat4(value, &fval))
+        return false;
+      *result = Float4GetDatum(fval);
+      return true;
+    }
+
+    case CONVERT_FLOAT8: {
+      float8 fval;
+      if (!number || !ParseFloat8(value, &fval))
+        return false;
+      *result = Float8GetDatum(fval);
+      return true;
+    }
+
+    case CONVERT_NUMERIC:
+      /* Decimal fractions are left to the input function, which
+       * keeps all the digits. */
+      if (type != TYPE_INTEGER || !ParseInteger(value, &ival))
+        return false;
+      *result = DirectFunctionCall1(int8_numeric, Int64GetDatum(ival));
+      return true;
+
+    case CONVERT_BOOL: {
+      bool bval;
+      if (number || !ParseBool(value, &bval))
+        return false;
+      *result = BoolGetDatum(bval);
+      return true;
+    }
+
+    case CONVERT_TEXT:
+      *result = PointerGetDatum(cstring_to_text(value));
+      return true;
+
+    case CONVERT_TIMESTAMPTZ: {
+      TimestampTz tval;
+      if (number || !ParseTimestampTz(value, &tval))
+        return false;
+      *result = TimestampTzGetDatum(tval);
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright 2022 Timescale Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Module to convert values of lines to column values.
+ *
+ * The parser classifies field values as integers, floats, booleans,
+ * or strings. Values for columns of common types are converted
+ * directly from the token and its type, which avoids calling the
+ * input function of the column type. Anything that the direct
+ * conversion does not handle exactly the way the input function
+ * would, including values that are not valid for the column, is left
+ * to the input function, so the result and any errors are the same as
+ * before.
+ */
+
+#ifndef CONVERT_H_
+#define CONVERT_H_
+
+#include <postgres.h>
+
+#include <catalog/pg_attribute.h>
+
+/**
+ * Type of a value, as classified by the parser.
+ *
+ * Tag values are not classified and have type `TYPE_NONE`.
+ */
+typedef enum Type {
+  TYPE_NONE,
+  TYPE_STRING,
+  TYPE_INTEGER,
+  TYPE_FLOAT,
+  TYPE_BOOLEAN,
+} Type;
+
+/**
+ * Conversion of values for a column.
+ */
+typedef enum Conversion {
+  CONVERT_INPUT, /**< Call the input function of the column type */
+  CONVERT_INT2,
+  CONVERT_INT4,
+  CONVERT_INT8,
+  CONVERT_FLOAT4,
+  CONVERT_FLOAT8,
+  CONVERT_NUMERIC,
+  CONVERT_BOOL,
+  CONVERT_TEXT,
+  CONVERT_TIMESTAMPTZ,
+} Conversion;
+
+extern Conversion ConversionForColumn(Form_pg_attribute attr);
+extern bool ConvertValue(Conversion conversion, const char *value, Type type,
+                         Datum *result);
+
+#endif /* CONVERT_H_ */
@@ -0,0 +1,722 @@
+/*
+ * Copyright 2022 Timescale Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "http.h"
+
+#include <postgres.h>
+
+#include <lib/stringinfo.h>
+#include <utils/json.h>
+#include <utils/memutils.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+
+/* Maximum size of the request line and headers, and of chunk size
+ * lines. */
+#define HTTP_MAX_HEADER_SIZE 16384
+
+/* Number of bytes to make room for with each read. */
+#define HTTP_READ_SIZE 65536
+
+/* Maximum number of bytes to read from a connection each time it is
+ * ready, so that a single connection does not starve the others. */
+#define HTTP_MAX_READ (1024 * 1024)
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/** Maximum size of a request body, before and after decoding. */
+int InfluxMaxBodySize = 32 * 1024 * 1024;
+
+static const char *StatusText(int status) {
+  switch (status) {
+    case 100:
+      return "Continue";
+    case 204:
+      return "No Content";
+    case 400:
+      return "Bad Request";
+    case 404:
+      return "Not Found";
+    case 405:
+      return "Method Not Allowed";
+    case 413:
+      return "Request Entity Too Large";
+    case 415:
+      return "Unsupported Media Type";
+    case 429:
+      return "Too Many Requests";
+    case 431:
+      return "Request Header Fields Too Large";
+    case 500:
+      return "Internal Server Error";
+    case 501:
+      return "Not Implemented";
+    default:
+      return "Unknown";
+  }
+}
+
+/**
+ * Create a new HTTP connection for a socket.
+ *
+ * All memory for the connection is allocated in a dedicated memory
+ * context, which is deleted when the connection is closed.
+ *
+ * @param fd Connected socket, which should be in non-blocking mode.
+ */
+HttpConn *HttpConnCreate(int fd) {
+  MemoryContext context = AllocSetContextCreate(
+      TopMemoryContext, "HTTP connection", ALLOCSET_DEFAULT_SIZES);
+  MemoryContext oldcontext = MemoryContextSwitchTo(context);
+  HttpConn *conn = palloc0(sizeof(HttpConn));
+
+  conn->fd = fd;
+  conn->context = context;
+  conn->request_context =
+      AllocSetContextCreate(context, "HTTP request", ALLOCSET_DEFAULT_SIZES);
+  conn->state = HTTP_STATE_HEADER;
+  initStringInfo(&conn->input);
+  initStringInfo(&conn->output);
+
+  MemoryContextSwitchTo(oldcontext);
+  return conn;
+}
+
+/**
+ * Close the connection and release the memory for it.
+ *
+ * Buffered responses that were not flushed are discarded.
+ */
+void HttpConnClose(HttpConn *conn) {
+  close(conn->fd);
+  MemoryContextDelete(conn->context);
+}
+
+/**
+ * Read available data from the connection.
+ *
+ * Data already parsed is removed from the input buffer before reading
+ * more.
+ *
+ * @retval true Connection is still open.
+ * @retval false Connection was closed by the peer or failed.
+ */
+bool HttpConnRead(HttpConn *conn) {
+  StringInfo input = &conn->input;
+  size_t total = 0;
+
+  if (input->cursor > 0) {
+    input->len -= input->cursor;
+    memmove(input->data, input->data + input->cursor, input->len);
+    input->data[input->len] = '\0';
+    input->cursor = 0;
+  }
+
+  while (total < HTTP_MAX_READ) {
+    ssize_t bytes;
+
+    enlargeStringInfo(input, HTTP_READ_SIZE);
+    bytes = recv(conn->fd, input->data + input->len,
+                 input->maxlen - input->len - 1, 0);
+    if (bytes < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        break;
+      ereport(LOG, (errcode_for_socket_access(),
+                    errmsg("could not read from connection: %m")));
+      return false;
+    }
+
+    /* If the peer closed the connection after sending a request, we
+     * process the request and will see the end of the stream on the
+     * next read. */
+    if (bytes == 0)
+      return total > 0;
+
+    /* We are going to close the connection, so just throw away
+     * whatever the peer sends. */
+    total += bytes;
+    if (conn->state == HTTP_STATE_CLOSING)
+      continue;
+
+    input->len += bytes;
+    input->data[input->len] = '\0';
+  }
+
+  return true;
+}
+
+/**
+ * Buffer a response to a request.
+ *
+ * If a message is given, it is sent as an error in a JSON object, in
+ * the same way as InfluxDB does.
+ *
+ * @param conn Connection to respond on.
+ * @param status HTTP status code.
+ * @param message Error message, or NULL.
+ */
+void HttpConnRespond(HttpConn *conn, int status, const char *message) {
+  MemoryContext oldcontext = MemoryContextSwitchTo(conn->context);
+  StringInfo output = &conn->output;
+
+  appendStringInfo(output, "HTTP/1.1 %d %s\r\n", status, StatusText(status));
+  if (conn->close)
+    appendStringInfoString(output, "Connection: close\r\n");
+
+  if (message) {
+    StringInfoData body;
+    initStringInfo(&body);
+    appendStringInfoString(&body, "{\"error\":");
+    escape_json(&body, message);
+    appendStringInfoString(&body, "}\n");
+    appendStringInfo(output,
+                     "Content-Type: application/json\r\n"
+                     "Content-Length: %d\r\n\r\n%s",
+                     body.len, body.data);
+    pfree(body.data);
+  } else if (status == 204) {
+    appendStringInfoString(output, "\r\n");
+  } else {
+    appendStringInfoString(output, "Content-Length: 0\r\n\r\n");
+  }
+
+  MemoryContextSwitchTo(oldcontext);
+}
+
+/**
+ * Respond with an error and close the connection.
+ *
+ * This is used when we cannot continue to parse requests from the
+ * connection.
+ */
+static void HttpConnAbort(HttpConn *conn, int status, const char *message) {
+  conn->close = true;
+  conn->state = HTTP_STATE_CLOSING;
+  HttpConnRespond(conn, status, message);
+}
+
+/**
+ * Send all buffered responses.
+ *
+ * Responses are small, so if the socket buffer is full the client is
+ * not reading responses and we give up on the connection.
+ *
+ * @retval true Connection is still open.
+ * @retval false Connection should be closed.
+ */
+bool HttpConnFlush(HttpConn *conn) {
+  StringInfo output = &conn->output;
+
+  while (output->cursor < output->len) {
+    ssize_t bytes = send(conn->fd, output->data + output->cursor,
+                         output->len - output->cursor, MSG_NOSIGNAL);
+    if (bytes < 0) {
+      if (errno == EINTR)
+        continue;
+      ereport(LOG, (errcode_for_socket_access(),
+                    errmsg("could not send response: %m")));
+      return false;
+    }
+    output->cursor += bytes;
+  }
+
+  resetStringInfo(output);
+  return !conn->close;
+}
+
+/**
+ * Get next line from the input buffer.
+ *
+ * The line terminator is removed and the line is null-terminated. The
+ * line is only valid until the next read.
+ *
+ * @returns Pointer to the line, or NULL if there is no complete line
+ * in the buffer.
+ */
+static char *NextLine(HttpConn *conn) {
+  StringInfo input = &conn->input;
+  char *line = input->data + input->cursor;
+  char *end = memchr(line, '\n', input->len - input->cursor);
+
+  if (end == NULL)
+    return NULL;
+
+  input->cursor = end - input->data + 1;
+  if (end > line && end[-1] == '\r')
+    --end;
+  *end = '\0';
+  return line;
+}
+
+/**
+ * Find the end of the header section.
+ *
+ * @returns Number of bytes in the header section, including the empty
+ * line, or zero if the header section is not complete.
+ */
+static size_t FindHeaderEnd(const char *data, size_t len) {
+  const char *ptr = data;
+  const char *const end = data + len;
+
+  while ((ptr = memchr(ptr, '\n', end - ptr)) != NULL) {
+    ++ptr;
+    if (ptr < end && *ptr == '\n')
+      return ptr - data + 1;
+    if (ptr + 1 < end && ptr[0] == '\r' && ptr[1] == '\n')
+      return ptr - data + 2;
+  }
+  return 0;
+}
+
+/**
+ * Decode a percent-encoded string in place.
+ */
+static char *DecodeComponent(char *str) {
+  char *rptr = str, *wptr = str;
+
+  while (*rptr) {
+    if (*rptr == '%' && isxdigit((unsigned char)rptr[1]) &&
+        isxdigit((unsigned char)rptr[2])) {
+      char hex[3] = {rptr[1], rptr[2], '\0'};
+      *wptr++ = (char)strtol(hex, NULL, 16);
+      rptr += 3;
+    } else if (*rptr == '+') {
+      *wptr++ = ' ';
+      ++rptr;
+    } else {
+      *wptr++ = *rptr++;
+    }
+  }
+  *wptr = '\0';
+  return str;
+}
+
+/**
+ * Parse the query string of a write request.
+ *
+ * The `db` parameter of the v1 API and the `bucket` parameter of the
+ * v2 API both give the database to write to. For compatibility with
+ * InfluxDB 1.8, a bucket can also be given as "database/retention",
+ * and the retention policy is then ignored.
+ */
+static void ParseQuery(HttpConn *conn, char *query, bool v2) {
+  char *param, *saveptr;
+
+  for (param = strtok_r(query, "&", &saveptr); param;
+       param = strtok_r(NULL, "&", &saveptr)) {
+    char *value = strchr(param, '=');
+    if (value == NULL)
+      continue;
+    *value++ = '\0';
+    DecodeComponent(param);
+    DecodeComponent(value);
+
+    if (strcmp(param, "precision") == 0) {
+      conn->request.precision = pstrdup(value);
+    } else if (!v2 && strcmp(param, "db") == 0) {
+      conn->request.database = pstrdup(value);
+    } else if (v2 && strcmp(param, "bucket") == 0) {
+      char *slash = strchr(value, '/');
+      if (slash)
+        *slash = '\0';
+      conn->request.database = pstrdup(value);
+    }
+  }
+}
+
+/**
+ * Parse the request line and the headers of a request.
+ *
+ * Requests that are not write requests are answered directly, but
+ * the body is still read and discarded so that the next request can
+ * be read from the connection.
+ *
+ * @retval true Header was parsed and state updated.
+ * @retval false Header is not complete, or the connection is closing.
+ */
+static bool ParseHeader(HttpConn *conn) {
+  StringInfo input = &conn->input;
+  char *method, *target, *version, *query, *line, *saveptr;
+  int status = 204;
+  const char *message = NULL;
+  int64 content_length = 0;
+  bool chunked = false, expect_continue = false;
+  const size_t header_size =
+      FindHeaderEnd(input->data + input->cursor, input->len - input->cursor);
+
+  if (header_size == 0) {
+    if (input->len - input->cursor > HTTP_MAX_HEADER_SIZE)
+      HttpConnAbort(conn, 431, "request header too large");
+    return false;
+  }
+
+  /* Start a new request. */
+  MemoryContextReset(conn->request_context);
+  MemoryContextSwitchTo(conn->request_context);
+  memset(&conn->request, 0, sizeof(conn->request));
+  initStringInfo(&conn->body);
+  conn->write = false;
+  conn->gzip = false;
+
+  /* Parse request line. Empty lines before the request line should
+   * be ignored according to RFC 7230. */
+  do {
+    line = NextLine(conn);
+  } while (line && *line == '\0');
+
+  method = strtok_r(line, " ", &saveptr);
+  target = strtok_r(NULL, " ", &saveptr);
+  version = strtok_r(NULL, " ", &saveptr);
+  if (!method || !target || !version || strncmp(version, "HTTP/1.", 7) != 0) {
+    HttpConnAbort(conn, 400, "malformed request line");
+    return false;
+  }
+
+  /* HTTP/1.1 connections are persistent by default, but not HTTP/1.0
+   * connections. */
+  conn->close = (strcmp(version, "HTTP/1.0") == 0);
+
+  /* Parse the headers until we reach the empty line. */
+  while ((line = NextLine(conn)) != NULL && *line != '\0') {
+    char *value = strchr(line, ':');
+    if (value == NULL) {
+      HttpConnAbort(conn, 400, "malformed header");
+      return false;
+    }
+    *value++ = '\0';
+    while (isspace((unsigned char)*value))
+      ++value;
+
+    if (pg_strcasecmp(line, "Content-Length") == 0) {
+      char *endptr;
+      errno = 0;
+      content_length = strtoll(value, &endptr, 10);
+      if (errno != 0 || endptr == value || *endptr != '\0' ||
+          content_length < 0) {
+        HttpConnAbort(conn, 400, "invalid content length");
+        return false;
+      }
+    } else if (pg_strcasecmp(line, "Transfer-Encoding") == 0) {
+      if (pg_strcasecmp(value, "chunked") != 0) {
+        HttpConnAbort(conn, 501, "unsupported transfer encoding");
+        return false;
+      }
+      chunked = true;
+    } else if (pg_strcasecmp(line, "Content-Encoding") == 0) {
+      if (pg_strcasecmp(value, "gzip") == 0)
+        conn->gzip = true;
+      else if (pg_strcasecmp(value, "identity") != 0) {
+        HttpConnAbort(conn, 415, "unsupported content encoding");
+        return false;
+      }
+    } else if (pg_strcasecmp(line, "Connection") == 0) {
+      if (pg_strcasecmp(value, "close") == 0)
+        conn->close = true;
+      else if (pg_strcasecmp(value, "keep-alive") == 0)
+        conn->close = false;
+    } else if (pg_strcasecmp(line, "Expect") == 0) {
+      expect_continue = (pg_strcasecmp(value, "100-continue") == 0);
+    }
+  }
+
+  if (content_length > InfluxMaxBodySize) {
+    HttpConnAbort(conn, 413, "request body too large");
+    return false;
+  }
+
+#ifndef HAVE_LIBZ
+  if (conn->gzip) {
+    HttpConnAbort(conn, 415, "gzip encoding not supported by server");
+    return false;
+  }
+#endif
+
+  query = strchr(target, '?');
+  if (query)
+    *query++ = '\0';
+
+  if (strcmp(target, "/write") == 0 || strcmp(target, "/api/v2/write") == 0) {
+    if (strcmp(method, "POST") == 0) {
+      conn->write = true;
+      if (query)
+        ParseQuery(conn, query, target[1] == 'a');
+    } else {
+      status = 405;
+      message = "method not allowed";
+    }
+  } else if (strcmp(target, "/ping") != 0 && strcmp(target, "/health") != 0) {
+    status = 404;
+    message = "not found";
+  }
+
+  if (!conn->write) {
+    /* A client waiting for permission to send the body will not send
+     * it when it gets a final response, so we cannot read the next
+     * request from the connection. */
+    if (expect_continue) {
+      HttpConnAbort(conn, status, message);
+      return false;
+    }
+    HttpConnRespond(conn, status, message);
+  } else if (expect_continue) {
+    /* We give permission to send the body directly unless there are
+     * responses buffered, in which case the client has to wait for
+     * them to be sent first. */
+    static const char response[] = "HTTP/1.1 100 Continue\r\n\r\n";
+    if (conn->output.len > 0 ||
+        send(conn->fd, response, sizeof(response) - 1, MSG_NOSIGNAL) < 0)
+      appendStringInfoString(&conn->output, response);
+  }
+
+  if (chunked) {
+    conn->state = HTTP_STATE_CHUNK_SIZE;
+  } else {
+    conn->state = HTTP_STATE_BODY;
+    conn->remaining = content_length;
+  }
+  return true;
+}
+
+/**
+ * Move body data from the input buffer to the body buffer.
+ *
+ * @returns true if all remaining bytes of the body or chunk were
+ * read.
+ */
+static bool ReadBody(HttpConn *conn) {
+  StringInfo input = &conn->input;
+  const size_t bytes =
+      Min((size_t)(input->len - input->cursor), conn->remaining);
+
+  appendBinaryStringInfo(&conn->body, input->data + input->cursor, bytes);
+  input->cursor += bytes;
+  conn->remaining -= bytes;
+  return conn->remaining == 0;
+}
+
+/**
+ * Parse a chunk size line.
+ *
+ * Chunk extensions are ignored.
+ *
+ * @retval true Line was parsed and state updated.
+ * @retval false Line is not complete, or the connection is closing.
+ */
+static bool ParseChunkSize(HttpConn *conn) {
+  char *endptr;
+  long size;
+  char *line = NextLine(conn);
+
+  if (line == NULL) {
+    if (conn->input.len - conn->input.cursor > HTTP_MAX_HEADER_SIZE)
+      HttpConnAbort(conn, 400, "malformed chunk size");
+    return false;
+  }
+
+  errno = 0;
+  size = strtol(line, &endptr, 16);
+  if (errno != 0 || endptr == line || size < 0 ||
+      (*endptr != '\0' && *endptr != ';' && !isspace((unsigned char)*endptr))) {
+    HttpConnAbort(conn, 400, "malformed chunk size");
+    return false;
+  }
+
+  if (conn->body.len + size > InfluxMaxBodySize) {
+    HttpConnAbort(conn, 413, "request body too large");
+    return false;
+  }
+
+  if (size == 0) {
+    conn->state = HTTP_STATE_TRAILER;
+  } else {
+    conn->state = HTTP_STATE_CHUNK_DATA;
+    conn->remaining = size;
+  }
+  return true;
+}
+
+/**
+ * Decompress the body of the request.
+ *
+ * The decompressed body is limited to the same size as the body to
+ * protect against decompression bombs.
+ *
+ * @returns true on success, false if the body could not be
+ * decompressed, in which case a response has been buffered.
+ */
+static bool InflateBody(HttpConn *conn, StringInfo decoded) {
+#ifdef HAVE_LIBZ
+  z_stream stream;
+  int ret;
+
+  memset(&stream, 0, sizeof(stream));
+  /* Adding 32 to the window bits enables automatic detection of gzip
+   * and zlib headers. */
+  if (inflateInit2(&stream, 15 + 32) != Z_OK) {
+    HttpConnRespond(conn, 500, "could not initialize decompression");
+    return false;
+  }
+
+  initStringInfo(decoded);
+  stream.next_in = (Bytef *)conn->body.data;
+  stream.avail_in = conn->body.len;
+
+  do {
+    size_t room;
+
+    if (decoded->len > InfluxMaxBodySize) {
+      inflateEnd(&stream);
+      HttpConnRespond(conn, 413, "decompressed request body too large");
+      return false;
+    }
+
+    enlargeStringInfo(decoded, HTTP_READ_SIZE);
+    room = decoded->maxlen - decoded->len - 1;
+    stream.next_out = (Bytef *)decoded->data + decoded->len;
+    stream.avail_out = room;
+    ret = inflate(&stream, Z_NO_FLUSH);
+    decoded->len += room - stream.avail_out;
+
+    /* Since there is always room in the output buffer, a buffer error
+     * means that the input ended before the end of the stream. */
+    if (ret != Z_OK && ret != Z_STREAM_END) {
+      inflateEnd(&stream);
+      HttpConnRespond(conn, 400,
+                      ret == Z_BUF_ERROR ? "unexpected end of gzip data"
+                                         : "invalid gzip data");
+      return false;
+    }
+  } while (ret != Z_STREAM_END);
+
+  inflateEnd(&stream);
+  decoded->data[decoded->len] = '\0';
+  return true;
+#else
+  HttpConnRespond(conn, 415, "gzip encoding not supported by server");
+  return false;
+#endif
+}
+
+/**
+ * Finish reading a request.
+ *
+ * @returns The write request, or NULL if this was not a write request
+ * or the body could not be decoded.
+ */
+static HttpRequest *FinishRequest(HttpConn *conn) {
+  HttpRequest *request = &conn->request;
+
+  conn->state = HTTP_STATE_HEADER;
+
+  if (!conn->write)
+    return NULL;
+
+  if (conn->gzip) {
+    StringInfoData decoded;
+    if (!InflateBody(conn, &decoded))
+      return NULL;
+    request->body = decoded.data;
+    request->bytes = decoded.len;
+  } else {
+    request->body = conn->body.data;
+    request->bytes = conn->body.len;
+  }
+
+  return request;
+}
+
+/**
+ * Get the next write request from the connection.
+ *
+ * Parse as much as possible of the input buffer and return when a
+ * complete write request has been read. Other requests are answered
+ * directly and parsing continues with the next request.
+ *
+ * The request and the body are valid until the next call to this
+ * function.
+ *
+ * @returns The next write request, or NULL if there are no more
+ * complete requests in the input buffer.
+ */
+HttpRequest *HttpConnNextRequest(HttpConn *conn) {
+  MemoryContext oldcontext = CurrentMemoryContext;
+  HttpRequest *request = NULL;
+
+  while (request == NULL && conn->state != HTTP_STATE_CLOSING) {
+    char *line;
+
+    switch (conn->state) {
+      case HTTP_STATE_HEADER:
+        if (!ParseHeader(conn))
+          goto done;
+        break;
+
+      case HTTP_STATE_BODY:
+        if (!ReadBody(conn))
+          goto done;
+        request = FinishRequest(conn);
+        break;
+
+      case HTTP_STATE_CHUNK_SIZE:
+        if (!ParseChunkSize(conn))
+          goto done;
+        break;
+
+      case HTTP_STATE_CHUNK_DATA:
+        if (!ReadBody(conn))
+          goto done;
+        conn->state = HTTP_STATE_CHUNK_END;
+        break;
+
+      case HTTP_STATE_CHUNK_END:
+        if ((line = NextLine(conn)) == NULL)
+          goto done;
+        if (*line != '\0') {
+          HttpConnAbort(conn, 400, "malformed chunk");
+          goto done;
+        }
+        conn->state = HTTP_STATE_CHUNK_SIZE;
+        break;
+
+      case HTTP_STATE_TRAILER:
+        /* Trailer fields are ignored, so we just look for the empty
+         * line that ends the request. */
+        if ((line = NextLine(conn)) == NULL)
+          goto done;
+        if (*line == '\0')
+          request = FinishRequest(conn);
+        break;
+
+      case HTTP_STATE_CLOSING:
+        break;
+    }
+  }
+
+done:
+  MemoryContextSwitchTo(oldcontext);
+  return request;
+}
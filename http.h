@@ -0,0 +1,122 @@
+/*
+ * Copyright 2022 Timescale Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Module implementing the InfluxDB HTTP write API.
+ *
+ * The module reads HTTP/1.1 requests from a connection and returns
+ * write requests with a decoded body to the caller, which is
+ * responsible for inserting the lines and responding to the
+ * request. Other requests are answered directly by the module.
+ *
+ * Responses are buffered and only sent when `HttpConnFlush` is
+ * called, which allows the caller to respond only after the
+ * transaction that wrote the lines has committed.
+ *
+ * Both the v1 API (`/write`) and the v2 API (`/api/v2/write`) are
+ * supported.
+ */
+
+#ifndef HTTP_H_
+#define HTTP_H_
+
+#include <postgres.h>
+
+#include <lib/stringinfo.h>
+
+#include <stdbool.h>
+
+/**
+ * Parse state for a connection.
+ */
+typedef enum HttpState {
+  HTTP_STATE_HEADER,
+  HTTP_STATE_BODY,
+  HTTP_STATE_CHUNK_SIZE,
+  HTTP_STATE_CHUNK_DATA,
+  HTTP_STATE_CHUNK_END,
+  HTTP_STATE_TRAILER,
+  HTTP_STATE_CLOSING,
+} HttpState;
+
+/**
+ * A write request.
+ */
+typedef struct HttpRequest {
+  /** Database (v1) or bucket (v2) parameter, or NULL if not given */
+  char *database;
+
+  /** Precision parameter, or NULL if not given */
+  char *precision;
+
+  /** Decoded body, null-terminated */
+  char *body;
+
+  /** Number of bytes in the decoded body */
+  size_t bytes;
+} HttpRequest;
+
+/**
+ * HTTP connection.
+ */
+typedef struct HttpConn {
+  /** Socket for the connection */
+  int fd;
+
+  /** Memory context for the connection */
+  MemoryContext context;
+
+  /** Memory context for the current request, reset for each request */
+  MemoryContext request_context;
+
+  /** Parse state */
+  HttpState state;
+
+  /** Data read from the socket, with `cursor` at the first unparsed byte */
+  StringInfoData input;
+
+  /** Body of the current request, before decoding */
+  StringInfoData body;
+
+  /** Buffered responses */
+  StringInfoData output;
+
+  /** Remaining bytes of body or chunk */
+  size_t remaining;
+
+  /** Current request is a write request */
+  bool write;
+
+  /** Body of current request is gzip-compressed */
+  bool gzip;
+
+  /** Close the connection after sending the buffered responses */
+  bool close;
+
+  /** Parameters of the current request */
+  HttpRequest request;
+} HttpConn;
+
+extern int InfluxMaxBodySize;
+
+extern HttpConn *HttpConnCreate(int fd);
+extern void HttpConnClose(HttpConn *conn);
+extern bool HttpConnRead(HttpConn *conn);
+extern HttpRequest *HttpConnNextRequest(HttpConn *conn);
+extern void HttpConnRespond(HttpConn *conn, int status, const char *message);
+extern bool HttpConnFlush(HttpConn *conn);
+
+#endif /* HTTP_H_ */
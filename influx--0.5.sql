@@ -0,0 +1,96 @@
+-- complain if script is sourced in psql, rather than via CREATE EXTENSION
+\echo Use "CREATE EXTENSION influx" to load this file. \quit
+
+-- Launch a new worker that listens on a port and writes to a namespace
+CREATE FUNCTION worker_launch(ns regnamespace, service text)
+RETURNS integer
+LANGUAGE C AS '$libdir/influx.so';
+
+CREATE FUNCTION worker_launch(service text)
+RETURNS integer
+LANGUAGE C AS '$libdir/influx.so';
+
+-- Launch a new worker that listens on a port using a specific protocol
+CREATE FUNCTION worker_launch(ns regnamespace, service text, protocol text)
+RETURNS integer
+LANGUAGE C AS '$libdir/influx.so';
+
+-- Send a packet over UDP to a host and service
+CREATE PROCEDURE send_packet(packet text, service text, hostname text = 'localhost')
+LANGUAGE C AS '$libdir/influx.so';
+
+-- Send a request over TCP to a host and service and return the status
+-- line of the response
+CREATE FUNCTION send_request(request text, service text, hostname text = 'localhost')
+RETURNS text
+LANGUAGE C AS '$libdir/influx.so';
+
+-- Parse InfluxDB Line Protocol packet
+CREATE FUNCTION parse_influx(text)
+RETURNS TABLE (_metric text, _time timestamp, _tags jsonb, _fields jsonb)
+LANGUAGE C AS '$libdir/influx.so';
+
+CREATE FUNCTION _create("metric" name, "tags" name[], "fields" name[])
+RETURNS regclass
+LANGUAGE C AS '$libdir/influx.so', 'default_create';
+
+-- Listeners served by catalog workers. The workers read the table when
+-- they start and when the configuration is reloaded.
+CREATE TABLE influx_listener (
+    id serial PRIMARY KEY,
+    address text,
+    service text NOT NULL,
+    protocol text NOT NULL DEFAULT 'udp'
+        CHECK (protocol IN ('udp', 'tcp', 'http')),
+    schema name NOT NULL,
+    role name,
+    precision text NOT NULL DEFAULT 'ns'
+        CHECK (precision IN ('ns', 'us', 'ms', 's', 'm', 'h')),
+    enabled boolean NOT NULL DEFAULT true
+);
+
+SELECT pg_catalog.pg_extension_config_dump('influx_listener', '');
+SELECT pg_catalog.pg_extension_config_dump('influx_listener_id_seq', '');
+
+-- Launch a new worker that serves the listeners in influx_listener
+CREATE FUNCTION listener_launch()
+RETURNS integer
+LANGUAGE C AS '$libdir/influx.so';
+
+REVOKE ALL ON FUNCTION listener_launch() FROM PUBLIC;
+
+-- Statistics for the workers, kept in shared memory
+CREATE FUNCTION influx_stat_get_workers(
+    OUT pid integer, OUT kind text, OUT protocol text, OUT schema text,
+    OUT service text, OUT started timestamptz, OUT load integer,
+    OUT spool_bytes bigint,
+    OUT datagrams bigint, OUT bytes bigint, OUT lines bigint,
+    OUT parse_errors bigint, OUT insert_errors bigint,
+    OUT rows_inserted bigint, OUT tables_created bigint,
+    OUT rejected_lines bigint, OUT commits bigint,
+    OUT spooled bigint, OUT replayed bigint, OUT shed_lines bigint,
+    OUT series_hits bigint, OUT series_misses bigint,
+    OUT receive_time double precision, OUT parse_time double precision,
+    OUT insert_time double precision, OUT commit_time double precision,
+    OUT spin_time double precision,
+    OUT stats_reset timestamptz)
+RETURNS SETOF record
+LANGUAGE C AS '$libdir/influx.so';
+
+CREATE VIEW influx_stat_workers AS SELECT * FROM influx_stat_get_workers();
+
+-- Latency histograms for all running workers
+CREATE FUNCTION influx_stat_get_latency(
+    OUT pid integer, OUT histogram text, OUT upper_bound double precision,
+    OUT count bigint)
+RETURNS SETOF record
+LANGUAGE C AS '$libdir/influx.so';
+
+CREATE VIEW influx_stat_latency AS SELECT * FROM influx_stat_get_latency();
+
+-- Reset the statistics for all workers
+CREATE FUNCTION influx_stat_reset()
+RETURNS void
+LANGUAGE C AS '$libdir/influx.so';
+
+REVOKE ALL ON FUNCTION influx_stat_reset() FROM PUBLIC;
@@ -34,7 +34,17 @@
 #include <stdbool.h>
 #include <string.h>
 
+#include "admission.h"
+#include "cache.h"
+#include "http.h"
 #include "ingest.h"
+#include "insert.h"
+#include "metric.h"
+#include "network.h"
+#include "series.h"
+#include "spool.h"
+#include "stats.h"
+#include "supervisor.h"
 #include "worker.h"
 
 PG_MODULE_MAGIC;
@@ -44,19 +54,22 @@ PG_FUNCTION_INFO_V1(parse_influx);
 void PGDLLEXPORT _PG_init(void);
 
 /** Number of Influx protocol workers. */
-static int InfluxWorkersCount;
+int InfluxWorkersCount;
 
 /** Service name to listen on. */
 static char *InfluxServiceName;
 
+/** Protocol to use for the service. */
+static int InfluxProtocol;
+
 /** Schema name to use for metrics. */
-static char *InfluxSchemaName;
+char *InfluxSchemaName;
 
 /** Database name to work with. */
-static char *InfluxDatabaseName;
+char *InfluxDatabaseName;
 
 /** Role name to use when connecting to the database. */
-static char *InfluxRoleName;
+char *InfluxRoleName;
 
 /** Parser state setup. */
 IngestState *ParseInfluxSetup(char *buffer) {
@@ -65,6 +78,16 @@ IngestState *ParseInfluxSetup(char *buffer) {
   return state;
 }
 
+/**
+ * State of `parse_influx` between calls.
+ */
+typedef struct ParseInfluxState {
+  IngestState *ingest;
+
+  /** Description of the result, used to build the tuples */
+  MetricTable table;
+} ParseInfluxState;
+
 /**
  * Parse one line of data from the parser state and store it as a heap tuple
  * with the columns:
@@ -75,34 +98,29 @@ IngestState *ParseInfluxSetup(char *buffer) {
  * 4. The fields as a JSONB value
  *
  * @param state Parser state, with line information.
- * @param tupdesc Tuple descriptor for the data.
+ * @param table Description of the result columns.
  * @returns tuple Heap tuple
  */
-static HeapTuple ParseInfluxNextTuple(IngestState *state,
-                                      AttInMetadata *attinmeta) {
-  int metric_attnum;
+static HeapTuple ParseInfluxNextTuple(IngestState *state, MetricTable table) {
   Datum *values;
   bool *nulls;
-  Oid *argtypes;
-  TupleDesc tupdesc = attinmeta->tupdesc;
+  TupleDesc tupdesc = table->attinmeta->tupdesc;
 
   nulls = (bool *)palloc0(tupdesc->natts * sizeof(bool));
   values = (Datum *)palloc0(tupdesc->natts * sizeof(Datum));
-  argtypes = (Oid *)palloc0(tupdesc->natts * sizeof(Oid));
 
   /* Read lines until we find one that can be used. If none are found, we're
    * done. */
   do {
     if (!IngestReadNextLine(state))
       return NULL;
-  } while (!CollectValues(&state->metric, attinmeta, argtypes, values, nulls));
+  } while (!CollectValues(&state->metric, table, values, nulls, NULL));
 
   /* This assumes that the metric is a text column. We should probably add a
    * check here, or call the input function for the column type. */
-  metric_attnum = SPI_fnumber(tupdesc, "_metric");
-  if (metric_attnum > 0) {
-    values[metric_attnum - 1] = CStringGetTextDatum(state->metric.name);
-    nulls[metric_attnum - 1] = false;
+  if (table->metric_attnum > 0) {
+    values[table->metric_attnum - 1] = CStringGetTextDatum(state->metric.name);
+    nulls[table->metric_attnum - 1] = false;
   }
 
   return heap_form_tuple(tupdesc, values, nulls);
@@ -114,7 +132,7 @@ static HeapTuple ParseInfluxNextTuple(IngestState *state,
 Datum parse_influx(PG_FUNCTION_ARGS) {
   HeapTuple tuple;
   FuncCallContext *funcctx;
-  IngestState *state;
+  ParseInfluxState *state;
 
   if (SRF_IS_FIRSTCALL()) {
     TupleDesc tupdesc;
@@ -127,9 +145,11 @@ Datum parse_influx(PG_FUNCTION_ARGS) {
       ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
                       errmsg("function returning record called in context "
                              "that cannot accept type record")));
-    funcctx->attinmeta = TupleDescGetAttInMetadata(tupdesc);
-    funcctx->user_fctx =
-        ParseInfluxSetup(text_to_cstring(PG_GETARG_TEXT_PP(0)));
+    state = palloc(sizeof(ParseInfluxState));
+    state->ingest = ParseInfluxSetup(text_to_cstring(PG_GETARG_TEXT_PP(0)));
+    state->table = palloc0(sizeof(MetricTableData));
+    MetricTableDescribe(state->table, tupdesc);
+    funcctx->user_fctx = state;
 
     MemoryContextSwitchTo(oldcontext);
   }
@@ -137,68 +157,323 @@ Datum parse_influx(PG_FUNCTION_ARGS) {
   funcctx = SRF_PERCALL_SETUP();
   state = funcctx->user_fctx;
 
-  tuple = ParseInfluxNextTuple(state, funcctx->attinmeta);
+  tuple = ParseInfluxNextTuple(state->ingest, state->table);
   if (tuple == NULL)
     SRF_RETURN_DONE(funcctx);
 
   SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
 }
 
-static void StartBackgroundWorkers(const char *database_name,
-                                   const char *schema_name,
-                                   const char *role_name,
-                                   const char *service_name, int worker_count) {
+/* Show the socket permissions in octal, the same way as
+ * unix_socket_permissions. */
+static const char *ShowUnixSocketPermissions(void) {
+  static char buf[12];
+  snprintf(buf, sizeof(buf), "%04o", InfluxUnixSocketPermissions);
+  return buf;
+}
+
+/* The service name is passed to the workers in a fixed-size field, so
+ * check that it fits. */
+static bool CheckServiceName(char **newval, void **extra, GucSource source) {
+  const size_t maxlen = sizeof(((WorkerArgs *)NULL)->service) - 1;
+  if (*newval && strlen(*newval) > maxlen) {
+    GUC_check_errdetail("Service names can be at most %zu characters.",
+                        maxlen);
+    return false;
+  }
+  return true;
+}
+
+/* The workers use the database, role, and schema from the
+ * configuration, so only the service is passed in the arguments. */
+static void StartBackgroundWorkers(const char *service_name, int protocol) {
   MemoryContext oldcontext = MemoryContextSwitchTo(TopMemoryContext);
   WorkerArgs args = {0};
-  int i;
   BackgroundWorker worker;
 
-  if (schema_name)
-    strncpy(args.namespace, schema_name, sizeof(args.namespace));
-  if (database_name)
-    strncpy(args.database, database_name, sizeof(args.database));
-  if (role_name)
-    strncpy(args.role, role_name, sizeof(args.role));
   if (service_name)
     strncpy(args.service, service_name, sizeof(args.service));
 
-  elog(LOG, "starting influx workers");
+  elog(LOG, "starting influx supervisor");
 
-  InfluxWorkerInit(&worker, &args);
-  elog(LOG, "memory allocated in %s memory context",
-       CurrentMemoryContext->name);
-  for (i = 0; i < worker_count; i++)
-    RegisterBackgroundWorker(&worker);
-  elog(LOG, "background workers started");
+  /* The supervisor launches the workers and keeps the number of
+   * workers between influx.workers and influx.max_workers. */
+  InfluxSupervisorInit(&worker, &args, protocol);
+  RegisterBackgroundWorker(&worker);
   MemoryContextSwitchTo(oldcontext);
 }
 
 void _PG_init(void) {
   DefineCustomIntVariable("influx.workers",     /* option name */
                           "Number of workers.", /* short descriptor */
-                          "Number of workers to spawn when starting up"
-                          "the server.",       /* long description */
+                          "Minimum number of workers, which are started"
+                          " with the server. The supervisor adds workers"
+                          " up to influx.max_workers when the load is"
+                          " high.",            /* long description */
                           &InfluxWorkersCount, /* value address */
                           4,                   /* boot value */
                           0,                   /* min value */
-                          20,                  /* max value */
+                          1024,                /* max value */
                           PGC_SIGHUP,          /* option context */
                           0,                   /* option flags */
                           NULL,                /* check hook */
                           NULL,                /* assign hook */
                           NULL);               /* show hook */
 
+  DefineCustomIntVariable(
+      "influx.receive_batch_size", "Number of datagrams to read at once.",
+      "Maximum number of datagrams that a worker reads from the socket with"
+      " a single system call. Each datagram has a pre-allocated buffer.",
+      &InfluxReceiveBatchSize, 32, 1, 1024, PGC_SIGHUP, 0, NULL, NULL, NULL);
+  DefineCustomIntVariable(
+      "influx.receive_buffer_size", "Size of each receive buffer.",
+      "Maximum size of a datagram that can be received without being"
+      " truncated. Lines that do not fit in the buffer are dropped.",
+      &InfluxReceiveBufferSize, 65535, 1024, 1024 * 1024, PGC_SIGHUP,
+      GUC_UNIT_BYTE, NULL, NULL, NULL);
+  DefineCustomIntVariable(
+      "influx.socket_buffer_size", "Size of the socket receive buffer.",
+      "Size of the kernel receive buffer for the socket, which decides how"
+      " large bursts can be absorbed before datagrams are dropped. Zero"
+      " means that the system default is used. Only affects workers started"
+      " after the change.",
+      &InfluxSocketBufferSize, 0, 0, INT_MAX, PGC_SIGHUP, GUC_UNIT_BYTE, NULL,
+      NULL, NULL);
+  DefineCustomIntVariable(
+      "influx.max_connections", "Maximum number of connections per worker.",
+      "Maximum number of open connections for each worker using a stream"
+      " protocol. Additional connections wait in the listen queue until a"
+      " connection is closed.",
+      &InfluxMaxConnections, 64, 1, 10000, PGC_SIGHUP, 0, NULL, NULL, NULL);
+  DefineCustomIntVariable(
+      "influx.max_body_size", "Maximum size of an HTTP request body.",
+      "Maximum size of the body of an HTTP write request, both before and"
+      " after decompression. Larger requests are rejected.",
+      &InfluxMaxBodySize, 32 * 1024 * 1024, 1024, 256 * 1024 * 1024,
+      PGC_SIGHUP, GUC_UNIT_BYTE, NULL, NULL, NULL);
+  DefineCustomIntVariable(
+      "influx.unix_socket_permissions",
+      "Access permissions of Unix domain sockets.",
+      "Permissions set on the socket file when a worker listens on a Unix"
+      " domain socket. The value is expected to be a numeric mode"
+      " specification in the form accepted by the chmod and umask system"
+      " calls.",
+      &InfluxUnixSocketPermissions, 0777, 0000, 0777, PGC_SIGHUP, 0, NULL,
+      NULL, ShowUnixSocketPermissions);
+  DefineCustomIntVariable(
+      "influx.batch_max_rows", "Maximum number of rows in a batch.",
+      "The transaction for a batch is committed when this number of rows"
+      " have been inserted. Zero means no limit.",
+      &InfluxBatchMaxRows, 0, 0, INT_MAX, PGC_SIGHUP, 0, NULL, NULL, NULL);
+  DefineCustomIntVariable(
+      "influx.batch_max_bytes", "Maximum number of bytes in a batch.",
+      "The transaction for a batch is committed when this number of bytes"
+      " of lines have been processed. Zero means no limit.",
+      &InfluxBatchMaxBytes, 0, 0, INT_MAX, PGC_SIGHUP, GUC_UNIT_BYTE, NULL,
+      NULL, NULL);
+  DefineCustomIntVariable(
+      "influx.batch_max_duration", "Maximum duration of a batch.",
+      "The transaction for a batch is committed when it has been open this"
+      " long, even if there is more data to read. Zero means no limit.",
+      &InfluxBatchMaxDuration, 1000, 0, INT_MAX, PGC_SIGHUP, GUC_UNIT_MS,
+      NULL, NULL, NULL);
+  DefineCustomIntVariable(
+      "influx.batch_flush_delay", "Time to wait for more data in a batch.",
+      "When there is no more data to read, the transaction for a batch is"
+      " kept open until this much time has passed since the batch started,"
+      " so that more lines can be added to it. Zero means that the batch is"
+      " committed as soon as there is no more data.",
+      &InfluxBatchFlushDelay, 0, 0, INT_MAX, PGC_SIGHUP, GUC_UNIT_MS, NULL,
+      NULL, NULL);
+  DefineCustomBoolVariable(
+      "influx.direct_insert", "Insert rows without insert statements.",
+      "Rows are inserted directly into the tables through the executor"
+      " when the tables allow it. If off, every row is inserted using an"
+      " insert statement.",
+      &InfluxDirectInsert, true, PGC_SIGHUP, 0, NULL, NULL, NULL);
+  DefineCustomIntVariable(
+      "influx.insert_buffer_rows",
+      "Maximum number of rows buffered for each table.",
+      "Rows inserted directly are buffered for each table and written"
+      " together when the buffer is full or the batch is committed. One"
+      " means that each row is written when it arrives.",
+      &InfluxInsertBufferRows, 1000, 1, 100000, PGC_SIGHUP, 0, NULL, NULL,
+      NULL);
+  DefineCustomIntVariable(
+      "influx.create_retry_interval",
+      "Time before creating a table for a measurement is tried again.",
+      "Lines for a measurement that a table could not be created for are"
+      " skipped until this much time has passed. Zero means that creating"
+      " the table is tried for every line.",
+      &InfluxCreateRetryInterval, 10000, 0, INT_MAX, PGC_SIGHUP, GUC_UNIT_MS,
+      NULL, NULL, NULL);
+  DefineCustomIntVariable(
+      "influx.series_cache_size", "Memory used to cache series by each worker.",
+      "Workers keep the tags of recently seen series, converted to the types"
+      " of their columns, so that the tags of further lines for the series"
+      " do not have to be parsed and converted again. Zero disables the"
+      " cache.",
+      &InfluxSeriesCacheSize, 8192, 0, MAX_KILOBYTES, PGC_SIGHUP, GUC_UNIT_KB,
+      NULL, NULL, NULL);
+  DefineCustomEnumVariable(
+      "influx.precision", "Precision of line timestamps.",
+      "Precision of timestamps for workers that are not started from the"
+      " listener catalog. HTTP requests can override it using the precision"
+      " parameter.",
+      &InfluxPrecision, PRECISION_NANOSECONDS, InfluxPrecisionOptions,
+      PGC_SIGHUP, 0, NULL, NULL, NULL);
+  DefineCustomEnumVariable(
+      "influx.receive_engine", "Engine used to receive datagrams.",
+      "Either recv, which reads batches of datagrams with system calls, or"
+      " io_uring, which lets the kernel fill a ring of buffers. Workers fall"
+      " back on recv if io_uring is not available. Only affects workers"
+      " started after the change.",
+      &InfluxReceiveEngine, ENGINE_RECV, InfluxReceiveEngineOptions,
+      PGC_SIGHUP, 0, NULL, NULL, NULL);
+  DefineCustomBoolVariable(
+      "influx.udp_gro", "Use UDP generic receive offload.",
+      "Let the kernel coalesce datagrams from the same source before they"
+      " are read by the workers. Only affects workers started after the"
+      " change.",
+      &InfluxUdpGro, false, PGC_SIGHUP, 0, NULL, NULL, NULL);
+  DefineCustomBoolVariable(
+      "influx.udp_steering", "Steer datagrams to workers by measurement.",
+      "Pick the worker that receives a datagram using a hash of the"
+      " measurement name instead of the source address, so that each table"
+      " is mostly written by one worker. Only affects workers started after"
+      " the change.",
+      &InfluxUdpSteering, false, PGC_SIGHUP, 0, NULL, NULL, NULL);
+  DefineCustomIntVariable(
+      "influx.busy_poll", "Time to busy poll for datagrams.",
+      "If non-zero, UDP workers enable busy polling on their sockets and"
+      " spin on the socket for this many microseconds before blocking, which"
+      " lowers the latency at the cost of CPU time. Zero means that workers"
+      " block as soon as there is nothing to read. Only affects the socket"
+      " options of workers started after the change.",
+      &InfluxBusyPoll, 0, 0, 1000000, PGC_SIGHUP, 0, NULL, NULL, NULL);
+  DefineCustomStringVariable(
+      "influx.cpu_affinity", "CPUs that the workers run on.",
+      "List of CPU numbers and ranges, for example 0-3,8, that workers and"
+      " inserters are pinned to. Empty means that they can run on any CPU."
+      " Only affects workers started after the change.",
+      &InfluxCpuAffinity, "", PGC_SIGHUP, 0, CheckCpuAffinity, NULL, NULL);
+  DefineCustomIntVariable(
+      "influx.inserters", "Number of inserters for each UDP worker.",
+      "If non-zero, UDP workers only receive datagrams and hand them over"
+      " to this number of inserter processes through shared memory rings."
+      " Zero means that the workers insert the lines themselves. Only"
+      " affects workers started after the change.",
+      &InfluxInserters, 0, 0, 64, PGC_SIGHUP, 0, NULL, NULL, NULL);
+  DefineCustomIntVariable(
+      "influx.ring_size", "Size of the ring for each inserter.",
+      "Size of the shared memory ring between a UDP worker and each of its"
+      " inserters, which is rounded up to a power of 2. Datagrams are"
+      " dropped when all rings are full. Only affects workers started after"
+      " the change.",
+      &InfluxRingSize, 8 * 1024 * 1024, 64 * 1024, 1024 * 1024 * 1024,
+      PGC_SIGHUP, GUC_UNIT_BYTE, NULL, NULL, NULL);
+  DefineCustomIntVariable(
+      "influx.spool_size", "Size of the spool for each UDP worker.",
+      "If non-zero, UDP workers that fall behind append datagrams to a"
+      " memory-mapped file of this size in the data directory and insert"
+      " them once they have caught up. The size is rounded up to a power"
+      " of 2. Only affects workers started after the change.",
+      &InfluxSpoolSize, 0, 0, 1024 * 1024 * 1024, PGC_SIGHUP, GUC_UNIT_BYTE,
+      NULL, NULL, NULL);
+  DefineCustomIntVariable(
+      "influx.spool_threshold", "Backlog at which datagrams are spooled.",
+      "Fill level of the socket receive buffer, or of the rings for"
+      " receivers, in percent, at which datagrams are written to the spool"
+      " instead of being inserted.",
+      &InfluxSpoolThreshold, 50, 1, 100, PGC_SIGHUP, 0, NULL, NULL, NULL);
+  DefineCustomIntVariable(
+      "influx.spool_time_budget", "Insert time at which datagrams are spooled.",
+      "If inserting one batch of datagrams, or committing it, takes longer"
+      " than this, UDP workers that insert the datagrams themselves spool"
+      " the datagrams that queued up meanwhile instead of inserting them."
+      " Zero means that only the backlog is used.",
+      &InfluxSpoolTimeBudget, 100, 0, INT_MAX, PGC_SIGHUP, GUC_UNIT_MS, NULL,
+      NULL, NULL);
+  DefineCustomIntVariable(
+      "influx.source_rate_limit", "Maximum rate of lines from a source.",
+      "Number of lines per second that each worker admits from a source"
+      " address, with bursts of up to one second worth of lines. Lines above"
+      " the limit are handled according to influx.rate_limit_policy. Zero"
+      " means no limit.",
+      &InfluxSourceRateLimit, 0, 0, INT_MAX, PGC_SIGHUP, 0, NULL, NULL, NULL);
+  DefineCustomIntVariable(
+      "influx.measurement_rate_limit",
+      "Maximum rate of lines for a measurement.",
+      "Number of lines per second that each worker admits for a measurement,"
+      " with bursts of up to one second worth of lines. Lines above the limit"
+      " are handled according to influx.rate_limit_policy. Zero means no"
+      " limit.",
+      &InfluxMeasurementRateLimit, 0, 0, INT_MAX, PGC_SIGHUP, 0, NULL, NULL,
+      NULL);
+  DefineCustomEnumVariable(
+      "influx.rate_limit_policy", "What to do with lines above the limits.",
+      "Either drop, which drops the lines, sample, which admits one in"
+      " influx.rate_limit_sample of the lines, or spool, which defers the"
+      " lines to a separate spool of UDP workers and admits them again"
+      " later, and drops them if influx.spool_size is 0 or it is full.",
+      &InfluxRateLimitPolicy, ADMISSION_DROP, InfluxRateLimitPolicyOptions,
+      PGC_SIGHUP, 0, NULL, NULL, NULL);
+  DefineCustomIntVariable(
+      "influx.rate_limit_sample", "Sampling rate for lines above the limits.",
+      "When influx.rate_limit_policy is sample, one in this many lines above"
+      " the limits is admitted.",
+      &InfluxRateLimitSample, 10, 1, INT_MAX, PGC_SIGHUP, 0, NULL, NULL, NULL);
+  DefineCustomStringVariable(
+      "influx.rate_limit_exempt", "Measurements that are not rate limited.",
+      "Comma-separated list of measurement names whose lines are always"
+      " admitted and do not count against the limit of their source.",
+      &InfluxRateLimitExempt, "", PGC_SIGHUP, GUC_LIST_INPUT,
+      CheckRateLimitExempt, NULL, NULL);
+  DefineCustomIntVariable(
+      "influx.max_workers", "Maximum number of workers.",
+      "Maximum number of workers that the supervisor starts when the load"
+      " of the workers is high. Zero, or a value below influx.workers, means"
+      " that the number of workers is not scaled.",
+      &InfluxMaxWorkers, 0, 0, 1024, PGC_SIGHUP, 0, NULL, NULL, NULL);
+  DefineCustomIntVariable(
+      "influx.scale_interval", "Time between checks of the worker load.",
+      "The supervisor checks the load of the workers, adds or retires at"
+      " most one worker, and restarts workers that exited at this interval.",
+      &InfluxScaleInterval, 10000, 1000, INT_MAX, PGC_SIGHUP, GUC_UNIT_MS,
+      NULL, NULL, NULL);
+  DefineCustomIntVariable(
+      "influx.scale_up_load", "Worker load that adds a worker.",
+      "Average load of the workers, in percent, at which the supervisor"
+      " starts another worker. The load is the fraction of time a worker"
+      " is busy, or how full its socket buffer is if that is higher.",
+      &InfluxScaleUpLoad, 80, 1, 100, PGC_SIGHUP, 0, NULL, NULL, NULL);
+  DefineCustomIntVariable(
+      "influx.scale_down_load", "Worker load that retires a worker.",
+      "Average load of the workers, in percent, below which the supervisor"
+      " retires a worker, provided that the load of the remaining workers"
+      " also stays below this value.",
+      &InfluxScaleDownLoad, 30, 0, 100, PGC_SIGHUP, 0, NULL, NULL, NULL);
+
   if (!process_shared_preload_libraries_in_progress)
     return;
 
+  StatsShmemInit();
+
   /* Right now we have only UDP supported, so we use 8089. If we decide to
    * support more protocols, we should dynamically pick the default based on the
    * protocol. */
   DefineCustomStringVariable(
       "influx.service", "Service name.",
       "Service name to listen on, or port number. If it is a service name, it"
-      " will be looked up.If it is a port, it will be used as it is.",
-      &InfluxServiceName, "8089", PGC_POSTMASTER, 0, NULL, NULL, NULL);
+      " will be looked up.If it is a port, it will be used as it is. If it"
+      " starts with unix://, the rest is the path of a Unix domain socket.",
+      &InfluxServiceName, "8089", PGC_POSTMASTER, 0, CheckServiceName, NULL,
+      NULL);
+  DefineCustomEnumVariable(
+      "influx.protocol", "Protocol to use.",
+      "Protocol that the workers use to receive lines on the service.",
+      &InfluxProtocol, PROTOCOL_UDP, InfluxProtocolOptions, PGC_POSTMASTER, 0,
+      NULL, NULL, NULL);
   DefineCustomStringVariable(
       "influx.database", "Database name.", "Database name to connect to.",
       &InfluxDatabaseName, NULL, PGC_POSTMASTER, 0, NULL, NULL, NULL);
@@ -212,13 +487,18 @@ void _PG_init(void) {
       "Schema name to use for the workers. This is where the measurement"
       " tables should be placed.",
       &InfluxSchemaName, NULL, PGC_POSTMASTER, 0, NULL, NULL, NULL);
+  DefineCustomBoolVariable(
+      "influx.listener_catalog", "Serve the listeners in the catalog.",
+      "If on, the workers serve all listeners in the influx_listener table"
+      " of influx.database instead of listening on influx.service, and"
+      " read the table again when the configuration is reloaded.",
+      &InfluxListenerCatalog, false, PGC_POSTMASTER, 0, NULL, NULL, NULL);
 
   elog(LOG,
        "InfluxDatabaseName: %s, InfluxSchemaName: %s, InfluxServiceName: %s, "
-       "InfluxRoleName: %s, InfluxWorkersCount: %d",
-       InfluxDatabaseName, InfluxSchemaName, InfluxServiceName, InfluxRoleName,
-       InfluxWorkersCount);
+       "InfluxProtocol: %s, InfluxRoleName: %s, InfluxWorkersCount: %d",
+       InfluxDatabaseName, InfluxSchemaName, InfluxServiceName,
+       ProtocolName(InfluxProtocol), InfluxRoleName, InfluxWorkersCount);
 
-  StartBackgroundWorkers(InfluxDatabaseName, InfluxSchemaName, InfluxRoleName,
-                         InfluxServiceName, InfluxWorkersCount);
+  StartBackgroundWorkers(InfluxServiceName, InfluxProtocol);
 }
@@ -29,6 +29,11 @@
 
 #include "ingest.h"
 
+extern int InfluxWorkersCount;
+extern char *InfluxSchemaName;
+extern char *InfluxDatabaseName;
+extern char *InfluxRoleName;
+
 IngestState *ParseInfluxSetup(char *buffer);
 Jsonb *BuildJsonObject(List *items);
 
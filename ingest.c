@@ -27,7 +27,9 @@
 #include <stdlib.h>
 #include <string.h>
 
-enum state { ST_BEG, ST_NUM, ST_DEC, ST_INT, ST_STR };
+#include "series.h"
+
+enum state { ST_BEG, ST_SGN, ST_NUM, ST_DEC, ST_INT, ST_STR };
 
 static bool isident(char ch) {
   return isalnum(ch) || ch == '_' || ch == '-';
@@ -100,6 +102,22 @@ static char *ReadIdent(IngestState *state) {
   return begin;
 }
 
+/**
+ * Check if a bare value is one of the boolean literals of the line
+ * protocol.
+ */
+static bool IsBoolean(const char *str, size_t len) {
+  static const char *const literals[] = {
+      "t", "T", "true", "True", "TRUE", "f", "F", "false", "False", "FALSE",
+  };
+  int i;
+
+  for (i = 0; i < lengthof(literals); ++i)
+    if (strlen(literals[i]) == len && memcmp(str, literals[i], len) == 0)
+      return true;
+  return false;
+}
+
 /**
  * Read a string.
  *
@@ -144,11 +162,13 @@ static char *ReadValue(IngestState *state, Type *ptype) {
     else if (!was_quoted && (isspace(*rptr) || *rptr == ','))
       break;
 
-    if (st == ST_NUM && *rptr == 'i')
+    if (st == ST_BEG && *rptr == '-')
+      st = ST_SGN;
+    else if (st == ST_NUM && *rptr == 'i')
       st = ST_INT;
     else if (st == ST_NUM && *rptr == '.')
       st = ST_DEC;
-    else if (st == ST_BEG || st == ST_NUM)
+    else if (st == ST_BEG || st == ST_SGN || st == ST_NUM)
       st = isdigit(*rptr) ? ST_NUM : ST_STR;
     else if (st == ST_INT)
       st = ST_STR;
@@ -183,7 +203,14 @@ static char *ReadValue(IngestState *state, Type *ptype) {
         *ptype = TYPE_FLOAT;
         break;
       case ST_STR:
+        /* Quoted values are always strings. */
+        if (!was_quoted && IsBoolean(begin, wptr - begin))
+          *ptype = TYPE_BOOLEAN;
+        else
+          *ptype = TYPE_STRING;
+        break;
       case ST_BEG:
+      case ST_SGN:
         *ptype = TYPE_STRING;
         break;
     }
@@ -228,6 +255,58 @@ static List *ParserReadItemList(IngestState *state, bool typed) {
   return items;
 }
 
+/**
+ * Find the end of the tag set that starts at the current position.
+ *
+ * The tag set ends at the first blank that is not escaped. Quoted
+ * values are not treated specially, so for tag sets with blanks in
+ * quoted values, the end found here is not where the parser stops.
+ */
+static char *FindTagSetEnd(IngestState *state) {
+  char *ptr = state->current;
+  while (*ptr && !isspace(*ptr)) {
+    if (*ptr == '\\' && ptr[1])
+      ++ptr;
+    ++ptr;
+  }
+  return ptr;
+}
+
+/**
+ * Read the tags of a line, using the series cache if enabled.
+ *
+ * If the measurement and the raw tag set of the line are in the
+ * cache, the tags are not parsed at all and the parser state is moved
+ * past them. Otherwise, the tag set is copied before it is parsed,
+ * since parsing modifies the line buffer, and added to the cache once
+ * it has been parsed.
+ *
+ * @param state Parser state
+ */
+static void ReadTags(IngestState *state) {
+  char *const begin = state->current;
+  char *end, *tagset;
+
+  if (!state->series) {
+    state->metric.tags = ParserReadItemList(state, false);
+    return;
+  }
+
+  end = FindTagSetEnd(state);
+  state->metric.series = SeriesLookup(state->metric.name, begin, end - begin);
+  if (state->metric.series) {
+    state->current = end;
+    return;
+  }
+
+  tagset = pnstrdup(begin, end - begin);
+  state->metric.tags = ParserReadItemList(state, false);
+  if (state->current == end)
+    state->metric.series = SeriesAdd(state->metric.name, tagset, end - begin,
+                                     state->metric.tags);
+  pfree(tagset);
+}
+
 /**
  * Parse a line in Influx line format.
  *
@@ -242,6 +321,7 @@ bool IngestReadNextLine(IngestState *state) {
   char *name;
   state->metric.timestamp = NULL;
   state->metric.tags = NIL;
+  state->metric.series = NULL;
   state->metric.fields = NIL;
 
   name = ReadIdent(state);
@@ -249,11 +329,29 @@ bool IngestReadNextLine(IngestState *state) {
     return false;
   state->metric.name = name;
   if (CheckNextChar(state, ','))
-    state->metric.tags = ParserReadItemList(state, false);
+    ReadTags(state);
   ExpectNextChar(state, ' ');
   state->metric.fields = ParserReadItemList(state, true);
-  ExpectNextChar(state, ' ');
-  state->metric.timestamp = ReadValue(state, NULL);
+  if (CheckNextChar(state, ' '))
+    state->metric.timestamp = ReadValue(state, NULL);
   CheckNextChar(state, '\n');
   return true;
 }
+
+/**
+ * Skip the rest of the current line.
+ *
+ * This is used to recover after a parse error so that the following
+ * lines in the buffer can still be read. The parser state will point
+ * to the beginning of the next line, or to the end of the buffer if
+ * there are no more lines.
+ *
+ * @param state Parser state
+ */
+void IngestSkipLine(IngestState *state) {
+  char *end = strchr(state->current, '\n');
+  if (end)
+    state->current = end + 1;
+  else
+    state->current += strlen(state->current);
+}
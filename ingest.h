@@ -42,9 +42,13 @@ typedef struct IngestState {
 
   /** Metric resulting from the parse. */
   Metric metric;
+
+  /** Look up the tags of lines in the series cache */
+  bool series;
 } IngestState;
 
 void IngestStateInit(IngestState *state, char *line);
 bool IngestReadNextLine(IngestState *state);
+void IngestSkipLine(IngestState *state);
 
 #endif /* INGEST_H_ */
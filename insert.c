@@ -0,0 +1,464 @@
+/*
+ * Copyright 2022 Timescale Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "insert.h"
+
+#include <postgres.h>
+
+#include <access/heapam.h>
+#include <access/table.h>
+#include <access/tableam.h>
+#include <access/tupconvert.h>
+#include <access/xact.h>
+#include <catalog/pg_class.h>
+#include <commands/trigger.h>
+#include <executor/execPartition.h>
+#include <executor/executor.h>
+#include <miscadmin.h>
+#if PG_VERSION_NUM >= 160000
+#include <parser/parse_relation.h>
+#endif
+#include <utils/acl.h>
+#include <utils/memutils.h>
+#include <utils/rls.h>
+
+/* Maximum number of tables with buffered rows. When rows for more
+ * tables arrive, all buffers are flushed. This is the same limit as
+ * COPY uses for partitions. */
+#define INSERT_MAX_BUFFERS 32
+
+/** Insert rows directly instead of using insert statements. */
+bool InfluxDirectInsert = true;
+
+/** Maximum number of rows buffered for each table. */
+int InfluxInsertBufferRows = 1000;
+
+/**
+ * Insert state for one table.
+ *
+ * For partitioned tables, the rows are routed to the buffers of the
+ * partitions, so the buffer has no slots of its own.
+ */
+typedef struct InsertBuffer {
+  /** Table the rows are inserted into */
+  Oid relid;
+
+  /** Role the rows are inserted as */
+  Oid userid;
+
+  /** False if rows for the table cannot be inserted directly */
+  bool supported;
+
+  /** Table, which is kept open until the buffer is freed */
+  Relation rel;
+
+  EState *estate;
+  ResultRelInfo *rri;
+  BulkInsertState bistate;
+
+  /** Tuple routing for partitioned tables, otherwise NULL */
+  PartitionTupleRouting *proute;
+  ModifyTableState *mtstate;
+
+  /** Slot used to find the partition of a row */
+  TupleTableSlot *route_slot;
+
+  /** Partitioned table that `map` converts rows from */
+  Oid map_relid;
+
+  /** Conversion of rows from that table, or NULL if not needed */
+  TupleConversionMap *map;
+
+  /** Slots for the rows, which are created when first used */
+  TupleTableSlot **slots;
+
+  /** Number of slots */
+  int size;
+
+  /** Number of rows in the buffer */
+  int count;
+} InsertBuffer;
+
+static MemoryContext InsertBufferContext = NULL;
+static InsertBuffer *Buffers[INSERT_MAX_BUFFERS];
+static int NumBuffers = 0;
+
+/**
+ * Check if rows for a table can be inserted directly.
+ *
+ * Rows can only be inserted directly if that does the same thing as
+ * an insert statement for the current role. Tables that need anything
+ * more are left to the insert statements, which also report any
+ * permission errors.
+ */
+static bool CanInsertDirectly(Relation rel) {
+  const Oid relid = RelationGetRelid(rel);
+  TriggerDesc *trigdesc = rel->trigdesc;
+  TupleDesc tupdesc = RelationGetDescr(rel);
+
+  if (rel->rd_rel->relkind != RELKIND_RELATION &&
+      rel->rd_rel->relkind != RELKIND_PARTITIONED_TABLE)
+    return false;
+  if (rel->rd_rel->relhasrules)
+    return false;
+  if (tupdesc->constr && tupdesc->constr->has_generated_stored)
+    return false;
+  if (trigdesc &&
+      (trigdesc->trig_insert_before_row || trigdesc->trig_insert_instead_row ||
+       trigdesc->trig_insert_before_statement ||
+       trigdesc->trig_insert_after_statement ||
+       trigdesc->trig_insert_new_table))
+    return false;
+  if (check_enable_rls(relid, InvalidOid, true) == RLS_ENABLED)
+    return false;
+  return pg_class_aclcheck(relid, GetUserId(), ACL_INSERT) == ACLCHECK_OK;
+}
+
+/**
+ * Set up the executor state for inserting into the table of a buffer.
+ *
+ * This is a range table with just the table and a result relation
+ * with the indexes open, similar to what COPY sets up. For
+ * partitioned tables, tuple routing is set up as well.
+ */
+static void InitInsertExecutor(InsertBuffer *buffer) {
+  RangeTblEntry *rte = makeNode(RangeTblEntry);
+  EState *estate = CreateExecutorState();
+#if PG_VERSION_NUM >= 160000
+  List *perminfos = NIL;
+  RTEPermissionInfo *perminfo;
+#endif
+
+  rte->rtekind = RTE_RELATION;
+  rte->relid = buffer->relid;
+  rte->relkind = buffer->rel->rd_rel->relkind;
+  rte->rellockmode = RowExclusiveLock;
+#if PG_VERSION_NUM >= 160000
+  perminfo = addRTEPermissionInfo(&perminfos, rte);
+  perminfo->requiredPerms = ACL_INSERT;
+  ExecInitRangeTable(estate, list_make1(rte), perminfos);
+#else
+  rte->requiredPerms = ACL_INSERT;
+  ExecInitRangeTable(estate, list_make1(rte));
+#endif
+
+  buffer->rri = makeNode(ResultRelInfo);
+#if PG_VERSION_NUM >= 140000
+  ExecInitResultRelation(estate, buffer->rri, 1);
+#else
+  InitResultRelInfo(buffer->rri, buffer->rel, 1, NULL, 0);
+  estate->es_result_relations = buffer->rri;
+  estate->es_num_result_relations = 1;
+  estate->es_result_relation_info = buffer->rri;
+#endif
+  buffer->estate = estate;
+
+  if (buffer->rel->rd_rel->relkind == RELKIND_PARTITIONED_TABLE) {
+    /* The partitions are opened by the tuple routing when the first
+     * row for them arrives. The modify table state is only needed
+     * for the calls, like in COPY. */
+    ModifyTableState *mtstate = makeNode(ModifyTableState);
+    mtstate->ps.state = estate;
+    mtstate->operation = CMD_INSERT;
+    mtstate->resultRelInfo = buffer->rri;
+#if PG_VERSION_NUM >= 140000
+    mtstate->mt_nrels = 1;
+    mtstate->rootResultRelInfo = buffer->rri;
+    buffer->proute = ExecSetupPartitionTupleRouting(estate, buffer->rel);
+#else
+    buffer->proute =
+        ExecSetupPartitionTupleRouting(estate, mtstate, buffer->rel);
+#endif
+    buffer->mtstate = mtstate;
+    buffer->route_slot =
+        table_slot_create(buffer->rel, &estate->es_tupleTable);
+  } else {
+    ExecOpenIndices(buffer->rri, false);
+    buffer->bistate = GetBulkInsertState();
+    buffer->size = InfluxInsertBufferRows;
+    buffer->slots = palloc0(buffer->size * sizeof(TupleTableSlot *));
+  }
+}
+
+/**
+ * Find the buffer for rows inserted into a table by the current role,
+ * or create it.
+ *
+ * If there are already buffers for too many tables, they are flushed
+ * and freed first, so pointers to other buffers are not valid after
+ * calling this.
+ */
+static InsertBuffer *GetInsertBuffer(Oid relid) {
+  const Oid userid = GetUserId();
+  InsertBuffer *buffer;
+  MemoryContext oldcontext;
+  int i;
+
+  for (i = 0; i < NumBuffers; ++i)
+    if (Buffers[i]->relid == relid && Buffers[i]->userid == userid)
+      return Buffers[i];
+
+  if (NumBuffers == INSERT_MAX_BUFFERS)
+    InsertBuffersFlush();
+
+  if (InsertBufferContext == NULL)
+    InsertBufferContext = AllocSetContextCreate(
+        TopMemoryContext, "Influx Insert Buffers", ALLOCSET_DEFAULT_SIZES);
+
+  oldcontext = MemoryContextSwitchTo(InsertBufferContext);
+  buffer = palloc0(sizeof(InsertBuffer));
+  buffer->relid = relid;
+  buffer->userid = userid;
+  buffer->rel = table_open(relid, RowExclusiveLock);
+  buffer->supported = CanInsertDirectly(buffer->rel);
+  if (buffer->supported) {
+    InitInsertExecutor(buffer);
+  } else {
+    table_close(buffer->rel, NoLock);
+    buffer->rel = NULL;
+  }
+  MemoryContextSwitchTo(oldcontext);
+
+  Buffers[NumBuffers++] = buffer;
+  return buffer;
+}
+
+/**
+ * Insert the rows of a buffer into the table.
+ *
+ * The index entries are inserted and AFTER ROW triggers queued for
+ * each row, and the triggers are fired before returning, like at the
+ * end of an insert statement. Triggers run as the role that added
+ * the rows to the buffer.
+ */
+static void FlushInsertBuffer(InsertBuffer *buffer) {
+  EState *estate = buffer->estate;
+  ResultRelInfo *rri = buffer->rri;
+  Oid save_userid;
+  int save_context, i;
+
+  if (buffer->count == 0)
+    return;
+
+  GetUserIdAndSecContext(&save_userid, &save_context);
+  if (buffer->userid != save_userid)
+    SetUserIdAndSecContext(buffer->userid,
+                           save_context | SECURITY_LOCAL_USERID_CHANGE);
+
+  AfterTriggerBeginQuery();
+  table_multi_insert(buffer->rel, buffer->slots, buffer->count,
+                     GetCurrentCommandId(true), 0, buffer->bistate);
+  for (i = 0; i < buffer->count; ++i) {
+    TupleTableSlot *slot = buffer->slots[i];
+    List *recheck = NIL;
+
+    if (rri->ri_NumIndices > 0)
+#if PG_VERSION_NUM >= 160000
+      recheck = ExecInsertIndexTuples(rri, slot, estate, false, false, NULL,
+                                      NIL, false);
+#elif PG_VERSION_NUM >= 140000
+      recheck =
+          ExecInsertIndexTuples(rri, slot, estate, false, false, NULL, NIL);
+#else
+      recheck = ExecInsertIndexTuples(slot, estate, false, NULL, NIL);
+#endif
+    ExecARInsertTriggers(estate, rri, slot, recheck, NULL);
+    list_free(recheck);
+    ExecClearTuple(slot);
+  }
+  AfterTriggerEndQuery(estate);
+  ResetPerTupleExprContext(estate);
+
+  SetUserIdAndSecContext(save_userid, save_context);
+  buffer->count = 0;
+
+  /* Make the rows visible to the following commands, as if they had
+   * been inserted by a statement. */
+  CommandCounterIncrement();
+}
+
+/**
+ * Release the executor state of a buffer and close the table.
+ */
+static void FreeInsertBuffer(InsertBuffer *buffer) {
+  EState *estate = buffer->estate;
+
+  if (buffer->proute) {
+    ExecCleanupTupleRouting(buffer->mtstate, buffer->proute);
+  } else {
+    FreeBulkInsertState(buffer->bistate);
+    table_finish_bulk_insert(buffer->rel, 0);
+  }
+#if PG_VERSION_NUM >= 140000
+  ExecCloseResultRelations(estate);
+  ExecCloseRangeTableRelations(estate);
+#else
+  if (!buffer->proute)
+    ExecCloseIndices(buffer->rri);
+  ExecCleanUpTriggerState(estate);
+#endif
+  ExecResetTupleTable(estate->es_tupleTable, false);
+  FreeExecutorState(estate);
+  table_close(buffer->rel, NoLock);
+}
+
+/**
+ * Add a row to a buffer.
+ *
+ * Constraints are checked when the row is added, and so is the
+ * partition constraint if the table is a partition that the row was
+ * not routed to.
+ */
+static void AddRow(InsertBuffer *buffer, Datum *values, bool *nulls,
+                   bool routed) {
+  const int natts = RelationGetDescr(buffer->rel)->natts;
+  TupleTableSlot *slot;
+  MemoryContext oldcontext;
+
+  oldcontext = MemoryContextSwitchTo(InsertBufferContext);
+  if (buffer->slots[buffer->count] == NULL)
+    buffer->slots[buffer->count] =
+        table_slot_create(buffer->rel, &buffer->estate->es_tupleTable);
+  slot = buffer->slots[buffer->count];
+  ExecClearTuple(slot);
+  memcpy(slot->tts_values, values, natts * sizeof(Datum));
+  memcpy(slot->tts_isnull, nulls, natts * sizeof(bool));
+  ExecStoreVirtualTuple(slot);
+  ExecMaterializeSlot(slot);
+  MemoryContextSwitchTo(oldcontext);
+
+  if (RelationGetDescr(buffer->rel)->constr)
+    ExecConstraints(buffer->rri, slot, buffer->estate);
+  if (buffer->rel->rd_rel->relispartition && !routed)
+    ExecPartitionCheck(buffer->rri, slot, buffer->estate, true);
+
+  if (++buffer->count == buffer->size)
+    FlushInsertBuffer(buffer);
+}
+
+/**
+ * Route a row for a partitioned table to the buffer of its partition.
+ *
+ * The partition is found using the tuple routing of the partitioned
+ * table, and the row is then converted to the columns of the
+ * partition, which can be in a different order.
+ *
+ * @returns false if the partition cannot be inserted into directly.
+ */
+static bool RouteRow(InsertBuffer *buffer, TupleDesc tupdesc, Datum *values,
+                     bool *nulls) {
+  const Oid parent_relid = buffer->relid;
+  TupleTableSlot *slot = buffer->route_slot;
+  ResultRelInfo *part_rri;
+  InsertBuffer *part;
+  Oid part_relid;
+
+  ExecClearTuple(slot);
+  memcpy(slot->tts_values, values, tupdesc->natts * sizeof(Datum));
+  memcpy(slot->tts_isnull, nulls, tupdesc->natts * sizeof(bool));
+  ExecStoreVirtualTuple(slot);
+  part_rri = ExecFindPartition(buffer->mtstate, buffer->rri, buffer->proute,
+                               slot, buffer->estate);
+  part_relid = RelationGetRelid(part_rri->ri_RelationDesc);
+  ExecClearTuple(slot);
+
+  /* This can free the buffer of the partitioned table. */
+  part = GetInsertBuffer(part_relid);
+  if (!part->supported || part->proute)
+    return false;
+
+  if (part->map_relid != parent_relid) {
+    MemoryContext oldcontext = MemoryContextSwitchTo(InsertBufferContext);
+    part->map =
+        convert_tuples_by_name(tupdesc, RelationGetDescr(part->rel));
+    part->map_relid = parent_relid;
+    MemoryContextSwitchTo(oldcontext);
+  }
+
+  if (part->map) {
+    const AttrMap *attrmap = part->map->attrMap;
+    Datum *part_values = palloc(attrmap->maplen * sizeof(Datum));
+    bool *part_nulls = palloc(attrmap->maplen * sizeof(bool));
+    int i;
+
+    for (i = 0; i < attrmap->maplen; ++i) {
+      const AttrNumber attnum = attrmap->attnums[i];
+      part_values[i] = attnum > 0 ? values[attnum - 1] : (Datum)0;
+      part_nulls[i] = attnum > 0 ? nulls[attnum - 1] : true;
+    }
+    AddRow(part, part_values, part_nulls, true);
+  } else {
+    AddRow(part, values, nulls, true);
+  }
+  return true;
+}
+
+/**
+ * Insert a row into a table without going through an insert
+ * statement.
+ *
+ * The row is added to the buffer of the table, or of the partition
+ * the row belongs to if the table is partitioned. The values are
+ * copied, so they do not have to be kept after the call. Constraints
+ * are checked when the row is added, so a row that violates them
+ * raises an error here, the same as for an insert statement. The
+ * buffer is flushed when it is full.
+ *
+ * @param relid Table to insert into.
+ * @param tupdesc Tuple descriptor of the table.
+ * @param values Values for all the columns of the table.
+ * @param nulls Null flags for all the columns of the table.
+ * @returns false if the table cannot be inserted into directly, in
+ * which case the row has to be inserted some other way.
+ */
+bool InsertDirect(Oid relid, TupleDesc tupdesc, Datum *values,
+                  bool *nulls) {
+  InsertBuffer *buffer;
+
+  if (!InfluxDirectInsert)
+    return false;
+
+  buffer = GetInsertBuffer(relid);
+  if (!buffer->supported)
+    return false;
+  if (buffer->proute)
+    return RouteRow(buffer, tupdesc, values, nulls);
+
+  AddRow(buffer, values, nulls, false);
+  return true;
+}
+
+/**
+ * Insert the rows of all buffers and free the buffers.
+ *
+ * This has to be called before the transaction commits, since the
+ * buffers keep the tables open.
+ */
+void InsertBuffersFlush(void) {
+  int i;
+
+  for (i = 0; i < NumBuffers; ++i)
+    if (Buffers[i]->supported && !Buffers[i]->proute)
+      FlushInsertBuffer(Buffers[i]);
+
+  for (i = 0; i < NumBuffers; ++i)
+    if (Buffers[i]->supported)
+      FreeInsertBuffer(Buffers[i]);
+
+  NumBuffers = 0;
+  if (InsertBufferContext)
+    MemoryContextReset(InsertBufferContext);
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright 2022 Timescale Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Module for inserting rows directly through the executor.
+ *
+ * Instead of executing an insert statement for each line, each table
+ * gets a result relation when the first row for it arrives in a
+ * batch, and the rows are inserted through the table access method
+ * the same way as COPY does. Rows are collected in a buffer for each
+ * table and written with a single call to `table_multi_insert` when
+ * the buffer is full or the batch is committed. The indexes are
+ * updated and AFTER ROW triggers are queued for the rows when the
+ * buffer is flushed. Rows for partitioned tables are routed to the
+ * buffers of their partitions.
+ *
+ * Tables where inserting rows directly would bypass something that
+ * an insert statement does are not inserted into directly. These are
+ * tables with rules, row level security, generated columns, BEFORE or
+ * INSTEAD OF triggers, or statement triggers, as well as views and
+ * foreign tables. Rows for those tables have to be inserted using the
+ * prepared insert statements.
+ */
+
+#ifndef INSERT_H_
+#define INSERT_H_
+
+#include <postgres.h>
+
+#include <utils/rel.h>
+
+extern bool InfluxDirectInsert;
+extern int InfluxInsertBufferRows;
+
+extern bool InsertDirect(Oid relid, TupleDesc tupdesc, Datum *values,
+                         bool *nulls);
+extern void InsertBuffersFlush(void);
+
+#endif /* INSERT_H_ */
@@ -6,11 +6,11 @@
 #include <access/table.h>
 #include <catalog/pg_type.h>
 #include <commands/tablecmds.h>
+#include <common/int.h>
 #include <executor/spi.h>
 #include <funcapi.h>
 #include <miscadmin.h>
 #include <nodes/makefuncs.h>
-#include <parser/parse_func.h>
 #include <utils/builtins.h>
 #if PG_VERSION_NUM < 150000
 #include <utils/int8.h>
@@ -18,20 +18,57 @@
 #include <utils/inval.h>
 #include <utils/jsonb.h>
 #include <utils/lsyscache.h>
+#include <utils/regproc.h>
 #include <utils/rel.h>
 #include <utils/syscache.h>
 #include <utils/timestamp.h>
 
 #include "cache.h"
+#include "insert.h"
+#include "number.h"
+#include "object.h"
+#include "series.h"
+#include "stats.h"
 
 PG_FUNCTION_INFO_V1(default_create);
 
-static void BuildFromCString(AttInMetadata *attinmeta, char *value, int attnum,
-                             Datum *values, bool *nulls) {
-  values[attnum - 1] = InputFunctionCall(
-      &attinmeta->attinfuncs[attnum - 1], value,
-      attinmeta->attioparams[attnum - 1], attinmeta->atttypmods[attnum - 1]);
-  nulls[attnum - 1] = (value == NULL);
+/** Precision of timestamps for listeners that do not have their own. */
+int InfluxPrecision = PRECISION_NANOSECONDS;
+
+const struct config_enum_entry InfluxPrecisionOptions[] = {
+    {"ns", PRECISION_NANOSECONDS, false},
+    {"n", PRECISION_NANOSECONDS, true},
+    {"us", PRECISION_MICROSECONDS, false},
+    {"u", PRECISION_MICROSECONDS, true},
+    {"ms", PRECISION_MILLISECONDS, false},
+    {"s", PRECISION_SECONDS, false},
+    {"m", PRECISION_MINUTES, false},
+    {"h", PRECISION_HOURS, false},
+    {NULL, 0, false},
+};
+
+/**
+ * Build the value of a column from an item.
+ *
+ * Values for columns of common types are converted directly, and
+ * other values are converted using the input function of the column
+ * type.
+ *
+ * @param isnull[out] Set to true if the value is null.
+ */
+static Datum BuildFromItem(MetricTable table, const KVItem *item, int attnum,
+                           bool *isnull) {
+  AttInMetadata *attinmeta = table->attinmeta;
+  Datum value;
+
+  *isnull = (item->value == NULL);
+  if (item->value != NULL &&
+      ConvertValue(table->conversions[attnum - 1], item->value, item->type,
+                   &value))
+    return value;
+  return InputFunctionCall(&attinmeta->attinfuncs[attnum - 1], item->value,
+                           attinmeta->attioparams[attnum - 1],
+                           attinmeta->atttypmods[attnum - 1]);
 }
 
 /**
@@ -50,61 +87,154 @@ static bool is_timestamp_type(Oid argtype) {
 }
 
 /**
- * Add key and value pair to JSONB parser state.
+ * Build the value of the time column from a timestamp.
+ *
+ * Timestamp types take the timestamp as it is. Columns of date and
+ * time types or string types get the text form of the timestamp,
+ * converted using the input function of the column type, which works
+ * for types such as `date` and `text`. Other types, such as `int4`
+ * or `interval`, would reject the text with an error, so the line is
+ * skipped instead.
  *
- * @param state JSON parser state
- * @param key Key as a C string.
- * @param value Value as a C string.
+ * @returns false if the column cannot hold the timestamp.
  */
-static void AddJsonField(JsonbParseState **state, char *key, char *value) {
-  JsonbValue jb_key, jb_val;
-  jb_key.type = jbvString;
-  jb_key.val.string.val = pstrdup(key);
-  jb_key.val.string.len = strlen(key);
-
-  (void)pushJsonbValue(state, WJB_KEY, &jb_key);
-
-  jb_val.type = jbvString;
-  jb_val.val.string.val = pstrdup(value);
-  jb_val.val.string.len = strlen(value);
-  (void)pushJsonbValue(state, WJB_VALUE, &jb_val);
+static bool BuildTime(MetricTable table, TimestampTz time, Datum *values,
+                      bool *nulls) {
+  const int i = table->time_attnum - 1;
+  AttInMetadata *attinmeta = table->attinmeta;
+
+  if (is_timestamp_type(table->argtypes[i])) {
+    values[i] = TimestampTzGetDatum(time);
+  } else {
+    char category;
+    bool preferred;
+    char *text;
+
+    get_type_category_preferred(table->argtypes[i], &category, &preferred);
+    if (category != TYPCATEGORY_DATETIME && category != TYPCATEGORY_STRING)
+      return false;
+
+    text = DatumGetCString(
+        DirectFunctionCall1(timestamptz_out, TimestampTzGetDatum(time)));
+    values[i] =
+        InputFunctionCall(&attinmeta->attinfuncs[i], text,
+                          attinmeta->attioparams[i], attinmeta->atttypmods[i]);
+  }
+  nulls[i] = false;
+  return true;
 }
 
 /**
- * Build JSON object from list of key-value items.
+ * Look up timestamp precision by name.
+ *
+ * The names are the same as the ones accepted by the `precision`
+ * parameter of InfluxDB.
  *
- * @param items List of `ParseItem`
- * @returns JSONB object with the key-value pairs.
+ * @param name Name of precision.
+ * @param precision[out] Precision with the given name.
+ * @returns true if the name is a valid precision, false otherwise.
  */
-static Jsonb *BuildJsonObject(List *items) {
-  ListCell *cell;
-  JsonbParseState *state = NULL;
-  JsonbValue *value;
+bool PrecisionByName(const char *name, Precision *precision) {
+  if (strcmp(name, "ns") == 0 || strcmp(name, "n") == 0)
+    *precision = PRECISION_NANOSECONDS;
+  else if (strcmp(name, "us") == 0 || strcmp(name, "u") == 0)
+    *precision = PRECISION_MICROSECONDS;
+  else if (strcmp(name, "ms") == 0)
+    *precision = PRECISION_MILLISECONDS;
+  else if (strcmp(name, "s") == 0)
+    *precision = PRECISION_SECONDS;
+  else if (strcmp(name, "m") == 0)
+    *precision = PRECISION_MINUTES;
+  else if (strcmp(name, "h") == 0)
+    *precision = PRECISION_HOURS;
+  else
+    return false;
+  return true;
+}
 
-  pushJsonbValue(&state, WJB_BEGIN_OBJECT, NULL);
-  foreach (cell, items) {
-    KVItem *item = (KVItem *)lfirst(cell);
-    AddJsonField(&state, item->key, item->value);
+/**
+ * Convert timestamp to microseconds since UNIX epoch.
+ *
+ * @returns false if the timestamp is out of range.
+ */
+static bool TimestampToMicroseconds(int64 value, Precision precision,
+                                    int64 *result) {
+  switch (precision) {
+    case PRECISION_NANOSECONDS:
+      *result = value / 1000;
+      return true;
+    case PRECISION_MICROSECONDS:
+      *result = value;
+      return true;
+    case PRECISION_MILLISECONDS:
+      return !pg_mul_s64_overflow(value, INT64CONST(1000), result);
+    case PRECISION_SECONDS:
+      return !pg_mul_s64_overflow(value, USECS_PER_SEC, result);
+    case PRECISION_MINUTES:
+      return !pg_mul_s64_overflow(value, USECS_PER_MINUTE, result);
+    case PRECISION_HOURS:
+      return !pg_mul_s64_overflow(value, USECS_PER_HOUR, result);
   }
-  value = pushJsonbValue(&state, WJB_END_OBJECT, NULL);
+  return false;
+}
 
-  return JsonbValueToJsonb(value);
+/**
+ * Convert the timestamp of a metric to a PostgreSQL timestamp.
+ *
+ * The timestamp of the line is the time since the UNIX epoch in the
+ * precision of the metric.
+ *
+ * @returns false if the metric has no timestamp, or if it is not an
+ * integer or outside the range of PostgreSQL timestamps.
+ */
+bool MetricTimestamp(const Metric *metric, TimestampTz *result) {
+  int64 value;
+
+  if (metric->timestamp == NULL)
+    return false;
+
+  /* Timestamps are almost always plain integers, which the number
+   * parsing kernel handles. Anything else is parsed the usual way. */
+  if (!NumberParseInt64(metric->timestamp, strlen(metric->timestamp),
+                        &value)) {
+#if PG_VERSION_NUM < 150000
+    if (!scanint8(metric->timestamp, true, &value))
+      return false;
+#else
+    char *endptr;
+    errno = 0;
+    value = strtoi64(metric->timestamp, &endptr, 10);
+    if (errno != 0 || *endptr != '\0')
+      return false;
+#endif
+  }
+
+  if (!TimestampToMicroseconds(value, metric->precision, &value) ||
+      pg_sub_s64_overflow(value,
+                          USECS_PER_SEC *
+                              ((POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) *
+                               SECS_PER_DAY),
+                          result))
+    return false;
+  return IS_VALID_TIMESTAMP(*result);
 }
 
 /**
  * Insert items into values array.
+ *
+ * Items that have a column in the table are removed from the list.
  */
-static void InsertItems(List **pitems, AttInMetadata *attinmeta, Datum *values,
+static void InsertItems(List **pitems, MetricTable table, Datum *values,
                         bool *nulls) {
   ListCell *cell;
-  TupleDesc tupdesc = attinmeta->tupdesc;
   List *items = *pitems;
 
   foreach (cell, items) {
     const KVItem *item = (KVItem *)lfirst(cell);
-    const int attnum = SPI_fnumber(tupdesc, item->key);
+    const AttrNumber attnum = MetricTableColumn(table, item->key);
     if (attnum > 0) {
-      BuildFromCString(attinmeta, item->value, attnum, values, nulls);
+      values[attnum - 1] =
+          BuildFromItem(table, item, attnum, &nulls[attnum - 1]);
       items = foreach_delete_current(items, cell);
     }
   }
@@ -112,106 +242,151 @@ static void InsertItems(List **pitems, AttInMetadata *attinmeta, Datum *values,
 }
 
 /**
- * Prepare a record for the relation.
+ * Derive the values of the tag columns and the `_tags` column of a
+ * series for a table.
  *
- * Memory for the record need to be already allocated, but it will be
- * filled in.
+ * This is done the same way as for the tags of lines that are not in
+ * the series cache, and the result is kept in the cache until the
+ * table is described again.
+ */
+static void DescribeSeries(SeriesEntry *series, MetricTable table) {
+  const AttrNumber tags_attnum = table->tags_attnum;
+  List *tags = SeriesTags(series);
+  SeriesColumn *columns;
+  Jsonb *object = NULL;
+  int ncolumns = 0;
+  ListCell *cell;
+
+  columns = palloc(list_length(tags) * sizeof(SeriesColumn));
+  foreach (cell, tags) {
+    const KVItem *item = (KVItem *)lfirst(cell);
+    const AttrNumber attnum = MetricTableColumn(table, item->key);
+    if (attnum > 0) {
+      SeriesColumn *column = &columns[ncolumns++];
+      column->attnum = attnum;
+      column->value = BuildFromItem(table, item, attnum, &column->isnull);
+      tags = foreach_delete_current(tags, cell);
+    }
+  }
+
+  if (tags_attnum > 0 && table->argtypes[tags_attnum - 1] == JSONBOID)
+    object = ObjectFromItems(tags);
+  SeriesSetValues(series, table, columns, ncolumns, object);
+}
+
+/**
+ * Insert the cached tag values of a series into values array.
+ */
+static void InsertSeries(SeriesEntry *series, MetricTable table,
+                         Datum *values, bool *nulls) {
+  int i;
+
+  if (!SeriesValid(series, table))
+    DescribeSeries(series, table);
+  for (i = 0; i < series->ncolumns; ++i) {
+    const SeriesColumn *column = &series->columns[i];
+    values[column->attnum - 1] = column->value;
+    nulls[column->attnum - 1] = column->isnull;
+  }
+}
+
+/**
+ * Prepare an insert statement for a metric table.
  *
- * @param[in] Relation to prepare record for.
- * @param[in] Array of parameter types.
- * @param[out] Pointer to variable for prepared insert statement.
+ * The statement is kept in the cache entry of the table until the
+ * entry is invalidated.
+ *
+ * @param table[in,out] Table to prepare the statement for.
  */
-static void PrepareRecord(Relation rel, Oid *argtypes, PreparedInsert record) {
-  TupleDesc tupdesc = RelationGetDescr(rel);
+static void PrepareRecord(MetricTable table) {
+  TupleDesc tupdesc = table->attinmeta->tupdesc;
+  const char *relname = get_rel_name(table->relid);
   StringInfoData stmt;
   SPIPlanPtr plan;
-  const Oid relid = RelationGetRelid(rel);
   int i;
 
   /* Using the tuple descriptor and the parsed package, build the
    * insert statement and collect the null array for the prepare
    * call. */
   initStringInfo(&stmt);
-  appendStringInfo(&stmt, "INSERT INTO %s.%s VALUES (",
-                   quote_identifier(SPI_getnspname(rel)),
-                   quote_identifier(SPI_getrelname(rel)));
+  appendStringInfo(
+      &stmt, "INSERT INTO %s.%s VALUES (",
+      quote_identifier(get_namespace_name(get_rel_namespace(table->relid))),
+      quote_identifier(relname));
   for (i = 0; i < tupdesc->natts; ++i)
     appendStringInfo(&stmt, "$%d%s", i + 1,
                      (i < tupdesc->natts - 1 ? ", " : ""));
   appendStringInfoString(&stmt, ")");
 
-  plan = SPI_prepare(stmt.data, tupdesc->natts, argtypes);
+  plan = SPI_prepare(stmt.data, tupdesc->natts, table->argtypes);
   if (!plan)
-    elog(ERROR, "SPI_prepare for relation %s failed: %s", SPI_getrelname(rel),
+    elog(ERROR, "SPI_prepare for relation %s failed: %s", relname,
          SPI_result_code_string(SPI_result));
   if (SPI_keepplan(plan))
-    elog(ERROR, "SPI_keepplan failed for relation %s", SPI_getrelname(rel));
+    elog(ERROR, "SPI_keepplan failed for relation %s", relname);
 
-  record->relid = relid;
-  record->pplan = plan;
+  table->pplan = plan;
 }
 
 /**
  * Compute values arrays and nulls from a metric.
+ *
+ * @param time[out] Timestamp of the line, or zero if the line has no
+ * timestamp of its own or the table has no time column. Can be NULL.
+ * @returns false if the line cannot be inserted into the table.
  */
-bool CollectValues(Metric *metric, AttInMetadata *attinmeta, Oid *argtypes,
-                   Datum *values, bool *nulls) {
-  TupleDesc tupdesc = attinmeta->tupdesc;
-  int time_attnum, tags_attnum, fields_attnum, i;
+bool CollectValues(Metric *metric, MetricTable table, Datum *values,
+                   bool *nulls, TimestampTz *time) {
+  TupleDesc tupdesc = table->attinmeta->tupdesc;
+  const AttrNumber time_attnum = table->time_attnum;
+  const AttrNumber tags_attnum = table->tags_attnum;
+  const AttrNumber fields_attnum = table->fields_attnum;
+  int i;
 
-  /* Set default values for nulls array and fill in the type id. */
-  for (i = 0; i < tupdesc->natts; ++i) {
+  /* Set default values for nulls array. */
+  for (i = 0; i < tupdesc->natts; ++i)
     nulls[i] = true;
-    argtypes[i] = SPI_gettypeid(tupdesc, i + 1);
-  }
+  if (time)
+    *time = 0;
 
-  time_attnum = SPI_fnumber(tupdesc, "_time");
   if (time_attnum > 0) {
-    /* If the type is not a timestamp type, we skip the line. Also if
-       we cannot parse the timestamp as an integer. */
-    int64 value;
-
-    if (!is_timestamp_type(argtypes[time_attnum - 1]))
-      return false;
-#if PG_VERSION_NUM < 150000
-    if (!scanint8(metric->timestamp, true, &value))
-      return false;
-#else
-    {
-      char *endptr;
-      errno = 0;
-      value = strtoi64(metric->timestamp, &endptr, 10);
-      if (errno != 0 || *endptr != '\0')
+    /* We skip the line if we cannot parse the timestamp as an
+       integer, or if the time column cannot hold a timestamp. Lines
+       without a timestamp get the time they were received, if it is
+       known. */
+    TimestampTz timestamp;
+
+    if (metric->timestamp) {
+      if (!MetricTimestamp(metric, &timestamp) ||
+          !BuildTime(table, timestamp, values, nulls))
+        return false;
+      if (time)
+        *time = timestamp;
+    } else if (metric->received != 0) {
+      if (!BuildTime(table, metric->received, values, nulls))
         return false;
     }
-#endif
-
-    /* The timestamp is timestamp in nanosecond since UNIX epoch, so we
-       convert it to PostgreSQL timestamp in microseconds since
-       PostgreSQL epoch. */
-    value /= 1000;
-    value -= USECS_PER_SEC *
-             ((POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * SECS_PER_DAY);
-    values[time_attnum - 1] = TimestampGetDatum(value);
-    nulls[time_attnum - 1] = false;
   }
 
-  InsertItems(&metric->tags, attinmeta, values, nulls);
-  InsertItems(&metric->fields, attinmeta, values, nulls);
+  if (metric->series)
+    InsertSeries(metric->series, table, values, nulls);
+  else
+    InsertItems(&metric->tags, table, values, nulls);
+  InsertItems(&metric->fields, table, values, nulls);
 
-  tags_attnum = SPI_fnumber(tupdesc, "_tags");
   if (tags_attnum > 0) {
-    if (argtypes[tags_attnum] != JSONBOID)
+    if (table->argtypes[tags_attnum - 1] != JSONBOID)
       return false;
-    values[tags_attnum - 1] = JsonbPGetDatum(BuildJsonObject(metric->tags));
+    values[tags_attnum - 1] =
+        JsonbPGetDatum(metric->series ? metric->series->object
+                                      : ObjectFromItems(metric->tags));
     nulls[tags_attnum - 1] = false;
   }
 
-  fields_attnum = SPI_fnumber(tupdesc, "_fields");
   if (fields_attnum > 0) {
-    if (argtypes[tags_attnum] != JSONBOID)
+    if (table->argtypes[fields_attnum - 1] != JSONBOID)
       return false;
-    values[fields_attnum - 1] = JsonbPGetDatum(BuildJsonObject(metric->fields));
+    values[fields_attnum - 1] = JsonbPGetDatum(ObjectFromItems(metric->fields));
     nulls[fields_attnum - 1] = false;
   }
   return true;
@@ -256,28 +431,25 @@ Oid MetricCreate(Metric *metric, Oid nspid) {
   Name metric_name;
   Oid createoid, result;
   ArrayType *tags_array, *fields_array;
-  Oid args[] = {NAMEOID, NAMEARRAYOID, NAMEARRAYOID};
-  char *namespace = get_namespace_name(nspid);
-  List *create_func = list_make2(makeString(namespace), makeString("_create"));
 
-  createoid =
-      LookupFuncName(create_func, sizeof(args) / sizeof(*args), args, true);
+  createoid = MetricCreateFunction(nspid);
 
   if (!OidIsValid(createoid))
     return InvalidOid;
 
   elog(DEBUG1, "found metric creation function \"%s\" with OID %d",
-       NameListToString(create_func), createoid);
+       format_procedure(createoid), createoid);
 
   if (get_func_rettype(createoid) != REGCLASSOID)
     ereport(ERROR, (errcode(ERRCODE_INVALID_OBJECT_DEFINITION),
                     errmsg("type input function \"%s\" must return type \"%s\"",
-                           NameListToString(create_func),
+                           format_procedure(createoid),
                            format_type_be(REGCLASSOID))));
 
   metric_name = palloc(NAMEDATALEN);
   namestrcpy(metric_name, metric->name);
-  tags_array = MakeArrayFromCStringList(metric->tags);
+  tags_array = MakeArrayFromCStringList(
+      metric->series ? SeriesTags(metric->series) : metric->tags);
   fields_array = MakeArrayFromCStringList(metric->fields);
   PG_TRY();
   {
@@ -291,65 +463,96 @@ Oid MetricCreate(Metric *metric, Oid nspid) {
   return result;
 }
 
+/**
+ * Insert a row using the prepared insert statement for the table.
+ *
+ * @returns true if the row was inserted.
+ */
+static bool ExecutePreparedInsert(MetricTable table, Datum *values,
+                                  bool *nulls) {
+  const int natts = table->attinmeta->tupdesc->natts;
+  char *cnulls;
+  int err, i;
+
+  /* Prepare the statement the first time it is needed. It is kept
+     in the cache entry. */
+  if (!table->pplan)
+    PrepareRecord(table);
+
+  cnulls = palloc(natts * sizeof(char));
+  for (i = 0; i < natts; ++i)
+    cnulls[i] = (nulls[i]) ? 'n' : ' ';
+
+  err = SPI_execute_plan(table->pplan, values, cnulls, false, 0);
+  if (err != SPI_OK_INSERT) {
+    elog(LOG, "SPI_execute_plan failed executing: %s",
+         SPI_result_code_string(err));
+    return false;
+  }
+  return true;
+}
+
 /*
  * Insert a row in the metric table.
  *
  * If there is no table with the same name as the metric, an attempt
- * will be made to create such a table.
+ * will be made to create such a table. If that fails, lines for the
+ * metric are skipped until `influx.create_retry_interval` has passed.
+ *
+ * The description of the table is cached, and the table is locked
+ * the first time it is used in a transaction and kept locked until
+ * the end of it. Otherwise, the table definition can change before
+ * we've had a chance to insert the data.
+ *
+ * The row is inserted directly into the table if possible, in which
+ * case it is written when the insert buffer of the table is flushed.
+ * Otherwise, it is inserted right away using a prepared insert
+ * statement.
+ *
+ * @param time[out] Timestamp of the line, as for `CollectValues`.
+ * @returns true if a row was inserted, false if the line was skipped.
  */
-void MetricInsert(Metric *metric, Oid nspid) {
-  Relation rel;
-  Oid relid;
+bool MetricInsert(Metric *metric, Oid nspid, TimestampTz *time) {
+  MetricTable table;
   Datum *values;
   bool *nulls;
-  Oid *argtypes;
-  AttInMetadata *attinmeta;
-  int err, i, natts;
+  bool rejected;
+  int natts;
 
   /* Try to fetch the table. */
-  relid = get_relname_relid(metric->name, nspid);
+  table = MetricTableLookup(nspid, metric->name, &rejected);
+
+  /* If creating the table failed recently, we skip the line. */
+  if (rejected) {
+    StatsAdd(STAT_REJECTED_LINES, 1);
+    return false;
+  }
 
-  /* If the table does not exist, we try to create the table. */
-  if (!OidIsValid(relid))
-    relid = MetricCreate(metric, nspid);
+  /* If the table does not exist, we try to create the table, and
+   * remember it if that fails. */
+  if (!table) {
+    const Oid relid = MetricCreate(metric, nspid);
+    if (OidIsValid(relid)) {
+      StatsAdd(STAT_TABLES_CREATED, 1);
+      table = MetricTableAdd(nspid, metric->name, relid);
+    } else {
+      MetricTableReject(nspid, metric->name);
+    }
+  }
 
   /* If that fails, we skip the line. */
-  if (!OidIsValid(relid))
-    return;
-
-  /* Get tuple descriptor for metric table and parse all the data
-   * into values array. To do this, we open the table for access and
-   * keep it open until the end of the transaction. Otherwise, the
-   * table definition can change before we've had a chance to insert
-   * the data. */
-  rel = table_open(relid, AccessShareLock);
-  attinmeta = TupleDescGetAttInMetadata(RelationGetDescr(rel));
-  natts = attinmeta->tupdesc->natts;
+  if (!table)
+    return false;
 
+  natts = table->attinmeta->tupdesc->natts;
   values = palloc0(natts * sizeof(Datum));
   nulls = palloc0(natts * sizeof(bool));
-  argtypes = palloc(natts * sizeof(Oid));
-
-  if (CollectValues(metric, attinmeta, argtypes, values, nulls)) {
-    PreparedInsert record;
-    char *cnulls;
-
-    /* Find the hashed entry, or prepare a statement and fill in the
-       entry. Filling in the entry will also cache it. */
-    if (!FindOrAllocEntry(rel, &record))
-      PrepareRecord(rel, argtypes, record);
-
-    cnulls = palloc(natts * sizeof(char));
-    for (i = 0; i < natts; ++i)
-      cnulls[i] = (nulls[i]) ? 'n' : ' ';
-
-    err = SPI_execute_plan(record->pplan, values, cnulls, false, 0);
-    if (err != SPI_OK_INSERT)
-      elog(LOG, "SPI_execute_plan failed executing: %s",
-           SPI_result_code_string(err));
-  }
 
-  table_close(rel, NoLock);
+  if (!CollectValues(metric, table, values, nulls, time))
+    return false;
+  return InsertDirect(table->relid, table->attinmeta->tupdesc, values,
+                      nulls) ||
+         ExecutePreparedInsert(table, values, nulls);
 }
 
 Datum default_create(PG_FUNCTION_ARGS) {
@@ -11,10 +11,28 @@
 
 #include <postgres.h>
 
+#include <datatype/timestamp.h>
 #include <funcapi.h>
 #include <nodes/pg_list.h>
+#include <utils/guc.h>
 
-typedef enum Type { TYPE_NONE, TYPE_STRING, TYPE_INTEGER, TYPE_FLOAT } Type;
+#include "cache.h"
+#include "convert.h"
+
+/**
+ * Precision of line timestamps.
+ */
+typedef enum Precision {
+  PRECISION_NANOSECONDS,
+  PRECISION_MICROSECONDS,
+  PRECISION_MILLISECONDS,
+  PRECISION_SECONDS,
+  PRECISION_MINUTES,
+  PRECISION_HOURS,
+} Precision;
+
+extern int InfluxPrecision;
+extern const struct config_enum_entry InfluxPrecisionOptions[];
 
 typedef struct KVItem {
   char *key;
@@ -27,7 +45,7 @@ typedef struct KVItem {
  *
  * A metric consists of:
  * - A name
- * - A timestamp
+ * - An optional timestamp
  * - A set of zero or more tags
  * - A set of one or more values
  */
@@ -35,19 +53,32 @@ typedef struct Metric {
   /** Measurement identifier, pointer into the line buffer */
   const char *name;
 
-  /** Timestamp as a string */
+  /** Timestamp as a string, or NULL if the line has no timestamp */
   const char *timestamp;
 
-  /** List of items that represent tags */
+  /** List of items that represent tags, or NIL if the tags were
+   * found in the series cache */
   List *tags;
 
+  /** Series of the line in the series cache, or NULL if the tags
+   * were not looked up in the cache */
+  struct SeriesEntry *series;
+
   /** List of items that represent fields */
   List *fields;
+
+  /** Precision of the timestamp */
+  Precision precision;
+
+  /** Time when the line was received, or zero if not known */
+  TimestampTz received;
 } Metric;
 
 Oid MetricCreate(Metric *metric, Oid nspid);
-void MetricInsert(Metric *metric, Oid nspid);
-bool CollectValues(Metric *metric, AttInMetadata *attinmeta, Oid *argtypes,
-                   Datum *values, bool *nulls);
+bool MetricInsert(Metric *metric, Oid nspid, TimestampTz *time);
+bool PrecisionByName(const char *name, Precision *precision);
+bool MetricTimestamp(const Metric *metric, TimestampTz *result);
+bool CollectValues(Metric *metric, MetricTable table, Datum *values,
+                   bool *nulls, TimestampTz *time);
 
 #endif /* METRIC_H_ */
@@ -20,18 +20,174 @@
 #include <fmgr.h>
 
 #include <common/ip.h>
+#include <lib/stringinfo.h>
 #include <miscadmin.h>
+#include <storage/ipc.h>
 #include <utils/builtins.h>
+#include <utils/memutils.h>
 
 #include <assert.h>
+#include <errno.h>
 #include <netdb.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <linux/filter.h>
+#include <linux/sock_diag.h>
+#endif
+
+/* Number of bytes of the measurement name that the steering program
+ * hashes. The program cannot contain loops, so it is unrolled for
+ * each byte. */
+#define STEERING_PREFIX_LENGTH 16
+
+/* Not all C libraries define these, but they have been available in
+ * kernels since 5.11. */
+#if defined(__linux__) && !defined(SO_PREFER_BUSY_POLL)
+#define SO_PREFER_BUSY_POLL 69
+#endif
+
+/** Size of socket receive buffer, or zero to use the system default. */
+int InfluxSocketBufferSize = 0;
+
+/** Access permissions for Unix domain socket files. */
+int InfluxUnixSocketPermissions = 0777;
+
+/** Steer datagrams to workers by measurement name. */
+bool InfluxUdpSteering = false;
+
+/** Microseconds to busy poll for datagrams, or zero to not poll. */
+int InfluxBusyPoll = 0;
+
+/* Remove the socket file when the process exits. */
+static void UnlinkSocketFile(int code, Datum arg) {
+  unlink(DatumGetCString(arg));
+}
+
+/*
+ * Check if a Unix domain socket file was left behind.
+ *
+ * A worker that did not exit cleanly leaves the socket file in place,
+ * which prevents binding the path. The file is stale if it is a
+ * socket that nobody is listening on.
+ */
+static bool IsStaleSocketFile(int fd, const struct sockaddr_un* addr) {
+  struct stat statbuf;
+  int socktype, probe, result;
+  socklen_t optlen = sizeof(socktype);
+
+  if (lstat(addr->sun_path, &statbuf) < 0 || !S_ISSOCK(statbuf.st_mode))
+    return false;
+
+  if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &socktype, &optlen) < 0)
+    return false;
+
+  probe = socket(AF_UNIX, socktype, 0);
+  if (probe < 0)
+    return false;
+  result = connect(probe, (const struct sockaddr*)addr, sizeof(*addr));
+  close(probe);
+  return result < 0 && errno == ECONNREFUSED;
+}
+
+/*
+ * Bind socket to an address.
+ *
+ * For Unix domain sockets, a stale socket file is removed before
+ * binding, and the socket file is removed again when the process
+ * exits. The permissions of the socket file are set from
+ * `influx.unix_socket_permissions`.
+ */
+static int BindSocket(int fd, const struct sockaddr* addr, socklen_t addrlen) {
+  const struct sockaddr_un* unaddr = (const struct sockaddr_un*)addr;
+  int result = bind(fd, addr, addrlen);
+
+  if (addr->sa_family != AF_UNIX)
+    return result;
+
+  if (result < 0 && errno == EADDRINUSE && IsStaleSocketFile(fd, unaddr)) {
+    ereport(LOG,
+            (errmsg("removing stale socket file \"%s\"", unaddr->sun_path)));
+    if (unlink(unaddr->sun_path) == 0)
+      result = bind(fd, addr, addrlen);
+  }
+
+  if (result < 0)
+    return result;
+
+  on_proc_exit(UnlinkSocketFile,
+               CStringGetDatum(
+                   MemoryContextStrdup(TopMemoryContext, unaddr->sun_path)));
+
+  if (chmod(unaddr->sun_path, InfluxUnixSocketPermissions) < 0)
+    ereport(LOG, (errcode_for_file_access(),
+                  errmsg("could not set permissions of file \"%s\": %m",
+                         unaddr->sun_path)));
+  return result;
+}
+
+/*
+ * Set the size of the socket receive buffer.
+ *
+ * The kernel caps the size at `net.core.rmem_max`, so we check the
+ * resulting size and log if it is smaller than requested. Note that
+ * Linux doubles the value to leave room for bookkeeping, so we
+ * compare with half of the reported size.
+ */
+static void SetReceiveBufferSize(int fd, int size) {
+  int optval = size;
+  socklen_t optlen = sizeof(optval);
+
+  if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &optval, sizeof(optval)) < 0) {
+    ereport(LOG, (errmsg("%s(%s) failed: %m", "setsockopt", "SO_RCVBUF")));
+    return;
+  }
+
+  if (getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &optval, &optlen) == 0 &&
+      optval / 2 < size)
+    ereport(LOG,
+            (errmsg("socket receive buffer size is %d bytes, requested %d",
+                    optval / 2, size),
+             errhint("The kernel limits the size using net.core.rmem_max.")));
+}
+
+/*
+ * Enable busy polling on the socket.
+ *
+ * Receive calls on the socket then poll the device queue for up to
+ * `usec` microseconds instead of waiting for the interrupt, and the
+ * kernel defers interrupts while the socket is polled. Raising the
+ * value above `net.core.busy_read` requires `CAP_NET_ADMIN`.
+ */
+static void EnableBusyPoll(int fd, int usec) {
+#ifdef SO_BUSY_POLL
+  int optval = usec;
+  if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &optval, sizeof(optval)) < 0) {
+    ereport(LOG, (errmsg("%s(%s) failed: %m", "setsockopt", "SO_BUSY_POLL"),
+                  errhint("The server needs CAP_NET_ADMIN to busy poll for "
+                          "longer than net.core.busy_read.")));
+    return;
+  }
+#endif
+#ifdef SO_PREFER_BUSY_POLL
+  {
+    int optval = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &optval,
+                   sizeof(optval)) < 0)
+      ereport(LOG, (errmsg("%s(%s) failed: %m", "setsockopt",
+                           "SO_PREFER_BUSY_POLL")));
+  }
+#endif
+}
+
 /*
  * Configure UDP receive socket.
  *
@@ -39,6 +195,10 @@
  * interrupts and process them and we use SO_REUSEPORT to allow
  * several UDP workers to be connected to the same socket and read and
  * process the packets.
+ *
+ * We also ask the kernel to report the number of datagrams dropped
+ * for the socket and the time each datagram arrived, which will be
+ * attached to the received datagrams.
  */
 static int ConfigUdpRecvSocket(int fd, const struct sockaddr* addr,
                                socklen_t addrlen) {
@@ -48,18 +208,145 @@ static int ConfigUdpRecvSocket(int fd, const struct sockaddr* addr,
     return STATUS_ERROR;
   }
 
+  if (InfluxSocketBufferSize > 0)
+    SetReceiveBufferSize(fd, InfluxSocketBufferSize);
+
+  if (InfluxBusyPoll > 0)
+    EnableBusyPoll(fd, InfluxBusyPoll);
+
+#ifdef SO_RXQ_OVFL
+  {
+    int optval = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &optval, sizeof(optval)) < 0)
+      ereport(LOG,
+              (errmsg("%s(%s) failed: %m", "setsockopt", "SO_RXQ_OVFL")));
+  }
+#endif
+
+#ifdef SO_TIMESTAMPNS
+  {
+    int optval = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &optval, sizeof(optval)) <
+        0)
+      ereport(LOG,
+              (errmsg("%s(%s) failed: %m", "setsockopt", "SO_TIMESTAMPNS")));
+  }
+#endif
+
   return STATUS_OK;
 }
 
+/*
+ * Bind a datagram socket.
+ *
+ * Port reuse is not supported for Unix domain sockets, so only one
+ * worker can bind each socket path.
+ */
 static int SetupUdpRecvSocket(int fd, const struct sockaddr* addr,
                               socklen_t addrlen) {
   int optval = 1;
-  if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) < 0) {
+  if (addr->sa_family != AF_UNIX &&
+      setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) < 0) {
     ereport(LOG, (errmsg("%s(%s) failed: %m", "setsockopt", "SO_REUSEPORT")));
     return STATUS_ERROR;
   }
 
-  return bind(fd, addr, addrlen);
+  return BindSocket(fd, addr, addrlen);
+}
+
+/**
+ * Get the fill level of the socket receive buffer.
+ *
+ * @returns Percent of the receive buffer in use, or zero if it cannot
+ * be determined.
+ */
+int SocketBacklog(int fd) {
+#ifdef SO_MEMINFO
+  uint32 meminfo[SK_MEMINFO_VARS];
+  socklen_t optlen = sizeof(meminfo);
+
+  if (getsockopt(fd, SOL_SOCKET, SO_MEMINFO, meminfo, &optlen) < 0 ||
+      meminfo[SK_MEMINFO_RCVBUF] == 0)
+    return 0;
+  return Min(100, (int)(100.0 * meminfo[SK_MEMINFO_RMEM_ALLOC] /
+                        meminfo[SK_MEMINFO_RCVBUF]));
+#else
+  return 0;
+#endif
+}
+
+/**
+ * Steer datagrams to workers using a hash of the measurement name.
+ *
+ * By default, the kernel picks the socket in a port reuse group using
+ * a hash of the source address and port, so every worker ends up
+ * writing to every table. This attaches a classic BPF program to the
+ * group that instead hashes the first bytes of the measurement name of
+ * the first line in the datagram, so that each table is mostly written
+ * by the same worker.
+ *
+ * The program is attached to the whole group, so it does not matter
+ * which of the workers attaches it last. If the program returns an
+ * index outside the group, for example because some workers are not
+ * running, the kernel falls back on the default selection.
+ *
+ * @param fd Socket that is part of the group.
+ * @param nsocks Number of sockets in the group.
+ * @returns true if the program was attached, false otherwise, in
+ * which case the reason has been logged.
+ */
+bool AttachSteeringProgram(int fd, int nsocks) {
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+  /* Each byte needs 8 instructions, and we need 2 instructions to
+   * initialize the hash and 3 to return the socket index. */
+  struct sock_filter code[8 * STEERING_PREFIX_LENGTH + 5];
+  struct sock_fprog prog;
+  const int done = 8 * STEERING_PREFIX_LENGTH + 2;
+  int i, pc = 0;
+
+  Assert(nsocks > 0);
+
+  /* The hash is kept in scratch memory slot 0 since we need both
+   * registers to update it. */
+  code[pc++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_IMM, 0);
+  code[pc++] = (struct sock_filter)BPF_STMT(BPF_ST, 0);
+
+  /* A load outside the packet aborts the program and selects the
+   * first socket, which only happens for malformed lines. */
+  for (i = 0; i < STEERING_PREFIX_LENGTH; ++i) {
+    code[pc++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_B | BPF_ABS, i);
+    code[pc] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ',',
+                                            done - pc - 1, 0);
+    pc++;
+    code[pc] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ' ',
+                                            done - pc - 1, 0);
+    pc++;
+    code[pc++] = (struct sock_filter)BPF_STMT(BPF_MISC | BPF_TAX, 0);
+    code[pc++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_MEM, 0);
+    code[pc++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 31);
+    code[pc++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0);
+    code[pc++] = (struct sock_filter)BPF_STMT(BPF_ST, 0);
+  }
+
+  Assert(pc == done);
+  code[pc++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_MEM, 0);
+  code[pc++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, nsocks);
+  code[pc++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_A, 0);
+
+  prog.len = pc;
+  prog.filter = code;
+  if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog,
+                 sizeof(prog)) < 0) {
+    ereport(LOG, (errmsg("%s(%s) failed: %m", "setsockopt",
+                         "SO_ATTACH_REUSEPORT_CBPF")));
+    return false;
+  }
+  return true;
+#else
+  ereport(LOG, (errmsg("steering by measurement is not supported on this "
+                       "platform")));
+  return false;
+#endif
 }
 
 struct SocketMethod UdpRecvSocket = {
@@ -70,6 +357,69 @@ struct SocketMethod UdpRecvSocket = {
     .flags = AI_PASSIVE,
 };
 
+/*
+ * Configure TCP listening socket.
+ *
+ * The listening socket is non-blocking for the same reason as the UDP
+ * socket, and the receive buffer size is inherited by the accepted
+ * connections.
+ */
+static int ConfigTcpRecvSocket(int fd, const struct sockaddr* addr,
+                               socklen_t addrlen) {
+  if (!pg_set_noblock(fd)) {
+    ereport(LOG, (errcode_for_socket_access(),
+                  errmsg("could not set socket to nonblocking mode: %m")));
+    return STATUS_ERROR;
+  }
+
+  if (InfluxSocketBufferSize > 0)
+    SetReceiveBufferSize(fd, InfluxSocketBufferSize);
+
+  return STATUS_OK;
+}
+
+/*
+ * Bind and listen on a TCP socket.
+ *
+ * We use SO_REUSEPORT so that several workers can listen on the same
+ * port, in which case the kernel distributes the connections between
+ * the workers, and SO_REUSEADDR so that a restarted worker can bind
+ * the port even if there are connections in TIME_WAIT state.
+ */
+static int SetupTcpRecvSocket(int fd, const struct sockaddr* addr,
+                              socklen_t addrlen) {
+  int optval = 1;
+
+  if (addr->sa_family != AF_UNIX) {
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval)) <
+        0) {
+      ereport(LOG,
+              (errmsg("%s(%s) failed: %m", "setsockopt", "SO_REUSEADDR")));
+      return STATUS_ERROR;
+    }
+
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) <
+        0) {
+      ereport(LOG,
+              (errmsg("%s(%s) failed: %m", "setsockopt", "SO_REUSEPORT")));
+      return STATUS_ERROR;
+    }
+  }
+
+  if (BindSocket(fd, addr, addrlen) < 0)
+    return STATUS_ERROR;
+
+  return listen(fd, SOMAXCONN);
+}
+
+struct SocketMethod TcpRecvSocket = {
+    .setup = SetupTcpRecvSocket,
+    .config = ConfigTcpRecvSocket,
+    .name = "listen",
+    .socktype = SOCK_STREAM,
+    .flags = AI_PASSIVE,
+};
+
 struct SocketMethod UdpSendSocket = {
     .setup = connect,
     .name = "connect",
@@ -77,6 +427,13 @@ struct SocketMethod UdpSendSocket = {
     .flags = 0,
 };
 
+struct SocketMethod TcpSendSocket = {
+    .setup = connect,
+    .name = "connect",
+    .socktype = SOCK_STREAM,
+    .flags = 0,
+};
+
 int SocketPort(struct sockaddr* addr, socklen_t addrlen) {
   switch (addr->sa_family) {
     case AF_INET:
@@ -88,12 +445,77 @@ int SocketPort(struct sockaddr* addr, socklen_t addrlen) {
   }
 }
 
+/**
+ * Get a printable name for the local address of a socket.
+ *
+ * @returns "port" followed by the port number for network sockets, or
+ * "socket" followed by the path for Unix domain sockets.
+ */
+char* SocketName(struct sockaddr* addr, socklen_t addrlen) {
+  if (addr->sa_family == AF_UNIX)
+    return psprintf("socket \"%s\"", ((struct sockaddr_un*)addr)->sun_path);
+  return psprintf("port %d", SocketPort(addr, addrlen));
+}
+
+/**
+ * Create a Unix domain socket.
+ *
+ * This works the same way as `CreateSocket`, but uses a path instead
+ * of looking up an address. Relative paths are relative to the data
+ * directory, which is the working directory of all server processes.
+ */
+static int CreateUnixSocket(const char* path, const struct SocketMethod* method,
+                            struct sockaddr* paddr, socklen_t addrlen) {
+  struct sockaddr_un addr;
+  int fd;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    ereport(LOG, (errmsg("socket path \"%s\" is too long", path)));
+    return STATUS_ERROR;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  fd = socket(AF_UNIX, method->socktype, 0);
+  if (fd == -1) {
+    ereport(LOG, (errcode_for_socket_access(),
+                  errmsg("could not create socket: %m")));
+    return STATUS_ERROR;
+  }
+
+  if (method->setup &&
+      (*method->setup)(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+    ereport(LOG, (errcode_for_socket_access(),
+                  errmsg("could not %s to \"%s\": %m", method->name, path)));
+    close(fd);
+    return STATUS_ERROR;
+  }
+
+  if (method->config == NULL ||
+      (*method->config)(fd, (struct sockaddr*)&addr, sizeof(addr)) ==
+          STATUS_OK) {
+    if (paddr) {
+      Assert(sizeof(addr) <= addrlen);
+      memcpy(paddr, &addr, sizeof(addr));
+    }
+    return fd;
+  }
+
+  close(fd);
+  return STATUS_ERROR;
+}
+
 /**
  * Create a new socket for communication.
  *
  * Lookup the address and service given and try to connect or bind it
  * to make sure that it is usable.
  *
+ * If the service starts with "unix://", the rest of the service is
+ * the path of a Unix domain socket and the hostname is ignored.
+ *
  * @param paddr Save the address in this location, if non-NULL.
  */
 int CreateSocket(const char* hostname, const char* service,
@@ -102,6 +524,10 @@ int CreateSocket(const char* hostname, const char* service,
   int err, fd = -1;
   struct addrinfo hints, *addrs, *addr;
 
+  if (strncmp(service, UNIX_SOCKET_PREFIX, strlen(UNIX_SOCKET_PREFIX)) == 0)
+    return CreateUnixSocket(service + strlen(UNIX_SOCKET_PREFIX), method,
+                            paddr, addrlen);
+
   memset(&hints, 0, sizeof(struct addrinfo));
   hints.ai_family = AF_UNSPEC; /* Allow IPv4 or IPv6 */
   hints.ai_flags = method->flags;
@@ -149,6 +575,83 @@ int CreateSocket(const char* hostname, const char* service,
   return STATUS_ERROR;
 }
 
+/**
+ * Create sockets for all addresses of a service.
+ *
+ * This works like `CreateSocket`, but instead of using the first
+ * address that works, a socket is created for each address that the
+ * hostname and service resolve to. With no hostname, this is usually
+ * the wildcard address for both IPv4 and IPv6. IPv6 sockets are set
+ * to only accept IPv6 so that they do not conflict with the IPv4
+ * socket for the same port.
+ *
+ * Addresses that cannot be used are logged and skipped.
+ *
+ * @param socks Array to store the sockets in.
+ * @param maxsocks Number of elements in `socks`.
+ * @returns Number of sockets created.
+ */
+int CreateSockets(const char* hostname, const char* service,
+                  const struct SocketMethod* method, BoundSocket* socks,
+                  int maxsocks) {
+  int err, nsocks = 0;
+  struct addrinfo hints, *addrs, *addr;
+
+  if (strncmp(service, UNIX_SOCKET_PREFIX, strlen(UNIX_SOCKET_PREFIX)) == 0) {
+    socks[0].fd = CreateUnixSocket(service + strlen(UNIX_SOCKET_PREFIX), method,
+                                   (struct sockaddr*)&socks[0].addr,
+                                   sizeof(socks[0].addr));
+    return socks[0].fd < 0 ? 0 : 1;
+  }
+
+  memset(&hints, 0, sizeof(struct addrinfo));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_flags = method->flags;
+  hints.ai_socktype = method->socktype;
+
+  err = pg_getaddrinfo_all(hostname, service, &hints, &addrs);
+  if (err) {
+    ereport(LOG, (errmsg("could not resolve service \"%s\": %s", service,
+                         gai_strerror(err))));
+    return 0;
+  }
+
+  for (addr = addrs; addr && nsocks < maxsocks; addr = addr->ai_next) {
+    const int fd = socket(addr->ai_family, method->socktype, addr->ai_protocol);
+    if (fd == -1)
+      continue;
+
+#ifdef IPV6_V6ONLY
+    if (addr->ai_family == AF_INET6) {
+      int optval = 1;
+      if (setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &optval, sizeof(optval)) <
+          0)
+        ereport(LOG,
+                (errmsg("%s(%s) failed: %m", "setsockopt", "IPV6_V6ONLY")));
+    }
+#endif
+
+    if ((method->setup &&
+         (*method->setup)(fd, addr->ai_addr, addr->ai_addrlen) == -1) ||
+        (method->config &&
+         (*method->config)(fd, addr->ai_addr, addr->ai_addrlen) != STATUS_OK)) {
+      ereport(LOG, (errcode_for_socket_access(),
+                    errmsg("could not %s to %s: %m", method->name,
+                           SocketName(addr->ai_addr, addr->ai_addrlen))));
+      close(fd);
+      continue;
+    }
+
+    Assert(addr->ai_addrlen <= sizeof(socks[nsocks].addr));
+    socks[nsocks].fd = fd;
+    memcpy(&socks[nsocks].addr, addr->ai_addr, addr->ai_addrlen);
+    ++nsocks;
+  }
+
+  pg_freeaddrinfo_all(hints.ai_family, addrs);
+  return nsocks;
+}
+
 PG_FUNCTION_INFO_V1(send_packet);
 Datum send_packet(PG_FUNCTION_ARGS) {
   struct sockaddr_storage serveraddr;
@@ -158,9 +661,8 @@ Datum send_packet(PG_FUNCTION_ARGS) {
   const int sockfd =
       CreateSocket(hostname, service, &UdpSendSocket,
                    (struct sockaddr*)&serveraddr, sizeof(serveraddr));
-  /* send the message to the server */
-  const int count = sendto(sockfd, packet, strlen(packet), 0,
-                           (struct sockaddr*)&serveraddr, sizeof(serveraddr));
+  /* send the message to the server, which the socket is connected to */
+  const int count = send(sockfd, packet, strlen(packet), 0);
   if (count < 0)
     ereport(ERROR,
             (errcode_for_socket_access(), errmsg("failed to send packet: %m")));
@@ -168,3 +670,64 @@ Datum send_packet(PG_FUNCTION_ARGS) {
   close(sockfd);
   PG_RETURN_NULL();
 }
+
+PG_FUNCTION_INFO_V1(send_request);
+Datum send_request(PG_FUNCTION_ARGS) {
+  const char* request = text_to_cstring(PG_GETARG_TEXT_PP(0));
+  const char* service = text_to_cstring(PG_GETARG_TEXT_P(1));
+  const char* hostname = text_to_cstring(PG_GETARG_TEXT_P(2));
+  const int sockfd = CreateSocket(hostname, service, &TcpSendSocket, NULL, 0);
+  struct timeval timeout = {.tv_sec = 10};
+  size_t sent = 0, length = strlen(request);
+  StringInfoData response;
+  char* end;
+
+  if (sockfd < 0)
+    ereport(ERROR, (errmsg("could not connect to service \"%s\"", service)));
+
+  /* Do not wait forever if the worker does not answer. */
+  if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) <
+      0)
+    ereport(LOG, (errmsg("%s(%s) failed: %m", "setsockopt", "SO_RCVTIMEO")));
+
+  while (sent < length) {
+    const ssize_t count = send(sockfd, request + sent, length - sent, 0);
+    if (count < 0) {
+      if (errno == EINTR)
+        continue;
+      close(sockfd);
+      ereport(ERROR, (errcode_for_socket_access(),
+                      errmsg("failed to send request: %m")));
+    }
+    sent += count;
+  }
+
+  /* The request has to ask for the connection to be closed, so the
+   * response ends when the worker closes the connection. */
+  initStringInfo(&response);
+  while (true) {
+    ssize_t count;
+
+    enlargeStringInfo(&response, 1024);
+    count = recv(sockfd, response.data + response.len,
+                 response.maxlen - response.len - 1, 0);
+    if (count < 0) {
+      if (errno == EINTR)
+        continue;
+      close(sockfd);
+      ereport(ERROR, (errcode_for_socket_access(),
+                      errmsg("failed to read response: %m")));
+    }
+    if (count == 0)
+      break;
+    response.len += count;
+    response.data[response.len] = '\0';
+  }
+  close(sockfd);
+
+  /* Only the status line is returned. */
+  end = strstr(response.data, "\r\n");
+  if (end)
+    *end = '\0';
+  PG_RETURN_TEXT_P(cstring_to_text(response.data));
+}
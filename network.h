@@ -17,13 +17,14 @@
 #ifndef NETWORK_H_
 #define NETWORK_H_
 
+#include <stdbool.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 
 /**
  * Method to setup the socket and also check it.
  *
- * Either "bind" or "connect".
+ * Either "bind", "listen", or "connect".
  */
 struct SocketMethod {
   int (*setup)(int sockfd, const struct sockaddr* addr, socklen_t addrlen);
@@ -33,12 +34,36 @@ struct SocketMethod {
   int flags;
 };
 
+/**
+ * Socket bound to one of the addresses of a service.
+ */
+typedef struct BoundSocket {
+  int fd;
+  struct sockaddr_storage addr;
+} BoundSocket;
+
+/** Prefix of services that are Unix domain socket paths. */
+#define UNIX_SOCKET_PREFIX "unix://"
+
+extern int InfluxSocketBufferSize;
+extern int InfluxUnixSocketPermissions;
+extern bool InfluxUdpSteering;
+extern int InfluxBusyPoll;
+
 extern struct SocketMethod UdpRecvSocket;
 extern struct SocketMethod UdpSendSocket;
+extern struct SocketMethod TcpRecvSocket;
+extern struct SocketMethod TcpSendSocket;
 
 extern int CreateSocket(const char* hostname, const char* service,
                         const struct SocketMethod*, struct sockaddr* addr,
                         socklen_t addrlen);
+extern int CreateSockets(const char* hostname, const char* service,
+                         const struct SocketMethod*, BoundSocket* socks,
+                         int maxsocks);
 extern int SocketPort(struct sockaddr* addr, socklen_t addrlen);
+extern char* SocketName(struct sockaddr* addr, socklen_t addrlen);
+extern bool AttachSteeringProgram(int fd, int nsocks);
+extern int SocketBacklog(int fd);
 
 #endif /* NETWORK_H_ */
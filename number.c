@@ -0,0 +1,462 @@
+/*
+ * Copyright 2022 Timescale Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "number.h"
+
+#include <postgres.h>
+
+#include <port/pg_bitutils.h>
+
+#include <float.h>
+#include <string.h>
+
+/* Range of decimal exponents that the Eisel-Lemire algorithm is used
+ * for. Numbers outside it are rare in metrics and left to strtod. */
+#define POWERS_MIN_EXP10 (-100)
+#define POWERS_MAX_EXP10 100
+#define POWERS_COUNT (POWERS_MAX_EXP10 - POWERS_MIN_EXP10 + 1)
+
+/* Number of 32-bit limbs of the big numbers used to compute the
+ * powers of ten, which is enough for 2^128 * 10^100. */
+#define BIGNUM_LIMBS 24
+
+/* The Clinger fast path needs arithmetic in double precision, without
+ * extended precision for intermediate results. */
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+#define CLINGER_FAST_PATH
+
+/* Powers of ten that are exact as doubles. */
+static const double ExactPowersOfTen[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+#endif
+
+/*
+ * The 128 most significant bits of each power of ten in the range,
+ * rounded down, as high and low words. They are computed the first
+ * time they are needed instead of being kept in a large table in the
+ * source.
+ */
+static uint64 PowersOfTen[POWERS_COUNT][2];
+static bool PowersOfTenReady = false;
+
+/* Check if eight characters are all digits. */
+static inline bool IsEightDigits(uint64 val) {
+  return (((val + UINT64CONST(0x4646464646464646)) |
+           (val - UINT64CONST(0x3030303030303030))) &
+          UINT64CONST(0x8080808080808080)) == 0;
+}
+
+/*
+ * Parse eight digits at once.
+ *
+ * The characters are loaded into a word, and pairs, quads, and then
+ * all eight digits are combined using three multiplications. This is
+ * only done on little-endian machines, where the first character is
+ * in the lowest byte.
+ */
+static inline bool ParseEightDigits(const char *ptr, uint64 *result) {
+#ifndef WORDS_BIGENDIAN
+  const uint64 mask = UINT64CONST(0x000000FF000000FF);
+  const uint64 mul1 = 100 + (UINT64CONST(1000000) << 32);
+  const uint64 mul2 = 1 + (UINT64CONST(10000) << 32);
+  uint64 val;
+
+  memcpy(&val, ptr, sizeof(val));
+  if (!IsEightDigits(val))
+    return false;
+  val -= UINT64CONST(0x3030303030303030);
+  val = (val * 10) + (val >> 8);
+  val = (((val & mask) * mul1) + (((val >> 16) & mask) * mul2)) >> 32;
+  *result = val;
+  return true;
+#else
+  return false;
+#endif
+}
+
+static inline bool IsDigit(char ch) { return ch >= '0' && ch <= '9'; }
+
+/**
+ * Parse a decimal integer.
+ *
+ * The string has to consist of an optional minus sign followed by
+ * digits and nothing else.
+ *
+ * @param str String to parse, which does not need to be terminated.
+ * @param len Length of the string.
+ * @param result[out] The value.
+ * @returns false if the string is not an integer or the value does
+ * not fit in an int64.
+ */
+bool NumberParseInt64(const char *str, size_t len, int64 *result) {
+  const char *ptr = str;
+  const char *const end = str + len;
+  bool negative = false;
+  uint64 value = 0, chunk;
+  int digits = 0;
+
+  if (ptr < end && *ptr == '-') {
+    negative = true;
+    ++ptr;
+  }
+  if (ptr == end)
+    return false;
+
+  /* Eight digits at a time as long as the value cannot overflow. */
+  while (digits <= 10 && end - ptr >= 8 && ParseEightDigits(ptr, &chunk)) {
+    value = value * 100000000 + chunk;
+    digits += 8;
+    ptr += 8;
+  }
+
+  while (ptr < end && IsDigit(*ptr)) {
+    const int digit = *ptr++ - '0';
+    if (value > (uint64)(PG_INT64_MAX - digit) / 10)
+      return false;
+    value = value * 10 + digit;
+    ++digits;
+  }
+
+  if (ptr != end || digits == 0)
+    return false;
+  *result = negative ? -(int64)value : (int64)value;
+  return true;
+}
+
+#ifdef HAVE_INT128
+
+/* Big numbers, least significant limb first. */
+typedef struct Bignum {
+  uint32 limbs[BIGNUM_LIMBS];
+} Bignum;
+
+static void BignumMultiply(Bignum *num, uint32 factor) {
+  uint64 carry = 0;
+  int i;
+
+  for (i = 0; i < BIGNUM_LIMBS; ++i) {
+    const uint64 product = (uint64)num->limbs[i] * factor + carry;
+    num->limbs[i] = (uint32)product;
+    carry = product >> 32;
+  }
+}
+
+static int BignumBitLength(const Bignum *num) {
+  int i;
+
+  for (i = BIGNUM_LIMBS - 1; i >= 0; --i)
+    if (num->limbs[i] != 0)
+      return i * 32 + pg_leftmost_one_pos32(num->limbs[i]) + 1;
+  return 0;
+}
+
+static int BignumBit(const Bignum *num, int bit) {
+  return (num->limbs[bit / 32] >> (bit % 32)) & 1;
+}
+
+static void BignumShiftLeft(Bignum *num) {
+  int i;
+
+  for (i = BIGNUM_LIMBS - 1; i > 0; --i)
+    num->limbs[i] = (num->limbs[i] << 1) | (num->limbs[i - 1] >> 31);
+  num->limbs[0] <<= 1;
+}
+
+static bool BignumLess(const Bignum *lhs, const Bignum *rhs) {
+  int i;
+
+  for (i = BIGNUM_LIMBS - 1; i >= 0; --i)
+    if (lhs->limbs[i] != rhs->limbs[i])
+      return lhs->limbs[i] < rhs->limbs[i];
+  return false;
+}
+
+static void BignumSubtract(Bignum *lhs, const Bignum *rhs) {
+  int64 borrow = 0;
+  int i;
+
+  for (i = 0; i < BIGNUM_LIMBS; ++i) {
+    const int64 diff = (int64)lhs->limbs[i] - rhs->limbs[i] - borrow;
+    lhs->limbs[i] = (uint32)diff;
+    borrow = diff < 0;
+  }
+}
+
+/* Store a bit of a 128-bit number, counted from the top. */
+static void SetPowerBit(uint64 power[2], int bit) {
+  if (bit < 64)
+    power[0] |= UINT64CONST(1) << (63 - bit);
+  else
+    power[1] |= UINT64CONST(1) << (127 - bit);
+}
+
+/*
+ * Compute the 128 most significant bits of the powers of ten.
+ *
+ * For positive exponents these are the top bits of 10^e. For negative
+ * exponents, the quotient 2^(127 + L) / 10^-e, where L is the bit
+ * length of 10^-e, has exactly 128 bits, which are the top bits of
+ * 10^e. Both are rounded down, which is what the algorithm expects.
+ */
+static void ComputePowersOfTen(void) {
+  Bignum power;
+  int exp10, bit;
+
+  memset(&power, 0, sizeof(power));
+  power.limbs[0] = 1;
+  for (exp10 = 0; exp10 <= POWERS_MAX_EXP10; ++exp10) {
+    uint64 *const result = PowersOfTen[exp10 - POWERS_MIN_EXP10];
+    const int length = BignumBitLength(&power);
+
+    result[0] = result[1] = 0;
+    for (bit = 0; bit < 128 && bit < length; ++bit)
+      if (BignumBit(&power, length - 1 - bit))
+        SetPowerBit(result, bit);
+    BignumMultiply(&power, 10);
+  }
+
+  memset(&power, 0, sizeof(power));
+  power.limbs[0] = 1;
+  for (exp10 = -1; exp10 >= POWERS_MIN_EXP10; --exp10) {
+    uint64 *const result = PowersOfTen[exp10 - POWERS_MIN_EXP10];
+    Bignum remainder;
+    int length;
+
+    BignumMultiply(&power, 10);
+    length = BignumBitLength(&power);
+    memset(&remainder, 0, sizeof(remainder));
+    result[0] = result[1] = 0;
+
+    /* Long division of 2^(127 + length) by the power, one bit at a
+     * time. The quotient is below 2^128. */
+    for (bit = 127 + length; bit >= 0; --bit) {
+      BignumShiftLeft(&remainder);
+      if (bit == 127 + length)
+        remainder.limbs[0] |= 1;
+      if (!BignumLess(&remainder, &power)) {
+        BignumSubtract(&remainder, &power);
+        if (bit < 128)
+          SetPowerBit(result, 127 - bit);
+      }
+    }
+  }
+
+  PowersOfTenReady = true;
+}
+
+static inline void Multiply64(uint64 lhs, uint64 rhs, uint64 *hi,
+                              uint64 *lo) {
+  const uint128 product = (uint128)lhs * rhs;
+  *hi = (uint64)(product >> 64);
+  *lo = (uint64)product;
+}
+
+/*
+ * Convert mantissa * 10^exp10 to the nearest double using the
+ * Eisel-Lemire algorithm.
+ *
+ * The mantissa is multiplied with the truncated 128-bit power of ten.
+ * If the truncation could change the rounding, or if the result is
+ * exactly halfway between two doubles, or subnormal, or out of range,
+ * the algorithm gives up.
+ */
+static bool EiselLemire(uint64 mantissa, int exp10, bool negative,
+                        double *result) {
+  const uint64 *power;
+  uint64 x_hi, x_lo, ret_mantissa, ret_exp2, bits;
+  int64 scaled;
+  int clz, msb;
+
+  if (exp10 < POWERS_MIN_EXP10 || exp10 > POWERS_MAX_EXP10)
+    return false;
+  if (!PowersOfTenReady)
+    ComputePowersOfTen();
+  power = PowersOfTen[exp10 - POWERS_MIN_EXP10];
+
+  /* Normalize the mantissa and estimate the binary exponent, where
+   * 217706 / 2^16 is approximately log2(10). */
+  clz = 63 - pg_leftmost_one_pos64(mantissa);
+  mantissa <<= clz;
+  scaled = (int64)217706 * exp10;
+  scaled = scaled >= 0 ? scaled >> 16 : -((-scaled + 65535) >> 16);
+  ret_exp2 = (uint64)(scaled + 64 + 1023) - clz;
+
+  Multiply64(mantissa, power[0], &x_hi, &x_lo);
+
+  /* If the lower bits are all ones, the truncated part of the power
+   * can matter, so include it. */
+  if ((x_hi & 0x1FF) == 0x1FF && x_lo + mantissa < mantissa) {
+    uint64 y_hi, y_lo, merged_hi = x_hi, merged_lo;
+
+    Multiply64(mantissa, power[1], &y_hi, &y_lo);
+    merged_lo = x_lo + y_hi;
+    if (merged_lo < x_lo)
+      merged_hi++;
+    if ((merged_hi & 0x1FF) == 0x1FF && merged_lo + 1 == 0 &&
+        y_lo + mantissa < mantissa)
+      return false;
+    x_hi = merged_hi;
+    x_lo = merged_lo;
+  }
+
+  /* Shift to 54 bits, check for a halfway case, and round to 53. */
+  msb = (int)(x_hi >> 63);
+  ret_mantissa = x_hi >> (msb + 9);
+  ret_exp2 -= 1 ^ msb;
+  if (x_lo == 0 && (x_hi & 0x1FF) == 0 && (ret_mantissa & 3) == 1)
+    return false;
+  ret_mantissa += ret_mantissa & 1;
+  ret_mantissa >>= 1;
+  if (ret_mantissa >> 53 > 0) {
+    ret_mantissa >>= 1;
+    ret_exp2 += 1;
+  }
+
+  /* Subnormal, infinite, or NaN. */
+  if (ret_exp2 - 1 >= 0x7FF - 1)
+    return false;
+
+  bits = ret_exp2 << 52 | (ret_mantissa & UINT64CONST(0x000FFFFFFFFFFFFF));
+  if (negative)
+    bits |= UINT64CONST(0x8000000000000000);
+  memcpy(result, &bits, sizeof(*result));
+  return true;
+}
+
+#endif /* HAVE_INT128 */
+
+/**
+ * Parse a decimal number into the nearest double.
+ *
+ * The string has to consist of an optional minus sign, digits with an
+ * optional decimal point, and an optional exponent, and nothing else.
+ * The result is the same as for `strtod`.
+ *
+ * @param str String to parse, which does not need to be terminated.
+ * @param len Length of the string.
+ * @param result[out] The value.
+ * @returns false if the string is not a number, or if it could not be
+ * converted by the fast paths, such as numbers with more than 19
+ * significant digits.
+ */
+bool NumberParseFloat8(const char *str, size_t len, double *result) {
+  const char *ptr = str;
+  const char *const end = str + len;
+  bool negative = false, any = false;
+  uint64 mantissa = 0, chunk;
+  int digits = 0;
+  int64 exp10 = 0;
+
+  if (ptr < end && *ptr == '-') {
+    negative = true;
+    ++ptr;
+  }
+
+  /* Leading zeros are not significant. */
+  while (ptr < end && *ptr == '0') {
+    any = true;
+    ++ptr;
+  }
+  while (digits <= 11 && end - ptr >= 8 && ParseEightDigits(ptr, &chunk)) {
+    mantissa = mantissa * 100000000 + chunk;
+    digits += 8;
+    ptr += 8;
+    any = true;
+  }
+  while (ptr < end && IsDigit(*ptr)) {
+    if (digits == 19)
+      return false;
+    mantissa = mantissa * 10 + (*ptr++ - '0');
+    ++digits;
+    any = true;
+  }
+
+  if (ptr < end && *ptr == '.') {
+    ++ptr;
+    if (mantissa == 0) {
+      while (ptr < end && *ptr == '0') {
+        --exp10;
+        ++ptr;
+        any = true;
+      }
+    }
+    while (digits <= 11 && end - ptr >= 8 && ParseEightDigits(ptr, &chunk)) {
+      mantissa = mantissa * 100000000 + chunk;
+      digits += 8;
+      exp10 -= 8;
+      ptr += 8;
+      any = true;
+    }
+    while (ptr < end && IsDigit(*ptr)) {
+      if (digits == 19)
+        return false;
+      mantissa = mantissa * 10 + (*ptr++ - '0');
+      ++digits;
+      --exp10;
+      any = true;
+    }
+  }
+
+  if (!any)
+    return false;
+
+  if (ptr < end && (*ptr == 'e' || *ptr == 'E')) {
+    bool exp_negative = false;
+    int64 exponent = 0;
+
+    ++ptr;
+    if (ptr < end && (*ptr == '+' || *ptr == '-'))
+      exp_negative = (*ptr++ == '-');
+    if (ptr == end || !IsDigit(*ptr))
+      return false;
+    while (ptr < end && IsDigit(*ptr)) {
+      if (exponent < 100000)
+        exponent = exponent * 10 + (*ptr - '0');
+      ++ptr;
+    }
+    exp10 += exp_negative ? -exponent : exponent;
+  }
+
+  if (ptr != end)
+    return false;
+
+  if (mantissa == 0) {
+    *result = negative ? -0.0 : 0.0;
+    return true;
+  }
+
+#ifdef CLINGER_FAST_PATH
+  /* Both the mantissa and the power of ten are exact as doubles, so
+   * a single multiplication or division is correctly rounded. */
+  if (mantissa <= (UINT64CONST(1) << 53) && exp10 >= -22 && exp10 <= 22) {
+    double value = (double)mantissa;
+    if (exp10 < 0)
+      value /= ExactPowersOfTen[-exp10];
+    else
+      value *= ExactPowersOfTen[exp10];
+    *result = negative ? -value : value;
+    return true;
+  }
+#endif
+
+#ifdef HAVE_INT128
+  return EiselLemire(mantissa, (int)exp10, negative, result);
+#else
+  return false;
+#endif
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright 2022 Timescale Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Module with the number parsing kernel.
+ *
+ * Integers are parsed eight digits at a time using SWAR (SIMD within
+ * a register) arithmetic on little-endian machines. Decimal numbers
+ * with at most 19 significant digits are converted to the correctly
+ * rounded double using the Clinger fast path when the result is
+ * exact, and the Eisel-Lemire algorithm otherwise.
+ *
+ * The functions never report errors. They return false for anything
+ * they do not handle, in which case the caller falls back on the
+ * usual functions (`strtod`, the type input functions), which also
+ * produce the error for invalid values. The kernel does not depend
+ * on anything in the server, so it can be built into the benchmark
+ * in `bench/`.
+ */
+
+#ifndef NUMBER_H_
+#define NUMBER_H_
+
+#include <postgres.h>
+
+extern bool NumberParseInt64(const char *str, size_t len, int64 *result);
+extern bool NumberParseFloat8(const char *str, size_t len, double *result);
+
+#endif /* NUMBER_H_ */
@@ -0,0 +1,288 @@
+/*
+ * Copyright 2022 Timescale Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "object.h"
+
+#include <postgres.h>
+#include <fmgr.h>
+
+#include <utils/builtins.h>
+#include <utils/numeric.h>
+
+#include <ctype.h>
+#include <string.h>
+
+#include "convert.h"
+#include "metric.h"
+#include "number.h"
+
+/* Numbers longer than this are stored as strings, which keeps the
+ * scale of the numeric within its limits. */
+#define OBJECT_MAX_NUMBER_LENGTH 1000
+
+/**
+ * Key and value of an object, as they are stored.
+ */
+typedef struct ObjectPair {
+  const char *key;
+  int keylen;
+
+  /** Position of the item, used to keep the last of duplicate keys */
+  int order;
+
+  /** Type of the value, as the type bits of the entry */
+  JEntry type;
+
+  /** Bytes of the value, which is a string or a numeric */
+  const char *data;
+  int datalen;
+} ObjectPair;
+
+/**
+ * Check if a string is a decimal number that the numeric input
+ * function accepts, in the syntax of JSON numbers.
+ *
+ * The exponent has at most three digits, which is within the range of
+ * the numeric type.
+ */
+static bool IsJsonNumber(const char *str, size_t len) {
+  const char *ptr = str, *const end = str + len;
+  const char *digits;
+
+  if (len > OBJECT_MAX_NUMBER_LENGTH)
+    return false;
+  if (ptr < end && *ptr == '-')
+    ++ptr;
+  digits = ptr;
+  while (ptr < end && isdigit((unsigned char)*ptr))
+    ++ptr;
+  if (ptr == digits)
+    return false;
+  if (ptr < end && *ptr == '.') {
+    digits = ++ptr;
+    while (ptr < end && isdigit((unsigned char)*ptr))
+      ++ptr;
+    if (ptr == digits)
+      return false;
+  }
+  if (ptr < end && (*ptr == 'e' || *ptr == 'E')) {
+    ++ptr;
+    if (ptr < end && (*ptr == '+' || *ptr == '-'))
+      ++ptr;
+    digits = ptr;
+    while (ptr < end && isdigit((unsigned char)*ptr))
+      ++ptr;
+    if (ptr == digits || ptr - digits > 3)
+      return false;
+  }
+  return ptr == end;
+}
+
+/**
+ * Set the value of a pair from an item.
+ *
+ * Integers that fit in 64 bits are converted directly, and other
+ * numbers using the numeric input function, which keeps all digits.
+ * Values that are not valid JSON numbers are stored as strings.
+ */
+static void SetPairValue(ObjectPair *pair, const KVItem *item) {
+  const size_t len = strlen(item->value);
+  Numeric numeric = NULL;
+  int64 ival;
+
+  switch (item->type) {
+    case TYPE_BOOLEAN:
+      pair->type = (item->value[0] == 't' || item->value[0] == 'T')
+                       ? JENTRY_ISBOOL_TRUE
+                       : JENTRY_ISBOOL_FALSE;
+      pair->data = NULL;
+      pair->datalen = 0;
+      return;
+
+    case TYPE_INTEGER:
+    case TYPE_FLOAT:
+      if (NumberParseInt64(item->value, len, &ival))
+        numeric = DatumGetNumeric(
+            DirectFunctionCall1(int8_numeric, Int64GetDatum(ival)));
+      else if (IsJsonNumber(item->value, len))
+        numeric = DatumGetNumeric(DirectFunctionCall3(
+            numeric_in, CStringGetDatum(item->value),
+            ObjectIdGetDatum(InvalidOid), Int32GetDatum(-1)));
+      break;
+
+    case TYPE_NONE:
+    case TYPE_STRING:
+      break;
+  }
+
+  if (numeric) {
+    pair->type = JENTRY_ISNUMERIC;
+    pair->data = (const char *)numeric;
+    pair->datalen = VARSIZE_ANY(numeric);
+  } else {
+    pair->type = JENTRY_ISSTRING;
+    pair->data = item->value;
+    pair->datalen = len;
+  }
+}
+
+/* Compare keys in the order of JSONB objects: by length, then
+ * bytewise. */
+static int CompareKeys(const ObjectPair *a, const ObjectPair *b) {
+  if (a->keylen != b->keylen)
+    return a->keylen > b->keylen ? 1 : -1;
+  return memcmp(a->key, b->key, a->keylen);
+}
+
+/* Compare pairs for sorting. Pairs with the same key are sorted with
+ * the last one first, so that it is the one that is kept. */
+static int ComparePairs(const void *a, const void *b) {
+  const ObjectPair *pa = (const ObjectPair *)a;
+  const ObjectPair *pb = (const ObjectPair *)b;
+  const int res = CompareKeys(pa, pb);
+
+  if (res != 0)
+    return res;
+  return pa->order > pb->order ? -1 : 1;
+}
+
+/**
+ * Sort the pairs in the order of JSONB objects and remove duplicate
+ * keys.
+ *
+ * @returns Number of pairs left.
+ */
+static int SortPairs(ObjectPair *pairs, int count) {
+  bool ordered = true, named = true;
+  int i, j;
+
+  for (i = 1; i < count; ++i) {
+    if (CompareKeys(&pairs[i - 1], &pairs[i]) >= 0)
+      ordered = false;
+    if (strcmp(pairs[i - 1].key, pairs[i].key) >= 0)
+      named = false;
+  }
+
+  if (ordered)
+    return count;
+
+  /* Keys sorted by name are unique, and keys of the same length are
+   * already in the right order, so a stable sort by length is
+   * enough. */
+  if (named) {
+    for (i = 1; i < count; ++i) {
+      const ObjectPair pair = pairs[i];
+      for (j = i; j > 0 && pairs[j - 1].keylen > pair.keylen; --j)
+        pairs[j] = pairs[j - 1];
+      pairs[j] = pair;
+    }
+    return count;
+  }
+
+  qsort(pairs, count, sizeof(ObjectPair), ComparePairs);
+  for (i = 1, j = 0; i < count; ++i) {
+    if (CompareKeys(&pairs[j], &pairs[i]) != 0)
+      pairs[++j] = pairs[i];
+  }
+  return j + 1;
+}
+
+/* Set the entry for a key or value. Every JB_OFFSET_STRIDE entry
+ * holds the end offset of the data instead of the length. */
+static void SetEntry(JEntry *entry, int index, JEntry type, uint32 length,
+                     uint32 end) {
+  if (index % JB_OFFSET_STRIDE == 0)
+    *entry = type | JENTRY_HAS_OFF | end;
+  else
+    *entry = type | length;
+}
+
+/**
+ * Build a JSONB object from a list of items.
+ *
+ * The result is the same as building the object with
+ * `pushJsonbValue` and converting it with `JsonbValueToJsonb`.
+ *
+ * @param items List of `KVItem`.
+ * @returns JSONB object with the key-value pairs.
+ */
+Jsonb *ObjectFromItems(List *items) {
+  const int count = list_length(items);
+  ObjectPair *pairs = palloc(count * sizeof(ObjectPair));
+  Size datalen = 0, offset = 0, size;
+  Jsonb *result;
+  char *data;
+  ListCell *cell;
+  int i, npairs;
+
+  i = 0;
+  foreach (cell, items) {
+    const KVItem *item = (const KVItem *)lfirst(cell);
+    pairs[i].key = item->key;
+    pairs[i].keylen = strlen(item->key);
+    pairs[i].order = i;
+    SetPairValue(&pairs[i], item);
+    ++i;
+  }
+  npairs = SortPairs(pairs, count);
+
+  /* Numerics are aligned on an int boundary relative to the start of
+   * the data, and the padding counts as part of their length. */
+  for (i = 0; i < npairs; ++i)
+    datalen += pairs[i].keylen;
+  for (i = 0; i < npairs; ++i) {
+    if (pairs[i].type == JENTRY_ISNUMERIC)
+      datalen = INTALIGN(datalen);
+    datalen += pairs[i].datalen;
+  }
+  if (datalen > JENTRY_OFFLENMASK)
+    ereport(ERROR,
+            (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+             errmsg("total size of jsonb object elements exceeds the "
+                    "maximum of %d bytes",
+                    JENTRY_OFFLENMASK)));
+
+  size = offsetof(Jsonb, root.children) + 2 * npairs * sizeof(JEntry) +
+         datalen;
+  result = palloc(size);
+  SET_VARSIZE(result, size);
+  result->root.header = npairs | JB_FOBJECT;
+  data = (char *)&result->root.children[2 * npairs];
+
+  for (i = 0; i < npairs; ++i) {
+    memcpy(data + offset, pairs[i].key, pairs[i].keylen);
+    offset += pairs[i].keylen;
+    SetEntry(&result->root.children[i], i, JENTRY_ISSTRING, pairs[i].keylen,
+             offset);
+  }
+
+  for (i = 0; i < npairs; ++i) {
+    const Size start = offset;
+    if (pairs[i].type == JENTRY_ISNUMERIC) {
+      while (offset % sizeof(int32) != 0)
+        data[offset++] = '\0';
+    }
+    if (pairs[i].datalen > 0)
+      memcpy(data + offset, pairs[i].data, pairs[i].datalen);
+    offset += pairs[i].datalen;
+    SetEntry(&result->root.children[npairs + i], npairs + i, pairs[i].type,
+             offset - start, offset);
+  }
+
+  Assert(offset == datalen);
+  pfree(pairs);
+  return result;
+}
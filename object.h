@@ -0,0 +1,47 @@
+/*
+ * Copyright 2022 Timescale Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Module to build JSONB objects from the tags and fields of a line.
+ *
+ * The objects are written directly in the binary format of JSONB,
+ * instead of building a tree of `JsonbValue` with `pushJsonbValue`
+ * and converting it, so keys and values are only copied once, from
+ * the line buffer into the result.
+ *
+ * Field values that the parser classified as integers or floats are
+ * stored as JSON numbers and booleans as JSON booleans, so they can
+ * be used in queries without casts. Tag values and other field values
+ * are stored as JSON strings.
+ *
+ * JSONB keeps the keys of an object sorted by length and then
+ * bytewise, with only the last value of duplicate keys. Agents such
+ * as Telegraf send tags and fields sorted by name, which only have to
+ * be reordered by length, so the full sort is only needed for items
+ * in any other order.
+ */
+
+#ifndef OBJECT_H_
+#define OBJECT_H_
+
+#include <postgres.h>
+
+#include <nodes/pg_list.h>
+#include <utils/jsonb.h>
+
+extern Jsonb *ObjectFromItems(List *items);
+
+#endif /* OBJECT_H_ */
@@ -0,0 +1,312 @@
+/*
+ * Copyright 2022 Timescale Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "receive.h"
+
+#include <postgres.h>
+
+#include <utils/timestamp.h>
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/* Not all C libraries define this, but it has been available in
+ * kernels since 5.0. */
+#if defined(__linux__) && !defined(UDP_GRO)
+#define UDP_GRO 104
+#endif
+
+#define BUFFER(BATCH, N) ((BATCH)->pool + (N) * ((BATCH)->bufsize + 1))
+
+/**
+ * Create a pool of receive buffers.
+ *
+ * All memory is allocated in the current memory context, which need
+ * to live as long as the batch is used.
+ *
+ * @param size Number of buffers, which is also the maximum number of
+ * datagrams read with one call.
+ * @param bufsize Size of each buffer.
+ */
+PacketBatch *PacketBatchCreate(int size, size_t bufsize) {
+  PacketBatch *batch = palloc0(sizeof(PacketBatch));
+
+  Assert(size > 0);
+
+  batch->size = size;
+  batch->bufsize = bufsize;
+  batch->lengths = palloc0(size * sizeof(*batch->lengths));
+  batch->segsizes = palloc0(size * sizeof(*batch->segsizes));
+  batch->addrs = palloc0(size * sizeof(*batch->addrs));
+  batch->stamps = palloc0(size * sizeof(*batch->stamps));
+  batch->pool = palloc(size * (bufsize + 1));
+
+#ifdef HAVE_RECVMMSG
+  {
+    int i;
+
+    batch->controllen = CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(uint32)) +
+                        CMSG_SPACE(sizeof(struct timespec));
+    batch->iov = palloc0(size * sizeof(*batch->iov));
+    batch->msgs = palloc0(size * sizeof(*batch->msgs));
+    batch->control = palloc0(size * batch->controllen);
+
+    for (i = 0; i < size; ++i) {
+      struct msghdr *hdr = &batch->msgs[i].msg_hdr;
+      batch->iov[i].iov_base = BUFFER(batch, i);
+      batch->iov[i].iov_len = bufsize;
+      hdr->msg_iov = &batch->iov[i];
+      hdr->msg_iovlen = 1;
+      hdr->msg_name = &batch->addrs[i];
+      hdr->msg_control = batch->control + i * batch->controllen;
+    }
+  }
+#endif
+
+  return batch;
+}
+
+void PacketBatchFree(PacketBatch *batch) {
+  pfree(batch->lengths);
+  pfree(batch->segsizes);
+  pfree(batch->addrs);
+  pfree(batch->stamps);
+  pfree(batch->pool);
+#ifdef HAVE_RECVMMSG
+  pfree(batch->iov);
+  pfree(batch->msgs);
+  pfree(batch->control);
+#endif
+  pfree(batch);
+}
+
+/**
+ * Enable UDP generic receive offload on socket.
+ *
+ * @returns true if GRO was enabled, false if it is not supported.
+ */
+bool EnableUdpGro(int fd) {
+#ifdef UDP_GRO
+  int optval = 1;
+  if (setsockopt(fd, IPPROTO_UDP, UDP_GRO, &optval, sizeof(optval)) < 0) {
+    ereport(LOG, (errmsg("%s(%s) failed: %m", "setsockopt", "UDP_GRO")));
+    return false;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+/**
+ * Convert a kernel time stamp to a PostgreSQL timestamp.
+ */
+TimestampTz TimespecToTimestamp(const struct timespec *ts) {
+  const int64 epoch_offset =
+      (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * SECS_PER_DAY;
+  return ((int64)ts->tv_sec - epoch_offset) * USECS_PER_SEC +
+         ts->tv_nsec / 1000;
+}
+
+/**
+ * Drop the partial line at the end of a truncated datagram.
+ *
+ * @returns Number of bytes that contain complete lines.
+ */
+size_t TrimPartialLine(const char *buffer, size_t bytes) {
+  while (bytes > 0 && buffer[bytes - 1] != '\n')
+    --bytes;
+  return bytes;
+}
+
+/**
+ * Receive a batch of datagrams from a non-blocking socket.
+ *
+ * @returns Number of buffers filled, or -1 on error, in which case
+ * `errno` is set. If no data was available, -1 is returned and
+ * `errno` is set to `EAGAIN` or `EWOULDBLOCK`.
+ */
+int PacketBatchReceive(PacketBatch *batch, int fd) {
+  int count;
+
+  batch->count = 0;
+  batch->current = 0;
+  batch->offset = 0;
+
+#ifdef HAVE_RECVMMSG
+  {
+    TimestampTz now;
+    int i;
+
+    /* The kernel update these fields, so they need to be reset
+     * before each call. */
+    for (i = 0; i < batch->size; ++i) {
+      batch->msgs[i].msg_hdr.msg_namelen = sizeof(batch->addrs[i]);
+      batch->msgs[i].msg_hdr.msg_controllen = batch->controllen;
+      batch->msgs[i].msg_hdr.msg_flags = 0;
+    }
+
+    count = recvmmsg(fd, batch->msgs, batch->size, 0, NULL);
+    if (count < 0)
+      return -1;
+
+    /* Datagrams without a kernel time stamp get the time when they
+     * were read instead. */
+    now = GetCurrentTimestamp();
+
+    for (i = 0; i < count; ++i) {
+      struct msghdr *hdr = &batch->msgs[i].msg_hdr;
+      struct cmsghdr *cmsg;
+
+      batch->lengths[i] = batch->msgs[i].msg_len;
+      batch->segsizes[i] = 0;
+      batch->stamps[i] = now;
+      for (cmsg = CMSG_FIRSTHDR(hdr); cmsg; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+#ifdef SO_TIMESTAMPNS
+        if (cmsg->cmsg_level == SOL_SOCKET &&
+            cmsg->cmsg_type == SO_TIMESTAMPNS) {
+          struct timespec ts;
+          memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+          batch->stamps[i] = TimespecToTimestamp(&ts);
+        }
+#endif
+#ifdef UDP_GRO
+        if (cmsg->cmsg_level == IPPROTO_UDP && cmsg->cmsg_type == UDP_GRO) {
+          int segsize;
+          memcpy(&segsize, CMSG_DATA(cmsg), sizeof(segsize));
+          batch->segsizes[i] = segsize;
+        }
+#endif
+#ifdef SO_RXQ_OVFL
+        /* The kernel counter is for the lifetime of the socket and
+         * wraps around, so we just add the difference since the last
+         * datagram. */
+        if (cmsg->cmsg_level == SOL_SOCKET &&
+            cmsg->cmsg_type == SO_RXQ_OVFL) {
+          uint32 drops;
+          memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+          batch->stats.dropped += (uint32)(drops - batch->stats.kernel_drops);
+          batch->stats.kernel_drops = drops;
+        }
+#endif
+      }
+
+      batch->stats.bytes += batch->lengths[i];
+
+      /* If the datagram was truncated, the last line is incomplete,
+       * so we remove it to avoid inserting a partial line. Coalesced
+       * datagrams are never truncated by the kernel. */
+      if (hdr->msg_flags & MSG_TRUNC) {
+        batch->stats.truncated++;
+        batch->lengths[i] =
+            TrimPartialLine(BUFFER(batch, i), batch->lengths[i]);
+      }
+    }
+  }
+#else
+  /* Datagrams are read one at a time with recvmsg rather than
+   * recvfrom, since only the message flags tell if a datagram was
+   * truncated. */
+  for (count = 0; count < batch->size; ++count) {
+    struct iovec iov;
+    struct msghdr hdr = {0};
+    ssize_t bytes;
+
+    iov.iov_base = BUFFER(batch, count);
+    iov.iov_len = batch->bufsize;
+    hdr.msg_name = &batch->addrs[count];
+    hdr.msg_namelen = sizeof(batch->addrs[count]);
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+
+    bytes = recvmsg(fd, &hdr, 0);
+    if (bytes < 0) {
+      /* If we already have read some datagrams, we return those and
+       * let the next call report the error. */
+      if (count > 0)
+        break;
+      return -1;
+    }
+    batch->lengths[count] = bytes;
+    batch->segsizes[count] = 0;
+    batch->stamps[count] = GetCurrentTimestamp();
+    batch->stats.bytes += bytes;
+
+    /* Same as above, the partial line of a truncated datagram is
+     * removed. */
+    if (hdr.msg_flags & MSG_TRUNC) {
+      batch->stats.truncated++;
+      batch->lengths[count] =
+          TrimPartialLine(BUFFER(batch, count), batch->lengths[count]);
+    }
+  }
+#endif
+
+  batch->stats.datagrams += count;
+  batch->count = count;
+  return count;
+}
+
+/**
+ * Get next packet from the batch.
+ *
+ * Buffers with coalesced datagrams are split into one packet for each
+ * datagram. Since datagrams in a coalesced buffer follow each other
+ * directly, we save the character overwritten by the null terminator
+ * and restore it when the next packet is fetched, so the previous
+ * packet is no longer terminated when that happens.
+ *
+ * @param batch Batch to fetch packet from.
+ * @param packet[out] Next packet.
+ * @retval true A packet was returned.
+ * @retval false There are no more packets in the batch.
+ */
+bool PacketBatchNext(PacketBatch *batch, Packet *packet) {
+  while (batch->current < batch->count) {
+    char *buffer = BUFFER(batch, batch->current);
+    const size_t length = batch->lengths[batch->current];
+    const size_t segsize = batch->segsizes[batch->current];
+    size_t bytes;
+
+    if (batch->offset >= length) {
+      batch->current++;
+      batch->offset = 0;
+      continue;
+    }
+
+    if (batch->offset > 0)
+      buffer[batch->offset] = batch->saved;
+
+    bytes = length - batch->offset;
+    if (segsize > 0 && segsize < bytes)
+      bytes = segsize;
+
+    packet->data = buffer + batch->offset;
+    packet->bytes = bytes;
+    packet->source = (struct sockaddr *)&batch->addrs[batch->current];
+    packet->received = batch->stamps[batch->current];
+    batch->offset += bytes;
+    batch->saved = buffer[batch->offset];
+    buffer[batch->offset] = '\0';
+    return true;
+  }
+  return false;
+}
@@ -0,0 +1,168 @@
+/*
+ * Copyright 2022 Timescale Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Module to receive datagrams in batches.
+ *
+ * Datagrams are read into a pool of buffers that are allocated once
+ * and re-used for each batch. On Linux, the full batch is read using
+ * a single `recvmmsg` call and the socket can optionally use UDP
+ * generic receive offload (GRO), in which case the kernel can
+ * coalesce several datagrams into a single buffer.
+ *
+ * The kernel time stamps each datagram when it arrives, which is
+ * kept with the datagram so that the time from arrival to commit can
+ * be measured.
+ */
+
+#ifndef RECEIVE_H_
+#define RECEIVE_H_
+
+#include <postgres.h>
+
+#include <datatype/timestamp.h>
+
+#include <stdbool.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
+
+#ifdef __linux__
+#define HAVE_RECVMMSG 1
+#endif
+
+/**
+ * A received datagram.
+ *
+ * The data is null-terminated, which is what the parser expects, and
+ * can be modified in place.
+ */
+typedef struct Packet {
+  char *data;
+  size_t bytes;
+
+  /** Address the datagram was sent from, or NULL if not known */
+  const struct sockaddr *source;
+
+  /** Time when the datagram was received */
+  TimestampTz received;
+} Packet;
+
+/**
+ * Header of a packet stored in a ring or a spool.
+ *
+ * The null-terminated payload follows the header, so that the packet
+ * can be parsed in place. A length of `PG_UINT32_MAX` marks the rest
+ * of the ring as unused.
+ */
+typedef struct PacketHeader {
+  /** Length of the payload */
+  uint32 length;
+
+  /** Time when the packet was received */
+  TimestampTz received;
+} PacketHeader;
+
+/* Size of a stored packet, including the header and the terminating
+ * null. Packets are aligned so that the header of the next packet is
+ * aligned. */
+#define PACKET_RECORD_SIZE(BYTES) \
+  TYPEALIGN(8, sizeof(PacketHeader) + (BYTES) + 1)
+
+/**
+ * Counters for received datagrams.
+ */
+typedef struct ReceiveStats {
+  /** Number of datagrams received */
+  uint64 datagrams;
+
+  /** Number of bytes received */
+  uint64 bytes;
+
+  /** Number of datagrams that did not fit in the buffer */
+  uint64 truncated;
+
+  /** Number of datagrams dropped by the kernel */
+  uint64 dropped;
+
+  /** Number of datagrams dropped because the rings or the spool were
+   * full */
+  uint64 overflowed;
+
+  /** Last value of the kernel drop counter for the socket */
+  uint32 kernel_drops;
+} ReceiveStats;
+
+/**
+ * Pool of receive buffers.
+ *
+ * Each buffer has room for one datagram, or for several coalesced
+ * datagrams if GRO is used, and a terminating null character.
+ */
+typedef struct PacketBatch {
+  /** Number of buffers in the pool */
+  int size;
+
+  /** Size of each buffer, not counting the terminating null */
+  size_t bufsize;
+
+  /** Number of buffers filled by the last receive */
+  int count;
+
+  /** Buffer currently being returned by `PacketBatchNext` */
+  int current;
+
+  /** Offset into current buffer for next GRO segment */
+  size_t offset;
+
+  /** Character overwritten when terminating the previous segment */
+  char saved;
+
+  /** Length of the received data for each buffer */
+  size_t *lengths;
+
+  /** GRO segment size for each buffer, or zero if not coalesced */
+  size_t *segsizes;
+
+  /** Source address for each buffer */
+  struct sockaddr_storage *addrs;
+
+  /** Receive time for each buffer */
+  TimestampTz *stamps;
+
+  /** Buffer memory, `size` buffers of `bufsize + 1` bytes */
+  char *pool;
+
+  /** Counters for all datagrams received into the batch */
+  ReceiveStats stats;
+
+#ifdef HAVE_RECVMMSG
+  struct iovec *iov;
+  struct mmsghdr *msgs;
+  char *control;
+  size_t controllen;
+#endif
+} PacketBatch;
+
+extern PacketBatch *PacketBatchCreate(int size, size_t bufsize);
+extern void PacketBatchFree(PacketBatch *batch);
+extern int PacketBatchReceive(PacketBatch *batch, int fd);
+extern bool PacketBatchNext(PacketBatch *batch, Packet *packet);
+extern bool EnableUdpGro(int fd);
+extern TimestampTz TimespecToTimestamp(const struct timespec *ts);
+extern size_t TrimPartialLine(const char *buffer, size_t bytes);
+
+#endif /* RECEIVE_H_ */
@@ -0,0 +1,321 @@
+/*
+ * Copyright 2022 Timescale Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ring.h"
+
+#include <postgres.h>
+
+#include <port/pg_bitutils.h>
+#include <storage/latch.h>
+#include <storage/shm_toc.h>
+#include <utils/memutils.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+
+/* Magic number for the table of contents of the segment. */
+#define RING_MAGIC 0x494e464c
+
+/* Key of the shared header in the table of contents. The rings use
+ * the keys following it. */
+#define RING_KEY_HEADER 0
+
+/* Length word marking the rest of the ring as unused. */
+#define RING_PADDING PG_UINT32_MAX
+
+/**
+ * Shared header of a ring set.
+ */
+typedef struct RingSetHeader {
+  int nrings;
+} RingSetHeader;
+
+static RingSet *RingSetSetup(dsm_segment *seg, shm_toc *toc) {
+  RingSetHeader *header = shm_toc_lookup(toc, RING_KEY_HEADER, false);
+  RingSet *set = MemoryContextAllocZero(TopMemoryContext, sizeof(RingSet));
+  int i;
+
+  set->segment = seg;
+  set->nrings = header->nrings;
+  set->rings =
+      MemoryContextAlloc(TopMemoryContext, set->nrings * sizeof(InfluxRing *));
+  for (i = 0; i < set->nrings; ++i)
+    set->rings[i] = shm_toc_lookup(toc, RING_KEY_HEADER + 1 + i, false);
+  return set;
+}
+
+/**
+ * Create a set of rings in a new dynamic shared memory segment.
+ *
+ * The mapping is kept for the lifetime of the process.
+ *
+ * @param nrings Number of rings, one for each consumer.
+ * @param size Size of each ring, which is rounded up to a power of 2.
+ */
+RingSet *RingSetCreate(int nrings, uint64 size) {
+  shm_toc_estimator estimator;
+  shm_toc *toc;
+  dsm_segment *seg;
+  RingSetHeader *header;
+  const Size ringsize = offsetof(InfluxRing, data) + pg_nextpower2_64(size);
+  int i;
+
+  shm_toc_initialize_estimator(&estimator);
+  shm_toc_estimate_chunk(&estimator, sizeof(RingSetHeader));
+  for (i = 0; i < nrings; ++i)
+    shm_toc_estimate_chunk(&estimator, ringsize);
+  shm_toc_estimate_keys(&estimator, nrings + 1);
+
+  seg = dsm_create(shm_toc_estimate(&estimator), 0);
+  dsm_pin_mapping(seg);
+  toc = shm_toc_create(RING_MAGIC, dsm_segment_address(seg),
+                       dsm_segment_map_length(seg));
+
+  header = shm_toc_allocate(toc, sizeof(RingSetHeader));
+  header->nrings = nrings;
+  shm_toc_insert(toc, RING_KEY_HEADER, header);
+
+  for (i = 0; i < nrings; ++i) {
+    InfluxRing *ring = shm_toc_allocate(toc, ringsize);
+    ring->consumer = NULL;
+    pg_atomic_init_u32(&ring->consumer_pid, 0);
+    ring->size = pg_nextpower2_64(size);
+    pg_atomic_init_u64(&ring->head, 0);
+    pg_atomic_init_u64(&ring->tail, 0);
+    shm_toc_insert(toc, RING_KEY_HEADER + 1 + i, ring);
+  }
+
+  return RingSetSetup(seg, toc);
+}
+
+/**
+ * Attach to an existing set of rings.
+ *
+ * @returns The ring set, or NULL if the segment no longer exists.
+ */
+RingSet *RingSetAttach(dsm_handle handle) {
+  dsm_segment *seg = dsm_attach(handle);
+  shm_toc *toc;
+
+  if (seg == NULL)
+    return NULL;
+  dsm_pin_mapping(seg);
+
+  toc = shm_toc_attach(RING_MAGIC, dsm_segment_address(seg));
+  if (toc == NULL)
+    ereport(ERROR, (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+                    errmsg("invalid magic number in ring segment")));
+
+  return RingSetSetup(seg, toc);
+}
+
+/**
+ * Write a record to a ring.
+ *
+ * @returns false if there is no room for the record.
+ */
+static bool RingPut(InfluxRing *ring, const Packet *packet) {
+  const uint64 need = PACKET_RECORD_SIZE(packet->bytes);
+  uint64 head = pg_atomic_read_u64(&ring->head);
+  const uint64 tail = pg_atomic_read_u64(&ring->tail);
+  uint64 offset = head & (ring->size - 1);
+  const uint64 contiguous = ring->size - offset;
+  const uint64 total = (contiguous < need) ? contiguous + need : need;
+  PacketHeader header;
+
+  if (head + total - tail > ring->size)
+    return false;
+
+  /* Make sure that we do not overwrite anything before the consumer
+   * has released it. */
+  pg_memory_barrier();
+
+  if (contiguous < need) {
+    const uint32 padding = RING_PADDING;
+    memcpy(ring->data + offset, &padding, sizeof(padding));
+    head += contiguous;
+    offset = 0;
+  }
+
+  header.length = packet->bytes;
+  header.received = packet->received;
+  memcpy(ring->data + offset, &header, sizeof(header));
+  memcpy(ring->data + offset + sizeof(header), packet->data, packet->bytes);
+  ring->data[offset + sizeof(header) + packet->bytes] = '\0';
+
+  /* The record has to be written before it is published. */
+  pg_write_barrier();
+  pg_atomic_write_u64(&ring->head, head + need);
+  return true;
+}
+
+/**
+ * Write a record to one of the rings.
+ *
+ * Records are distributed round-robin over the rings. If a ring is
+ * full, the next ring is tried.
+ *
+ * @returns false if all rings are full.
+ */
+bool RingSetPut(RingSet *set, const Packet *packet) {
+  int i;
+
+  for (i = 0; i < set->nrings; ++i) {
+    InfluxRing *ring = set->rings[set->next];
+    set->next = (set->next + 1) % set->nrings;
+    if (RingPut(ring, packet))
+      return true;
+  }
+  return false;
+}
+
+/**
+ * Wake up the consumers of rings that have records.
+ */
+void RingSetWakeConsumers(RingSet *set) {
+  int i;
+
+  for (i = 0; i < set->nrings; ++i) {
+    InfluxRing *ring = set->rings[i];
+    PGPROC *consumer = ring->consumer;
+    if (consumer && pg_atomic_read_u64(&ring->head) !=
+                        pg_atomic_read_u64(&ring->tail))
+      SetLatch(&consumer->procLatch);
+  }
+}
+
+/**
+ * Compute how full the rings are.
+ *
+ * @returns Used part of the rings in percent.
+ */
+int RingSetUsage(RingSet *set) {
+  uint64 used = 0, size = 0;
+  int i;
+
+  for (i = 0; i < set->nrings; ++i) {
+    InfluxRing *ring = set->rings[i];
+    used +=
+        pg_atomic_read_u64(&ring->head) - pg_atomic_read_u64(&ring->tail);
+    size += ring->size;
+  }
+  return (int)(100 * used / size);
+}
+
+/**
+ * Attach to the first free ring as consumer.
+ *
+ * @returns Reader for the ring, or NULL if all rings already have a
+ * consumer.
+ */
+RingReader *RingSetAttachReader(RingSet *set) {
+  int i;
+
+  for (i = 0; i < set->nrings; ++i) {
+    InfluxRing *ring = set->rings[i];
+    uint32 expected = 0;
+    RingReader *reader;
+
+    if (!pg_atomic_compare_exchange_u32(&ring->consumer_pid, &expected,
+                                        MyProcPid))
+      continue;
+
+    reader = MemoryContextAllocZero(TopMemoryContext, sizeof(RingReader));
+    reader->ring = ring;
+    pg_write_barrier();
+    ring->consumer = MyProc;
+    return reader;
+  }
+  return NULL;
+}
+
+/**
+ * Free the rings of consumers that have exited.
+ *
+ * A new consumer that attaches to the ring continues where the old
+ * one stopped. Records that the old consumer had released are not
+ * read again, except the one it was reading when it exited.
+ *
+ * @returns Number of rings that were freed.
+ */
+int RingSetReleaseExited(RingSet *set) {
+  int i, released = 0;
+
+  for (i = 0; i < set->nrings; ++i) {
+    InfluxRing *ring = set->rings[i];
+    const pid_t pid = pg_atomic_read_u32(&ring->consumer_pid);
+
+    if (pid == 0 || kill(pid, 0) == 0 || errno != ESRCH)
+      continue;
+    ring->consumer = NULL;
+    pg_write_barrier();
+    pg_atomic_write_u32(&ring->consumer_pid, 0);
+    ++released;
+  }
+  return released;
+}
+
+/**
+ * Get next record from the ring.
+ *
+ * The record returned by the previous call is released, so it is no
+ * longer valid when this is called.
+ *
+ * @param reader Reader to fetch packet from.
+ * @param packet[out] Next packet, which can be modified in place.
+ * @retval true A packet was returned.
+ * @retval false The ring is empty.
+ */
+bool RingReaderNext(RingReader *reader, Packet *packet) {
+  InfluxRing *ring = reader->ring;
+  uint64 tail = pg_atomic_read_u64(&ring->tail);
+  uint64 head;
+
+  if (reader->pending > 0) {
+    /* We have to be done with the record before the producer can
+     * overwrite it. */
+    pg_memory_barrier();
+    tail += reader->pending;
+    pg_atomic_write_u64(&ring->tail, tail);
+    reader->pending = 0;
+  }
+
+  head = pg_atomic_read_u64(&ring->head);
+  pg_read_barrier();
+
+  while (tail != head) {
+    const uint64 offset = tail & (ring->size - 1);
+    PacketHeader header;
+
+    memcpy(&header, ring->data + offset, sizeof(header.length));
+    if (header.length == RING_PADDING) {
+      tail += ring->size - offset;
+      pg_atomic_write_u64(&ring->tail, tail);
+      continue;
+    }
+
+    memcpy(&header, ring->data + offset, sizeof(header));
+    packet->data = ring->data + offset + sizeof(header);
+    packet->bytes = header.length;
+    packet->source = NULL;
+    packet->received = header.received;
+    reader->pending = PACKET_RECORD_SIZE(header.length);
+    return true;
+  }
+
+  return false;
+}
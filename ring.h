@@ -0,0 +1,103 @@
+/*
+ * Copyright 2022 Timescale Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Module with ring buffers in dynamic shared memory.
+ *
+ * A receiver process copies datagrams into a set of rings, and each
+ * ring is drained by one inserter process. Each ring has a single
+ * producer and a single consumer, so no locks are needed: the
+ * producer only advances the head and the consumer only advances the
+ * tail.
+ *
+ * Datagrams are stored as records with a `PacketHeader` followed by
+ * the null-terminated payload, so that the consumer can parse them in
+ * place. If a record does not fit at the end of the ring, a padding
+ * record is written and the record is stored at the start.
+ */
+
+#ifndef RING_H_
+#define RING_H_
+
+#include <postgres.h>
+
+#include <port/atomics.h>
+#include <storage/dsm.h>
+#include <storage/proc.h>
+
+#include "receive.h"
+
+/**
+ * Ring buffer for one consumer.
+ */
+typedef struct InfluxRing {
+  /** Process draining the ring, or NULL if not attached yet */
+  PGPROC *volatile consumer;
+
+  /** Process id of the consumer that claimed the ring, or zero if the
+   * ring is free */
+  pg_atomic_uint32 consumer_pid;
+
+  /** Size of the data area, a power of 2 */
+  uint64 size;
+
+  /** Position where the next record will be written */
+  pg_atomic_uint64 head;
+
+  /** Position of the next record to read */
+  pg_atomic_uint64 tail;
+
+  /** Ring data */
+  char data[FLEXIBLE_ARRAY_MEMBER];
+} InfluxRing;
+
+/**
+ * Set of rings in a dynamic shared memory segment.
+ */
+typedef struct RingSet {
+  /** Segment containing the rings */
+  dsm_segment *segment;
+
+  /** Number of rings */
+  int nrings;
+
+  /** Rings in the segment */
+  InfluxRing **rings;
+
+  /** Ring to try first for the next record */
+  int next;
+} RingSet;
+
+/**
+ * Consumer state for a ring.
+ */
+typedef struct RingReader {
+  InfluxRing *ring;
+
+  /** Bytes to release from the tail before reading the next record */
+  uint64 pending;
+} RingReader;
+
+extern RingSet *RingSetCreate(int nrings, uint64 size);
+extern RingSet *RingSetAttach(dsm_handle handle);
+extern bool RingSetPut(RingSet *set, const Packet *packet);
+extern void RingSetWakeConsumers(RingSet *set);
+extern int RingSetUsage(RingSet *set);
+extern RingReader *RingSetAttachReader(RingSet *set);
+extern int RingSetReleaseExited(RingSet *set);
+extern bool RingReaderNext(RingReader *reader, Packet *packet);
+
+#endif /* RING_H_ */
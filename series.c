@@ -0,0 +1,330 @@
+/*
+ * Copyright 2022 Timescale Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "series.h"
+
+#include <postgres.h>
+
+#include <access/tupdesc.h>
+#include <common/hashfn.h>
+#include <lib/ilist.h>
+#include <utils/datum.h>
+#include <utils/hsearch.h>
+#include <utils/memutils.h>
+
+#include <string.h>
+
+#include "stats.h"
+
+/** Memory for cached series in kilobytes, or zero to not cache. */
+int InfluxSeriesCacheSize = 8192;
+
+static MemoryContext SeriesContext = NULL;
+static HTAB *SeriesCache = NULL;
+
+/* Series in the cache, most recently used first. */
+static dlist_head SeriesList = DLIST_STATIC_INIT(SeriesList);
+
+/* Memory used by all series in the cache, in bytes. */
+static Size SeriesCacheSpace = 0;
+
+static uint32 SeriesHash(const void *key, Size keysize) {
+  const SeriesKey *series = (const SeriesKey *)key;
+  return hash_combine(
+      hash_bytes((const unsigned char *)series->name, strlen(series->name)),
+      hash_bytes((const unsigned char *)series->tagset, series->length));
+}
+
+static int SeriesMatch(const void *key1, const void *key2, Size keysize) {
+  const SeriesKey *series1 = (const SeriesKey *)key1;
+  const SeriesKey *series2 = (const SeriesKey *)key2;
+
+  if (series1->length != series2->length ||
+      memcmp(series1->tagset, series2->tagset, series1->length) != 0)
+    return 1;
+  return strcmp(series1->name, series2->name);
+}
+
+static void InitSeriesCache(void) {
+  HASHCTL hash_ctl;
+
+  SeriesContext = AllocSetContextCreate(TopMemoryContext, "Influx Series Cache",
+                                        ALLOCSET_DEFAULT_SIZES);
+
+  memset(&hash_ctl, 0, sizeof(hash_ctl));
+  hash_ctl.keysize = sizeof(SeriesKey);
+  hash_ctl.entrysize = sizeof(SeriesEntry);
+  hash_ctl.hash = SeriesHash;
+  hash_ctl.match = SeriesMatch;
+  hash_ctl.hcxt = SeriesContext;
+  SeriesCache =
+      hash_create("Influx Series", 1024, &hash_ctl,
+                  HASH_ELEM | HASH_FUNCTION | HASH_COMPARE | HASH_CONTEXT);
+  dlist_init(&SeriesList);
+  SeriesCacheSpace = 0;
+}
+
+/* Free the values derived for a series, but keep the series. */
+static void ReleaseValues(SeriesEntry *series) {
+  Size space = 0;
+  int i;
+
+  for (i = 0; i < series->ncolumns; ++i) {
+    if (series->columns[i].byref) {
+      space += GetMemoryChunkSpace(DatumGetPointer(series->columns[i].value));
+      pfree(DatumGetPointer(series->columns[i].value));
+    }
+  }
+  if (series->columns) {
+    space += GetMemoryChunkSpace(series->columns);
+    pfree(series->columns);
+  }
+  if (series->object) {
+    space += GetMemoryChunkSpace(series->object);
+    pfree(series->object);
+  }
+
+  series->table = NULL;
+  series->version = 0;
+  series->columns = NULL;
+  series->ncolumns = 0;
+  series->object = NULL;
+  series->space -= space;
+  SeriesCacheSpace -= space;
+}
+
+/* Remove a series from the cache. */
+static void RemoveSeries(SeriesEntry *series) {
+  const SeriesKey key = series->key;
+  KVItem *items = series->items;
+
+  ReleaseValues(series);
+  SeriesCacheSpace -= series->space;
+  dlist_delete(&series->node);
+  hash_search(SeriesCache, &key, HASH_REMOVE, NULL);
+
+  /* The key points into the same chunk as the items, so it can only
+   * be freed once the entry has been removed. */
+  pfree(items);
+}
+
+/* Evict the least recently used series until the cache fits in its
+ * size, but never the series that is being used. */
+static void EvictSeries(SeriesEntry *keep) {
+  const Size limit = (Size)InfluxSeriesCacheSize * 1024;
+
+  while (SeriesCacheSpace > limit && !dlist_is_empty(&SeriesList)) {
+    SeriesEntry *series = dlist_tail_element(SeriesEntry, node, &SeriesList);
+    if (series == keep)
+      break;
+    RemoveSeries(series);
+  }
+}
+
+static char *CopyString(char **ptr, const char *str) {
+  const Size size = strlen(str) + 1;
+  char *result = *ptr;
+  memcpy(result, str, size);
+  *ptr += size;
+  return result;
+}
+
+/**
+ * Find a series in the cache.
+ *
+ * A series that is found becomes the most recently used one.
+ *
+ * @param name Measurement name.
+ * @param tagset Raw tag set of the line, which does not have to be
+ * null-terminated.
+ * @param length Length of the tag set.
+ * @returns The series, or NULL if it is not in the cache.
+ */
+SeriesEntry *SeriesLookup(const char *name, const char *tagset,
+                          uint32 length) {
+  SeriesEntry *series = NULL;
+  SeriesKey key;
+
+  key.name = name;
+  key.tagset = tagset;
+  key.length = length;
+  if (SeriesCache)
+    series = hash_search(SeriesCache, &key, HASH_FIND, NULL);
+
+  if (!series) {
+    StatsAdd(STAT_SERIES_MISSES, 1);
+    return NULL;
+  }
+
+  StatsAdd(STAT_SERIES_HITS, 1);
+  dlist_move_head(&SeriesList, &series->node);
+  return series;
+}
+
+/**
+ * Add a series to the cache.
+ *
+ * The name, the tag set, and the tags are copied into a single chunk
+ * owned by the cache, and the least recently used series are evicted
+ * if the cache is full.
+ *
+ * @param name Measurement name.
+ * @param tagset Raw tag set of the line, as it was before the tags
+ * were parsed.
+ * @param length Length of the tag set.
+ * @param tags Tags parsed from the tag set.
+ * @returns The new series.
+ */
+SeriesEntry *SeriesAdd(const char *name, const char *tagset, uint32 length,
+                       List *tags) {
+  const Size namelen = strlen(name) + 1;
+  Size size = list_length(tags) * sizeof(KVItem) + namelen + length;
+  SeriesEntry *series;
+  SeriesKey key;
+  KVItem *items;
+  ListCell *cell;
+  char *ptr;
+  bool found;
+
+  foreach (cell, tags) {
+    const KVItem *tag = (KVItem *)lfirst(cell);
+    size += strlen(tag->key) + 1;
+    if (tag->value)
+      size += strlen(tag->value) + 1;
+  }
+
+  if (!SeriesCache)
+    InitSeriesCache();
+
+  items = MemoryContextAlloc(SeriesContext, size);
+  ptr = (char *)(items + list_length(tags));
+  key.name = CopyString(&ptr, name);
+  key.tagset = ptr;
+  key.length = length;
+  memcpy(ptr, tagset, length);
+  ptr += length;
+
+  foreach (cell, tags) {
+    const KVItem *tag = (KVItem *)lfirst(cell);
+    KVItem *item = &items[foreach_current_index(cell)];
+    item->key = CopyString(&ptr, tag->key);
+    item->value = tag->value ? CopyString(&ptr, tag->value) : NULL;
+    item->type = tag->type;
+  }
+
+  series = hash_search(SeriesCache, &key, HASH_ENTER, &found);
+  if (found) {
+    pfree(items);
+    return series;
+  }
+
+  series->items = items;
+  series->nitems = list_length(tags);
+  series->table = NULL;
+  series->version = 0;
+  series->columns = NULL;
+  series->ncolumns = 0;
+  series->object = NULL;
+  series->space = sizeof(SeriesEntry) + GetMemoryChunkSpace(items);
+  dlist_push_head(&SeriesList, &series->node);
+  SeriesCacheSpace += series->space;
+
+  EvictSeries(series);
+  return series;
+}
+
+/**
+ * Get the tags of a series.
+ *
+ * The list is allocated in the current memory context, but the items
+ * belong to the cache and must not be modified.
+ */
+List *SeriesTags(SeriesEntry *series) {
+  List *tags = NIL;
+  int i;
+
+  for (i = 0; i < series->nitems; ++i)
+    tags = lappend(tags, &series->items[i]);
+  return tags;
+}
+
+/**
+ * Set the values derived for a series from the description of a
+ * table.
+ *
+ * The values are copied into the cache and replace the previous
+ * values of the series. Everything is copied before the previous
+ * values are released, so the series is left as it was if copying
+ * fails.
+ *
+ * @param series Series to set the values of.
+ * @param table Table the values were derived for.
+ * @param columns Values of the tag columns.
+ * @param ncolumns Number of tag columns.
+ * @param object Value of the `_tags` column, or NULL.
+ */
+void SeriesSetValues(SeriesEntry *series, MetricTable table,
+                     SeriesColumn *columns, int ncolumns, Jsonb *object) {
+  TupleDesc tupdesc = table->attinmeta->tupdesc;
+  SeriesColumn *copy = NULL;
+  MemoryContext oldcontext;
+  Size space = 0;
+  int i;
+
+  oldcontext = MemoryContextSwitchTo(SeriesContext);
+  if (ncolumns > 0) {
+    copy = palloc(ncolumns * sizeof(SeriesColumn));
+    space += GetMemoryChunkSpace(copy);
+  }
+  for (i = 0; i < ncolumns; ++i) {
+    Form_pg_attribute attr = TupleDescAttr(tupdesc, columns[i].attnum - 1);
+    copy[i] = columns[i];
+    copy[i].byref = !columns[i].isnull && !attr->attbyval;
+    if (copy[i].byref) {
+      copy[i].value = datumCopy(columns[i].value, false, attr->attlen);
+      space += GetMemoryChunkSpace(DatumGetPointer(copy[i].value));
+    }
+  }
+  if (object) {
+    object = memcpy(palloc(VARSIZE(object)), object, VARSIZE(object));
+    space += GetMemoryChunkSpace(object);
+  }
+  MemoryContextSwitchTo(oldcontext);
+
+  ReleaseValues(series);
+  series->table = table;
+  series->version = table->version;
+  series->columns = copy;
+  series->ncolumns = ncolumns;
+  series->object = object;
+  series->space += space;
+  SeriesCacheSpace += space;
+
+  EvictSeries(series);
+}
+
+/**
+ * Remove all series from the cache and free its memory.
+ */
+void SeriesCacheReset(void) {
+  if (!SeriesCache)
+    return;
+  MemoryContextDelete(SeriesContext);
+  SeriesContext = NULL;
+  SeriesCache = NULL;
+  dlist_init(&SeriesList);
+  SeriesCacheSpace = 0;
+}
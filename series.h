@@ -0,0 +1,135 @@
+/*
+ * Copyright 2022 Timescale Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Module for the series cache.
+ *
+ * A series is a measurement together with a set of tags, and agents
+ * usually send many lines for each series, which have the same tag
+ * set, byte for byte. Each worker keeps the series it has seen
+ * recently, keyed by the measurement name and the raw tag set of the
+ * line, so that the tags of further lines for the series do not have
+ * to be parsed, converted to the types of their columns, and turned
+ * into the `_tags` object again. Only the fields and the timestamp of
+ * those lines are processed.
+ *
+ * The tags of a series are kept as they were parsed. The values of
+ * the tag columns and the `_tags` object are derived from the tags
+ * and the description of the table the first time a line of the
+ * series is inserted, and again when the table was described anew,
+ * for example because it was altered.
+ *
+ * The cache is bounded by `influx.series_cache_size`, and the least
+ * recently used series are evicted when it is full.
+ */
+
+#ifndef SERIES_H_
+#define SERIES_H_
+
+#include <postgres.h>
+
+#include <access/attnum.h>
+#include <lib/ilist.h>
+#include <nodes/pg_list.h>
+#include <utils/jsonb.h>
+
+#include "cache.h"
+#include "metric.h"
+
+/**
+ * Key of a series.
+ *
+ * The key points to the name and the tag set, which are owned by the
+ * cache entry, or by the line buffer when looking up a series.
+ */
+typedef struct SeriesKey {
+  const char *name;
+  const char *tagset;
+  uint32 length;
+} SeriesKey;
+
+/**
+ * Value of a tag column of a series.
+ */
+typedef struct SeriesColumn {
+  AttrNumber attnum;
+  bool isnull;
+
+  /** True if the value points to memory owned by the cache, which
+   * is set when the values are added to the series */
+  bool byref;
+
+  Datum value;
+} SeriesColumn;
+
+/**
+ * Cached series.
+ */
+typedef struct SeriesEntry {
+  /** Hash key, which has to be first */
+  SeriesKey key;
+
+  /** Position in the list of series, most recently used first */
+  dlist_node node;
+
+  /** Tags of the series */
+  KVItem *items;
+  int nitems;
+
+  /** Table and version of its description that the values below
+   * were derived from, or NULL if they have not been derived yet */
+  MetricTable table;
+  uint64 version;
+
+  /** Values of the tag columns */
+  SeriesColumn *columns;
+  int ncolumns;
+
+  /** Tags without a column, or NULL if the table has no `_tags`
+   * column */
+  Jsonb *object;
+
+  /** Memory used by the entry, in bytes */
+  Size space;
+} SeriesEntry;
+
+extern int InfluxSeriesCacheSize;
+
+extern SeriesEntry *SeriesLookup(const char *name, const char *tagset,
+                                 uint32 length);
+extern SeriesEntry *SeriesAdd(const char *name, const char *tagset,
+                              uint32 length, List *tags);
+extern List *SeriesTags(SeriesEntry *series);
+extern void SeriesSetValues(SeriesEntry *series, MetricTable table,
+                            SeriesColumn *columns, int ncolumns,
+                            Jsonb *object);
+extern void SeriesCacheReset(void);
+
+/**
+ * Check if the values of a series were derived for a table.
+ */
+static inline bool SeriesValid(const SeriesEntry *series, MetricTable table) {
+  return series->table == table && series->version == table->version;
+}
+
+/**
+ * Check if the series cache is enabled.
+ */
+static inline bool SeriesCacheEnabled(void) {
+  return InfluxSeriesCacheSize > 0;
+}
+
+#endif /* SERIES_H_ */
@@ -0,0 +1,347 @@
+/*
+ * Copyright 2022 Timescale Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "spool.h"
+
+#include <postgres.h>
+
+#include <common/file_perm.h>
+#include <miscadmin.h>
+#include <port/pg_bitutils.h>
+#include <storage/fd.h>
+#include <storage/ipc.h>
+#include <utils/memutils.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Magic number at the start of spool files. */
+#define SPOOL_MAGIC 0x494e4653
+
+/* Prefix of spool file names, which are followed by the process id
+ * and, for spools other than the main one, a name. */
+#define SPOOL_FILE_PREFIX "spool."
+
+/* Length word marking the rest of the ring as unused. */
+#define SPOOL_PADDING PG_UINT32_MAX
+
+/** Size of the spool for each worker, or zero to not spool. */
+int InfluxSpoolSize = 0;
+
+/** Backlog in percent at which datagrams are spooled. */
+int InfluxSpoolThreshold = 50;
+
+/** Milliseconds that inserting a batch of datagrams may take before
+ * the datagrams received after it are spooled, or zero for no limit. */
+int InfluxSpoolTimeBudget = 100;
+
+/**
+ * Header at the start of the spool file.
+ *
+ * The header takes a full block so that the ring data is aligned.
+ */
+struct SpoolHeader {
+  uint32 magic;
+
+  /** Size of the ring data */
+  uint64 size;
+
+  /** Position where the next record will be written */
+  uint64 head;
+
+  /** Position of the oldest record */
+  uint64 tail;
+
+  /** Number of records in the spool */
+  uint64 count;
+};
+
+#define SPOOL_HEADER_SIZE TYPEALIGN(BLCKSZ, sizeof(SpoolHeader))
+
+/*
+ * Header of each record in the spool.
+ *
+ * The source address is kept so that lines deferred by the rate
+ * limits can be admitted again when they are replayed. Addresses
+ * other than IP addresses are not kept.
+ */
+typedef struct SpoolRecordHeader {
+  PacketHeader packet;
+  union {
+    struct sockaddr sa;
+    struct sockaddr_in sin;
+    struct sockaddr_in6 sin6;
+  } source;
+} SpoolRecordHeader;
+
+/* Size of a record, including the header and the terminating null. */
+#define SPOOL_RECORD_SIZE(BYTES) \
+  TYPEALIGN(8, sizeof(SpoolRecordHeader) + (BYTES) + 1)
+
+/*
+ * Remove spool files of processes that no longer exist.
+ *
+ * Workers remove their spool file when they exit, so this only finds
+ * files of workers that crashed.
+ */
+static void RemoveStaleSpoolFiles(void) {
+  DIR *dir = AllocateDir(SPOOL_DIRECTORY);
+  struct dirent *de;
+
+  while ((de = ReadDir(dir, SPOOL_DIRECTORY)) != NULL) {
+    char path[MAXPGPATH];
+    pid_t pid;
+
+    if (strncmp(de->d_name, SPOOL_FILE_PREFIX, strlen(SPOOL_FILE_PREFIX)) != 0)
+      continue;
+    pid = atoi(de->d_name + strlen(SPOOL_FILE_PREFIX));
+    if (pid <= 0 || kill(pid, 0) == 0 || errno != ESRCH)
+      continue;
+
+    snprintf(path, sizeof(path), "%s/%s", SPOOL_DIRECTORY, de->d_name);
+    ereport(LOG, (errmsg("removing stale spool file \"%s\"", path)));
+    if (unlink(path) < 0)
+      ereport(LOG, (errcode_for_file_access(),
+                    errmsg("could not remove file \"%s\": %m", path)));
+  }
+
+  FreeDir(dir);
+}
+
+/* Remove the spool file when the process exits, unless the spool was
+ * already closed. */
+static void RemoveSpoolFile(int code, Datum arg) {
+  Spool *spool = (Spool *)DatumGetPointer(arg);
+  if (spool->header)
+    unlink(spool->path);
+}
+
+/**
+ * Create a spool for the worker.
+ *
+ * The file is created in `SPOOL_DIRECTORY` and the space for it is
+ * allocated up front, so that running out of disk space is detected
+ * here instead of when writing to the mapping.
+ *
+ * @param name Name added to the file name, or NULL for the main spool
+ * of the worker.
+ * @param size Size of the ring, which is rounded up to a power of 2.
+ * @returns The spool, or NULL if it could not be created, in which
+ * case the reason has been logged.
+ */
+Spool *SpoolOpen(const char *name, uint64 size) {
+  Spool *spool;
+  char *path;
+  void *addr;
+  int fd, err;
+
+  size = pg_nextpower2_64(size);
+
+  if (MakePGDirectory(SPOOL_DIRECTORY) < 0 && errno != EEXIST) {
+    ereport(LOG, (errcode_for_file_access(),
+                  errmsg("could not create directory \"%s\": %m",
+                         SPOOL_DIRECTORY)));
+    return NULL;
+  }
+
+  RemoveStaleSpoolFiles();
+
+  path = psprintf("%s/%s%d%s%s", SPOOL_DIRECTORY, SPOOL_FILE_PREFIX,
+                  MyProcPid, name ? "." : "", name ? name : "");
+  fd = open(path, O_RDWR | O_CREAT | O_TRUNC | PG_BINARY, pg_file_create_mode);
+  if (fd < 0) {
+    ereport(LOG, (errcode_for_file_access(),
+                  errmsg("could not create file \"%s\": %m", path)));
+    return NULL;
+  }
+
+#ifdef HAVE_POSIX_FALLOCATE
+  err = posix_fallocate(fd, 0, SPOOL_HEADER_SIZE + size);
+#else
+  err = ftruncate(fd, SPOOL_HEADER_SIZE + size) < 0 ? errno : 0;
+#endif
+  if (err != 0) {
+    errno = err;
+    ereport(LOG, (errcode_for_file_access(),
+                  errmsg("could not allocate %llu bytes for file \"%s\": %m",
+                         (unsigned long long)(SPOOL_HEADER_SIZE + size),
+                         path)));
+    close(fd);
+    unlink(path);
+    return NULL;
+  }
+
+  addr = mmap(NULL, SPOOL_HEADER_SIZE + size, PROT_READ | PROT_WRITE,
+              MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED) {
+    ereport(LOG, (errmsg("could not map file \"%s\": %m", path)));
+    close(fd);
+    unlink(path);
+    return NULL;
+  }
+  close(fd);
+
+  spool = MemoryContextAllocZero(TopMemoryContext, sizeof(Spool));
+  spool->path = MemoryContextStrdup(TopMemoryContext, path);
+  spool->header = addr;
+  spool->data = (char *)addr + SPOOL_HEADER_SIZE;
+  spool->size = size;
+  spool->header->magic = SPOOL_MAGIC;
+  spool->header->size = size;
+  spool->header->head = 0;
+  spool->header->tail = 0;
+  spool->header->count = 0;
+  pfree(path);
+
+  on_proc_exit(RemoveSpoolFile, PointerGetDatum(spool));
+  return spool;
+}
+
+/**
+ * Unmap the spool and remove the file.
+ *
+ * Datagrams still in the spool are lost. The spool itself is kept
+ * since the exit callback refers to it.
+ */
+void SpoolClose(Spool *spool) {
+  munmap(spool->header, SPOOL_HEADER_SIZE + spool->size);
+  unlink(spool->path);
+  spool->header = NULL;
+  spool->data = NULL;
+}
+
+/**
+ * Append a datagram to the spool.
+ *
+ * @returns true if the datagram was added, false if the spool is
+ * full.
+ */
+bool SpoolPut(Spool *spool, const Packet *packet) {
+  SpoolHeader *header = spool->header;
+  const uint64 record = SPOOL_RECORD_SIZE(packet->bytes);
+  uint64 offset = header->head & (spool->size - 1);
+  uint64 needed = record;
+  SpoolRecordHeader record_header;
+
+  /* If the record does not fit before the end of the ring, the rest
+   * is padded and the record is written at the start. */
+  if (offset + record > spool->size)
+    needed += spool->size - offset;
+  if (header->head - header->tail + needed > spool->size)
+    return false;
+
+  if (offset + record > spool->size) {
+    const uint32 padding = SPOOL_PADDING;
+    memcpy(spool->data + offset, &padding, sizeof(padding));
+    header->head += spool->size - offset;
+    offset = 0;
+  }
+
+  memset(&record_header, 0, sizeof(record_header));
+  record_header.packet.length = packet->bytes;
+  record_header.packet.received = packet->received;
+  if (packet->source && packet->source->sa_family == AF_INET)
+    record_header.source.sin = *(const struct sockaddr_in *)packet->source;
+  else if (packet->source && packet->source->sa_family == AF_INET6)
+    record_header.source.sin6 = *(const struct sockaddr_in6 *)packet->source;
+  memcpy(spool->data + offset, &record_header, sizeof(record_header));
+  memcpy(spool->data + offset + sizeof(record_header), packet->data,
+         packet->bytes);
+  spool->data[offset + sizeof(record_header) + packet->bytes] = '\0';
+  header->head += record;
+  header->count++;
+  return true;
+}
+
+/**
+ * Get the oldest datagram in the spool without removing it.
+ *
+ * The datagram is null-terminated and can be modified in place. It
+ * is valid until `SpoolPop` is called, and its source address until
+ * the next call to `SpoolPeek`.
+ *
+ * @returns true if there was a datagram, false if the spool is empty.
+ */
+bool SpoolPeek(Spool *spool, Packet *packet) {
+  SpoolHeader *header = spool->header;
+
+  while (header->tail != header->head) {
+    const uint64 offset = header->tail & (spool->size - 1);
+    SpoolRecordHeader record_header;
+    uint32 length;
+
+    memcpy(&length, spool->data + offset, sizeof(length));
+    if (length == SPOOL_PADDING) {
+      header->tail += spool->size - offset;
+      continue;
+    }
+
+    memcpy(&record_header, spool->data + offset, sizeof(record_header));
+    memcpy(&spool->source, &record_header.source,
+           sizeof(record_header.source));
+    packet->data = spool->data + offset + sizeof(record_header);
+    packet->bytes = record_header.packet.length;
+    packet->source = record_header.source.sa.sa_family != AF_UNSPEC
+                         ? (const struct sockaddr *)&spool->source
+                         : NULL;
+    packet->received = record_header.packet.received;
+    return true;
+  }
+
+  return false;
+}
+
+/**
+ * Remove the oldest datagram from the spool.
+ *
+ * This has to be preceded by a successful call to `SpoolPeek`.
+ */
+void SpoolPop(Spool *spool) {
+  SpoolHeader *header = spool->header;
+  uint32 length;
+
+  Assert(header->tail != header->head);
+  memcpy(&length, spool->data + (header->tail & (spool->size - 1)),
+         sizeof(length));
+  header->tail += SPOOL_RECORD_SIZE(length);
+  header->count--;
+
+  /* Start from the beginning of the file when the spool is empty,
+   * which keeps the pages that are written to few. */
+  if (header->tail == header->head)
+    header->tail = header->head = 0;
+}
+
+/**
+ * Get the number of bytes used in the spool.
+ */
+uint64 SpoolDepth(Spool *spool) {
+  return spool->header->head - spool->header->tail;
+}
+
+/**
+ * Get the number of datagrams in the spool.
+ */
+uint64 SpoolCount(Spool *spool) {
+  return spool->header->count;
+}
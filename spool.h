@@ -0,0 +1,91 @@
+/*
+ * Copyright 2022 Timescale Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Module for spooling datagrams to disk.
+ *
+ * When a worker cannot insert datagrams as fast as they arrive, it
+ * appends them to a spool instead and replays them once it has
+ * caught up. The spool is a ring in a memory-mapped file in the data
+ * directory, so a burst can be absorbed without growing the memory
+ * of the worker. The kernel writes the pages back in the background.
+ *
+ * The records are laid out like in the shared memory rings: a header
+ * followed by the null-terminated payload, so that the datagrams can
+ * be parsed in place. The header also keeps the source address of the
+ * datagram, which the rate limits need.
+ *
+ * Each worker has its own spool file, which is removed when the worker
+ * exits. A worker that defers lines because of the rate limits keeps
+ * them in a second spool file, so that they are not mixed up with the
+ * datagrams that are waiting to be inserted. Datagrams in the spools
+ * are lost if the worker crashes.
+ */
+
+#ifndef SPOOL_H_
+#define SPOOL_H_
+
+#include <postgres.h>
+
+#include <sys/socket.h>
+
+#include "receive.h"
+
+/** Directory for spool files, relative to the data directory. */
+#define SPOOL_DIRECTORY "pg_influx"
+
+typedef struct SpoolHeader SpoolHeader;
+
+/**
+ * Spool of one worker.
+ */
+typedef struct Spool {
+  /** Path of the spool file */
+  char *path;
+
+  /** Mapped header, followed by the ring data */
+  SpoolHeader *header;
+
+  /** Ring data */
+  char *data;
+
+  /** Size of the ring data, a power of 2 */
+  uint64 size;
+
+  /** Source address of the datagram returned by `SpoolPeek` */
+  struct sockaddr_storage source;
+} Spool;
+
+extern int InfluxSpoolSize;
+extern int InfluxSpoolThreshold;
+extern int InfluxSpoolTimeBudget;
+
+extern Spool *SpoolOpen(const char *name, uint64 size);
+extern void SpoolClose(Spool *spool);
+extern bool SpoolPut(Spool *spool, const Packet *packet);
+extern bool SpoolPeek(Spool *spool, Packet *packet);
+extern void SpoolPop(Spool *spool);
+extern uint64 SpoolDepth(Spool *spool);
+extern uint64 SpoolCount(Spool *spool);
+
+/**
+ * Check if there are datagrams in the spool.
+ */
+static inline bool SpoolIsEmpty(Spool *spool) {
+  return SpoolDepth(spool) == 0;
+}
+
+#endif /* SPOOL_H_ */
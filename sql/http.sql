@@ -0,0 +1,30 @@
+CREATE SCHEMA db_http;
+CREATE EXTENSION influx WITH SCHEMA db_http;
+
+\set VERBOSITY terse
+\x on
+CREATE FUNCTION pg_temp.write(target text, body text) RETURNS text AS $$
+  SELECT db_http.send_request(format(E'POST %s HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\nContent-Length: %s\r\n\r\n%s', target, octet_length(body), body), '4731')
+$$ LANGUAGE sql;
+
+SELECT pg_sleep(1), pid AS worker_pid FROM db_http.worker_launch('db_http', '4731', 'http') AS pid \gset
+SELECT pg_temp.write('/write', 'cpu,host=fury usage_user=2.5 1574753954000000000');
+SELECT pg_temp.write('/write?db=db_http', 'cpu,host=fury usage_user=3.5 1574753954000000000');
+
+-- Clients cannot write to other schemas than the one of the worker
+SELECT pg_temp.write('/write?db=public', 'cpu,host=fury usage_user=4.5 1574753954000000000');
+SELECT pg_temp.write('/write?db=pg_catalog', 'pg_authid,host=fury rolname="intruder" 1574753954000000000');
+SELECT pg_temp.write('/api/v2/write?bucket=public', 'cpu,host=fury usage_user=5.5 1574753954000000000');
+
+-- Lines with a timestamp outside the range of timestamps are skipped
+SELECT pg_temp.write('/write?precision=s', 'cpu,host=fury usage_user=6.5 -300000000000');
+
+SELECT count(*) FROM db_http.cpu;
+SELECT to_regclass('public.cpu') IS NULL AS missing;
+SELECT count(*) FROM pg_authid WHERE rolname = 'intruder';
+
+SELECT pg_terminate_backend(:worker_pid);
+
+DROP EXTENSION influx;
+DROP TABLE db_http.cpu;
+DROP SCHEMA db_http;
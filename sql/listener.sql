@@ -0,0 +1,47 @@
+CREATE SCHEMA db_listener;
+CREATE SCHEMA db_team_a;
+CREATE SCHEMA db_team_b;
+CREATE EXTENSION influx WITH SCHEMA db_listener;
+
+\set VERBOSITY terse
+\x on
+INSERT INTO db_listener.influx_listener(service, protocol, schema)
+VALUES ('4721', 'udp', 'db_team_a'), ('4722', 'udp', 'db_team_b');
+
+SELECT pg_sleep(1), pid AS worker_pid FROM db_listener.listener_launch() AS pid \gset
+CALL db_listener.send_packet('cpu,cpu=cpu0,host=fury usage_user=2.5 1574753954000000000', '4721');
+CALL db_listener.send_packet('cpu,cpu=cpu1,host=fury usage_user=3.5 1574753954000000000', '4721');
+CALL db_listener.send_packet('mem,host=fury used=42i 1574753954000000000', '4722');
+SELECT pg_sleep(1);
+
+SELECT count(*) FROM db_team_a.cpu;
+SELECT count(*) FROM db_team_b.mem;
+
+-- New listeners are picked up when the configuration is reloaded
+INSERT INTO db_listener.influx_listener(service, protocol, schema)
+VALUES ('4723', 'udp', 'db_team_b');
+INSERT INTO db_listener.influx_listener(service, protocol, schema, precision)
+VALUES ('4724', 'udp', 'db_team_a', 's');
+SELECT pg_reload_conf();
+SELECT pg_sleep(1);
+CALL db_listener.send_packet('cpu,cpu=cpu0,host=fury usage_user=4.5 1574753954000000000', '4723');
+-- Timestamps are in the precision of the listener, and lines without
+-- a timestamp get the time they were received
+CALL db_listener.send_packet('disk,host=fury used=17i 1574753954', '4724');
+CALL db_listener.send_packet('disk,host=fury used=18i', '4724');
+SELECT pg_sleep(1);
+
+SELECT count(*) FROM db_team_b.cpu;
+SELECT _time FROM db_team_a.disk WHERE _time < '2020-01-01';
+SELECT count(*) FROM db_team_a.disk WHERE _time > '2020-01-01';
+
+SELECT pg_terminate_backend(:worker_pid);
+
+DROP EXTENSION influx;
+DROP TABLE db_team_a.cpu;
+DROP TABLE db_team_a.disk;
+DROP TABLE db_team_b.cpu;
+DROP TABLE db_team_b.mem;
+DROP SCHEMA db_team_a;
+DROP SCHEMA db_team_b;
+DROP SCHEMA db_listener;
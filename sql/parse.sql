@@ -13,6 +13,13 @@ SELECT * FROM parse_influx(E'disk,mode=rw,path=/boot/efi free=527806464i,inodes_
 SELECT * FROM parse_influx(E'disk,mode=0 free="527806464i",total=\\0i 1574753954000000000');
 SELECT * FROM parse_influx(E'disk,mode=0,path=0i free="527806464i",total=\\0i 1574753954000000000');
 
+-- Lines without a timestamp have no time when parsed
+SELECT _metric, _time IS NULL AS no_time, _fields FROM parse_influx(E'cpu foo=12\ncpu foo=13 1465839830100400200');
+
+-- Numbers and booleans are stored as JSON numbers and booleans, and
+-- the last value of duplicate keys is kept
+SELECT _fields FROM parse_influx(E'cpu a=t,b=FALSE,c="true",d=-5i,e=-1.5,f=1.5e3,g=1.abc,h=-x\ncpu zz=1i,b=2i,b=3i');
+
 \set ON_ERROR_STOP OFF
 SELECT * FROM parse_influx(E'measurement,tag field=12 12345');
 SELECT * FROM parse_influx(E'measurement, field=12 12345');
@@ -0,0 +1,40 @@
+CREATE SCHEMA db_spool;
+CREATE TABLE db_spool.cpu(_time timestamptz, host text, usage_user float8, _tags jsonb, _fields jsonb);
+CREATE EXTENSION influx WITH SCHEMA db_spool;
+
+\set VERBOSITY terse
+\x on
+ALTER SYSTEM SET influx.spool_size = '1MB';
+ALTER SYSTEM SET influx.spool_time_budget = '100ms';
+SELECT pg_reload_conf();
+SELECT pg_sleep(1), pid AS worker_pid FROM db_spool.worker_launch('db_spool', '4741') AS pid \gset
+SELECT count(*) FROM pg_ls_dir('pg_influx') AS file WHERE file = 'spool.' || :worker_pid;
+
+-- Hold a lock on the table so that the worker stalls on the first
+-- line while more datagrams queue up in the socket. When the lock is
+-- released, the insert has taken longer than the time budget, so the
+-- worker spools the queued datagrams and replays them in order.
+BEGIN;
+LOCK TABLE db_spool.cpu IN ACCESS EXCLUSIVE MODE;
+CALL db_spool.send_packet('cpu,host=fury usage_user=1 1574753954000000000', '4741');
+SELECT pg_sleep(1);
+CALL db_spool.send_packet('cpu,host=fury usage_user=2 1574753955000000000', '4741');
+CALL db_spool.send_packet('cpu,host=fury usage_user=3 1574753956000000000', '4741');
+SELECT pg_sleep(1);
+COMMIT;
+SELECT pg_sleep(2);
+
+SELECT array_agg(usage_user ORDER BY _time) AS usage FROM db_spool.cpu;
+
+-- The two datagrams queued behind the first were spooled and replayed
+SELECT spooled, replayed
+  FROM db_spool.influx_stat_workers WHERE pid = :worker_pid;
+
+SELECT pg_terminate_backend(:worker_pid);
+ALTER SYSTEM RESET influx.spool_size;
+ALTER SYSTEM RESET influx.spool_time_budget;
+SELECT pg_reload_conf();
+
+DROP EXTENSION influx;
+DROP TABLE db_spool.cpu;
+DROP SCHEMA db_spool;
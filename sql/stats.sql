@@ -0,0 +1,27 @@
+CREATE SCHEMA db_stats;
+CREATE EXTENSION influx WITH SCHEMA db_stats;
+
+SELECT count(*) AS columns FROM information_schema.columns
+ WHERE table_schema = 'db_stats' AND table_name = 'influx_stat_workers';
+
+-- A worker counts the lines it reads and the rows it inserts, and
+-- the time from receipt to commit of each row.
+SELECT pg_sleep(1), pid AS worker_pid FROM db_stats.worker_launch('db_stats', 4751::text) AS pid \gset
+CALL db_stats.send_packet('cpu,host=fury usage_user=2.5 1574753954000000000', 4751::text);
+SELECT pg_sleep(1);
+SELECT count(*) FROM db_stats.cpu;
+SELECT kind, protocol, schema, service, lines, rows_inserted
+  FROM db_stats.influx_stat_workers WHERE pid = :worker_pid;
+SELECT sum(count) AS rows FROM db_stats.influx_stat_latency
+ WHERE pid = :worker_pid AND histogram = 'receive';
+
+-- Resetting the statistics clears the counters of running workers
+SELECT db_stats.influx_stat_reset();
+SELECT lines, rows_inserted
+  FROM db_stats.influx_stat_workers WHERE pid = :worker_pid;
+
+SELECT pg_terminate_backend(:worker_pid);
+
+DROP EXTENSION influx;
+DROP TABLE db_stats.cpu;
+DROP SCHEMA db_stats;
@@ -0,0 +1,28 @@
+CREATE SCHEMA db_unix;
+CREATE EXTENSION influx WITH SCHEMA db_unix;
+
+\set VERBOSITY terse
+\x on
+SELECT pg_sleep(1), pid AS worker_pid FROM db_unix.worker_launch('db_unix', 'unix://influx.sock') AS pid \gset
+CALL db_unix.send_packet('cpu,cpu=cpu0,host=fury usage_user=2.5 1574753954000000000', 'unix://influx.sock');
+CALL db_unix.send_packet('cpu,cpu=cpu1,host=fury usage_user=3.5 1574753954000000000', 'unix://influx.sock');
+SELECT pg_sleep(1);
+
+SELECT count(*) FROM db_unix.cpu;
+
+-- Service names can be longer than names in the catalog
+SELECT pg_sleep(1), pid AS long_pid FROM db_unix.worker_launch('db_unix', 'unix://influx-socket-with-a-name-longer-than-the-names-in-the-catalog.sock') AS pid \gset
+CALL db_unix.send_packet('cpu,cpu=cpu2,host=fury usage_user=4.5 1574753954000000000', 'unix://influx-socket-with-a-name-longer-than-the-names-in-the-catalog.sock');
+SELECT pg_sleep(1);
+
+SELECT count(*) FROM db_unix.cpu;
+SELECT pg_terminate_backend(:long_pid);
+
+-- Service name does not fit in the worker arguments
+SELECT db_unix.worker_launch('db_unix', 'unix://too/long/' || repeat('x', 100));
+
+SELECT pg_terminate_backend(:worker_pid);
+
+DROP EXTENSION influx;
+DROP TABLE db_unix.cpu;
+DROP SCHEMA db_unix;
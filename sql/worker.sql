@@ -1,6 +1,13 @@
 CREATE SCHEMA db_worker;
 CREATE TABLE db_worker.disk(_time timestamptz, host text, device text, _tags jsonb, _fields jsonb);
 CREATE TABLE db_worker.system(_time timestamp, host text, uptime int, _tags jsonb, _fields jsonb);
+CREATE TABLE db_worker.mem(_time timestamptz, host text, _tags jsonb, _fields jsonb) PARTITION BY LIST (host);
+CREATE TABLE db_worker.mem_fury PARTITION OF db_worker.mem FOR VALUES IN ('fury');
+CREATE TABLE db_worker.mem_other(_fields jsonb, host text, _tags jsonb, _time timestamptz);
+ALTER TABLE db_worker.mem ATTACH PARTITION db_worker.mem_other FOR VALUES IN ('other');
+CREATE TABLE db_worker.sensor(_time timestamptz, host text, temp float8, level real, reading bigint, small smallint, ok boolean, amount numeric, seen timestamptz, note varchar, _fields jsonb);
+CREATE TABLE db_worker.counter(_time int4, host text, _fields jsonb);
+CREATE TABLE db_worker.series(_time timestamptz, host text, _fields jsonb);
 
 CREATE EXTENSION influx WITH SCHEMA db_worker;
 
@@ -14,22 +21,53 @@ CALL db_worker.send_packet('disk,device=nvme0n1p1,fstype=vfat,host=fury,mode=rw,
 CALL db_worker.send_packet('system,host=fury load1=2.13,load15=0.84,load5=1.18,n_cpus=8i,n_users=1i 1574753954000000000', 4711::text);
 CALL db_worker.send_packet('system,host=fury uptime=607641i 1574753954000000000', 4711::text);
 CALL db_worker.send_packet('system,host=fury uptime_format="7 days,  0:47" 1574753954000000000', 4711::text);
+CALL db_worker.send_packet('mem,host=fury used=1i 1574753954000000000', 4711::text);
+CALL db_worker.send_packet('mem,host=other used=2i 1574753954000000000', 4711::text);
+CALL db_worker.send_packet('sensor,host=fury temp=21.5,level=0.25,reading=42i,small=7i,ok=true,amount=12i,seen="2019-11-26T08:39:14.5+01:00",note="all good",extra=1i 1574753954000000000', 4711::text);
 SELECT pg_sleep(2);
 
 SELECT * FROM db_worker.cpu;	--Automatically created
 SELECT * FROM db_worker.disk;
 SELECT * FROM db_worker.system;
 
+SELECT tableoid::regclass AS partition, * FROM db_worker.mem ORDER BY host;
+SELECT * FROM db_worker.sensor;
+
 SELECT count(*) FROM pg_stat_activity WHERE pid = :worker_pid;
 -- Syntax error, but the worker should not stop
 CALL db_worker.send_packet('system,host=fury', 4711::text);
 SELECT pg_sleep(1);
 SELECT count(*) FROM pg_stat_activity WHERE pid = :worker_pid;
 
+-- A time column that cannot hold a timestamp skips the line, but the
+-- worker should not stop
+CALL db_worker.send_packet('counter,host=fury value=1i 1574753954000000000', 4711::text);
+SELECT pg_sleep(1);
+SELECT count(*) FROM db_worker.counter;
+SELECT count(*) FROM pg_stat_activity WHERE pid = :worker_pid;
+
+-- A cached series picks up tag columns added to the table. The
+-- second line is a cache hit even though its tags are converted
+-- again.
+SELECT series_hits AS hits, series_misses AS misses
+  FROM db_worker.influx_stat_workers WHERE pid = :worker_pid \gset
+CALL db_worker.send_packet('series,host=fury,region=north value=1i 1574753954000000000', 4711::text);
+SELECT pg_sleep(1);
+ALTER TABLE db_worker.series ADD COLUMN region text;
+CALL db_worker.send_packet('series,host=fury,region=north value=2i 1574753955000000000', 4711::text);
+SELECT pg_sleep(1);
+SELECT host, region, _fields FROM db_worker.series ORDER BY _time;
+SELECT series_hits - :hits AS hits, series_misses - :misses AS misses
+  FROM db_worker.influx_stat_workers WHERE pid = :worker_pid;
+
 SELECT pg_terminate_backend(pid) FROM pg_stat_activity WHERE backend_type like '%Influx%';
 
 DROP EXTENSION influx;
 DROP TABLE db_worker.cpu;
 DROP TABLE db_worker.disk;
 DROP TABLE db_worker.system;
+DROP TABLE db_worker.mem;
+DROP TABLE db_worker.sensor;
+DROP TABLE db_worker.counter;
+DROP TABLE db_worker.series;
 DROP SCHEMA db_worker;
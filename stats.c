@@ -0,0 +1,613 @@
+/*
+ * Copyright 2022 Timescale Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "stats.h"
+
+#include <postgres.h>
+#include <fmgr.h>
+
+#include <funcapi.h>
+#include <miscadmin.h>
+#include <port/atomics.h>
+#include <port/pg_bitutils.h>
+#include <storage/ipc.h>
+#include <storage/lwlock.h>
+#include <storage/shmem.h>
+#include <utils/builtins.h>
+#include <utils/float.h>
+#include <utils/timestamp.h>
+#include <utils/tuplestore.h>
+
+#include <string.h>
+
+#include "worker.h"
+
+PG_FUNCTION_INFO_V1(influx_stat_get_workers);
+PG_FUNCTION_INFO_V1(influx_stat_get_latency);
+PG_FUNCTION_INFO_V1(influx_stat_reset);
+
+/* Number of columns returned by influx_stat_get_workers. */
+#define STAT_WORKERS_COLS (STAT_COUNT + 9)
+
+/* Number of columns returned by influx_stat_get_latency. */
+#define STAT_LATENCY_COLS 4
+
+/* Maximum number of distinct times kept for each histogram while a
+ * batch is built. Rows beyond that are counted with the last time,
+ * so latencies are slightly underestimated for very large batches. */
+#define LATENCY_MAX_SAMPLES 4096
+
+/* Milliseconds over which the load of a worker is measured. */
+#define LOAD_INTERVAL 1000
+
+/**
+ * Statistics slot for one worker.
+ */
+typedef struct WorkerStatsSlot {
+  /** Process owning the slot, or zero if the slot is free */
+  pg_atomic_uint32 pid;
+
+  WorkerKind kind;
+  char protocol[16];
+  char schema[NAMEDATALEN];
+  char service[WORKER_SERVICE_SIZE];
+
+  /** Time when the worker attached to the slot */
+  TimestampTz started;
+
+  /** Load of the worker in percent, see `StatsUpdateLoad` */
+  pg_atomic_uint32 load;
+
+  /** Bytes of datagrams in the spool of the worker */
+  pg_atomic_uint64 spool_depth;
+
+  pg_atomic_uint64 counters[STAT_COUNT];
+  pg_atomic_uint64 latency[LATENCY_COUNT][LATENCY_BUCKETS];
+} WorkerStatsSlot;
+
+/**
+ * Shared statistics area.
+ */
+typedef struct WorkerStatsShared {
+  /** Time of last reset, stored as a `TimestampTz` */
+  pg_atomic_uint64 stats_reset;
+
+  int nslots;
+  WorkerStatsSlot slots[FLEXIBLE_ARRAY_MEMBER];
+} WorkerStatsShared;
+
+/**
+ * Number of rows in a batch with the same time.
+ */
+typedef struct LatencySample {
+  TimestampTz time;
+  uint64 count;
+} LatencySample;
+
+/** Counters not yet added to the slot of the worker. */
+uint64 PendingStats[STAT_COUNT];
+
+static const char *const LatencyHistogramNames[] = {
+    [LATENCY_RECEIVE] = "receive",
+    [LATENCY_TIMESTAMP] = "timestamp",
+};
+
+/* Times of the rows in the current batch. */
+static LatencySample PendingSamples[LATENCY_COUNT][LATENCY_MAX_SAMPLES];
+static int PendingSampleCount[LATENCY_COUNT];
+
+/* Histogram counts not yet added to the slot of the worker. */
+static uint64 PendingLatency[LATENCY_COUNT][LATENCY_BUCKETS];
+
+static const char *const WorkerKindNames[] = {
+    [WORKER_KIND_LISTENER] = "listener",
+    [WORKER_KIND_RECEIVER] = "receiver",
+    [WORKER_KIND_INSERTER] = "inserter",
+};
+
+static WorkerStatsShared *StatsShared = NULL;
+static WorkerStatsSlot *MySlot = NULL;
+
+/* Start of the current load measurement window. */
+static instr_time LoadWindowStart;
+
+/* Start of the current wait, or zero if not waiting. */
+static instr_time IdleStart;
+
+/* Time spent waiting in the current window. */
+static instr_time IdleTime;
+
+/* Highest backlog seen in the current window. */
+static int Backlog;
+
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+/**
+ * Size of the shared statistics area.
+ *
+ * There is one slot for each possible background worker, so there is
+ * always a slot for every worker and inserter.
+ */
+static Size StatsShmemSize(void) {
+  return add_size(offsetof(WorkerStatsShared, slots),
+                  mul_size(max_worker_processes, sizeof(WorkerStatsSlot)));
+}
+
+#if PG_VERSION_NUM >= 150000
+static void StatsShmemRequest(void) {
+  if (prev_shmem_request_hook)
+    prev_shmem_request_hook();
+  RequestAddinShmemSpace(StatsShmemSize());
+}
+#endif
+
+static void StatsShmemStartup(void) {
+  bool found;
+
+  if (prev_shmem_startup_hook)
+    prev_shmem_startup_hook();
+
+  LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+  StatsShared =
+      ShmemInitStruct("influx worker statistics", StatsShmemSize(), &found);
+  if (!found) {
+    int i, j;
+    StatsShared->nslots = max_worker_processes;
+    pg_atomic_init_u64(&StatsShared->stats_reset, GetCurrentTimestamp());
+    for (i = 0; i < StatsShared->nslots; ++i) {
+      WorkerStatsSlot *slot = &StatsShared->slots[i];
+      pg_atomic_init_u32(&slot->pid, 0);
+      pg_atomic_init_u32(&slot->load, 0);
+      pg_atomic_init_u64(&slot->spool_depth, 0);
+      for (j = 0; j < STAT_COUNT; ++j)
+        pg_atomic_init_u64(&slot->counters[j], 0);
+      for (j = 0; j < LATENCY_COUNT * LATENCY_BUCKETS; ++j)
+        pg_atomic_init_u64(&slot->latency[j / LATENCY_BUCKETS]
+                                         [j % LATENCY_BUCKETS],
+                           0);
+    }
+  }
+  LWLockRelease(AddinShmemInitLock);
+}
+
+/**
+ * Request the shared statistics area.
+ *
+ * This has to be called from `_PG_init` while the shared preload
+ * libraries are loaded.
+ */
+void StatsShmemInit(void) {
+#if PG_VERSION_NUM >= 150000
+  prev_shmem_request_hook = shmem_request_hook;
+  shmem_request_hook = StatsShmemRequest;
+#else
+  RequestAddinShmemSpace(StatsShmemSize());
+#endif
+  prev_shmem_startup_hook = shmem_startup_hook;
+  shmem_startup_hook = StatsShmemStartup;
+}
+
+static void ResetSlot(WorkerStatsSlot *slot) {
+  int i;
+  for (i = 0; i < STAT_COUNT; ++i)
+    pg_atomic_write_u64(&slot->counters[i], 0);
+  for (i = 0; i < LATENCY_COUNT * LATENCY_BUCKETS; ++i)
+    pg_atomic_write_u64(
+        &slot->latency[i / LATENCY_BUCKETS][i % LATENCY_BUCKETS], 0);
+}
+
+/* Release the slot when the worker exits. */
+static void StatsDetach(int code, Datum arg) {
+  StatsFlush();
+  pg_atomic_write_u32(&MySlot->pid, 0);
+  MySlot = NULL;
+}
+
+/**
+ * Claim a statistics slot for the worker.
+ *
+ * If the shared statistics area does not exist, the counters are
+ * still collected but never published.
+ */
+void StatsAttach(WorkerKind kind, const char *protocol, const char *schema,
+                 const char *service) {
+  int i;
+
+  if (StatsShared == NULL)
+    return;
+
+  for (i = 0; i < StatsShared->nslots; ++i) {
+    WorkerStatsSlot *slot = &StatsShared->slots[i];
+    uint32 expected = 0;
+    if (pg_atomic_compare_exchange_u32(&slot->pid, &expected, MyProcPid)) {
+      slot->kind = kind;
+      strlcpy(slot->protocol, protocol, sizeof(slot->protocol));
+      strlcpy(slot->schema, schema, sizeof(slot->schema));
+      strlcpy(slot->service, service, sizeof(slot->service));
+      slot->started = GetCurrentTimestamp();
+      pg_atomic_write_u32(&slot->load, 0);
+      pg_atomic_write_u64(&slot->spool_depth, 0);
+      ResetSlot(slot);
+      MySlot = slot;
+      before_shmem_exit(StatsDetach, 0);
+      return;
+    }
+  }
+
+  ereport(LOG, (errmsg("no free statistics slot for worker")));
+}
+
+/**
+ * Change the kind of the worker.
+ *
+ * UDP workers become receivers when they start inserters.
+ */
+void StatsSetKind(WorkerKind kind) {
+  if (MySlot)
+    MySlot->kind = kind;
+}
+
+/**
+ * Publish the load of the worker if the measurement window has passed.
+ *
+ * The load is the part of the window that the worker was busy, in
+ * percent, or the highest backlog reported during the window if that
+ * is higher. A worker that is busy all the time, or that falls behind
+ * on its socket, has a load close to 100.
+ */
+static void StatsUpdateLoad(void) {
+  instr_time now, window;
+  double busy;
+
+  INSTR_TIME_SET_CURRENT(now);
+  if (INSTR_TIME_IS_ZERO(LoadWindowStart)) {
+    LoadWindowStart = now;
+    return;
+  }
+
+  window = now;
+  INSTR_TIME_SUBTRACT(window, LoadWindowStart);
+  if (INSTR_TIME_GET_MILLISEC(window) < LOAD_INTERVAL)
+    return;
+
+  busy = 100.0 * (1.0 - INSTR_TIME_GET_DOUBLE(IdleTime) /
+                            INSTR_TIME_GET_DOUBLE(window));
+  if (MySlot)
+    pg_atomic_write_u32(&MySlot->load, Max((int)busy, Backlog));
+
+  LoadWindowStart = now;
+  INSTR_TIME_SET_ZERO(IdleTime);
+  Backlog = 0;
+}
+
+/**
+ * Mark the start of a wait for more work.
+ */
+void StatsIdleStart(void) {
+  INSTR_TIME_SET_CURRENT(IdleStart);
+}
+
+/**
+ * Mark the end of a wait for more work.
+ */
+void StatsIdleEnd(void) {
+  instr_time now;
+
+  if (INSTR_TIME_IS_ZERO(IdleStart))
+    return;
+  INSTR_TIME_SET_CURRENT(now);
+  INSTR_TIME_ACCUM_DIFF(IdleTime, now, IdleStart);
+  INSTR_TIME_SET_ZERO(IdleStart);
+  StatsUpdateLoad();
+}
+
+/**
+ * Report how much work is queued for the worker.
+ *
+ * @param percent Fill level of the socket buffer or rings.
+ */
+void StatsSetBacklog(int percent) {
+  Backlog = Max(Backlog, percent);
+}
+
+/**
+ * Publish the number of bytes in the spool of the worker.
+ */
+void StatsSetSpoolDepth(uint64 bytes) {
+  if (MySlot)
+    pg_atomic_write_u64(&MySlot->spool_depth, bytes);
+}
+
+/**
+ * Get the load of a worker.
+ *
+ * @returns Load in percent, or -1 if the worker has no slot.
+ */
+int StatsWorkerLoad(pid_t pid) {
+  int i;
+
+  if (StatsShared == NULL)
+    return -1;
+
+  for (i = 0; i < StatsShared->nslots; ++i)
+    if (pg_atomic_read_u32(&StatsShared->slots[i].pid) == pid)
+      return pg_atomic_read_u32(&StatsShared->slots[i].load);
+  return -1;
+}
+
+/**
+ * Count the workers listening on a service.
+ *
+ * Workers with the same protocol and service share the port, so this
+ * is the number of sockets in the port reuse group.
+ */
+int StatsCountListeners(const char *protocol, const char *service) {
+  int i, count = 0;
+
+  if (StatsShared == NULL)
+    return 0;
+
+  for (i = 0; i < StatsShared->nslots; ++i) {
+    WorkerStatsSlot *slot = &StatsShared->slots[i];
+    if (pg_atomic_read_u32(&slot->pid) != 0 &&
+        slot->kind != WORKER_KIND_INSERTER &&
+        strcmp(slot->protocol, protocol) == 0 &&
+        strcmp(slot->service, service) == 0)
+      ++count;
+  }
+  return count;
+}
+
+/* Add a time to the pending samples of a histogram. */
+static void AddPendingSample(LatencyHistogram histogram, TimestampTz time) {
+  LatencySample *samples = PendingSamples[histogram];
+  int *count = &PendingSampleCount[histogram];
+
+  if (*count > 0 && (samples[*count - 1].time == time ||
+                     *count == LATENCY_MAX_SAMPLES)) {
+    samples[*count - 1].count++;
+    return;
+  }
+  samples[*count].time = time;
+  samples[*count].count = 1;
+  ++*count;
+}
+
+/**
+ * Get the histogram bucket for a latency.
+ *
+ * Negative latencies, which are possible for rows with timestamps
+ * from clocks that are ahead, are counted in the first bucket.
+ */
+static int LatencyBucket(TimestampTz latency) {
+  const int64 msecs = latency / 1000;
+  if (msecs < 1)
+    return 0;
+  return Min(pg_leftmost_one_pos64(msecs) + 1, LATENCY_BUCKETS - 1);
+}
+
+/**
+ * Remember the times of a row inserted in the current batch.
+ *
+ * @param received Time when the row was received, or zero if not
+ * known.
+ * @param time Timestamp of the row, or zero if the row has none.
+ */
+void StatsAddPendingRow(TimestampTz received, TimestampTz time) {
+  if (received != 0)
+    AddPendingSample(LATENCY_RECEIVE, received);
+  if (time != 0)
+    AddPendingSample(LATENCY_TIMESTAMP, time);
+}
+
+/**
+ * Count the rows of the batch that was just committed in the latency
+ * histograms.
+ *
+ * The counts are published with the other counters by `StatsFlush`.
+ */
+void StatsCommitPendingRows(TimestampTz committed) {
+  int h, i;
+
+  for (h = 0; h < LATENCY_COUNT; ++h) {
+    for (i = 0; i < PendingSampleCount[h]; ++i) {
+      const LatencySample *sample = &PendingSamples[h][i];
+      PendingLatency[h][LatencyBucket(committed - sample->time)] +=
+          sample->count;
+    }
+    PendingSampleCount[h] = 0;
+  }
+}
+
+/**
+ * Add the pending counters to the slot of the worker.
+ *
+ * This is also where the load is updated for workers that are too
+ * busy to wait.
+ */
+void StatsFlush(void) {
+  int i, j;
+
+  StatsUpdateLoad();
+
+  if (MySlot) {
+    for (i = 0; i < STAT_COUNT; ++i)
+      if (PendingStats[i] > 0)
+        pg_atomic_fetch_add_u64(&MySlot->counters[i], PendingStats[i]);
+    for (i = 0; i < LATENCY_COUNT; ++i)
+      for (j = 0; j < LATENCY_BUCKETS; ++j)
+        if (PendingLatency[i][j] > 0)
+          pg_atomic_fetch_add_u64(&MySlot->latency[i][j],
+                                  PendingLatency[i][j]);
+  }
+  memset(PendingStats, 0, sizeof(PendingStats));
+  memset(PendingLatency, 0, sizeof(PendingLatency));
+}
+
+/**
+ * Return the statistics of all workers.
+ *
+ * Returns no rows if the extension is not in `shared_preload_libraries`.
+ */
+Datum influx_stat_get_workers(PG_FUNCTION_ARGS) {
+  ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+  TupleDesc tupdesc;
+  Tuplestorestate *tupstore;
+  MemoryContext oldcontext;
+  TimestampTz stats_reset;
+  int i, j;
+
+  if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+    ereport(ERROR,
+            (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+             errmsg("set-valued function called in context that cannot "
+                    "accept a set")));
+  if (!(rsinfo->allowedModes & SFRM_Materialize))
+    ereport(ERROR,
+            (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+             errmsg("materialize mode required, but it is not allowed in "
+                    "this context")));
+  if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+    elog(ERROR, "return type must be a row type");
+
+  oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+  tupstore = tuplestore_begin_heap(true, false, work_mem);
+  rsinfo->returnMode = SFRM_Materialize;
+  rsinfo->setResult = tupstore;
+  rsinfo->setDesc = tupdesc;
+  MemoryContextSwitchTo(oldcontext);
+
+  if (StatsShared == NULL)
+    return (Datum)0;
+
+  stats_reset = (TimestampTz)pg_atomic_read_u64(&StatsShared->stats_reset);
+  for (i = 0; i < StatsShared->nslots; ++i) {
+    WorkerStatsSlot *slot = &StatsShared->slots[i];
+    Datum values[STAT_WORKERS_COLS];
+    bool nulls[STAT_WORKERS_COLS] = {0};
+    const uint32 pid = pg_atomic_read_u32(&slot->pid);
+    int col = 0;
+
+    if (pid == 0)
+      continue;
+
+    values[col++] = Int32GetDatum(pid);
+    values[col++] = CStringGetTextDatum(WorkerKindNames[slot->kind]);
+    values[col++] = CStringGetTextDatum(slot->protocol);
+    values[col++] = CStringGetTextDatum(slot->schema);
+    values[col++] = CStringGetTextDatum(slot->service);
+    values[col++] = TimestampTzGetDatum(slot->started);
+    values[col++] = Int32GetDatum(pg_atomic_read_u32(&slot->load));
+    values[col++] = Int64GetDatum(pg_atomic_read_u64(&slot->spool_depth));
+    for (j = 0; j < STAT_COUNT; ++j) {
+      const uint64 value = pg_atomic_read_u64(&slot->counters[j]);
+      /* Times are shown in milliseconds, like in pg_stat_statements. */
+      if (j >= STAT_RECEIVE_TIME)
+        values[col++] = Float8GetDatum(value / 1000.0);
+      else
+        values[col++] = Int64GetDatum(value);
+    }
+    values[col++] = TimestampTzGetDatum(stats_reset);
+    Assert(col == STAT_WORKERS_COLS);
+
+    tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+  }
+
+  return (Datum)0;
+}
+
+/**
+ * Return the latency histograms of all workers.
+ *
+ * There is one row for each bucket of each histogram, with the upper
+ * bound of the bucket in milliseconds, which is infinity for the
+ * last bucket. Returns no rows if the extension is not in
+ * `shared_preload_libraries`.
+ */
+Datum influx_stat_get_latency(PG_FUNCTION_ARGS) {
+  ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+  TupleDesc tupdesc;
+  Tuplestorestate *tupstore;
+  MemoryContext oldcontext;
+  int i, h, b;
+
+  if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+    ereport(ERROR,
+            (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+             errmsg("set-valued function called in context that cannot "
+                    "accept a set")));
+  if (!(rsinfo->allowedModes & SFRM_Materialize))
+    ereport(ERROR,
+            (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+             errmsg("materialize mode required, but it is not allowed in "
+                    "this context")));
+  if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+    elog(ERROR, "return type must be a row type");
+
+  oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+  tupstore = tuplestore_begin_heap(true, false, work_mem);
+  rsinfo->returnMode = SFRM_Materialize;
+  rsinfo->setResult = tupstore;
+  rsinfo->setDesc = tupdesc;
+  MemoryContextSwitchTo(oldcontext);
+
+  if (StatsShared == NULL)
+    return (Datum)0;
+
+  for (i = 0; i < StatsShared->nslots; ++i) {
+    WorkerStatsSlot *slot = &StatsShared->slots[i];
+    const uint32 pid = pg_atomic_read_u32(&slot->pid);
+
+    if (pid == 0)
+      continue;
+
+    for (h = 0; h < LATENCY_COUNT; ++h) {
+      for (b = 0; b < LATENCY_BUCKETS; ++b) {
+        Datum values[STAT_LATENCY_COLS];
+        bool nulls[STAT_LATENCY_COLS] = {0};
+        const double upper_bound = b == LATENCY_BUCKETS - 1
+                              ? get_float8_infinity()
+                              : (double)((int64)1 << b);
+
+        values[0] = Int32GetDatum(pid);
+        values[1] = CStringGetTextDatum(LatencyHistogramNames[h]);
+        values[2] = Float8GetDatum(upper_bound);
+        values[3] = Int64GetDatum(pg_atomic_read_u64(&slot->latency[h][b]));
+        tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+      }
+    }
+  }
+
+  return (Datum)0;
+}
+
+/**
+ * Reset the counters and latency histograms of all workers.
+ */
+Datum influx_stat_reset(PG_FUNCTION_ARGS) {
+  int i;
+
+  if (StatsShared) {
+    for (i = 0; i < StatsShared->nslots; ++i)
+      ResetSlot(&StatsShared->slots[i]);
+    pg_atomic_write_u64(&StatsShared->stats_reset, GetCurrentTimestamp());
+  }
+
+  PG_RETURN_VOID();
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright 2022 Timescale Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Module for worker statistics in shared memory.
+ *
+ * Each worker has a slot in shared memory with counters. To keep the
+ * cost low, the counters are first accumulated in process-local
+ * memory and added to the slot when a batch is committed or the
+ * worker goes idle.
+ *
+ * Each worker also keeps histograms of the time from when rows were
+ * received, and from the timestamp of the rows, until they were
+ * committed. The times are collected for each row while a batch is
+ * built and turned into histogram counts when the batch commits.
+ *
+ * The shared memory is only available if the extension is loaded
+ * using `shared_preload_libraries`. Otherwise, the counters are just
+ * not published.
+ */
+
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <postgres.h>
+
+#include <datatype/timestamp.h>
+#include <portability/instr_time.h>
+
+/**
+ * Counters for a worker.
+ *
+ * Times are in microseconds.
+ */
+typedef enum WorkerStat {
+  STAT_DATAGRAMS,
+  STAT_BYTES,
+  STAT_LINES,
+  STAT_PARSE_ERRORS,
+  STAT_INSERT_ERRORS,
+  STAT_ROWS_INSERTED,
+  STAT_TABLES_CREATED,
+  STAT_REJECTED_LINES,
+  STAT_COMMITS,
+  STAT_SPOOLED,
+  STAT_REPLAYED,
+  STAT_SHED_LINES,
+  STAT_SERIES_HITS,
+  STAT_SERIES_MISSES,
+  STAT_RECEIVE_TIME,
+  STAT_PARSE_TIME,
+  STAT_INSERT_TIME,
+  STAT_COMMIT_TIME,
+  STAT_SPIN_TIME,
+  STAT_COUNT
+} WorkerStat;
+
+/**
+ * Latency histograms for a worker.
+ */
+typedef enum LatencyHistogram {
+  /** Time from receiving a row until it was committed */
+  LATENCY_RECEIVE,
+
+  /** Time from the timestamp of a row until it was committed */
+  LATENCY_TIMESTAMP,
+
+  LATENCY_COUNT
+} LatencyHistogram;
+
+/* Number of buckets in each latency histogram. The first bucket is
+ * for latencies below one millisecond, bucket N is for latencies
+ * below 2^N milliseconds, and the last bucket is for the rest. */
+#define LATENCY_BUCKETS 24
+
+/**
+ * Kind of worker.
+ */
+typedef enum WorkerKind {
+  WORKER_KIND_LISTENER,
+  WORKER_KIND_RECEIVER,
+  WORKER_KIND_INSERTER,
+} WorkerKind;
+
+extern uint64 PendingStats[STAT_COUNT];
+
+extern void StatsShmemInit(void);
+extern void StatsAttach(WorkerKind kind, const char *protocol,
+                        const char *schema, const char *service);
+extern void StatsSetKind(WorkerKind kind);
+extern void StatsFlush(void);
+extern void StatsIdleStart(void);
+extern void StatsIdleEnd(void);
+extern void StatsSetBacklog(int percent);
+extern void StatsSetSpoolDepth(uint64 bytes);
+extern int StatsWorkerLoad(pid_t pid);
+extern int StatsCountListeners(const char *protocol, const char *service);
+extern void StatsAddPendingRow(TimestampTz received, TimestampTz time);
+extern void StatsCommitPendingRows(TimestampTz committed);
+
+/**
+ * Add to a counter.
+ */
+static inline void StatsAdd(WorkerStat stat, uint64 value) {
+  PendingStats[stat] += value;
+}
+
+/**
+ * Add the time elapsed since `start` to a counter.
+ */
+static inline void StatsAddTime(WorkerStat stat, instr_time start) {
+  instr_time now;
+  INSTR_TIME_SET_CURRENT(now);
+  INSTR_TIME_SUBTRACT(now, start);
+  PendingStats[stat] += INSTR_TIME_GET_MICROSEC(now);
+}
+
+#endif /* STATS_H_ */
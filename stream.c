@@ -0,0 +1,141 @@
+/*
+ * Copyright 2022 Timescale Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "stream.h"
+
+#include <postgres.h>
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/**
+ * Create a new stream connection for a socket.
+ *
+ * The connection takes ownership of the socket and will close it when
+ * the connection is closed.
+ *
+ * @param fd Connected socket, which should be in non-blocking mode.
+ * @param size Size of line buffer, which is the longest line that can
+ * be read.
+ */
+StreamConn *StreamConnCreate(int fd, size_t size) {
+  StreamConn *conn = palloc0(sizeof(StreamConn));
+  conn->fd = fd;
+  conn->size = size;
+  conn->buffer = palloc(size + 1);
+  return conn;
+}
+
+/**
+ * Close the connection and release the memory for it.
+ */
+void StreamConnClose(StreamConn *conn) {
+  if (conn->discarded > 0)
+    ereport(LOG, (errmsg("discarded %llu lines longer than %zu bytes",
+                         (unsigned long long)conn->discarded, conn->size)));
+  close(conn->fd);
+  pfree(conn->buffer);
+  pfree(conn);
+}
+
+/**
+ * Read more data from the connection.
+ *
+ * Lines returned by the previous call to `StreamConnLines` are
+ * removed from the buffer before reading.
+ *
+ * @returns Number of bytes read, zero if the peer closed the
+ * connection, or -1 on error, in which case `errno` is set.
+ */
+ssize_t StreamConnRead(StreamConn *conn) {
+  ssize_t bytes;
+
+  if (conn->consumed > 0) {
+    conn->used -= conn->consumed;
+    memmove(conn->buffer, conn->buffer + conn->consumed, conn->used);
+    conn->consumed = 0;
+  }
+
+  /* If the buffer is full, we have a line that does not fit in the
+   * buffer, so we throw away what we have and skip the rest of the
+   * line. */
+  if (conn->used == conn->size) {
+    conn->discarding = true;
+    conn->discarded++;
+    conn->used = 0;
+  }
+
+  bytes = recv(conn->fd, conn->buffer + conn->used, conn->size - conn->used, 0);
+  if (bytes > 0)
+    conn->used += bytes;
+  return bytes;
+}
+
+/**
+ * Get complete lines from the buffer.
+ *
+ * The lines are returned as a null-terminated string, which can be
+ * modified in place. The string is valid until the next call to
+ * `StreamConnRead`.
+ *
+ * @param conn Connection to get lines from.
+ * @param eof True if the peer has closed the connection, in which
+ * case any partial line is returned as well.
+ * @param bytes[out] Number of bytes in the returned string.
+ * @returns Pointer to the lines, or NULL if there are no complete
+ * lines in the buffer.
+ */
+char *StreamConnLines(StreamConn *conn, bool eof, size_t *bytes) {
+  char *end;
+
+  Assert(conn->consumed == 0);
+
+  /* Skip the remains of a line that was too long. */
+  if (conn->discarding) {
+    end = memchr(conn->buffer, '\n', conn->used);
+    if (end == NULL) {
+      conn->used = 0;
+      return NULL;
+    }
+    conn->discarding = false;
+    conn->used -= end - conn->buffer + 1;
+    memmove(conn->buffer, end + 1, conn->used);
+  }
+
+  /* Find the end of the last complete line. */
+  end = conn->buffer + conn->used;
+  while (end > conn->buffer && end[-1] != '\n')
+    --end;
+
+  if (end > conn->buffer) {
+    /* Replace the last newline with a terminator. The parser does
+     * not require a newline at the end of the last line. */
+    end[-1] = '\0';
+    *bytes = end - conn->buffer - 1;
+    conn->consumed = end - conn->buffer;
+  } else if (eof && conn->used > 0) {
+    conn->buffer[conn->used] = '\0';
+    *bytes = conn->used;
+    conn->consumed = conn->used;
+  } else {
+    return NULL;
+  }
+
+  return conn->buffer;
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright 2022 Timescale Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Module for reading lines from stream connections.
+ *
+ * Data is read from the connection into a buffer and complete lines
+ * are returned to the caller. A partial line at the end of the buffer
+ * is kept and completed by the next read.
+ */
+
+#ifndef STREAM_H_
+#define STREAM_H_
+
+#include <postgres.h>
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/**
+ * Stream connection.
+ */
+typedef struct StreamConn {
+  /** Socket for the connection */
+  int fd;
+
+  /** Line buffer, with room for a terminating null character */
+  char *buffer;
+
+  /** Size of line buffer, not counting the terminating null */
+  size_t size;
+
+  /** Number of bytes in the buffer */
+  size_t used;
+
+  /** Number of bytes at the start of the buffer already returned */
+  size_t consumed;
+
+  /** True if we are discarding a line that is too long */
+  bool discarding;
+
+  /** Number of lines discarded because they were too long */
+  uint64 discarded;
+} StreamConn;
+
+extern StreamConn *StreamConnCreate(int fd, size_t size);
+extern void StreamConnClose(StreamConn *conn);
+extern ssize_t StreamConnRead(StreamConn *conn);
+extern char *StreamConnLines(StreamConn *conn, bool eof, size_t *bytes);
+
+#endif /* STREAM_H_ */
@@ -0,0 +1,320 @@
+/*
+ * Copyright 2022 Timescale Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "supervisor.h"
+
+#include <postgres.h>
+#include <fmgr.h>
+
+#include <miscadmin.h>
+#include <pgstat.h>
+#include <postmaster/bgworker.h>
+#include <storage/ipc.h>
+#include <storage/latch.h>
+#include <utils/guc.h>
+#include <utils/memutils.h>
+#include <utils/timestamp.h>
+
+#include <errno.h>
+#include <string.h>
+
+#include "influx.h"
+#include "network.h"
+#include "stats.h"
+
+/* Seconds before the postmaster restarts a supervisor that failed. */
+#define SUPERVISOR_RESTART_TIME 10
+
+/** Maximum number of workers, or zero to not scale. */
+int InfluxMaxWorkers = 0;
+
+/** Milliseconds between checks of the workers. */
+int InfluxScaleInterval = 10000;
+
+/** Average load in percent above which a worker is added. */
+int InfluxScaleUpLoad = 80;
+
+/** Average load in percent below which a worker is retired. */
+int InfluxScaleDownLoad = 30;
+
+/**
+ * Worker launched by the supervisor.
+ */
+typedef struct SupervisedWorker {
+  BackgroundWorkerHandle *handle;
+
+  /** Time when the worker was launched */
+  TimestampTz launched;
+} SupervisedWorker;
+
+/**
+ * State of the supervisor.
+ */
+typedef struct Supervisor {
+  int protocol;
+  WorkerArgs args;
+
+  /** Number of running workers */
+  int nworkers;
+
+  /** Number of allocated slots in `workers` */
+  int capacity;
+
+  SupervisedWorker *workers;
+} Supervisor;
+
+static Supervisor MySupervisor;
+
+static volatile sig_atomic_t ReloadConfig = false;
+static volatile sig_atomic_t ShutdownSupervisor = false;
+
+/* Signal handler for SIGTERM */
+static void SupervisorSigterm(SIGNAL_ARGS) {
+  int save_errno = errno;
+  ShutdownSupervisor = true;
+  SetLatch(MyLatch);
+  errno = save_errno;
+}
+
+/* Signal handler for SIGHUP */
+static void SupervisorSighup(SIGNAL_ARGS) {
+  int save_errno = errno;
+  ReloadConfig = true;
+  SetLatch(MyLatch);
+  errno = save_errno;
+}
+
+/**
+ * Initialize the supervisor before registering it.
+ *
+ * The supervisor gets the same arguments as the workers, which it
+ * passes on to the workers it launches. It does not connect to a
+ * database itself, and is restarted by the postmaster if it fails.
+ */
+void InfluxSupervisorInit(BackgroundWorker *worker, WorkerArgs *args,
+                          int protocol) {
+  InfluxWorkerInit(worker, args, protocol);
+  worker->bgw_flags = BGWORKER_SHMEM_ACCESS;
+  worker->bgw_restart_time = SUPERVISOR_RESTART_TIME;
+  sprintf(worker->bgw_function_name, INFLUX_SUPERVISOR_FUNCTION_NAME);
+  snprintf(worker->bgw_name, BGW_MAXLEN, "Influx supervisor for schema %s",
+           WorkerSchemaName(args));
+  snprintf(worker->bgw_type, BGW_MAXLEN, "Influx worker supervisor");
+}
+
+static bool LaunchWorker(Supervisor *sup) {
+  BackgroundWorker worker;
+  BackgroundWorkerHandle *handle;
+
+  if (InfluxListenerCatalog)
+    InfluxCatalogWorkerInit(&worker, &sup->args);
+  else
+    InfluxWorkerInit(&worker, &sup->args, sup->protocol);
+  worker.bgw_notify_pid = MyProcPid;
+  if (!RegisterDynamicBackgroundWorker(&worker, &handle)) {
+    ereport(LOG,
+            (errmsg("could not start worker"),
+             errhint("Consider increasing \"max_worker_processes\".")));
+    return false;
+  }
+
+  if (sup->nworkers == sup->capacity) {
+    sup->capacity = Max(2 * sup->capacity, 8);
+    sup->workers =
+        sup->workers
+            ? repalloc(sup->workers, sup->capacity * sizeof(SupervisedWorker))
+            : MemoryContextAlloc(TopMemoryContext,
+                                 sup->capacity * sizeof(SupervisedWorker));
+  }
+
+  sup->workers[sup->nworkers].handle = handle;
+  sup->workers[sup->nworkers].launched = GetCurrentTimestamp();
+  sup->nworkers++;
+  return true;
+}
+
+/**
+ * Retire the most recently launched worker.
+ *
+ * The worker commits the current batch before it exits, but
+ * datagrams still queued in its socket and the connections it has
+ * open are lost, so clients of stream protocols have to reconnect.
+ * The remaining UDP workers update the steering program for the
+ * sockets that are left.
+ */
+static void RetireWorker(Supervisor *sup) {
+  SupervisedWorker *worker = &sup->workers[--sup->nworkers];
+  TerminateBackgroundWorker(worker->handle);
+  pfree(worker->handle);
+}
+
+/**
+ * Forget about workers that have exited.
+ *
+ * @returns Number of workers that exited.
+ */
+static int ReapWorkers(Supervisor *sup) {
+  int i = 0, stopped = 0;
+
+  while (i < sup->nworkers) {
+    pid_t pid;
+    if (GetBackgroundWorkerPid(sup->workers[i].handle, &pid) == BGWH_STOPPED) {
+      pfree(sup->workers[i].handle);
+      sup->workers[i] = sup->workers[--sup->nworkers];
+      ++stopped;
+      continue;
+    }
+    ++i;
+  }
+  return stopped;
+}
+
+/**
+ * Compute the average load of the workers.
+ *
+ * Workers launched during the last interval are not included since
+ * their load has not been measured yet.
+ *
+ * @returns Average load in percent, or -1 if no worker has a load.
+ */
+static int AverageLoad(Supervisor *sup) {
+  const TimestampTz now = GetCurrentTimestamp();
+  int i, total = 0, count = 0;
+
+  for (i = 0; i < sup->nworkers; ++i) {
+    pid_t pid;
+    int load;
+
+    if (!TimestampDifferenceExceeds(sup->workers[i].launched, now,
+                                    InfluxScaleInterval))
+      continue;
+    if (GetBackgroundWorkerPid(sup->workers[i].handle, &pid) != BGWH_STARTED)
+      continue;
+    if ((load = StatsWorkerLoad(pid)) < 0)
+      continue;
+    total += load;
+    ++count;
+  }
+
+  return count > 0 ? total / count : -1;
+}
+
+/**
+ * Decide how many workers we need and launch or retire workers.
+ *
+ * At most one worker is added or retired in each check, so that the
+ * load of the workers can settle before the next decision. A worker
+ * is retired only if the load of the remaining workers would stay
+ * below the limit.
+ */
+static void SuperviseWorkers(Supervisor *sup) {
+  int min = InfluxWorkersCount;
+  int max = Max(InfluxMaxWorkers, min);
+  int target, load, stopped;
+
+  /* Only one worker can bind a Unix domain socket path. */
+  if (!InfluxListenerCatalog &&
+      strncmp(sup->args.service, UNIX_SOCKET_PREFIX,
+              strlen(UNIX_SOCKET_PREFIX)) == 0) {
+    min = Min(min, 1);
+    max = Min(max, 1);
+  }
+
+  stopped = ReapWorkers(sup);
+  if (stopped > 0)
+    ereport(LOG, (errmsg("%d influx workers exited, restarting", stopped)));
+
+  target = sup->nworkers + stopped;
+  load = AverageLoad(sup);
+  if (load >= 0 && target < max && load >= InfluxScaleUpLoad)
+    target++;
+  else if (load >= 0 && target > min && target > 1 &&
+           load * target / (target - 1) < InfluxScaleDownLoad)
+    target--;
+  target = Max(min, Min(target, max));
+
+  if (target != sup->nworkers + stopped)
+    ereport(LOG, (errmsg("scaling influx workers from %d to %d",
+                         sup->nworkers + stopped, target),
+                  errdetail("Average load is %d%%.", load)));
+
+  while (sup->nworkers < target && LaunchWorker(sup))
+    ;
+  while (sup->nworkers > target)
+    RetireWorker(sup);
+}
+
+/* Stop all workers when the supervisor exits, so that a restarted
+ * supervisor does not start a second set of workers. */
+static void StopWorkers(int code, Datum arg) {
+  Supervisor *sup = &MySupervisor;
+  while (sup->nworkers > 0)
+    RetireWorker(sup);
+}
+
+/**
+ * Main function for the supervisor.
+ *
+ * The worker arguments are in `bgw_extra` and the protocol is passed
+ * as the parameter, the same as for the workers.
+ */
+void InfluxSupervisorMain(Datum arg) {
+  Supervisor *sup = &MySupervisor;
+  TimestampTz next_check = 0;
+
+  sup->protocol = DatumGetInt32(arg);
+  memcpy(&sup->args, MyBgworkerEntry->bgw_extra, sizeof(sup->args));
+
+  pqsignal(SIGTERM, SupervisorSigterm);
+  pqsignal(SIGHUP, SupervisorSighup);
+  BackgroundWorkerUnblockSignals();
+
+  before_shmem_exit(StopWorkers, 0);
+
+  if (InfluxListenerCatalog)
+    ereport(LOG, (errmsg("supervisor started for listener catalog")));
+  else
+    ereport(LOG, (errmsg("supervisor started for %s %s",
+                         ProtocolName(sup->protocol), sup->args.service)));
+
+  while (!ShutdownSupervisor) {
+    TimestampTz now = GetCurrentTimestamp();
+    int wait_result;
+
+    if (ReloadConfig) {
+      ReloadConfig = false;
+      ProcessConfigFile(PGC_SIGHUP);
+      next_check = now;
+    }
+
+    if (now >= next_check) {
+      SuperviseWorkers(sup);
+      next_check = TimestampTzPlusMilliseconds(now, InfluxScaleInterval);
+    }
+
+    /* The latch is also set when a worker exits, but those are only
+     * replaced at the next check to not restart failing workers in a
+     * tight loop. */
+    wait_result =
+        WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+                  Max((next_check - now) / 1000, 0), PG_WAIT_EXTENSION);
+    ResetLatch(MyLatch);
+    if (wait_result & WL_POSTMASTER_DEATH)
+      proc_exit(1);
+  }
+
+  proc_exit(0);
+}
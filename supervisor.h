@@ -0,0 +1,48 @@
+/*
+ * Copyright 2022 Timescale Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Module for the worker supervisor.
+ *
+ * The supervisor is started when the server starts and launches the
+ * workers for the configured service as dynamic background workers.
+ * It periodically checks the load of the workers and adds or retires
+ * workers between `influx.workers` and `influx.max_workers`, and
+ * replaces workers that exited.
+ */
+
+#ifndef SUPERVISOR_H_
+#define SUPERVISOR_H_
+
+#include <postgres.h>
+
+#include <postmaster/bgworker.h>
+
+#include "worker.h"
+
+#define INFLUX_SUPERVISOR_FUNCTION_NAME "InfluxSupervisorMain"
+
+extern int InfluxMaxWorkers;
+extern int InfluxScaleInterval;
+extern int InfluxScaleUpLoad;
+extern int InfluxScaleDownLoad;
+
+void InfluxSupervisorInit(BackgroundWorker *worker, WorkerArgs *args,
+                          int protocol);
+
+void PGDLLEXPORT InfluxSupervisorMain(Datum arg) pg_attribute_noreturn();
+
+#endif /* SUPERVISOR_H_ */
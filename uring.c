@@ -0,0 +1,297 @@
+/*
+ * Copyright 2022 Timescale Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "uring.h"
+
+#include <postgres.h>
+
+#ifdef USE_LIBURING
+
+#include <port/pg_bitutils.h>
+#include <utils/timestamp.h>
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+
+/* Buffer group identifier for the provided buffers. There is only one
+ * buffer ring for each io_uring instance. */
+#define URING_BUFFER_GROUP 0
+
+/* Number of entries in the submission queue. We only have one
+ * request in flight, but need room to re-arm it. */
+#define URING_QUEUE_DEPTH 4
+
+#define BUFFER(ENGINE, N) ((ENGINE)->pool + (N) * ((ENGINE)->entsize + 1))
+
+/**
+ * Check if the kernel supports multishot receive.
+ *
+ * There is no way to probe for multishot support directly, so we
+ * check for zero-copy send, which was added in the same release
+ * (Linux 6.0) as multishot `recvmsg`.
+ */
+static bool SupportsMultishotReceive(struct io_uring *ring) {
+  struct io_uring_probe *probe = io_uring_get_probe_ring(ring);
+  bool supported;
+
+  if (probe == NULL)
+    return false;
+  supported = io_uring_opcode_supported(probe, IORING_OP_SEND_ZC);
+  io_uring_free_probe(probe);
+  return supported;
+}
+
+/* Give a buffer back to the kernel. */
+static void RecycleBuffer(UringEngine *engine, int bid) {
+  io_uring_buf_ring_add(engine->buf_ring, BUFFER(engine, bid), engine->entsize,
+                        bid, io_uring_buf_ring_mask(engine->nbufs), 0);
+  io_uring_buf_ring_advance(engine->buf_ring, 1);
+}
+
+/**
+ * Create an io_uring receive engine for a socket.
+ *
+ * All memory is allocated in the current memory context, which need
+ * to live as long as the engine is used.
+ *
+ * @param fd Socket to receive datagrams from.
+ * @param nbufs Number of buffers, which is rounded up to a power of 2.
+ * @param bufsize Maximum size of a datagram.
+ * @returns The engine, or NULL if io_uring or the features we need
+ * are not supported by the kernel, in which case the reason has been
+ * logged.
+ */
+UringEngine *UringEngineCreate(int fd, int nbufs, size_t bufsize) {
+  UringEngine *engine = palloc0(sizeof(UringEngine));
+  int err, i;
+
+  engine->fd = fd;
+  engine->nbufs = pg_nextpower2_32(Max(nbufs, 2));
+  engine->bufsize = bufsize;
+  engine->current = -1;
+
+  /* Datagrams are received with a header followed by the source
+   * address, which is used for the rate limits, and the control data,
+   * which we use to get the kernel drop counter and time stamp. */
+  engine->msg.msg_namelen = sizeof(struct sockaddr_storage);
+  engine->msg.msg_controllen =
+      CMSG_SPACE(sizeof(uint32)) + CMSG_SPACE(sizeof(struct timespec));
+  engine->entsize = sizeof(struct io_uring_recvmsg_out) +
+                    engine->msg.msg_namelen + engine->msg.msg_controllen +
+                    bufsize;
+
+  if ((err = io_uring_queue_init(URING_QUEUE_DEPTH, &engine->ring, 0)) < 0) {
+    ereport(LOG, (errmsg("could not create io_uring instance: %s",
+                         strerror(-err))));
+    pfree(engine);
+    return NULL;
+  }
+
+  if (!SupportsMultishotReceive(&engine->ring)) {
+    ereport(LOG, (errmsg("multishot receive is not supported by the kernel")));
+    io_uring_queue_exit(&engine->ring);
+    pfree(engine);
+    return NULL;
+  }
+
+  engine->buf_ring = io_uring_setup_buf_ring(&engine->ring, engine->nbufs,
+                                             URING_BUFFER_GROUP, 0, &err);
+  if (engine->buf_ring == NULL) {
+    ereport(LOG,
+            (errmsg("could not register buffer ring: %s", strerror(-err))));
+    io_uring_queue_exit(&engine->ring);
+    pfree(engine);
+    return NULL;
+  }
+
+  engine->pool = palloc(engine->nbufs * (engine->entsize + 1));
+  for (i = 0; i < engine->nbufs; ++i)
+    io_uring_buf_ring_add(engine->buf_ring, BUFFER(engine, i), engine->entsize,
+                          i, io_uring_buf_ring_mask(engine->nbufs), i);
+  io_uring_buf_ring_advance(engine->buf_ring, engine->nbufs);
+
+  return engine;
+}
+
+void UringEngineFree(UringEngine *engine) {
+  io_uring_free_buf_ring(&engine->ring, engine->buf_ring, engine->nbufs,
+                         URING_BUFFER_GROUP);
+  io_uring_queue_exit(&engine->ring);
+  pfree(engine->pool);
+  pfree(engine);
+}
+
+/**
+ * File descriptor that becomes readable when completions are
+ * available.
+ *
+ * This is used to wait for datagrams together with the latch.
+ */
+int UringEngineFd(UringEngine *engine) {
+  return engine->ring.ring_fd;
+}
+
+/**
+ * Arm the multishot receive request.
+ *
+ * The kernel terminates the request if it runs out of buffers, so it
+ * needs to be re-armed after the buffers have been returned.
+ */
+static int ArmReceive(UringEngine *engine) {
+  struct io_uring_sqe *sqe = io_uring_get_sqe(&engine->ring);
+  int err;
+
+  Assert(sqe != NULL);
+  io_uring_prep_recvmsg_multishot(sqe, engine->fd, &engine->msg, 0);
+  sqe->flags |= IOSQE_BUFFER_SELECT;
+  sqe->buf_group = URING_BUFFER_GROUP;
+
+  if ((err = io_uring_submit(&engine->ring)) < 0) {
+    errno = -err;
+    return -1;
+  }
+
+  engine->armed = true;
+  return 0;
+}
+
+/**
+ * Prepare to receive datagrams.
+ *
+ * @returns Number of completions ready to be consumed using
+ * `UringEngineNext`, or -1 on error, in which case `errno` is
+ * set. Zero means that there is nothing to read right now.
+ */
+int UringEngineReceive(UringEngine *engine) {
+  if (engine->error) {
+    errno = engine->error;
+    engine->error = 0;
+    return -1;
+  }
+
+  if (!engine->armed && ArmReceive(engine) < 0)
+    return -1;
+
+  return io_uring_cq_ready(&engine->ring);
+}
+
+/**
+ * Get next packet from the completion queue.
+ *
+ * The buffer of the previous packet is given back to the kernel, so
+ * the previous packet is no longer valid when this is called.
+ *
+ * @param engine Engine to fetch packet from.
+ * @param packet[out] Next packet.
+ * @retval true A packet was returned.
+ * @retval false There are no more packets ready.
+ */
+bool UringEngineNext(UringEngine *engine, Packet *packet) {
+  struct io_uring_cqe *cqe;
+
+  if (engine->current >= 0) {
+    RecycleBuffer(engine, engine->current);
+    engine->current = -1;
+  }
+
+  while (io_uring_peek_cqe(&engine->ring, &cqe) == 0) {
+    const int res = cqe->res;
+    const unsigned int flags = cqe->flags;
+    struct io_uring_recvmsg_out *out;
+    char *payload;
+    size_t bytes;
+    int bid;
+
+    io_uring_cqe_seen(&engine->ring, cqe);
+
+    if (!(flags & IORING_CQE_F_MORE))
+      engine->armed = false;
+
+    /* Running out of buffers just means that the request has to be
+     * re-armed. Other errors are reported by the next receive. */
+    if (res < 0) {
+      if (res != -ENOBUFS)
+        engine->error = -res;
+      continue;
+    }
+
+    if (!(flags & IORING_CQE_F_BUFFER))
+      continue;
+
+    bid = flags >> IORING_CQE_BUFFER_SHIFT;
+    out = io_uring_recvmsg_validate(BUFFER(engine, bid), res, &engine->msg);
+    if (out == NULL) {
+      RecycleBuffer(engine, bid);
+      continue;
+    }
+
+    /* Same handling of the drop counter and the time stamp as in
+     * `PacketBatchReceive`. */
+    packet->received = GetCurrentTimestamp();
+    {
+      struct cmsghdr *cmsg;
+      for (cmsg = io_uring_recvmsg_cmsg_firsthdr(out, &engine->msg); cmsg;
+           cmsg = io_uring_recvmsg_cmsg_nexthdr(out, &engine->msg, cmsg)) {
+#ifdef SO_RXQ_OVFL
+        if (cmsg->cmsg_level == SOL_SOCKET &&
+            cmsg->cmsg_type == SO_RXQ_OVFL) {
+          uint32 drops;
+          memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+          engine->stats.dropped +=
+              (uint32)(drops - engine->stats.kernel_drops);
+          engine->stats.kernel_drops = drops;
+        }
+#endif
+#ifdef SO_TIMESTAMPNS
+        if (cmsg->cmsg_level == SOL_SOCKET &&
+            cmsg->cmsg_type == SO_TIMESTAMPNS) {
+          struct timespec ts;
+          memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+          packet->received = TimespecToTimestamp(&ts);
+        }
+#endif
+      }
+    }
+
+    payload = io_uring_recvmsg_payload(out, &engine->msg);
+    bytes = io_uring_recvmsg_payload_length(out, res, &engine->msg);
+
+    engine->stats.datagrams++;
+    engine->stats.bytes += bytes;
+    if (out->flags & MSG_TRUNC) {
+      engine->stats.truncated++;
+      bytes = TrimPartialLine(payload, bytes);
+    }
+
+    /* Each buffer has room for a terminator after the payload. */
+    payload[bytes] = '\0';
+    packet->data = payload;
+    packet->bytes = bytes;
+    packet->source = NULL;
+    if (out->namelen > 0) {
+      memcpy(&engine->source, io_uring_recvmsg_name(out),
+             Min(out->namelen, sizeof(engine->source)));
+      packet->source = (struct sockaddr *)&engine->source;
+    }
+    engine->current = bid;
+    return true;
+  }
+
+  return false;
+}
+
+#endif /* USE_LIBURING */
@@ -0,0 +1,97 @@
+/*
+ * Copyright 2022 Timescale Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Module to receive datagrams using io_uring.
+ *
+ * A single multishot `recvmsg` request is kept armed on the socket
+ * and the kernel picks buffers from a ring of provided buffers for
+ * each datagram received, so datagrams can be consumed without any
+ * system calls as long as the request stays armed.
+ *
+ * Packets are returned in the same way as for a `PacketBatch`, so
+ * both engines feed the same processing code. The module is only
+ * available when building with `USE_LIBURING`.
+ */
+
+#ifndef URING_H_
+#define URING_H_
+
+#include <postgres.h>
+
+#include <stdbool.h>
+#include <sys/socket.h>
+
+#include "receive.h"
+
+#ifdef USE_LIBURING
+
+#include <liburing.h>
+
+/**
+ * Receive engine using io_uring.
+ */
+typedef struct UringEngine {
+  /** Socket to receive from */
+  int fd;
+
+  /** The io_uring instance */
+  struct io_uring ring;
+
+  /** Ring of provided buffers */
+  struct io_uring_buf_ring *buf_ring;
+
+  /** Number of buffers in the buffer ring, a power of 2 */
+  int nbufs;
+
+  /** Size of each datagram payload, not counting the terminating null */
+  size_t bufsize;
+
+  /** Size of each buffer given to the kernel */
+  size_t entsize;
+
+  /** Buffer memory, `nbufs` buffers of `entsize + 1` bytes */
+  char *pool;
+
+  /** Message header template for the multishot request */
+  struct msghdr msg;
+
+  /** Multishot request is armed */
+  bool armed;
+
+  /** Buffer of the packet last returned, or -1 if none */
+  int current;
+
+  /** Source address of the packet last returned, copied out of the
+   * buffer since it is not aligned there */
+  struct sockaddr_storage source;
+
+  /** Error from the last completion, or zero */
+  int error;
+
+  /** Counters for all datagrams received */
+  ReceiveStats stats;
+} UringEngine;
+
+extern UringEngine *UringEngineCreate(int fd, int nbufs, size_t bufsize);
+extern void UringEngineFree(UringEngine *engine);
+extern int UringEngineReceive(UringEngine *engine);
+extern bool UringEngineNext(UringEngine *engine, Packet *packet);
+extern int UringEngineFd(UringEngine *engine);
+
+#endif /* USE_LIBURING */
+
+#endif /* URING_H_ */
@@ -23,13 +23,16 @@
 #include <access/xact.h>
 #include <catalog/namespace.h>
 #include <commands/dbcommands.h>
+#include <commands/extension.h>
 #include <executor/spi.h>
 #include <funcapi.h>
 #include <miscadmin.h>
 #include <pgstat.h>
 #include <postmaster/bgworker.h>
+#include <storage/dsm.h>
 #include <storage/ipc.h>
 #include <storage/latch.h>
+#include <utils/acl.h>
 #include <utils/builtins.h>
 #include <utils/elog.h>
 #include <utils/guc.h>
@@ -40,82 +43,2410 @@
 #include <utils/lsyscache.h>
 #include <utils/rel.h>
 #include <utils/snapmgr.h>
+#include <utils/timestamp.h>
 
+#include <ctype.h>
 #include <errno.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
 #include <stdbool.h>
 #include <string.h>
 #include <unistd.h>
 
-#include "cache.h"
-#include "influx.h"
-#include "network.h"
+#include "admission.h"
+#include "cache.h"
+#include "http.h"
+#include "influx.h"
+#include "insert.h"
+#include "network.h"
+#include "receive.h"
+#include "ring.h"
+#include "series.h"
+#include "spool.h"
+#include "stats.h"
+#include "stream.h"
+#include "uring.h"
+
+PG_FUNCTION_INFO_V1(worker_launch);
+PG_FUNCTION_INFO_V1(listener_launch);
+
+/* Maximum size of a UDP datagram. This is used for the buffers when
+ * GRO is enabled since the kernel can then coalesce several datagrams
+ * into one buffer. */
+#define UDP_MAX_PAYLOAD 65535
+
+/* Maximum number of sockets for each listener in the catalog, which
+ * is one for each address the listener resolves to. */
+#define MAX_LISTENER_SOCKETS 4
+
+/* Milliseconds to wait before moving more spooled datagrams to the
+ * rings, since the inserters do not wake up the receiver. */
+#define SPOOL_REPLAY_INTERVAL 10
+
+/* Number of replay intervals without progress before a receiver that
+ * is exiting gives up on the spool. A worker that inserts itself
+ * gives up after the same number of intervals in total. */
+#define SPOOL_DRAIN_ATTEMPTS 1000
+
+/* Milliseconds between passes over the deferred lines, which is the
+ * time it takes for the rate limit buckets to fill up. */
+#define DEFERRED_PASS_INTERVAL 1000
+
+/* Minimum number of milliseconds between reports of lost datagrams. */
+#define LOSS_REPORT_INTERVAL 10000
+
+/* Milliseconds between checks of the number of workers that the
+ * steering program distributes datagrams over. */
+#define STEERING_CHECK_INTERVAL 1000
+
+/* Milliseconds between checks for inserters that exited, which is
+ * also how often an inserter that keeps failing is relaunched. */
+#define INSERTER_CHECK_INTERVAL 5000
+
+/** Number of datagrams to read with each receive call. */
+int InfluxReceiveBatchSize = 32;
+
+/** Size of each receive buffer. */
+int InfluxReceiveBufferSize = UDP_MAX_PAYLOAD;
+
+/** Use generic receive offload for UDP sockets. */
+bool InfluxUdpGro = false;
+
+/** Maximum number of open connections for each stream worker. */
+int InfluxMaxConnections = 64;
+
+/** Maximum number of rows in a batch, or zero for no limit. */
+int InfluxBatchMaxRows = 0;
+
+/** Maximum number of bytes in a batch, or zero for no limit. */
+int InfluxBatchMaxBytes = 0;
+
+/** Maximum duration of a batch in milliseconds, or zero for no limit. */
+int InfluxBatchMaxDuration = 1000;
+
+/** Milliseconds to wait for more data before committing a batch. */
+int InfluxBatchFlushDelay = 0;
+
+/** Number of inserters for each UDP worker, or zero to insert in the
+ * worker. */
+int InfluxInserters = 0;
+
+/** Size of the ring for each inserter. */
+int InfluxRingSize = 8 * 1024 * 1024;
+
+/** Serve the listeners in the listener catalog instead of the service. */
+bool InfluxListenerCatalog = false;
+
+/** CPUs that the workers run on, or NULL or empty for any CPU. */
+char *InfluxCpuAffinity = NULL;
+
+/** Engine used to receive datagrams. */
+int InfluxReceiveEngine = ENGINE_RECV;
+
+const struct config_enum_entry InfluxReceiveEngineOptions[] = {
+    {"recv", ENGINE_RECV, false},
+    {"io_uring", ENGINE_IO_URING, false},
+    {NULL, 0, false},
+};
+
+const struct config_enum_entry InfluxProtocolOptions[] = {
+    {"udp", PROTOCOL_UDP, false},
+    {"tcp", PROTOCOL_TCP, false},
+    {"http", PROTOCOL_HTTP, false},
+    {NULL, 0, false},
+};
+
+static volatile sig_atomic_t ReloadConfig = false;
+static volatile sig_atomic_t ShutdownWorker = false;
+
+/**
+ * State of the current batch of inserts.
+ *
+ * A batch is a transaction that is kept open while lines are
+ * inserted and committed when it reaches one of the limits, or when
+ * there is no more data to read and the flush delay has passed.
+ */
+typedef struct BatchState {
+  /** A transaction is open for the batch */
+  bool active;
+
+  /** Time when the batch was started */
+  TimestampTz started;
+
+  /** Number of rows inserted in the batch */
+  uint64 rows;
+
+  /** Number of bytes processed in the batch */
+  uint64 bytes;
+} BatchState;
+
+static BatchState CurrentBatch;
+
+/**
+ * Lines deferred by the rate limits.
+ *
+ * The lines are kept in a spool of their own, so that they do not
+ * make the worker spool everything it receives while the main spool
+ * is empty. They are replayed in passes when the worker is idle and
+ * admitted again, so lines still above the limits are deferred again.
+ */
+typedef struct DeferredLines {
+  /** Spool with the lines, opened when the first line is deferred */
+  Spool *spool;
+
+  /** The spool could not be opened, so lines are dropped */
+  bool unavailable;
+
+  /** Number of records left in the current pass */
+  uint64 remaining;
+
+  /** Time when the last pass started */
+  TimestampTz last_pass;
+} DeferredLines;
+
+static DeferredLines Deferred;
+
+/**
+ * Steering of datagrams by measurement name.
+ */
+typedef struct SteeringState {
+  /** Socket in the port reuse group, or -1 if datagrams are not
+   * steered */
+  int fd;
+
+  /** Service that the workers of the group listen on */
+  const char *service;
+
+  /** Number of sockets that the program was attached for */
+  int nsocks;
+
+  /** Time when the number of sockets was last checked */
+  TimestampTz checked;
+} SteeringState;
+
+static SteeringState Steering = {.fd = -1, .nsocks = 1};
+
+/* Check that the worker arguments fit in `bgw_extra`. */
+static char c1[BGW_EXTRALEN - sizeof(WorkerArgs)] pg_attribute_unused();
+
+#ifdef __linux__
+/**
+ * Parse a list of CPUs.
+ *
+ * The list is a comma-separated list of CPU numbers and ranges, in
+ * the same format as `taskset --cpu-list`, for example "0-3,8".
+ *
+ * @returns true if the list was parsed, false on syntax errors.
+ */
+static bool ParseCpuList(const char *list, cpu_set_t *set) {
+  const char *p = list;
+
+  CPU_ZERO(set);
+  while (*p) {
+    long first, last;
+    char *end;
+
+    while (isspace((unsigned char)*p))
+      ++p;
+    if (!isdigit((unsigned char)*p))
+      return false;
+    first = last = strtol(p, &end, 10);
+    p = end;
+    if (*p == '-') {
+      ++p;
+      if (!isdigit((unsigned char)*p))
+        return false;
+      last = strtol(p, &end, 10);
+      p = end;
+    }
+    if (first > last || last >= CPU_SETSIZE)
+      return false;
+    for (; first <= last; ++first)
+      CPU_SET(first, set);
+
+    while (isspace((unsigned char)*p))
+      ++p;
+    if (*p == ',')
+      ++p;
+    else if (*p)
+      return false;
+  }
+  return true;
+}
+#endif
+
+/**
+ * Check that the CPU list for the workers can be parsed.
+ */
+bool CheckCpuAffinity(char **newval, void **extra, GucSource source) {
+  if (*newval == NULL || **newval == '\0')
+    return true;
+#ifdef __linux__
+  {
+    cpu_set_t set;
+    if (!ParseCpuList(*newval, &set)) {
+      GUC_check_errdetail("Expected a list of CPU numbers and ranges.");
+      return false;
+    }
+    return true;
+  }
+#else
+  GUC_check_errdetail("CPU affinity is not supported on this platform.");
+  return false;
+#endif
+}
+
+/**
+ * Pin the worker to the CPUs in `influx.cpu_affinity`.
+ *
+ * Keeping a worker on the same CPUs keeps its caches warm and, if the
+ * CPUs are the ones that handle the interrupts of the network device,
+ * the datagrams are processed where they arrive.
+ */
+static void SetWorkerAffinity(void) {
+#ifdef __linux__
+  cpu_set_t set;
+
+  if (InfluxCpuAffinity == NULL || *InfluxCpuAffinity == '\0')
+    return;
+  if (!ParseCpuList(InfluxCpuAffinity, &set) || CPU_COUNT(&set) == 0)
+    return;
+  if (sched_setaffinity(0, sizeof(set), &set) < 0)
+    ereport(LOG, (errmsg("could not set CPU affinity to \"%s\": %m",
+                         InfluxCpuAffinity)));
+#endif
+}
+
+/**
+ * Process one packet of lines.
+ *
+ * The packet data need to be null-terminated. The receive time of the
+ * packet is used as the time of lines without a timestamp.
+ *
+ * @returns Number of lines that were skipped because of parse errors.
+ */
+static uint64 ProcessPacket(const Packet *packet, Oid nspid,
+                            Precision precision) {
+  IngestState *state;
+  uint64 errors = 0;
+
+  Assert(packet->data[packet->bytes] == '\0');
+  state = ParseInfluxSetup(packet->data);
+  state->metric.precision = precision;
+  state->metric.received = packet->received;
+  state->series = SeriesCacheEnabled();
+  CurrentBatch.bytes += packet->bytes;
+  StatsAdd(STAT_DATAGRAMS, 1);
+  StatsAdd(STAT_BYTES, packet->bytes);
+
+  while (true) {
+    MemoryContext oldcontext = CurrentMemoryContext;
+    bool result, failed = false;
+    instr_time start;
+    TimestampTz time;
+
+    INSTR_TIME_SET_CURRENT(start);
+    PG_TRY();
+    { result = IngestReadNextLine(state); }
+    PG_CATCH();
+    {
+      MemoryContextSwitchTo(oldcontext);
+      FlushErrorState();
+      failed = true;
+    }
+    PG_END_TRY();
+    StatsAddTime(STAT_PARSE_TIME, start);
+
+    /* Skip the line with the parse error and continue with the next
+     * line in the packet. */
+    if (failed) {
+      IngestSkipLine(state);
+      StatsAdd(STAT_PARSE_ERRORS, 1);
+      errors++;
+      continue;
+    }
+
+    if (!result)
+      return errors;
+    StatsAdd(STAT_LINES, 1);
+
+    INSTR_TIME_SET_CURRENT(start);
+    if (MetricInsert(&state->metric, nspid, &time)) {
+      StatsAdd(STAT_ROWS_INSERTED, 1);
+      StatsAddPendingRow(packet->received, time);
+      CurrentBatch.rows++;
+    } else {
+      StatsAdd(STAT_INSERT_ERRORS, 1);
+    }
+    StatsAddTime(STAT_INSERT_TIME, start);
+  }
+}
+
+/**
+ * Get the spool for deferred lines, opening it if necessary.
+ *
+ * @returns The spool, or NULL if lines are not deferred or the spool
+ * could not be opened.
+ */
+static Spool *DeferredSpool(void) {
+  if (!Deferred.spool && !Deferred.unavailable &&
+      InfluxRateLimitPolicy == ADMISSION_SPOOL && InfluxSpoolSize > 0) {
+    Deferred.spool = SpoolOpen("deferred", InfluxSpoolSize);
+    Deferred.unavailable = (Deferred.spool == NULL);
+    Deferred.last_pass = GetCurrentTimestamp();
+  }
+  return Deferred.spool;
+}
+
+/**
+ * Remove the lines of a packet that are above the rate limits.
+ *
+ * @param defer Lines above the limits can be deferred, which requires
+ * that the caller replays the deferred lines.
+ * @returns false if no line of the packet was admitted.
+ */
+static bool AdmitPacket(Packet *packet, bool defer) {
+  if (!AdmissionEnabled())
+    return true;
+  return AdmitLines(packet, defer ? DeferredSpool() : NULL, NULL) > 0;
+}
+
+/**
+ * Process all packets in a batch.
+ *
+ * @param defer Lines above the limits can be deferred, as for
+ * `AdmitPacket`.
+ */
+static void ProcessBatch(PacketBatch *batch, Oid nspid, Precision precision,
+                         bool defer) {
+  Packet packet;
+  while (PacketBatchNext(batch, &packet)) {
+    if (AdmitPacket(&packet, defer))
+      ProcessPacket(&packet, nspid, precision);
+  }
+}
+
+/**
+ * Compute the buffer size to use for the receive buffers.
+ *
+ * If GRO is enabled, the buffer has to be able to hold a full UDP
+ * datagram since the kernel can coalesce datagrams up to that size.
+ */
+static size_t WorkerBufferSize(bool gro) {
+  if (gro && InfluxReceiveBufferSize < UDP_MAX_PAYLOAD)
+    return UDP_MAX_PAYLOAD;
+  return InfluxReceiveBufferSize;
+}
+
+/**
+ * Allocate the receive buffers for the worker.
+ *
+ * The buffers are allocated in the top memory context since they are
+ * re-used for the lifetime of the worker.
+ */
+static PacketBatch *CreateWorkerBatch(bool gro) {
+  MemoryContext oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+  PacketBatch *batch =
+      PacketBatchCreate(InfluxReceiveBatchSize, WorkerBufferSize(gro));
+  MemoryContextSwitchTo(oldcontext);
+  return batch;
+}
+
+/**
+ * Re-allocate the receive buffers if the configuration changed.
+ *
+ * The counters are kept from the old batch.
+ */
+static PacketBatch *ResizeWorkerBatch(PacketBatch *batch, bool gro) {
+  PacketBatch *new_batch;
+
+  if (batch->size == InfluxReceiveBatchSize &&
+      batch->bufsize == WorkerBufferSize(gro))
+    return batch;
+
+  new_batch = CreateWorkerBatch(gro);
+  new_batch->stats = batch->stats;
+  PacketBatchFree(batch);
+  return new_batch;
+}
+
+/**
+ * Attach the steering program again if the number of workers on the
+ * service changed.
+ *
+ * The kernel removes the socket of a worker that exits from the port
+ * reuse group, so a program built for the old number of sockets would
+ * keep counting it. The program applies to the whole group and all
+ * workers build the same program, so it is enough that one of them
+ * notices the change. With one socket left, no program is needed, but
+ * the old one has to be replaced anyway.
+ *
+ * @param force Check even if `STEERING_CHECK_INTERVAL` has not passed.
+ */
+static void UpdateSteering(bool force) {
+  const TimestampTz now = GetCurrentTimestamp();
+  int nsocks;
+
+  if (Steering.fd < 0)
+    return;
+  if (!force &&
+      !TimestampDifferenceExceeds(Steering.checked, now,
+                                  STEERING_CHECK_INTERVAL))
+    return;
+  Steering.checked = now;
+
+  nsocks = StatsCountListeners(ProtocolName(PROTOCOL_UDP), Steering.service);
+  if (nsocks < 1 || nsocks == Steering.nsocks)
+    return;
+
+  /* Steering is not supported here, which has been logged, so do not
+   * try again. */
+  if (!AttachSteeringProgram(Steering.fd, nsocks)) {
+    Steering.fd = -1;
+    return;
+  }
+  Steering.nsocks = nsocks;
+}
+
+/**
+ * Report lost datagrams to the log.
+ *
+ * To not flood the log, we only report when the counters changed and
+ * at most once every `LOSS_REPORT_INTERVAL` milliseconds.
+ *
+ * @param stats Current counters
+ * @param reported[in,out] Counters at the time of the last report
+ * @param last_report[in,out] Time of the last report
+ */
+static void ReportLostDatagrams(const ReceiveStats *stats,
+                                ReceiveStats *reported,
+                                TimestampTz *last_report) {
+  const TimestampTz now = GetCurrentTimestamp();
+
+  if (stats->dropped == reported->dropped &&
+      stats->truncated == reported->truncated &&
+      stats->overflowed == reported->overflowed)
+    return;
+
+  if (!TimestampDifferenceExceeds(*last_report, now, LOSS_REPORT_INTERVAL))
+    return;
+
+  if (stats->dropped > reported->dropped)
+    ereport(LOG,
+            (errmsg("kernel dropped %llu datagrams",
+                    (unsigned long long)(stats->dropped - reported->dropped)),
+             errhint("Consider increasing \"influx.socket_buffer_size\".")));
+  if (stats->truncated > reported->truncated)
+    ereport(LOG,
+            (errmsg("truncated %llu datagrams",
+                    (unsigned long long)(stats->truncated -
+                                         reported->truncated)),
+             errhint("Consider increasing \"influx.receive_buffer_size\".")));
+  if (stats->overflowed > reported->overflowed)
+    ereport(LOG,
+            (errmsg("inserts could not keep up, dropped %llu datagrams",
+                    (unsigned long long)(stats->overflowed -
+                                         reported->overflowed)),
+             errhint("Consider increasing \"influx.spool_size\", "
+                     "\"influx.ring_size\", or \"influx.inserters\".")));
+
+  *reported = *stats;
+  *last_report = now;
+}
+
+/* Signal handler for SIGTERM */
+static void WorkerSigterm(SIGNAL_ARGS) {
+  int save_errno = errno;
+  ShutdownWorker = true;
+  SetLatch(MyLatch);
+  errno = save_errno;
+}
+
+/* Signal handler for SIGHUP */
+static void WorkerSighup(SIGNAL_ARGS) {
+  int save_errno = errno;
+  ReloadConfig = true;
+  SetLatch(MyLatch);
+  errno = save_errno;
+}
+
+/**
+ * Initalize a worker before registering it.
+ *
+ * The protocol is passed as the argument to the main function of the
+ * worker since there is no room for it in the worker arguments.
+ */
+void InfluxWorkerInit(BackgroundWorker *worker, WorkerArgs *args,
+                      int protocol) {
+  memset(worker, 0, sizeof(*worker));
+  /* Shared memory access is necessary to connect to the database. */
+  worker->bgw_flags =
+      BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
+  worker->bgw_start_time = BgWorkerStart_RecoveryFinished;
+  worker->bgw_restart_time = BGW_NEVER_RESTART;
+  worker->bgw_main_arg = Int32GetDatum(protocol);
+  sprintf(worker->bgw_library_name, INFLUX_LIBRARY_NAME);
+  sprintf(worker->bgw_function_name, INFLUX_FUNCTION_NAME);
+  snprintf(worker->bgw_name, BGW_MAXLEN, "Influx listener for schema %s",
+           WorkerSchemaName(args));
+  snprintf(worker->bgw_type, BGW_MAXLEN, "Influx line protocol listener");
+  memcpy(worker->bgw_extra, args, sizeof(*args));
+}
+
+/**
+ * Get the name of the schema of a worker.
+ *
+ * This needs catalog access if the arguments have a schema OID.
+ *
+ * @returns The schema name, or an empty string if there is none.
+ */
+const char *WorkerSchemaName(const WorkerArgs *args) {
+  const char *name = OidIsValid(args->nspid) ? get_namespace_name(args->nspid)
+                                             : InfluxSchemaName;
+  return name ? name : "";
+}
+
+/* Connect to the database of a worker. */
+static void WorkerConnect(const WorkerArgs *args) {
+  if (OidIsValid(args->dbid))
+    BackgroundWorkerInitializeConnectionByOid(args->dbid, args->roleid, 0);
+  else
+    BackgroundWorkerInitializeConnection(InfluxDatabaseName, InfluxRoleName,
+                                         0);
+}
+
+/* Look up the schema of a worker. This has to be done inside a
+ * transaction. */
+static Oid WorkerNamespace(const WorkerArgs *args) {
+  if (!OidIsValid(args->nspid))
+    return get_namespace_oid(WorkerSchemaName(args), false);
+  if (get_namespace_name(args->nspid) == NULL)
+    ereport(ERROR, (errcode(ERRCODE_UNDEFINED_SCHEMA),
+                    errmsg("schema with OID %u does not exist", args->nspid)));
+  return args->nspid;
+}
+
+/**
+ * Look up protocol by name.
+ *
+ * @returns Protocol number. An error is raised if there is no
+ * protocol with the name.
+ */
+int ProtocolByName(const char *name) {
+  const struct config_enum_entry *entry;
+  for (entry = InfluxProtocolOptions; entry->name; ++entry)
+    if (pg_strcasecmp(entry->name, name) == 0)
+      return entry->val;
+  ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                  errmsg("unrecognized protocol \"%s\"", name)));
+  pg_unreachable();
+}
+
+/**
+ * Get name of protocol.
+ */
+const char *ProtocolName(int protocol) {
+  const struct config_enum_entry *entry;
+  for (entry = InfluxProtocolOptions; entry->name; ++entry)
+    if (entry->val == protocol)
+      return entry->name;
+  return "unknown";
+}
+
+/**
+ * Reload the configuration file if we got a SIGHUP.
+ *
+ * @retval true Configuration was reloaded.
+ * @retval false Configuration was not reloaded.
+ */
+static bool ReloadConfiguration(void) {
+  if (!ReloadConfig)
+    return false;
+  ReloadConfig = false;
+  ProcessConfigFile(PGC_SIGHUP);
+  if (!SeriesCacheEnabled())
+    SeriesCacheReset();
+  elog(LOG, "configuration file reloaded");
+  return true;
+}
+
+/**
+ * Start a batch of inserts.
+ *
+ * We need to open a non-atomic (that is, transactional) context since
+ * we are opening a table for the metric and we need to make sure that
+ * it does not change while we are updating it.
+ */
+static void StartBatch(void) {
+  int err;
+  if ((err = SPI_connect_ext(SPI_OPT_NONATOMIC)) != SPI_OK_CONNECT)
+    elog(ERROR, "SPI_connect failed: %s", SPI_result_code_string(err));
+  PushActiveSnapshot(GetTransactionSnapshot());
+  pgstat_report_activity(STATE_RUNNING, "processing incoming packets");
+  CurrentBatch.active = true;
+  CurrentBatch.started = GetCurrentTimestamp();
+  CurrentBatch.rows = 0;
+  CurrentBatch.bytes = 0;
+}
+
+/**
+ * Commit the batch of inserts.
+ *
+ * Rows still in the insert buffers are written before the commit.
+ * The commit will automatically start a new transaction, which is
+ * used by the next batch.
+ */
+static void FinishBatch(void) {
+  int err;
+  instr_time start;
+
+  INSTR_TIME_SET_CURRENT(start);
+  InsertBuffersFlush();
+  StatsAddTime(STAT_INSERT_TIME, start);
+
+  INSTR_TIME_SET_CURRENT(start);
+  PopActiveSnapshot();
+  SPI_commit();
+  if ((err = SPI_finish()) != SPI_OK_FINISH)
+    elog(ERROR, "SPI_finish failed: %s", SPI_result_code_string(err));
+  StatsAddTime(STAT_COMMIT_TIME, start);
+  StatsAdd(STAT_COMMITS, 1);
+  StatsCommitPendingRows(GetCurrentTimestamp());
+  StatsFlush();
+  pgstat_report_stat(false);
+  pgstat_report_activity(STATE_IDLE, NULL);
+  CurrentBatch.active = false;
+}
+
+/**
+ * Check if the batch has reached any of the limits.
+ *
+ * A full batch should be committed even if there is more data to
+ * read, so that a constant stream of data does not keep a single
+ * transaction open, which would hold back the xmin horizon.
+ */
+static bool BatchIsFull(void) {
+  if (InfluxBatchMaxRows > 0 && CurrentBatch.rows >= InfluxBatchMaxRows)
+    return true;
+  if (InfluxBatchMaxBytes > 0 && CurrentBatch.bytes >= InfluxBatchMaxBytes)
+    return true;
+  return InfluxBatchMaxDuration > 0 &&
+         TimestampDifferenceExceeds(CurrentBatch.started, GetCurrentTimestamp(),
+                                    InfluxBatchMaxDuration);
+}
+
+/**
+ * Compute how long to wait for more data before committing.
+ *
+ * The batch is kept open for the flush delay after it was started,
+ * but never longer than the maximum duration.
+ *
+ * @returns Number of milliseconds to wait, zero if the batch should
+ * be committed now, or -1 if there is no batch.
+ */
+static long BatchTimeout(void) {
+  long delay = InfluxBatchFlushDelay, elapsed;
+
+  if (!CurrentBatch.active)
+    return -1;
+
+  if (InfluxBatchMaxDuration > 0)
+    delay = Min(delay, InfluxBatchMaxDuration);
+  elapsed = (GetCurrentTimestamp() - CurrentBatch.started) / 1000;
+  return Max(delay - elapsed, 0);
+}
+
+/**
+ * Spin on the socket until there is data to read.
+ *
+ * In low-latency mode, we poll the socket for up to `influx.busy_poll`
+ * microseconds before blocking, which avoids the wakeup latency when
+ * datagrams arrive close together. With busy polling enabled on the
+ * socket, each poll also checks the device queue directly.
+ *
+ * The time spent spinning is counted as idle time, so that it does
+ * not make the supervisor add workers, and reported separately.
+ *
+ * @param timeout Maximum number of milliseconds to spin, or -1 for no
+ * limit other than `influx.busy_poll`.
+ * @returns true if there is data to read, or the socket has an error
+ * that the next receive will report.
+ */
+static bool SpinOnSocket(int fd, long timeout) {
+  const int64 limit =
+      timeout >= 0 ? Min(InfluxBusyPoll, timeout * 1000) : InfluxBusyPoll;
+  instr_time start, now;
+  bool ready = false;
+
+  if (limit <= 0)
+    return false;
+
+  StatsIdleStart();
+  INSTR_TIME_SET_CURRENT(start);
+  while (!ShutdownWorker && !ReloadConfig && !MyLatch->is_set) {
+    char byte;
+    if (recv(fd, &byte, sizeof(byte), MSG_PEEK | MSG_DONTWAIT) >= 0 ||
+        (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+      ready = true;
+      break;
+    }
+    INSTR_TIME_SET_CURRENT(now);
+    INSTR_TIME_SUBTRACT(now, start);
+    if (INSTR_TIME_GET_MICROSEC(now) >= limit)
+      break;
+  }
+  StatsAddTime(STAT_SPIN_TIME, start);
+  StatsIdleEnd();
+  return ready;
+}
+
+/**
+ * Compute how long to wait before replaying deferred lines.
+ *
+ * @returns Number of milliseconds to wait, zero if there are lines to
+ * replay now, or -1 if there are no deferred lines.
+ */
+static long DeferredTimeout(void) {
+  long elapsed;
+
+  if (!Deferred.spool || SpoolIsEmpty(Deferred.spool))
+    return -1;
+  if (Deferred.remaining > 0)
+    return 0;
+  elapsed = (GetCurrentTimestamp() - Deferred.last_pass) / 1000;
+  return Max(DEFERRED_PASS_INTERVAL - elapsed, 0);
+}
+
+/**
+ * Wait until there is data to read from the socket.
+ *
+ * If a batch is open, we only wait until it should be committed, and
+ * if there are deferred lines, only until they should be replayed.
+ *
+ * @returns The wait events that occurred.
+ */
+static int WaitForData(int fd) {
+  const long batch_timeout = BatchTimeout();
+  const long deferred_timeout = DeferredTimeout();
+  const long timeout = batch_timeout < 0 || deferred_timeout < 0
+                           ? Max(batch_timeout, deferred_timeout)
+                           : Min(batch_timeout, deferred_timeout);
+  int result;
+
+  StatsIdleStart();
+  result = WaitLatchOrSocket(MyLatch,
+                             WL_LATCH_SET | WL_POSTMASTER_DEATH |
+                                 WL_SOCKET_READABLE |
+                                 (timeout >= 0 ? WL_TIMEOUT : 0),
+                             fd, timeout, PG_WAIT_EXTENSION);
+  StatsIdleEnd();
+  return result;
+}
+
+/**
+ * Open the spool for the worker, if spooling is enabled.
+ */
+static Spool *OpenWorkerSpool(void) {
+  if (InfluxSpoolSize == 0)
+    return NULL;
+  return SpoolOpen(NULL, InfluxSpoolSize);
+}
+
+/**
+ * Close the spool for deferred lines, dropping the lines in it.
+ *
+ * The lines are above the rate limits, so they are not inserted when
+ * the worker exits.
+ */
+static void CloseDeferredSpool(void) {
+  if (!Deferred.spool)
+    return;
+  if (!SpoolIsEmpty(Deferred.spool))
+    ereport(LOG, (errmsg("dropping %llu datagrams of deferred lines",
+                         (unsigned long long)SpoolCount(Deferred.spool))));
+  SpoolClose(Deferred.spool);
+  Deferred.spool = NULL;
+}
+
+/**
+ * Report the number of bytes in the spools of the worker.
+ */
+static void ReportSpoolDepth(Spool *spool) {
+  uint64 depth = spool ? SpoolDepth(spool) : 0;
+  if (Deferred.spool)
+    depth += SpoolDepth(Deferred.spool);
+  StatsSetSpoolDepth(depth);
+}
+
+/**
+ * Check if inserting took longer than `influx.spool_time_budget`.
+ *
+ * @param start Time when the inserts started.
+ */
+static bool ExceedsTimeBudget(instr_time start) {
+  instr_time now;
+
+  if (InfluxSpoolTimeBudget <= 0)
+    return false;
+  INSTR_TIME_SET_CURRENT(now);
+  INSTR_TIME_SUBTRACT(now, start);
+  return INSTR_TIME_GET_MILLISEC(now) > InfluxSpoolTimeBudget;
+}
+
+/**
+ * Append all datagrams in a batch to the spool.
+ *
+ * Datagrams that do not fit are dropped and counted.
+ */
+static void SpoolBatch(Spool *spool, PacketBatch *batch) {
+  Packet packet;
+  while (PacketBatchNext(batch, &packet)) {
+    if (!AdmitPacket(&packet, true))
+      continue;
+    if (SpoolPut(spool, &packet))
+      StatsAdd(STAT_SPOOLED, 1);
+    else
+      batch->stats.overflowed++;
+  }
+  ReportSpoolDepth(spool);
+}
+
+/**
+ * Take the next datagram of deferred lines to replay.
+ *
+ * A pass covers the datagrams that were deferred when it started, so
+ * lines that are deferred again are not seen twice in the same pass,
+ * and a new pass starts at most once every `DEFERRED_PASS_INTERVAL`.
+ *
+ * The datagram is copied and removed from the spool, so that its
+ * lines can be deferred again when it is admitted. The copy has to be
+ * freed by the caller.
+ *
+ * @returns true if there was a datagram to replay.
+ */
+static bool NextDeferred(Packet *packet) {
+  Packet record;
+
+  if (DeferredTimeout() != 0)
+    return false;
+  if (Deferred.remaining == 0) {
+    Deferred.remaining = SpoolCount(Deferred.spool);
+    Deferred.last_pass = GetCurrentTimestamp();
+  }
+  if (!SpoolPeek(Deferred.spool, &record)) {
+    Deferred.remaining = 0;
+    return false;
+  }
+
+  *packet = record;
+  packet->data = palloc(record.bytes + 1);
+  memcpy(packet->data, record.data, record.bytes + 1);
+  SpoolPop(Deferred.spool);
+  Deferred.remaining--;
+  StatsAdd(STAT_REPLAYED, 1);
+  return true;
+}
+
+/**
+ * Insert datagrams from the spool.
+ *
+ * At most one receive batch of datagrams is inserted, so that the
+ * socket is checked again before the worker falls behind on it.
+ */
+static void ReplaySpool(Spool *spool, Oid nspid) {
+  Packet packet;
+  int i;
+
+  if (!CurrentBatch.active)
+    StartBatch();
+  for (i = 0; i < InfluxReceiveBatchSize && SpoolPeek(spool, &packet); ++i) {
+    ProcessPacket(&packet, nspid, InfluxPrecision);
+    SpoolPop(spool);
+    StatsAdd(STAT_REPLAYED, 1);
+  }
+  if (BatchIsFull())
+    FinishBatch();
+  ReportSpoolDepth(spool);
+}
+
+/**
+ * Admit deferred lines again and insert the admitted lines.
+ *
+ * At most one receive batch of datagrams is replayed, like for
+ * `ReplaySpool`.
+ */
+static void ReplayDeferred(Spool *spool, Oid nspid) {
+  Packet packet;
+  int i;
+
+  for (i = 0; i < InfluxReceiveBatchSize && NextDeferred(&packet); ++i) {
+    if (AdmitPacket(&packet, true)) {
+      if (!CurrentBatch.active)
+        StartBatch();
+      ProcessPacket(&packet, nspid, InfluxPrecision);
+    }
+    pfree(packet.data);
+  }
+  if (CurrentBatch.active && BatchIsFull())
+    FinishBatch();
+  ReportSpoolDepth(spool);
+}
+
+/**
+ * Receive datagrams from a socket and insert them.
+ *
+ * This is the same approach as used in pgstats.c: We read the packets
+ * in two loops. One outer that will block when there is no data
+ * received, and one inner loop that will read packets as long as
+ * possible in non-blocking mode.
+ *
+ * The packets are inserted in batches, where each batch is a
+ * transaction. The batch is committed when it is full, or when the
+ * socket is drained and the flush delay has passed.
+ *
+ * If the socket buffer fills up beyond `influx.spool_threshold`, or
+ * inserting or committing a batch took longer than
+ * `influx.spool_time_budget`, the datagrams are appended to the spool
+ * instead of being inserted, and are replayed in order once the
+ * socket is drained. The worker cannot spool while it is stalled on a
+ * lock or a commit, but the time budget makes it drain what queued up
+ * during the stall into the spool right after. New datagrams go to
+ * the spool as long as it is not empty, so the order is kept.
+ * Lines deferred by the rate limits are replayed after the spool.
+ *
+ * If `gro` is true, generic receive offload is enabled for the socket
+ * if the kernel supports it.
+ */
+static void ReceiveDatagrams(int sfd, Oid nspid, bool gro) {
+  PacketBatch *batch;
+  ReceiveStats reported = {0};
+  TimestampTz last_report = 0;
+  Spool *spool = OpenWorkerSpool();
+  bool behind = false;
+
+  if (gro)
+    gro = EnableUdpGro(sfd);
+  batch = CreateWorkerBatch(gro);
+
+  while (true) {
+    instr_time start;
+    int wait_result;
+
+    ResetLatch(MyLatch);
+    if (ShutdownWorker)
+      break;
+
+    while (!ShutdownWorker) {
+      int count;
+
+      if (ReloadConfiguration())
+        batch = ResizeWorkerBatch(batch, gro);
+
+      /* Try to read one batch of datagrams from the socket. Note that
+         the socket is in noblock mode, so this might fail immediately
+         and we will then exit to the outer loop. */
+      INSTR_TIME_SET_CURRENT(start);
+      count = PacketBatchReceive(batch, sfd);
+      StatsAddTime(STAT_RECEIVE_TIME, start);
+      if (count < 0) {
+        /* Leave the inner loop if there either was no data to receive
+         * or if the call was interrupted by a signal. */
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+          break;
+        ereport(ERROR, (errcode_for_socket_access(),
+                        errmsg("could not read lines: %m")));
+      }
+
+      if (spool && (behind || !SpoolIsEmpty(spool) ||
+                    SocketBacklog(sfd) >= InfluxSpoolThreshold)) {
+        SpoolBatch(spool, batch);
+        behind = false;
+        continue;
+      }
+
+      INSTR_TIME_SET_CURRENT(start);
+      if (!CurrentBatch.active)
+        StartBatch();
+      ProcessBatch(batch, nspid, InfluxPrecision, true);
+      if (BatchIsFull())
+        FinishBatch();
+      behind = ExceedsTimeBudget(start);
+      if (Deferred.spool)
+        ReportSpoolDepth(spool);
+    }
+
+    if (CurrentBatch.active && BatchTimeout() == 0) {
+      INSTR_TIME_SET_CURRENT(start);
+      FinishBatch();
+      behind = ExceedsTimeBudget(start);
+    }
+    ReportLostDatagrams(&batch->stats, &reported, &last_report);
+    UpdateSteering(false);
+
+    /* The socket is drained, so we can replay from the spool, but we
+     * check the socket again before blocking. */
+    if (spool && !SpoolIsEmpty(spool) && !ShutdownWorker) {
+      ReplaySpool(spool, nspid);
+      continue;
+    }
+    if (DeferredTimeout() == 0 && !ShutdownWorker) {
+      ReplayDeferred(spool, nspid);
+      continue;
+    }
+
+    /* In low-latency mode, we spin for a while before blocking. */
+    if (InfluxBusyPoll > 0 && SpinOnSocket(sfd, BatchTimeout()))
+      continue;
+
+    /* Here we block and wait until there is anything to read from the
+     * socket, the batch should be committed, or the postmaster shuts
+     * down. */
+    wait_result = WaitForData(sfd);
+    if (wait_result & WL_POSTMASTER_DEATH)
+      return; /* Abort the worker */
+
+    /* How much is queued when we wake up tells if we keep up. */
+    if (wait_result & WL_SOCKET_READABLE)
+      StatsSetBacklog(SocketBacklog(sfd));
+  }
+
+  /* Insert what is left in the spool before exiting, since it is
+   * removed when the worker exits, but do not hold up the shutdown
+   * for longer than a receiver with inserters would. */
+  if (spool) {
+    const TimestampTz start = GetCurrentTimestamp();
+    while (!SpoolIsEmpty(spool) &&
+           !TimestampDifferenceExceeds(
+               start, GetCurrentTimestamp(),
+               SPOOL_DRAIN_ATTEMPTS * SPOOL_REPLAY_INTERVAL))
+      ReplaySpool(spool, nspid);
+    if (!SpoolIsEmpty(spool))
+      ereport(LOG, (errmsg("worker exiting, dropping %llu bytes of spooled "
+                           "datagrams",
+                           (unsigned long long)SpoolDepth(spool))));
+    SpoolClose(spool);
+  }
+  CloseDeferredSpool();
+
+  if (CurrentBatch.active)
+    FinishBatch();
+}
+
+/**
+ * Methods for connections of a stream protocol.
+ */
+typedef struct ConnMethods {
+  /** Create connection state for an accepted socket */
+  void *(*create)(int fd);
+
+  /**
+   * Read from the connection and process the data read.
+   *
+   * Responses that should be sent after the transaction commits are
+   * flagged by setting `pending`. Returns false if the connection
+   * should be closed.
+   */
+  bool (*read)(void *state, const struct sockaddr *peer, Oid nspid,
+               Precision precision, bool *pending);
+
+  /**
+   * Send pending responses. Returns false if the connection should
+   * be closed.
+   */
+  bool (*flush)(void *state);
+
+  /** Close the connection and free the state */
+  void (*close)(void *state);
+} ConnMethods;
+
+/**
+ * Socket that a listener receives lines on.
+ *
+ * Endpoints for datagram protocols receive the lines directly, while
+ * endpoints for stream protocols accept connections.
+ */
+typedef struct Endpoint {
+  /** Bound socket */
+  int fd;
+
+  /** Protocol methods for connections, or NULL for datagrams */
+  const ConnMethods *methods;
+
+  /** Schema to write metrics to */
+  Oid nspid;
+
+  /** Role to insert as, or `InvalidOid` for the role of the worker */
+  Oid roleid;
+
+  /** Precision of timestamps in lines without an explicit precision */
+  Precision precision;
+
+  /** Listener in the catalog that the endpoint was created for */
+  int32 id;
+  int protocol;
+  char *address;
+  char *service;
+
+  /** Local address of the socket */
+  struct sockaddr_storage addr;
+
+  /** Still in the catalog, used when reloading it */
+  bool seen;
+} Endpoint;
+
+/**
+ * Connection accepted by a stream listener.
+ */
+typedef struct Connection {
+  /** Socket for the connection */
+  int fd;
+
+  /** Endpoint that accepted the connection */
+  Endpoint *endpoint;
+
+  /** Address of the peer, used for the rate limits */
+  struct sockaddr_storage peer;
+
+  /** Protocol state for the connection */
+  void *state;
+
+  /** Responses waiting for the transaction to commit */
+  bool pending;
+} Connection;
+
+#ifdef USE_LIBURING
+/**
+ * Receive datagrams using io_uring and insert them.
+ *
+ * This works the same way as `ReceiveDatagrams`, but the kernel
+ * fills the buffers while we are processing and we only wait on the
+ * completion queue when there are no more datagrams.
+ *
+ * The number and size of the buffers are decided when the worker
+ * starts, so changes to the configuration do not affect the buffers.
+ *
+ * There is no spool: the kernel keeps filling the buffers while the
+ * worker is stalled, and datagrams are dropped when they run out.
+ */
+static void ReceiveDatagramsUring(UringEngine *engine, Oid nspid) {
+  ReceiveStats reported = {0};
+  TimestampTz last_report = 0;
+  Packet packet;
+
+  if (InfluxSpoolSize > 0)
+    ereport(LOG, (errmsg("spool is not available with the io_uring engine"),
+                  errdetail("Datagrams are dropped when the socket buffer "
+                            "is full, and lines deferred by the rate "
+                            "limits are dropped.")));
+
+  while (true) {
+    int wait_result;
+
+    ResetLatch(MyLatch);
+    if (ShutdownWorker)
+      break;
+
+    while (!ShutdownWorker) {
+      instr_time start;
+      int count;
+
+      ReloadConfiguration();
+
+      INSTR_TIME_SET_CURRENT(start);
+      count = UringEngineReceive(engine);
+      StatsAddTime(STAT_RECEIVE_TIME, start);
+      if (count < 0)
+        ereport(ERROR, (errcode_for_socket_access(),
+                        errmsg("could not read lines: %m")));
+      if (count == 0)
+        break;
+
+      if (!CurrentBatch.active)
+        StartBatch();
+      while (UringEngineNext(engine, &packet)) {
+        if (AdmitPacket(&packet, false))
+          ProcessPacket(&packet, nspid, InfluxPrecision);
+      }
+      if (BatchIsFull())
+        FinishBatch();
+    }
+
+    if (CurrentBatch.active && BatchTimeout() == 0)
+      FinishBatch();
+    ReportLostDatagrams(&engine->stats, &reported, &last_report);
+    UpdateSteering(false);
+
+    /* The io_uring file descriptor is readable when there are
+     * completions in the queue. */
+    wait_result = WaitForData(UringEngineFd(engine));
+    if (wait_result & WL_POSTMASTER_DEATH)
+      return; /* Abort the worker */
+    if (wait_result & WL_SOCKET_READABLE)
+      StatsSetBacklog(SocketBacklog(UringEngineFd(engine)));
+  }
+
+  if (CurrentBatch.active)
+    FinishBatch();
+}
+#endif
+
+/**
+ * Receive datagrams using the configured engine.
+ *
+ * If the io_uring engine is selected but cannot be used, we fall
+ * back on the `recv` engine.
+ */
+static void ReceiveDatagramsWithEngine(int sfd, Oid nspid, bool gro) {
+  if (InfluxReceiveEngine == ENGINE_IO_URING) {
+#ifdef USE_LIBURING
+    MemoryContext oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+    UringEngine *engine = UringEngineCreate(sfd, InfluxReceiveBatchSize,
+                                            WorkerBufferSize(false));
+    MemoryContextSwitchTo(oldcontext);
+    if (engine) {
+      ReceiveDatagramsUring(engine, nspid);
+      UringEngineFree(engine);
+      return;
+    }
+    ereport(LOG, (errmsg("io_uring engine not available, using recv")));
+#else
+    ereport(LOG, (errmsg("io_uring engine not available, using recv"),
+                  errdetail("The extension was built without liburing.")));
+#endif
+  }
+
+  ReceiveDatagrams(sfd, nspid, gro);
+}
+
+/**
+ * Inserters started by a receiver.
+ */
+typedef struct InserterSet {
+  int count;
+  BackgroundWorkerHandle **handles;
+
+  /** Worker description used to launch the inserters */
+  BackgroundWorker worker;
+
+  /** Time when the inserters were last checked */
+  TimestampTz checked;
+} InserterSet;
+
+/**
+ * Stop the inserters when the receiver detaches from the rings.
+ *
+ * The inserters drain their rings before they exit, so nothing that
+ * was received is lost.
+ */
+static void StopInserters(dsm_segment *seg, Datum arg) {
+  InserterSet *inserters = (InserterSet *)DatumGetPointer(arg);
+  int i;
+  for (i = 0; i < inserters->count; ++i)
+    TerminateBackgroundWorker(inserters->handles[i]);
+}
+
+/**
+ * Start inserters for the rings.
+ *
+ * The inserters connect to the same database as the receiver and
+ * attach to the rings using the segment handle. If not all inserters
+ * could be started, the rings without an inserter are not used.
+ */
+static InserterSet *LaunchInserters(RingSet *rings, WorkerArgs *args) {
+  InserterSet *inserters =
+      MemoryContextAllocZero(TopMemoryContext, sizeof(InserterSet));
+  BackgroundWorker *worker = &inserters->worker;
+  int i;
+
+  inserters->handles = MemoryContextAlloc(
+      TopMemoryContext, rings->nrings * sizeof(BackgroundWorkerHandle *));
+  inserters->checked = GetCurrentTimestamp();
+
+  InfluxWorkerInit(worker, args, PROTOCOL_UDP);
+  worker->bgw_main_arg = UInt32GetDatum(dsm_segment_handle(rings->segment));
+  worker->bgw_notify_pid = MyProcPid;
+  sprintf(worker->bgw_function_name, INFLUX_INSERTER_FUNCTION_NAME);
+  snprintf(worker->bgw_name, BGW_MAXLEN, "Influx inserter for schema %s",
+           WorkerSchemaName(args));
+  snprintf(worker->bgw_type, BGW_MAXLEN, "Influx line protocol inserter");
+
+  for (i = 0; i < rings->nrings; ++i) {
+    BackgroundWorkerHandle *handle;
+    if (!RegisterDynamicBackgroundWorker(worker, &handle)) {
+      ereport(LOG,
+              (errmsg("could only start %d of %d inserters", i,
+                      rings->nrings),
+               errhint("Consider increasing \"max_worker_processes\".")));
+      break;
+    }
+    inserters->handles[inserters->count++] = handle;
+  }
+
+  rings->nrings = inserters->count;
+  return inserters;
+}
+
+/**
+ * Relaunch inserters that have exited.
+ *
+ * The inserters are not restarted by the postmaster, so without this
+ * the ring of an inserter that failed would fill up and the other
+ * inserters would have to take over all of the datagrams. The ring of
+ * the inserter is freed and a new inserter claims it, so the
+ * datagrams in it are not lost.
+ *
+ * The receiver is notified when an inserter exits, but the inserters
+ * are only checked every `INSERTER_CHECK_INTERVAL` milliseconds, so
+ * that an inserter that keeps failing is not relaunched in a tight
+ * loop.
+ */
+static void RestartInserters(InserterSet *inserters, RingSet *rings) {
+  const TimestampTz now = GetCurrentTimestamp();
+  int i, stopped = 0;
+
+  if (!TimestampDifferenceExceeds(inserters->checked, now,
+                                  INSERTER_CHECK_INTERVAL))
+    return;
+  inserters->checked = now;
+
+  for (i = 0; i < inserters->count; ++i) {
+    pid_t pid;
+    if (GetBackgroundWorkerPid(inserters->handles[i], &pid) == BGWH_STOPPED)
+      ++stopped;
+  }
+  if (stopped == 0)
+    return;
+
+  /* The rings have to be free before the new inserters look for one. */
+  RingSetReleaseExited(rings);
+  ereport(LOG, (errmsg("%d inserters exited, restarting", stopped)));
+
+  for (i = 0; i < inserters->count; ++i) {
+    BackgroundWorkerHandle *handle;
+    pid_t pid;
+
+    if (GetBackgroundWorkerPid(inserters->handles[i], &pid) != BGWH_STOPPED)
+      continue;
+    if (!RegisterDynamicBackgroundWorker(&inserters->worker, &handle)) {
+      ereport(LOG,
+              (errmsg("could not restart inserter"),
+               errhint("Consider increasing \"max_worker_processes\".")));
+      break;
+    }
+    pfree(inserters->handles[i]);
+    inserters->handles[i] = handle;
+  }
+}
+
+/**
+ * Move datagrams from the spool to the rings while there is room.
+ */
+static void ReplaySpoolToRings(Spool *spool, RingSet *rings) {
+  Packet packet;
+
+  while (SpoolPeek(spool, &packet) &&
+         RingSetPut(rings, &packet)) {
+    StatsAdd(STAT_DATAGRAMS, 1);
+    StatsAdd(STAT_BYTES, packet.bytes);
+    StatsAdd(STAT_REPLAYED, 1);
+    SpoolPop(spool);
+  }
+  RingSetWakeConsumers(rings);
+  ReportSpoolDepth(spool);
+}
+
+/**
+ * Admit deferred lines again and move the admitted lines to the
+ * rings.
+ *
+ * At most one receive batch of datagrams is replayed. Lines that do
+ * not fit in the rings are dropped and counted.
+ */
+static void ReplayDeferredToRings(Spool *spool, RingSet *rings,
+                                  ReceiveStats *stats) {
+  Packet packet;
+  int i;
+
+  for (i = 0; i < InfluxReceiveBatchSize && NextDeferred(&packet); ++i) {
+    if (AdmitPacket(&packet, true)) {
+      StatsAdd(STAT_DATAGRAMS, 1);
+      StatsAdd(STAT_BYTES, packet.bytes);
+      if (!RingSetPut(rings, &packet))
+        stats->overflowed++;
+    }
+    pfree(packet.data);
+  }
+  RingSetWakeConsumers(rings);
+  ReportSpoolDepth(spool);
+}
+
+/**
+ * Receive datagrams from a socket and copy them to the rings.
+ *
+ * This works like `ReceiveDatagrams` but only copies the datagrams to
+ * the rings of the inserters, so the socket is drained even while the
+ * inserters are waiting on locks or commits.
+ *
+ * If the rings fill up beyond `influx.spool_threshold`, the datagrams
+ * are appended to the spool instead, and moved to the rings in order
+ * when there is room again. If neither the rings nor the spool have
+ * room, the datagram is dropped and counted. Lines deferred by the
+ * rate limits are moved to the rings when the spool is empty and the
+ * rings are below the threshold.
+ *
+ * Inserters that exit are relaunched, see `RestartInserters`.
+ */
+static void ReceiveDatagramsToRings(int sfd, RingSet *rings,
+                                    InserterSet *inserters, bool gro) {
+  PacketBatch *batch;
+  ReceiveStats reported = {0};
+  TimestampTz last_report = 0;
+  Spool *spool = OpenWorkerSpool();
+  int usage = -1;
+
+  if (gro)
+    gro = EnableUdpGro(sfd);
+  batch = CreateWorkerBatch(gro);
+
+  while (true) {
+    int wait_result, current;
+    long timeout;
+
+    ResetLatch(MyLatch);
+    if (ShutdownWorker)
+      break;
+
+    while (!ShutdownWorker) {
+      Packet packet;
+      instr_time start;
+      int count;
+
+      if (ReloadConfiguration())
+        batch = ResizeWorkerBatch(batch, gro);
+
+      if (spool && !SpoolIsEmpty(spool))
+        ReplaySpoolToRings(spool, rings);
+
+      INSTR_TIME_SET_CURRENT(start);
+      count = PacketBatchReceive(batch, sfd);
+      StatsAddTime(STAT_RECEIVE_TIME, start);
+      if (count < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+          break;
+        ereport(ERROR, (errcode_for_socket_access(),
+                        errmsg("could not read lines: %m")));
+      }
+
+      if (spool && (!SpoolIsEmpty(spool) ||
+                    RingSetUsage(rings) >= InfluxSpoolThreshold)) {
+        SpoolBatch(spool, batch);
+        continue;
+      }
+
+      while (PacketBatchNext(batch, &packet)) {
+        if (!AdmitPacket(&packet, true))
+          continue;
+        StatsAdd(STAT_DATAGRAMS, 1);
+        StatsAdd(STAT_BYTES, packet.bytes);
+        if (!RingSetPut(rings, &packet))
+          batch->stats.overflowed++;
+      }
+      RingSetWakeConsumers(rings);
+      if (Deferred.spool)
+        ReportSpoolDepth(spool);
+    }
+
+    if (DeferredTimeout() == 0 && (!spool || SpoolIsEmpty(spool)) &&
+        RingSetUsage(rings) < InfluxSpoolThreshold)
+      ReplayDeferredToRings(spool, rings, &batch->stats);
+
+    StatsFlush();
+    ReportLostDatagrams(&batch->stats, &reported, &last_report);
+    UpdateSteering(false);
+    RestartInserters(inserters, rings);
+
+    /* Show the ring occupancy in pg_stat_activity, but only when it
+     * changed since updating the activity is not free. */
+    current = RingSetUsage(rings);
+    StatsSetBacklog(current);
+    if (current != usage) {
+      char activity[64];
+      usage = current;
+      snprintf(activity, sizeof(activity),
+               "receiving datagrams, rings %d%% full", usage);
+      pgstat_report_activity(STATE_RUNNING, activity);
+    }
+
+    /* If there are datagrams in the spool, we need to wake up to move
+     * them to the rings as the inserters make room, and if there are
+     * deferred lines, to replay them. Otherwise we still wake up now
+     * and then to check the inserters. */
+    timeout = DeferredTimeout();
+    if ((spool && !SpoolIsEmpty(spool)) || timeout == 0)
+      timeout = SPOOL_REPLAY_INTERVAL;
+    else if (timeout < 0)
+      timeout = INSERTER_CHECK_INTERVAL;
+    if (InfluxBusyPoll > 0 && SpinOnSocket(sfd, timeout))
+      continue;
+    StatsIdleStart();
+    wait_result = WaitLatchOrSocket(
+        MyLatch,
+        WL_LATCH_SET | WL_POSTMASTER_DEATH | WL_SOCKET_READABLE | WL_TIMEOUT,
+        sfd, timeout, PG_WAIT_EXTENSION);
+    StatsIdleEnd();
+    if (wait_result & WL_POSTMASTER_DEATH)
+      return; /* Abort the worker */
+    if (wait_result & WL_SOCKET_READABLE)
+      StatsSetBacklog(SocketBacklog(sfd));
+  }
+
+  /* Hand over what is left in the spool before exiting. The inserters
+   * drain their rings before they exit, so this is not lost. */
+  if (spool) {
+    int attempts = 0;
+    while (!SpoolIsEmpty(spool) && attempts < SPOOL_DRAIN_ATTEMPTS) {
+      const uint64 depth = SpoolDepth(spool);
+      ReplaySpoolToRings(spool, rings);
+      attempts = SpoolDepth(spool) < depth ? 0 : attempts + 1;
+      if (!SpoolIsEmpty(spool))
+        pg_usleep(SPOOL_REPLAY_INTERVAL * 1000L);
+    }
+    if (!SpoolIsEmpty(spool))
+      ereport(LOG, (errmsg("inserters stopped, dropping %llu bytes of spooled "
+                           "datagrams",
+                           (unsigned long long)SpoolDepth(spool))));
+    SpoolClose(spool);
+  }
+  CloseDeferredSpool();
+}
+
+/**
+ * Receive datagrams and hand them over to inserters.
+ *
+ * The worker becomes a receiver that only reads from the socket,
+ * while `InfluxInserters` inserters do the inserts. If no inserter
+ * could be started, the worker inserts the datagrams itself.
+ */
+static void ReceiveDatagramsWithInserters(int sfd, Oid nspid,
+                                          WorkerArgs *args, bool gro) {
+  RingSet *rings;
+  InserterSet *inserters;
+
+  /* The inserters are launched inside the transaction since the
+   * schema name is looked up for the process name. */
+  rings = RingSetCreate(InfluxInserters, InfluxRingSize);
+  inserters = LaunchInserters(rings, args);
+  if (inserters->count == 0) {
+    ereport(LOG, (errmsg("no inserters started, inserting in the worker")));
+    ReceiveDatagramsWithEngine(sfd, nspid, gro);
+    return;
+  }
+
+  /* The receiver does not insert anything, so it should not keep a
+   * transaction open. */
+  CommitTransactionCommand();
+  StatsSetKind(WORKER_KIND_RECEIVER);
+
+  on_dsm_detach(rings->segment, StopInserters, PointerGetDatum(inserters));
+  ReceiveDatagramsToRings(sfd, rings, inserters, gro);
+}
+
+/**
+ * Insert the datagrams in a ring.
+ *
+ * Batches are handled in the same way as for `ReceiveDatagrams`. On
+ * shutdown, the ring is drained before the last batch is committed.
+ */
+static void InsertFromRing(RingReader *reader, Oid nspid) {
+  Packet packet;
+
+  while (true) {
+    int wait_result;
+    long timeout;
+
+    ResetLatch(MyLatch);
+    ReloadConfiguration();
+
+    while (RingReaderNext(reader, &packet)) {
+      if (!CurrentBatch.active)
+        StartBatch();
+      ProcessPacket(&packet, nspid, InfluxPrecision);
+      if (BatchIsFull())
+        FinishBatch();
+    }
+
+    if (CurrentBatch.active && BatchTimeout() == 0)
+      FinishBatch();
+
+    if (ShutdownWorker)
+      break;
+
+    timeout = BatchTimeout();
+    StatsIdleStart();
+    wait_result = WaitLatch(MyLatch,
+                            WL_LATCH_SET | WL_POSTMASTER_DEATH |
+                                (timeout >= 0 ? WL_TIMEOUT : 0),
+                            timeout, PG_WAIT_EXTENSION);
+    StatsIdleEnd();
+    if (wait_result & WL_POSTMASTER_DEATH)
+      return; /* Abort the worker */
+  }
+
+  if (CurrentBatch.active)
+    FinishBatch();
+}
+
+/**
+ * Endpoints and connections of a worker.
+ *
+ * All sockets are multiplexed using a single wait event set, so one
+ * worker can serve several endpoints with different protocols.
+ */
+typedef struct Listener {
+  /** Number of endpoints */
+  int nendpoints;
+
+  /** Number of allocated slots in `endpoints` */
+  int endpoint_capacity;
+
+  /** Sockets that the worker listens on */
+  Endpoint **endpoints;
+
+  /** Number of open connections */
+  int nconns;
+
+  /** Number of allocated slots in `conns` */
+  int capacity;
+
+  /** Open connections */
+  Connection **conns;
+
+  /** Receive buffers for datagram endpoints, or NULL if there are none */
+  PacketBatch *batch;
+
+  /** Endpoints are read from the listener catalog */
+  bool catalog;
+
+  /** Wait event set for all sockets, or NULL if it need to be rebuilt */
+  WaitEventSet *set;
+
+  /** Number of events in the wait event set */
+  int nevents;
+
+  /** Position of the first connection in the wait event set */
+  int first_conn;
+
+  /** Occurred events, with room for `nevents` events */
+  WaitEvent *events;
+} Listener;
+
+/**
+ * Rebuild the wait event set for the listener.
+ *
+ * Since it is not possible to remove sockets from a wait event set,
+ * we rebuild it each time a connection is opened or closed.
+ *
+ * If we have reached the maximum number of connections, we do not
+ * wait for the listening sockets, which means that new connections
+ * will remain in the kernel backlog until a connection is closed.
+ */
+static void RebuildWaitEventSet(Listener *listener) {
+  int i;
+
+  if (listener->set)
+    FreeWaitEventSet(listener->set);
+  if (listener->events)
+    pfree(listener->events);
+
+  listener->nevents = listener->nconns + listener->nendpoints + 2;
+  listener->events = MemoryContextAlloc(TopMemoryContext,
+                                        listener->nevents * sizeof(WaitEvent));
+  listener->set = CreateWaitEventSet(TopMemoryContext, listener->nevents);
+  AddWaitEventToSet(listener->set, WL_LATCH_SET, PGINVALID_SOCKET, MyLatch,
+                    NULL);
+  AddWaitEventToSet(listener->set, WL_POSTMASTER_DEATH, PGINVALID_SOCKET,
+                    NULL, NULL);
+  listener->first_conn = 2;
+  for (i = 0; i < listener->nendpoints; ++i) {
+    Endpoint *endpoint = listener->endpoints[i];
+    if (endpoint->methods && listener->nconns >= InfluxMaxConnections)
+      continue;
+    listener->first_conn =
+        AddWaitEventToSet(listener->set, WL_SOCKET_READABLE, endpoint->fd,
+                          NULL, endpoint) +
+        1;
+  }
+  for (i = 0; i < listener->nconns; ++i)
+    AddWaitEventToSet(listener->set, WL_SOCKET_READABLE,
+                      listener->conns[i]->fd, NULL, listener->conns[i]);
+}
+
+/**
+ * Mark the wait event set as outdated.
+ *
+ * The wait event set is freed and will be rebuilt before the next
+ * wait. Occurred events are stored separately, so it is safe to do
+ * this while iterating over the events.
+ */
+static void InvalidateWaitEventSet(Listener *listener) {
+  if (listener->set) {
+    FreeWaitEventSet(listener->set);
+    listener->set = NULL;
+  }
+}
+
+/**
+ * Add an endpoint to the listener.
+ *
+ * The endpoint is copied, so it can be allocated on the stack.
+ */
+static Endpoint *AddEndpoint(Listener *listener, const Endpoint *endpoint) {
+  Endpoint *copy = MemoryContextAlloc(TopMemoryContext, sizeof(Endpoint));
+
+  if (listener->nendpoints == listener->endpoint_capacity) {
+    listener->endpoint_capacity = Max(2 * listener->endpoint_capacity, 8);
+    listener->endpoints =
+        listener->endpoints
+            ? repalloc(listener->endpoints,
+                       listener->endpoint_capacity * sizeof(Endpoint *))
+            : MemoryContextAlloc(TopMemoryContext,
+                                 listener->endpoint_capacity *
+                                     sizeof(Endpoint *));
+  }
+
+  *copy = *endpoint;
+  listener->endpoints[listener->nendpoints++] = copy;
+  InvalidateWaitEventSet(listener);
+  return copy;
+}
+
+/**
+ * Accept all pending connections on a listening socket.
+ */
+static void AcceptConnections(Listener *listener, Endpoint *endpoint) {
+  while (listener->nconns < InfluxMaxConnections) {
+    Connection *conn;
+    struct sockaddr_storage peer;
+    socklen_t peerlen = sizeof(peer);
+    int fd = accept(endpoint->fd, (struct sockaddr *)&peer, &peerlen);
+    if (fd < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        break;
+      /* The peer closed the connection before we accepted it. */
+      if (errno == ECONNABORTED)
+        continue;
+      ereport(LOG, (errcode_for_socket_access(),
+                    errmsg("could not accept connection: %m")));
+      break;
+    }
+
+    if (!pg_set_noblock(fd)) {
+      ereport(LOG, (errcode_for_socket_access(),
+                    errmsg("could not set socket to nonblocking mode: %m")));
+      close(fd);
+      continue;
+    }
+
+    if (listener->nconns == listener->capacity) {
+      listener->capacity = Max(2 * listener->capacity, 8);
+      listener->conns =
+          listener->conns
+              ? repalloc(listener->conns,
+                         listener->capacity * sizeof(Connection *))
+              : MemoryContextAlloc(TopMemoryContext,
+                                   listener->capacity * sizeof(Connection *));
+    }
+
+    conn = MemoryContextAllocZero(TopMemoryContext, sizeof(Connection));
+    conn->fd = fd;
+    conn->endpoint = endpoint;
+    conn->peer = peer;
+    conn->state = endpoint->methods->create(fd);
+    listener->conns[listener->nconns++] = conn;
+    InvalidateWaitEventSet(listener);
+  }
+}
+
+/**
+ * Close a connection and remove it from the listener.
+ */
+static void CloseConnection(Listener *listener, Connection *conn) {
+  int i;
+  for (i = 0; i < listener->nconns; ++i) {
+    if (listener->conns[i] == conn) {
+      listener->conns[i] = listener->conns[--listener->nconns];
+      break;
+    }
+  }
+  conn->endpoint->methods->close(conn->state);
+  pfree(conn);
+  InvalidateWaitEventSet(listener);
+}
+
+/**
+ * Send pending responses on all connections.
+ *
+ * This should only be called after the transaction has committed.
+ */
+static void FlushConnections(Listener *listener) {
+  int i = 0;
+  while (i < listener->nconns) {
+    Connection *conn = listener->conns[i];
+    if (conn->pending) {
+      conn->pending = false;
+      if (!conn->endpoint->methods->flush(conn->state)) {
+        /* This moves the last connection into this slot, so we
+         * should not advance. */
+        CloseConnection(listener, conn);
+        continue;
+      }
+    }
+    ++i;
+  }
+}
+
+/**
+ * Commit the batch and send the responses waiting for the commit.
+ */
+static void FinishListenerBatch(Listener *listener) {
+  FinishBatch();
+  FlushConnections(listener);
+}
+
+/**
+ * Switch to the role of an endpoint.
+ *
+ * Endpoints from the listener catalog can insert as a different role
+ * than the one the worker connected as, which is done the same way as
+ * for security definer functions. If the endpoint has no role, the
+ * current role is kept.
+ */
+static void EndpointSetRole(const Endpoint *endpoint, Oid *save_userid,
+                            int *save_context) {
+  GetUserIdAndSecContext(save_userid, save_context);
+  if (OidIsValid(endpoint->roleid))
+    SetUserIdAndSecContext(endpoint->roleid,
+                           *save_context | SECURITY_LOCAL_USERID_CHANGE);
+}
+
+static void *CreateLineConnection(int fd) {
+  return StreamConnCreate(fd, InfluxReceiveBufferSize);
+}
+
+static void CloseLineConnection(void *state) {
+  StreamConnClose((StreamConn *)state);
+}
+
+/**
+ * Read from a line connection and process all complete lines.
+ *
+ * @retval true Connection is still open.
+ * @retval false Connection was closed by peer or failed.
+ */
+static bool ReadLineConnection(void *state, const struct sockaddr *peer,
+                               Oid nspid, Precision precision, bool *pending) {
+  StreamConn *conn = (StreamConn *)state;
+  Packet packet;
+  const ssize_t count = StreamConnRead(conn);
+
+  if (count < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+      return true;
+    ereport(LOG, (errcode_for_socket_access(),
+                  errmsg("could not read from connection: %m")));
+    return false;
+  }
+
+  packet.data = StreamConnLines(conn, count == 0, &packet.bytes);
+  packet.source = peer;
+  packet.received = GetCurrentTimestamp();
+  if (packet.data && packet.bytes > 0 && AdmitPacket(&packet, false))
+    ProcessPacket(&packet, nspid, precision);
+  return count > 0;
+}
 
-PG_FUNCTION_INFO_V1(worker_launch);
+static const ConnMethods LineConnMethods = {
+    .create = CreateLineConnection,
+    .read = ReadLineConnection,
+    .flush = NULL,
+    .close = CloseLineConnection,
+};
 
-/* MTU for the wireless interface. We don't bother about digging up
- * the actual MTU here and just pick something that is common. */
-#define MTU 1500
+static void *CreateHttpConnection(int fd) {
+  return HttpConnCreate(fd);
+}
 
-static volatile sig_atomic_t ReloadConfig = false;
-static volatile sig_atomic_t ShutdownWorker = false;
+static void CloseHttpConnection(void *state) {
+  HttpConnClose((HttpConn *)state);
+}
 
-/* Check that sizeof(WorkerArgs) > BGW_EXTRALEN */
-static char c1[BGW_EXTRALEN - sizeof(WorkerArgs)] pg_attribute_unused();
+static bool FlushHttpConnection(void *state) {
+  return HttpConnFlush((HttpConn *)state);
+}
 
 /**
- * Process one packet of lines.
+ * Insert the lines of a write request.
+ *
+ * The lines are always written to the schema of the endpoint. Clients
+ * are not authenticated, so they cannot pick another schema: a
+ * database given in the request has to be the name of that schema,
+ * otherwise the request is answered with 404, the same as InfluxDB
+ * does for a database that does not exist. The precision given in the
+ * request overrides the precision of the endpoint.
+ *
+ * The response is buffered and sent after the transaction has
+ * committed, so a successful response means that the lines are
+ * durably stored. Lines dropped by the rate limits are reported as a
+ * partial write, the same as lines that could not be parsed. The
+ * admitted lines are inserted, so the response cannot be 429, since
+ * clients retry the whole request then and would insert them again.
  */
-static void ProcessPacket(char *buffer, size_t bytes, Oid nspid) {
-  IngestState *state;
-
-  buffer[bytes] = '\0';
-  state = ParseInfluxSetup(buffer);
+static void HandleWriteRequest(HttpConn *conn, HttpRequest *request,
+                               const struct sockaddr *peer, Oid nspid,
+                               Precision precision) {
+  uint64 errors, shed = 0;
+  Packet packet;
 
-  while (true) {
-    bool result;
-    PG_TRY();
-    { result = IngestReadNextLine(state); }
-    PG_CATCH();
-    { result = false; }
-    PG_END_TRY();
-    if (!result)
+  if (request->database) {
+    const char *schema = get_namespace_name(nspid);
+    if (schema == NULL || strcmp(request->database, schema) != 0) {
+      HttpConnRespond(conn, 404, psprintf("database not found: \"%s\"",
+                                          request->database));
       return;
-    MetricInsert(&state->metric, nspid);
+    }
+  }
+
+  if (request->precision && !PrecisionByName(request->precision, &precision)) {
+    HttpConnRespond(conn, 400,
+                    psprintf("invalid precision: \"%s\"", request->precision));
+    return;
   }
+
+  packet.data = request->body;
+  packet.bytes = request->bytes;
+  packet.source = peer;
+  packet.received = GetCurrentTimestamp();
+  if (AdmissionEnabled())
+    request->bytes = AdmitLines(&packet, NULL, &shed);
+  errors = ProcessPacket(&packet, nspid, precision);
+  if (shed > 0)
+    HttpConnRespond(conn, 400,
+                    psprintf("partial write: %llu lines rejected, %llu lines"
+                             " dropped by rate limits",
+                             (unsigned long long)errors,
+                             (unsigned long long)shed));
+  else if (errors > 0)
+    HttpConnRespond(conn, 400,
+                    psprintf("partial write: %llu lines rejected",
+                             (unsigned long long)errors));
+  else
+    HttpConnRespond(conn, 204, NULL);
 }
 
-/* Signal handler for SIGTERM */
-static void WorkerSigterm(SIGNAL_ARGS) {
-  int save_errno = errno;
-  ShutdownWorker = true;
-  SetLatch(MyLatch);
-  errno = save_errno;
+/**
+ * Read from an HTTP connection and process all complete requests.
+ *
+ * @retval true Connection is still open.
+ * @retval false Connection was closed by peer, failed, or should be
+ * closed after sending the pending responses.
+ */
+static bool ReadHttpConnection(void *state, const struct sockaddr *peer,
+                               Oid nspid, Precision precision, bool *pending) {
+  HttpConn *conn = (HttpConn *)state;
+  HttpRequest *request;
+  const bool open = HttpConnRead(conn);
+
+  while ((request = HttpConnNextRequest(conn)) != NULL)
+    HandleWriteRequest(conn, request, peer, nspid, precision);
+
+  *pending = (conn->output.len > 0);
+  return open && conn->state != HTTP_STATE_CLOSING;
 }
 
-/* Signal handler for SIGHUP */
-static void WorkerSighup(SIGNAL_ARGS) {
-  int save_errno = errno;
-  ReloadConfig = true;
-  SetLatch(MyLatch);
-  errno = save_errno;
+static const ConnMethods HttpConnMethods = {
+    .create = CreateHttpConnection,
+    .read = ReadHttpConnection,
+    .flush = FlushHttpConnection,
+    .close = CloseHttpConnection,
+};
+
+/**
+ * Receive one batch of datagrams from an endpoint and insert them.
+ *
+ * We only read one batch for each event so that a busy endpoint does
+ * not starve the other endpoints. If there is more data, the socket
+ * is still readable when we wait the next time.
+ */
+static void ReadDatagrams(Listener *listener, Endpoint *endpoint) {
+  instr_time start;
+  Oid save_userid;
+  int save_context, count;
+
+  INSTR_TIME_SET_CURRENT(start);
+  count = PacketBatchReceive(listener->batch, endpoint->fd);
+  StatsAddTime(STAT_RECEIVE_TIME, start);
+  if (count < 0) {
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+      ereport(LOG, (errcode_for_socket_access(),
+                    errmsg("could not read lines: %m")));
+    return;
+  }
+
+  /* The listener does not replay deferred lines, which could also
+   * belong to different endpoints, so lines above the limits are not
+   * deferred. */
+  if (!CurrentBatch.active)
+    StartBatch();
+  EndpointSetRole(endpoint, &save_userid, &save_context);
+  ProcessBatch(listener->batch, endpoint->nspid, endpoint->precision, false);
+  SetUserIdAndSecContext(save_userid, save_context);
 }
 
 /**
- * Initalize a worker before registering it.
+ * Read from a connection and insert the lines received.
  */
-void InfluxWorkerInit(BackgroundWorker *worker, WorkerArgs *args) {
-  memset(worker, 0, sizeof(*worker));
-  /* Shared memory access is necessary to connect to the database. */
-  worker->bgw_flags =
-      BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
-  worker->bgw_start_time = BgWorkerStart_RecoveryFinished;
-  worker->bgw_restart_time = BGW_NEVER_RESTART;
-  sprintf(worker->bgw_library_name, INFLUX_LIBRARY_NAME);
-  sprintf(worker->bgw_function_name, INFLUX_FUNCTION_NAME);
-  snprintf(worker->bgw_name, BGW_MAXLEN, "Influx listener for schema %s",
-           args->namespace);
-  snprintf(worker->bgw_type, BGW_MAXLEN, "Influx line protocol listener");
-  memcpy(worker->bgw_extra, args, sizeof(*args));
+static void ReadConnection(Listener *listener, Connection *conn) {
+  const ConnMethods *methods = conn->endpoint->methods;
+  Oid save_userid;
+  int save_context;
+  bool open, pending = false;
+
+  if (!CurrentBatch.active)
+    StartBatch();
+  EndpointSetRole(conn->endpoint, &save_userid, &save_context);
+  open = methods->read(conn->state, (struct sockaddr *)&conn->peer,
+                       conn->endpoint->nspid, conn->endpoint->precision,
+                       &pending);
+  SetUserIdAndSecContext(save_userid, save_context);
+
+  if (!open) {
+    /* Other connections are flushed after the next commit, since they
+     * might have events later in this iteration. */
+    if (pending || conn->pending) {
+      FinishBatch();
+      methods->flush(conn->state);
+    }
+    CloseConnection(listener, conn);
+  } else if (pending) {
+    conn->pending = true;
+  }
+}
+
+static void LoadListenerCatalog(Listener *listener);
+
+/**
+ * Serve all endpoints of a listener and insert the lines received.
+ *
+ * All sockets are multiplexed using a wait event set. Similar to
+ * datagrams, we process events as long as there are sockets ready
+ * for reading, and commit the batch when it is full or when no socket
+ * is ready and the flush delay has passed.
+ *
+ * Responses are sent after the transaction has committed. If a
+ * connection has to be closed while there are responses waiting for
+ * the commit, the transaction is committed early so that the
+ * responses can be sent before the connection is closed.
+ */
+static void ServeListener(Listener *listener) {
+  ReceiveStats reported = {0};
+  TimestampTz last_report = 0;
+
+  while (!ShutdownWorker) {
+    int i, j, nevents;
+
+    if (listener->set == NULL)
+      RebuildWaitEventSet(listener);
+
+    /* Block when there is no batch, otherwise wait until the batch
+     * should be committed. */
+    StatsIdleStart();
+    nevents = WaitEventSetWait(listener->set, BatchTimeout(),
+                               listener->events, listener->nevents,
+                               PG_WAIT_EXTENSION);
+    StatsIdleEnd();
+    if (nevents == 0 && CurrentBatch.active) {
+      FinishListenerBatch(listener);
+      continue;
+    }
+
+    for (i = 0; i < nevents; ++i) {
+      WaitEvent *event = &listener->events[i];
+
+      if (event->events & WL_POSTMASTER_DEATH)
+        return; /* Abort the worker */
+
+      if (event->events & WL_LATCH_SET) {
+        ResetLatch(MyLatch);
+        if (ReloadConfiguration()) {
+          if (listener->batch)
+            listener->batch = ResizeWorkerBatch(listener->batch, false);
+          if (listener->catalog) {
+            /* Connections of removed endpoints are closed, so their
+             * responses have to be sent first. */
+            if (CurrentBatch.active)
+              FinishListenerBatch(listener);
+            LoadListenerCatalog(listener);
+            break;
+          }
+          for (j = 0; j < listener->nendpoints; ++j)
+            listener->endpoints[j]->precision = InfluxPrecision;
+        }
+      } else if (event->pos >= listener->first_conn) {
+        ReadConnection(listener, (Connection *)event->user_data);
+      } else {
+        Endpoint *endpoint = (Endpoint *)event->user_data;
+        if (endpoint->methods)
+          AcceptConnections(listener, endpoint);
+        else
+          ReadDatagrams(listener, endpoint);
+      }
+    }
+
+    if (CurrentBatch.active && BatchIsFull())
+      FinishListenerBatch(listener);
+    if (listener->batch)
+      ReportLostDatagrams(&listener->batch->stats, &reported, &last_report);
+  }
+
+  if (CurrentBatch.active)
+    FinishListenerBatch(listener);
+}
+
+/**
+ * Accept connections on a socket and insert the lines received.
+ */
+static void ReceiveStreams(int lfd, Oid nspid, const ConnMethods *methods) {
+  Listener listener = {0};
+  Endpoint endpoint = {0};
+
+  endpoint.fd = lfd;
+  endpoint.methods = methods;
+  endpoint.nspid = nspid;
+  endpoint.precision = InfluxPrecision;
+  AddEndpoint(&listener, &endpoint);
+  ServeListener(&listener);
+}
+
+/**
+ * Check if an endpoint was created for a listener in the catalog.
+ *
+ * Endpoints are only re-used if the listener still has the same
+ * protocol and address, otherwise new sockets are created.
+ */
+static bool EndpointMatches(const Endpoint *endpoint, int32 id,
+                            const char *address, const char *service,
+                            int protocol) {
+  if (endpoint->id != id || endpoint->protocol != protocol ||
+      strcmp(endpoint->service, service) != 0)
+    return false;
+  if (endpoint->address == NULL || address == NULL)
+    return endpoint->address == address;
+  return strcmp(endpoint->address, address) == 0;
+}
+
+/**
+ * Add a listener from the catalog.
+ *
+ * If there are already endpoints for the listener, they are kept and
+ * only the schema, role, and precision are updated. Otherwise, a socket is
+ * created for each address of the listener.
+ */
+static void AddCatalogListener(Listener *listener, int32 id,
+                               const char *address, const char *service,
+                               int protocol, Oid nspid, Oid roleid,
+                               Precision precision) {
+  BoundSocket socks[MAX_LISTENER_SOCKETS];
+  Endpoint endpoint = {0};
+  bool found = false;
+  int i, nsocks;
+
+  for (i = 0; i < listener->nendpoints; ++i) {
+    Endpoint *current = listener->endpoints[i];
+    if (EndpointMatches(current, id, address, service, protocol)) {
+      current->nspid = nspid;
+      current->roleid = roleid;
+      current->precision = precision;
+      current->seen = true;
+      found = true;
+    }
+  }
+
+  if (found)
+    return;
+
+  nsocks = CreateSockets(address, service,
+                         protocol == PROTOCOL_UDP ? &UdpRecvSocket
+                                                  : &TcpRecvSocket,
+                         socks, lengthof(socks));
+  if (nsocks == 0) {
+    ereport(LOG, (errmsg("could not create socket for listener %d", id),
+                  errdetail("Service is \"%s\".", service)));
+    return;
+  }
+
+  endpoint.id = id;
+  endpoint.protocol = protocol;
+  endpoint.methods = protocol == PROTOCOL_TCP    ? &LineConnMethods
+                     : protocol == PROTOCOL_HTTP ? &HttpConnMethods
+                                                 : NULL;
+  endpoint.nspid = nspid;
+  endpoint.roleid = roleid;
+  endpoint.precision = precision;
+  endpoint.address =
+      address ? MemoryContextStrdup(TopMemoryContext, address) : NULL;
+  endpoint.service = MemoryContextStrdup(TopMemoryContext, service);
+  endpoint.seen = true;
+
+  for (i = 0; i < nsocks; ++i) {
+    endpoint.fd = socks[i].fd;
+    endpoint.addr = socks[i].addr;
+    AddEndpoint(listener, &endpoint);
+    ereport(LOG,
+            (errmsg("worker listening on %s %s for listener %d",
+                    ProtocolName(protocol),
+                    SocketName((struct sockaddr *)&socks[i].addr,
+                               sizeof(socks[i].addr)),
+                    id),
+             errdetail("Metrics written to schema %s.",
+                       get_namespace_name(nspid))));
+  }
+
+  if (protocol != PROTOCOL_UDP || listener->batch)
+    return;
+  listener->batch = CreateWorkerBatch(false);
+}
+
+/**
+ * Close the endpoints of listeners that were removed from the catalog.
+ *
+ * Connections accepted by the endpoints are closed as well, so any
+ * pending responses have to be sent before calling this.
+ */
+static void RemoveUnseenEndpoints(Listener *listener) {
+  int i = 0, j;
+
+  while (i < listener->nendpoints) {
+    Endpoint *endpoint = listener->endpoints[i];
+
+    if (endpoint->seen) {
+      ++i;
+      continue;
+    }
+
+    j = 0;
+    while (j < listener->nconns) {
+      if (listener->conns[j]->endpoint == endpoint)
+        CloseConnection(listener, listener->conns[j]);
+      else
+        ++j;
+    }
+
+    ereport(LOG,
+            (errmsg("worker stopped listening on %s %s for listener %d",
+                    ProtocolName(endpoint->protocol),
+                    SocketName((struct sockaddr *)&endpoint->addr,
+                               sizeof(endpoint->addr)),
+                    endpoint->id)));
+    close(endpoint->fd);
+    if (endpoint->address)
+      pfree(endpoint->address);
+    pfree(endpoint->service);
+    pfree(endpoint);
+    listener->endpoints[i] = listener->endpoints[--listener->nendpoints];
+  }
+
+  InvalidateWaitEventSet(listener);
+}
+
+/**
+ * Read the listener catalog and update the endpoints.
+ *
+ * The catalog is read in a batch of its own, so no batch can be
+ * active when calling this. Listeners that reference a schema or
+ * role that does not exist are skipped, and so are listeners with a
+ * role that the worker role is not a member of.
+ */
+static void LoadListenerCatalog(Listener *listener) {
+  Oid extoid;
+  uint64 row;
+  int i, err;
+
+  Assert(!CurrentBatch.active);
+
+  for (i = 0; i < listener->nendpoints; ++i)
+    listener->endpoints[i]->seen = false;
+
+  StartBatch();
+  pgstat_report_activity(STATE_RUNNING, "reading listener catalog");
+
+  extoid = get_extension_oid(INFLUX_EXTENSION_NAME, true);
+  if (!OidIsValid(extoid)) {
+    ereport(LOG, (errmsg("extension \"%s\" is not installed in database "
+                         "\"%s\"",
+                         INFLUX_EXTENSION_NAME,
+                         get_database_name(MyDatabaseId)),
+                  errhint("Create the extension and reload the "
+                          "configuration.")));
+  } else {
+    const char *query = psprintf(
+        "SELECT id, address, service, protocol, schema, role, precision"
+        " FROM %s.%s WHERE enabled ORDER BY id",
+        quote_identifier(get_namespace_name(get_extension_schema(extoid))),
+        INFLUX_LISTENER_CATALOG);
+
+    if ((err = SPI_execute(query, true, 0)) != SPI_OK_SELECT)
+      elog(ERROR, "SPI_execute failed: %s", SPI_result_code_string(err));
+
+    for (row = 0; row < SPI_processed; ++row) {
+      HeapTuple tuple = SPI_tuptable->vals[row];
+      TupleDesc tupdesc = SPI_tuptable->tupdesc;
+      bool isnull;
+      const int32 id =
+          DatumGetInt32(SPI_getbinval(tuple, tupdesc, 1, &isnull));
+      const char *address = SPI_getvalue(tuple, tupdesc, 2);
+      const char *service = SPI_getvalue(tuple, tupdesc, 3);
+      const int protocol = ProtocolByName(SPI_getvalue(tuple, tupdesc, 4));
+      const char *schema = SPI_getvalue(tuple, tupdesc, 5);
+      const char *role = SPI_getvalue(tuple, tupdesc, 6);
+      const Oid nspid = get_namespace_oid(schema, true);
+      const Oid roleid = role ? get_role_oid(role, true) : InvalidOid;
+      Precision precision;
+
+      if (!OidIsValid(nspid)) {
+        ereport(LOG, (errmsg("schema \"%s\" for listener %d does not exist",
+                             schema, id)));
+        continue;
+      }
+
+      if (role && !OidIsValid(roleid)) {
+        ereport(LOG, (errmsg("role \"%s\" for listener %d does not exist",
+                             role, id)));
+        continue;
+      }
+
+      /* The worker switches to the role of the listener, so it has to
+       * be allowed to do that, the same as for SET ROLE. */
+      if (OidIsValid(roleid) && !is_member_of_role(GetUserId(), roleid)) {
+        ereport(LOG,
+                (errmsg("role \"%s\" for listener %d is not granted to "
+                        "role \"%s\"",
+                        role, id, GetUserNameFromId(GetUserId(), false))));
+        continue;
+      }
+
+      if (!PrecisionByName(SPI_getvalue(tuple, tupdesc, 7), &precision)) {
+        ereport(LOG, (errmsg("invalid precision for listener %d", id)));
+        continue;
+      }
+
+      AddCatalogListener(listener, id, address, service, protocol, nspid,
+                         roleid, precision);
+    }
+  }
+
+  FinishBatch();
+  RemoveUnseenEndpoints(listener);
 }
 
 /**
@@ -129,27 +2460,43 @@ void InfluxWorkerInit(BackgroundWorker *worker, WorkerArgs *args) {
  * - Field `bgw_extra` will contain the worker arguments in a
  *   WorkerArgs structure.
  *
- * - The database identifier is passed as a parameter to this
- *   function.
+ * - The protocol to use is passed as a parameter to this function.
  */
 void InfluxWorkerMain(Datum arg) {
   int sfd;
-  char buffer[MTU];
+  const int protocol = DatumGetInt32(arg);
   WorkerArgs *args = (WorkerArgs *)&MyBgworkerEntry->bgw_extra;
   Oid namespace_id;
+  const char *schema_name;
   struct sockaddr_storage sockaddr;
 
   /* Establish signal handlers; once that's done, unblock signals. */
   pqsignal(SIGTERM, WorkerSigterm);
   pqsignal(SIGHUP, WorkerSighup);
   BackgroundWorkerUnblockSignals();
-  BackgroundWorkerInitializeConnection(args->database, args->role, 0);
+  SetWorkerAffinity();
+  WorkerConnect(args);
 
   pgstat_report_activity(STATE_RUNNING, "initializing worker");
 
+  /* We need to start a transaction first because none is started and
+     SPI_connect_ext might use TopTransactionContext, which is set by
+     this function. The SPI_commit below will automatically start a
+     new one. */
+  StartTransactionCommand();
+
+  /* It is necessary to start a transaction before calling functions
+     like `get_namespace_oid`. Calling them before this will cause a
+     crash. */
+  namespace_id = WorkerNamespace(args);
+  schema_name = get_namespace_name(namespace_id);
+
   CacheInit();
+  StatsAttach(WORKER_KIND_LISTENER, ProtocolName(protocol), schema_name,
+              args->service);
 
-  sfd = CreateSocket(NULL, args->service, &UdpRecvSocket,
+  sfd = CreateSocket(NULL, args->service,
+                     protocol == PROTOCOL_UDP ? &UdpRecvSocket : &TcpRecvSocket,
                      (struct sockaddr *)&sockaddr, sizeof(sockaddr));
   if (sfd == -1) {
     ereport(LOG, (errcode_for_socket_access(),
@@ -158,94 +2505,154 @@ void InfluxWorkerMain(Datum arg) {
     proc_exit(1);
   }
 
-  /* We need to start a transaction first because none is started and
-     SPI_connect_ext might use TopTransactionContext, which is set by
-     this function. The SPI_commit below will automatically start a
-     new one. */
-  StartTransactionCommand();
-
-  /* It is necessary to start a transaction before calling functions
-     like `get_namespace_oid`. Calling them before this will cause a
-     crash. */
-  namespace_id = get_namespace_oid(args->namespace, false);
+  /* All workers on the service share the port. The program applies
+   * to the whole group, so each new worker replaces it with one for
+   * the current number of workers, and the workers replace it again
+   * when workers exit. */
+  if (protocol == PROTOCOL_UDP && InfluxUdpSteering &&
+      sockaddr.ss_family != AF_UNIX) {
+    Steering.fd = sfd;
+    Steering.service = args->service;
+    UpdateSteering(true);
+  }
 
   ereport(
       LOG,
-      (errmsg("worker listening on port %d",
-              SocketPort((struct sockaddr *)&sockaddr, sizeof(sockaddr))),
+      (errmsg("worker listening on %s %s", ProtocolName(protocol),
+              SocketName((struct sockaddr *)&sockaddr, sizeof(sockaddr))),
        errdetail(
            "Connected to database %s as user %s. Metrics written to schema %s.",
-           args->database, args->role, args->namespace)));
+           get_database_name(MyDatabaseId),
+           GetUserNameFromId(GetUserId(), false), schema_name)));
 
   pgstat_report_activity(STATE_RUNNING, "reading events");
 
-  /* This is the same approach as used in pgstats.c: We read the
-     packets in two loops. One outer that will block when there is no
-     data received, and one inner loop that will read packets as long
-     as possible in non-blocking mode. */
-  while (true) {
-    int wait_result;
-    int err;
-
-    ResetLatch(MyLatch);
-    if (ShutdownWorker)
+  switch (protocol) {
+    case PROTOCOL_UDP:
+      /* Generic receive offload only exists for UDP. */
+      if (InfluxInserters > 0)
+        ReceiveDatagramsWithInserters(
+            sfd, namespace_id, args,
+            InfluxUdpGro && sockaddr.ss_family != AF_UNIX);
+      else
+        ReceiveDatagramsWithEngine(sfd, namespace_id,
+                                   InfluxUdpGro &&
+                                       sockaddr.ss_family != AF_UNIX);
       break;
+    case PROTOCOL_TCP:
+      ReceiveStreams(sfd, namespace_id, &LineConnMethods);
+      break;
+    case PROTOCOL_HTTP:
+      ReceiveStreams(sfd, namespace_id, &HttpConnMethods);
+      break;
+  }
 
-    /* We start a transaction to insert all packets that we're
-       reading. This is not optimal if we are constantly inserting
-       data since we will build a very large snapshot, but it is good
-       enough for a first implementation.
-
-       We need to open a non-atomic (that is, transactional) context
-       since we are opening a table for the metric and we need to make
-       sure that it does not change while we are updating it. */
-    if ((err = SPI_connect_ext(SPI_OPT_NONATOMIC)) != SPI_OK_CONNECT)
-      elog(ERROR, "SPI_connect failed: %s", SPI_result_code_string(err));
-    PushActiveSnapshot(GetTransactionSnapshot());
+  proc_exit(0);
+}
 
-    pgstat_report_activity(STATE_RUNNING, "processing incoming packets");
+/**
+ * Main function for inserters.
+ *
+ * Inserters are started by a UDP worker when `influx.inserters` is
+ * set. They get the same worker arguments as the worker that started
+ * them, and the handle of the segment with the rings is passed as
+ * the parameter to this function.
+ */
+void InfluxInserterMain(Datum arg) {
+  WorkerArgs *args = (WorkerArgs *)&MyBgworkerEntry->bgw_extra;
+  RingSet *rings;
+  RingReader *reader;
+  Oid namespace_id;
 
-    while (!ShutdownWorker) {
-      int bytes;
+  pqsignal(SIGTERM, WorkerSigterm);
+  pqsignal(SIGHUP, WorkerSighup);
+  BackgroundWorkerUnblockSignals();
+  SetWorkerAffinity();
+  WorkerConnect(args);
 
-      if (ReloadConfig) {
-        ReloadConfig = false;
-        ProcessConfigFile(PGC_SIGHUP);
-        elog(LOG, "configuration file reloaded");
-      }
+  pgstat_report_activity(STATE_RUNNING, "initializing inserter");
 
-      /* Try to read one batch of rows from the socket. Note that the
-         socket is in noblock mode, so this might fail immediately and
-         we will then exit to the outer loop. */
-      bytes = recv(sfd, &buffer, sizeof(buffer), 0);
-      if (bytes < 0) {
-        /* Leave the inner loop if there either was no data to receive
-         * or if the call was interrupted by a signal. */
-        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
-          break;
-        ereport(ERROR, (errcode_for_socket_access(),
-                        errmsg("could not read lines: %m")));
-      }
+  /* Same as for the worker, the transaction is used by the first
+   * batch. */
+  StartTransactionCommand();
+  namespace_id = WorkerNamespace(args);
 
-      ProcessPacket(buffer, bytes, namespace_id);
-    }
+  CacheInit();
+  StatsAttach(WORKER_KIND_INSERTER, ProtocolName(PROTOCOL_UDP),
+              get_namespace_name(namespace_id), args->service);
 
-    PopActiveSnapshot();
-    SPI_commit();
-    if ((err = SPI_finish()) != SPI_OK_FINISH)
-      elog(ERROR, "SPI_finish failed: %s", SPI_result_code_string(err));
-    pgstat_report_stat(false);
-    pgstat_report_activity(STATE_IDLE, NULL);
+  rings = RingSetAttach(DatumGetUInt32(arg));
+  if (rings == NULL) {
+    ereport(LOG, (errmsg("receiver exited before inserter started")));
+    proc_exit(0);
+  }
 
-    /* Here we block and wait until there is anything to read from the socket,
-     * or the postmaster shuts down. */
-    wait_result = WaitLatchOrSocket(
-        MyLatch, WL_LATCH_SET | WL_POSTMASTER_DEATH | WL_SOCKET_READABLE, sfd,
-        -1L, PG_WAIT_EXTENSION);
-    if (wait_result & WL_POSTMASTER_DEATH)
-      break; /* Abort the worker */
+  reader = RingSetAttachReader(rings);
+  if (reader == NULL) {
+    ereport(LOG, (errmsg("no free ring for inserter")));
+    proc_exit(1);
   }
 
+  pgstat_report_activity(STATE_IDLE, NULL);
+
+  InsertFromRing(reader, namespace_id);
+
+  proc_exit(0);
+}
+
+/**
+ * Initialize a catalog worker before registering it.
+ *
+ * Catalog workers serve the listeners in the listener catalog of the
+ * database instead of a single service, so the service and protocol
+ * of the arguments are not used.
+ */
+void InfluxCatalogWorkerInit(BackgroundWorker *worker, WorkerArgs *args) {
+  InfluxWorkerInit(worker, args, PROTOCOL_UDP);
+  sprintf(worker->bgw_function_name, INFLUX_CATALOG_FUNCTION_NAME);
+  snprintf(worker->bgw_name, BGW_MAXLEN,
+           "Influx catalog listener for database %s",
+           OidIsValid(args->dbid) ? get_database_name(args->dbid)
+           : InfluxDatabaseName ? InfluxDatabaseName
+                                : "");
+  snprintf(worker->bgw_type, BGW_MAXLEN, "Influx catalog listener");
+}
+
+/**
+ * Main function for catalog workers.
+ *
+ * The worker reads the listener catalog when it starts and each time
+ * the configuration is reloaded, and serves all listeners using a
+ * single wait event set. Since all workers bind the ports using port
+ * reuse, several catalog workers can serve the same listeners.
+ */
+void InfluxCatalogWorkerMain(Datum arg) {
+  WorkerArgs *args = (WorkerArgs *)&MyBgworkerEntry->bgw_extra;
+  Listener listener = {0};
+
+  pqsignal(SIGTERM, WorkerSigterm);
+  pqsignal(SIGHUP, WorkerSighup);
+  BackgroundWorkerUnblockSignals();
+  SetWorkerAffinity();
+  WorkerConnect(args);
+
+  pgstat_report_activity(STATE_RUNNING, "initializing worker");
+
+  /* Same as for the worker, the transaction is used by the first
+   * batch. */
+  StartTransactionCommand();
+
+  CacheInit();
+  StatsAttach(WORKER_KIND_LISTENER, "catalog", WorkerSchemaName(args),
+              INFLUX_LISTENER_CATALOG);
+
+  listener.catalog = true;
+  LoadListenerCatalog(&listener);
+
+  pgstat_report_activity(STATE_IDLE, NULL);
+
+  ServeListener(&listener);
+
   proc_exit(0);
 }
 
@@ -256,29 +2663,39 @@ void InfluxWorkerMain(Datum arg) {
  * is automatically associated with the current database.
  *
  * @param schema Schema name where tables for metrics are stored.
+ * @param service Service or port to listen on.
+ * @param protocol Protocol to use. Optional, defaults to "udp".
  */
 Datum worker_launch(PG_FUNCTION_ARGS) {
   Oid nspid = PG_NARGS() == 1 ? get_func_namespace(fcinfo->flinfo->fn_oid)
                               : PG_GETARG_OID(0);
   char *service = text_to_cstring(PG_GETARG_TEXT_P(PG_NARGS() == 1 ? 0 : 1));
+  int protocol = PG_NARGS() < 3
+                     ? PROTOCOL_UDP
+                     : ProtocolByName(text_to_cstring(PG_GETARG_TEXT_PP(2)));
   BackgroundWorker worker;
   BackgroundWorkerHandle *handle;
   BgwHandleStatus status;
   pid_t pid;
   WorkerArgs args = {0};
 
+  if (strlen(service) >= sizeof(args.service))
+    ereport(ERROR, (errcode(ERRCODE_NAME_TOO_LONG),
+                    errmsg("service name \"%s\" is too long", service),
+                    errdetail("Service names can be at most %zu characters.",
+                              sizeof(args.service) - 1)));
+
   /* Check that we have a valid namespace id */
   if (get_namespace_name(nspid) == NULL)
     ereport(ERROR, (errcode(ERRCODE_UNDEFINED_SCHEMA),
                     errmsg("schema with OID %d does not exist", nspid)));
 
-  strncpy(args.role, GetUserNameFromId(GetUserId(), true), sizeof(args.role));
+  args.dbid = MyDatabaseId;
+  args.roleid = GetUserId();
+  args.nspid = nspid;
   strncpy(args.service, service, sizeof(args.service));
-  strncpy(args.namespace, get_namespace_name(nspid), sizeof(args.namespace));
-  strncpy(args.database, get_database_name(MyDatabaseId),
-          sizeof(args.database));
 
-  InfluxWorkerInit(&worker, &args);
+  InfluxWorkerInit(&worker, &args, protocol);
 
   /* set bgw_notify_pid so that we can use WaitForBackgroundWorkerStartup */
   worker.bgw_notify_pid = MyProcPid;
@@ -311,3 +2728,36 @@ Datum worker_launch(PG_FUNCTION_ARGS) {
   Assert(status == BGWH_STARTED);
   PG_RETURN_INT32(pid);
 }
+
+/**
+ * Dynamically launch a catalog worker.
+ *
+ * The worker serves the listeners in the listener catalog of the
+ * current database and connects as the current user.
+ */
+Datum listener_launch(PG_FUNCTION_ARGS) {
+  BackgroundWorker worker;
+  BackgroundWorkerHandle *handle;
+  BgwHandleStatus status;
+  pid_t pid;
+  WorkerArgs args = {0};
+
+  args.dbid = MyDatabaseId;
+  args.roleid = GetUserId();
+  args.nspid = get_func_namespace(fcinfo->flinfo->fn_oid);
+
+  InfluxCatalogWorkerInit(&worker, &args);
+  worker.bgw_notify_pid = MyProcPid;
+
+  if (!RegisterDynamicBackgroundWorker(&worker, &handle))
+    PG_RETURN_NULL();
+
+  status = WaitForBackgroundWorkerStartup(handle, &pid);
+  if (status != BGWH_STARTED)
+    ereport(ERROR,
+            (errcode(ERRCODE_INSUFFICIENT_RESOURCES),
+             errmsg("could not start background process"),
+             errhint("More details may be available in the server log.")));
+
+  PG_RETURN_INT32(pid);
+}
@@ -20,19 +20,84 @@
 #include <postgres.h>
 
 #include <postmaster/bgworker.h>
+#include <utils/guc.h>
+
+#include <sys/un.h>
+
+#include "network.h"
 
 #define INFLUX_LIBRARY_NAME "influx"
 #define INFLUX_FUNCTION_NAME "InfluxWorkerMain"
+#define INFLUX_INSERTER_FUNCTION_NAME "InfluxInserterMain"
+#define INFLUX_CATALOG_FUNCTION_NAME "InfluxCatalogWorkerMain"
+#define INFLUX_EXTENSION_NAME "influx"
+#define INFLUX_LISTENER_CATALOG "influx_listener"
+
+/**
+ * Protocols supported by the workers.
+ */
+typedef enum WorkerProtocol {
+  PROTOCOL_UDP,
+  PROTOCOL_TCP,
+  PROTOCOL_HTTP,
+} WorkerProtocol;
+
+/**
+ * Engines for receiving datagrams.
+ */
+typedef enum ReceiveEngine {
+  ENGINE_RECV,
+  ENGINE_IO_URING,
+} ReceiveEngine;
 
+/**
+ * Size of the service name in the worker arguments, which is enough
+ * for a Unix socket path of maximum length with the prefix.
+ */
+#define WORKER_SERVICE_SIZE \
+  (sizeof(UNIX_SOCKET_PREFIX) - 1 + sizeof(((struct sockaddr_un *)0)->sun_path))
+
+/**
+ * Worker arguments, passed in `bgw_extra`.
+ *
+ * There is only room for a full service name if the database, role,
+ * and schema are passed as OIDs. Workers started from the
+ * configuration have invalid OIDs and use `influx.database`,
+ * `influx.role`, and `influx.schema` instead.
+ */
 typedef struct WorkerArgs {
-  char role[32];
-  char namespace[32];
-  char database[32];
-  char service[32];
+  Oid dbid;
+  Oid roleid;
+  Oid nspid;
+  char service[WORKER_SERVICE_SIZE];
 } WorkerArgs;
 
-void InfluxWorkerInit(BackgroundWorker *worker, WorkerArgs *args);
+extern int InfluxReceiveBatchSize;
+extern int InfluxReceiveBufferSize;
+extern bool InfluxUdpGro;
+extern int InfluxMaxConnections;
+extern int InfluxReceiveEngine;
+extern int InfluxBatchMaxRows;
+extern int InfluxBatchMaxBytes;
+extern int InfluxBatchMaxDuration;
+extern int InfluxBatchFlushDelay;
+extern int InfluxInserters;
+extern int InfluxRingSize;
+extern bool InfluxListenerCatalog;
+extern char *InfluxCpuAffinity;
+extern const struct config_enum_entry InfluxReceiveEngineOptions[];
+extern const struct config_enum_entry InfluxProtocolOptions[];
+
+void InfluxWorkerInit(BackgroundWorker *worker, WorkerArgs *args,
+                      int protocol);
+void InfluxCatalogWorkerInit(BackgroundWorker *worker, WorkerArgs *args);
+const char *WorkerSchemaName(const WorkerArgs *args);
+bool CheckCpuAffinity(char **newval, void **extra, GucSource source);
+int ProtocolByName(const char *name);
+const char *ProtocolName(int protocol);
 
 void PGDLLEXPORT InfluxWorkerMain(Datum dbid) pg_attribute_noreturn();
+void PGDLLEXPORT InfluxInserterMain(Datum handle) pg_attribute_noreturn();
+void PGDLLEXPORT InfluxCatalogWorkerMain(Datum arg) pg_attribute_noreturn();
 
 #endif /* WORKER_H_ */